@@ -0,0 +1,296 @@
+/*******************************************************************************
+ * File: codec_bench.c
+ *
+ * Description:
+ *   Codec benchmark of the archive writer (ipmgr_codec.c) on real log
+ *   files: for every codec setting the rotator can be configured with,
+ *   reports the compression ratio and compression speed in MB/s of
+ *   uncompressed input.
+ *
+ *   The files are compressed the way an archive batch is: back to back as
+ *   one frame. The zstd dictionary setting trains its dictionary from the
+ *   same inputs, as the rotator does from the batch it archives. Codecs not
+ *   compiled in are listed as skipped.
+ *
+ * Usage:
+ *   codec_bench.exe /var/log/ipstrc.log.* /var/log/pdtrc.log.*
+ *
+ * Build:
+ *   gcc -O2 -o codec_bench.exe codec_bench.c ipmgr_codec.c -lz
+ *   zstd and lz4 codecs: add -DIPMGR_WITH_ZSTD=1 -lzstd -DIPMGR_WITH_LZ4=1 -llz4
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* System Headers */
+#include <sys/stat.h>
+
+/* Local Headers */
+#include "ipmgr_codec.h"
+
+/*******************************************************************************
+ *  CONFIGURATION DEFINES BEGIN
+ ******************************************************************************/
+
+#define BENCH_MIN_SECONDS       1.0     /* Each setting repeats for at least this long */
+#define BENCH_WRITE_LEN         (64 * 1024) /* Bytes per codec_stream_write(), as the writer */
+
+/* Dictionary training, same sizes as the rotator's ZSTD_DICT_* defines */
+#define BENCH_DICT_CAPACITY     (64 * 1024)
+#define BENCH_DICT_TRAIN_BYTES  (4 * 1024 * 1024)
+#define BENCH_DICT_SAMPLE_LEN   4096
+
+/*******************************************************************************
+ *  CONFIGURATION DEFINES END
+ ******************************************************************************/
+
+/* One benchmarked setting */
+typedef struct bench_setting_ {
+    const char *label;
+    int codec;
+    int level;
+    bool long_mode;
+    bool dict;
+} bench_setting_t;
+
+static const bench_setting_t bench_settings[] = {
+    { "gzip -1",            CODEC_GZIP, 1,  false, false },
+    { "gzip -6",            CODEC_GZIP, 6,  false, false },
+    { "gzip -9",            CODEC_GZIP, 9,  false, false },
+    { "zstd -1",            CODEC_ZSTD, 1,  false, false },
+    { "zstd -3",            CODEC_ZSTD, 3,  false, false },
+    { "zstd -9",            CODEC_ZSTD, 9,  false, false },
+    { "zstd -19",           CODEC_ZSTD, 19, false, false },
+    { "zstd -3 --long",     CODEC_ZSTD, 3,  true,  false },
+    { "zstd -19 --long",    CODEC_ZSTD, 19, true,  false },
+    { "zstd -3 dictionary", CODEC_ZSTD, 3,  false, true  },
+    { "lz4",                CODEC_LZ4,  0,  false, false },
+    { "lz4 -9 (HC)",        CODEC_LZ4,  9,  false, false },
+};
+
+/* Input files, concatenated */
+typedef struct bench_input_ {
+    unsigned char *data;
+    size_t len;
+    int nfiles;
+    size_t *file_len;
+} bench_input_t;
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Codec sink: only counts the compressed bytes */
+static int
+count_sink(void *ctx, const void *buf, size_t len)
+{
+    (void)buf;
+    *(uint64_t *)ctx += len;
+    return 0;
+}
+
+/* Appends the content of path to in->data, -1 on failure (reported) */
+static int
+load_file(bench_input_t *in, const char *path)
+{
+    struct stat st;
+    FILE *fp = fopen(path, "rb");
+    unsigned char *data;
+
+    if (!fp || fstat(fileno(fp), &st) < 0) {
+        perror(path);
+        if (fp) fclose(fp);
+        return -1;
+    }
+
+    data = realloc(in->data, in->len + (size_t)st.st_size + 1);
+    if (!data) {
+        fclose(fp);
+        errno = ENOMEM;
+        perror(path);
+        return -1;
+    }
+    in->data = data;
+
+    size_t n = fread(in->data + in->len, 1, (size_t)st.st_size, fp);
+    fclose(fp);
+    in->file_len[in->nfiles++] = n;
+    in->len += n;
+    return 0;
+}
+
+/**
+ * train_dictionary()
+ *
+ * Purpose:
+ *   Trains a zstd dictionary from samples spread evenly over every input
+ *   file, as zstd_dict_refresh() of the rotator does.
+ *
+ * @return Dictionary size, 0 if training failed
+ */
+static size_t
+train_dictionary(const bench_input_t *in, void *dict)
+{
+    unsigned max_samples = BENCH_DICT_TRAIN_BYTES / BENCH_DICT_SAMPLE_LEN;
+    unsigned per_file = max_samples / (unsigned)in->nfiles, nsamples = 0;
+    unsigned char *samples = malloc(BENCH_DICT_TRAIN_BYTES);
+    size_t *sizes = malloc(max_samples * sizeof(*sizes));
+    size_t used = 0, base = 0, dict_len = 0;
+
+    if (per_file == 0) per_file = 1;
+
+    if (samples && sizes) {
+        for (int i = 0; i < in->nfiles && nsamples < max_samples; i++) {
+            size_t step = in->file_len[i] / per_file;
+
+            if (step < BENCH_DICT_SAMPLE_LEN) step = BENCH_DICT_SAMPLE_LEN;
+            for (size_t off = 0; off < in->file_len[i] && nsamples < max_samples; off += step) {
+                size_t n = in->file_len[i] - off;
+
+                if (n > BENCH_DICT_SAMPLE_LEN) n = BENCH_DICT_SAMPLE_LEN;
+                memcpy(samples + used, in->data + base + off, n);
+                sizes[nsamples++] = n;
+                used += n;
+            }
+            base += in->file_len[i];
+        }
+        dict_len = codec_train_dictionary(dict, BENCH_DICT_CAPACITY, samples, sizes, nsamples);
+    }
+    free(samples);
+    free(sizes);
+    return dict_len;
+}
+
+/**
+ * bench_run()
+ *
+ * Purpose:
+ *   Compresses the whole input as one frame, repeatedly for at least
+ *   BENCH_MIN_SECONDS, and prints ratio and speed of one setting.
+ *
+ * @return 0 on success, -1 on a codec failure
+ */
+static int
+bench_run(codec_stream_t *cs, const bench_setting_t *s, const bench_input_t *in,
+          const void *dict, size_t dict_len)
+{
+    codec_params_t params = {
+        .codec = s->codec,
+        .level = s->level,
+        .long_mode = s->long_mode,
+        .dict = s->dict ? dict : NULL,
+        .dict_len = s->dict ? dict_len : 0,
+    };
+    double start = now_seconds(), elapsed;
+    uint64_t out_len = 0;
+    int rounds = 0;
+
+    do {
+        out_len = 0;
+        if (codec_stream_begin(cs, &params, count_sink, &out_len) < 0) return -1;
+        for (size_t off = 0; off < in->len; off += BENCH_WRITE_LEN) {
+            size_t n = in->len - off < BENCH_WRITE_LEN ? in->len - off : BENCH_WRITE_LEN;
+
+            if (codec_stream_write(cs, in->data + off, n) < 0) return -1;
+        }
+        if (codec_stream_end(cs) < 0) return -1;
+        rounds++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    printf("%-20s %14llu %8.2f %10.1f\n", s->label, (unsigned long long)out_len,
+           out_len ? (double)in->len / out_len : 0.0,
+           (double)in->len * rounds / elapsed / (1024.0 * 1024.0));
+    return 0;
+}
+
+/*******************************************************************************
+ *                     MAIN
+ ******************************************************************************/
+
+int
+main(int argc, char *argv[])
+{
+    codec_stream_t streams[CODEC_COUNT];
+    bench_input_t in = { 0 };
+    void *dict = NULL;
+    size_t dict_len = 0;
+    int rc = EXIT_SUCCESS;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <log file>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    in.file_len = calloc((size_t)argc, sizeof(*in.file_len));
+    if (!in.file_len) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (load_file(&in, argv[i]) < 0) return EXIT_FAILURE;
+    }
+    if (in.len == 0) {
+        fprintf(stderr, "Nothing to compress\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(streams, 0, sizeof(streams));
+    for (int c = 0; c < CODEC_COUNT; c++) {
+        if (codec_available(c) && codec_stream_init(&streams[c], c) < 0) {
+            perror(codec_name(c));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (codec_available(CODEC_ZSTD)) {
+        dict = malloc(BENCH_DICT_CAPACITY);
+        if (dict) dict_len = train_dictionary(&in, dict);
+    }
+
+    printf("%d files, %zu bytes", in.nfiles, in.len);
+    if (dict_len) printf(", zstd dictionary %zu bytes", dict_len);
+    printf("\n\n%-20s %14s %8s %10s\n", "setting", "compressed", "ratio", "MB/s");
+
+    for (size_t i = 0; i < sizeof(bench_settings) / sizeof(bench_settings[0]); i++) {
+        const bench_setting_t *s = &bench_settings[i];
+
+        if (!codec_available(s->codec)) {
+            printf("%-20s (%s not compiled in)\n", s->label, codec_name(s->codec));
+            continue;
+        }
+        if (s->dict && dict_len == 0) {
+            printf("%-20s (dictionary training failed)\n", s->label);
+            continue;
+        }
+        if (bench_run(&streams[s->codec], s, &in, dict, dict_len) < 0) {
+            perror(s->label);
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    for (int c = 0; c < CODEC_COUNT; c++) {
+        codec_stream_destroy(&streams[c]);
+    }
+    free(dict);
+    free(in.data);
+    free(in.file_len);
+    return rc;
+}
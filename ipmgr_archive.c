@@ -0,0 +1,1451 @@
+/*******************************************************************************
+ * File: ipmgr_archive.c
+ *
+ * Description:
+ *   Streaming tar.gz / gz writer used by the zipper thread. Replaces the
+ *   system("tar -czf ...") invocation, which forked the whole process and
+ *   exec'ed /bin/sh, tar and gzip on every archive cycle.
+ *
+ *   Data path:
+ *     log file --read()--> in_buf --codec (ipmgr_codec.c)--> write()--> archive
+ *   or, for gzip with a deflate pool, in_buf blocks deflated in parallel.
+ *
+ *   Both buffers are allocated once per writer and reused for every file and
+ *   every archive.
+ *
+ *   Append mode (archive_writer_open_append()) adds one gzip member per run
+ *   to the end of an existing archive instead of writing a new file. In a
+ *   tar.gz the end-of-archive blocks live in a separate, fixed last member
+ *   that every append strips and writes again, so the decompressed stream
+ *   is always one valid tar.
+ *
+ *   Seekable archives (ARCHIVE_FMT_SEEKABLE) end a codec frame at the first
+ *   line end past SEEKABLE_FRAME_LEN bytes and at the end of every file,
+ *   recording each frame in the index written as the footer on close. An
+ *   append replaces the footer with its frames and the extended index.
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+
+/* System Headers */
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "ipmgr_archive.h"
+
+/* Lazily built end-of-archive frame of append mode tar archives, per codec */
+static unsigned char tar_trailer_member[CODEC_COUNT][128];
+static size_t tar_trailer_len[CODEC_COUNT];
+static pthread_mutex_t tar_trailer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Parallel deflate slot states */
+#define DEFLATE_SLOT_FREE   0
+#define DEFLATE_SLOT_QUEUED 1
+#define DEFLATE_SLOT_DONE   2
+#define DEFLATE_SLOT_FAILED 3
+
+/* Bytes a sync flush or final block may add on top of deflateBound() */
+#define DEFLATE_SLOT_SLACK  64
+
+/* Tar format constants */
+#define TAR_BLOCK_SIZE      512
+#define TAR_RECORD_SIZE     (20 * TAR_BLOCK_SIZE)   /* GNU tar default blocking factor */
+#define TAR_MAX_OCTAL_SIZE  077777777777ULL         /* Largest size in 11 octal digits */
+
+/* GNU flavoured ustar header, as emitted by "tar -c" with default options */
+struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[8];          /* "ustar  \0" : GNU magic + version */
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+_Static_assert(sizeof(struct tar_header) == TAR_BLOCK_SIZE, "tar header must be one block");
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static int
+write_full(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Codec sink: compressed bytes go straight to the archive file */
+static int
+aw_codec_sink(void *ctx, const void *buf, size_t len)
+{
+    archive_writer_t *aw = ctx;
+
+    if (write_full(aw->out_fd, buf, len) < 0) return -1;
+    aw->bytes_out += len;
+    return 0;
+}
+
+/**
+ * aw_deflate_serial()
+ *
+ * Purpose:
+ *   Runs everything buffered in in_buf through the archive's codec and
+ *   writes the compressed output to the archive file. in_buf is empty on
+ *   return.
+ *
+ * @param flush  Z_NO_FLUSH while streaming, Z_FINISH to end the frame
+ * @return 0 on success, -1 on failure
+ */
+static int
+aw_deflate_serial(archive_writer_t *aw, int flush)
+{
+    if (codec_stream_write(aw->cs, aw->in_buf, aw->in_len) < 0 ||
+        (flush == Z_FINISH && codec_stream_end(aw->cs) < 0)) {
+        return -1;
+    }
+
+    aw->bytes_in += aw->in_len;
+    aw->in_len = 0;
+    return 0;
+}
+
+/* Seekable frames are small and cut at line ends: serial codec stream only */
+static bool
+aw_is_parallel(const archive_writer_t *aw)
+{
+    return aw->slots != NULL && aw->codec.codec == CODEC_GZIP &&
+           aw->format != ARCHIVE_FMT_SEEKABLE;
+}
+
+/**
+ * aw_write_oldest_block()
+ *
+ * Purpose:
+ *   Writes the oldest in-flight block to the archive once its worker is done.
+ *   Blocks are always written in submission order.
+ *
+ * @param wait  Block until the oldest block completes; otherwise return 1
+ *              immediately if it is still being compressed
+ * @return 0 when a block was written, 1 when nothing was ready, -1 on failure
+ */
+static int
+aw_write_oldest_block(archive_writer_t *aw, bool wait)
+{
+    if (aw->write_seq == aw->next_seq) {
+        return 1;
+    }
+
+    deflate_slot_t *slot = &aw->slots[aw->write_seq % aw->nslots];
+
+    pthread_mutex_lock(&aw->slot_lock);
+    while (slot->state == DEFLATE_SLOT_QUEUED) {
+        if (!wait) {
+            pthread_mutex_unlock(&aw->slot_lock);
+            return 1;
+        }
+        pthread_cond_wait(&aw->slot_cond, &aw->slot_lock);
+    }
+    int state = slot->state;
+    pthread_mutex_unlock(&aw->slot_lock);
+
+    slot->state = DEFLATE_SLOT_FREE;
+    aw->write_seq++;
+
+    if (state == DEFLATE_SLOT_FAILED) {
+        errno = EIO;
+        return -1;
+    }
+    if (aw->out_fd >= 0 && write_full(aw->out_fd, slot->out, slot->out_len) < 0) {
+        return -1;
+    }
+
+    aw->crc = crc32_combine(aw->crc, slot->crc, (z_off_t)slot->in_len);
+    aw->bytes_out += slot->out_len;
+    return 0;
+}
+
+/* Wait for every in-flight block; written unless the archive was aborted */
+static int
+aw_drain_blocks(archive_writer_t *aw)
+{
+    int rc = 0;
+
+    while (aw->write_seq != aw->next_seq) {
+        if (aw_write_oldest_block(aw, true) < 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+/**
+ * aw_deflate_parallel()
+ *
+ * Purpose:
+ *   Hands the block held in in_buf to the deflate pool and switches in_buf
+ *   to the next free slot, primed with the tail of the submitted block as
+ *   its dictionary. Finished blocks are written out opportunistically.
+ *
+ * @param flush  Z_NO_FLUSH for a full block, Z_FINISH for the last block
+ * @return 0 on success, -1 on failure
+ */
+static int
+aw_deflate_parallel(archive_writer_t *aw, int flush)
+{
+    deflate_pool_t *pool = aw->pool;
+    deflate_slot_t *cur = &aw->slots[aw->next_seq % aw->nslots];
+
+    cur->in_len = aw->in_len;
+    cur->level = aw->level;
+    cur->last = (flush == Z_FINISH);
+    cur->state = DEFLATE_SLOT_QUEUED;
+    cur->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = cur;
+    } else {
+        pool->head = cur;
+    }
+    pool->tail = cur;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    aw->next_seq++;
+    aw->bytes_in += aw->in_len;
+    aw->in_len = 0;
+
+    if (cur->last) {
+        return 0;
+    }
+
+    /* Recycle the oldest slot when every slot is in flight */
+    while (aw->next_seq - aw->write_seq >= (uint64_t)aw->nslots) {
+        if (aw_write_oldest_block(aw, true) < 0) return -1;
+    }
+
+    deflate_slot_t *nxt = &aw->slots[aw->next_seq % aw->nslots];
+    nxt->dict_len = cur->in_len < ARCHIVE_DICT_LEN ? cur->in_len : ARCHIVE_DICT_LEN;
+    memcpy(nxt->dict, cur->in + cur->in_len - nxt->dict_len, nxt->dict_len);
+    aw->in_buf = nxt->in;
+
+    /* Write out whatever already finished, without waiting */
+    int rc;
+    while ((rc = aw_write_oldest_block(aw, false)) == 0) {
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+static int
+aw_deflate(archive_writer_t *aw, int flush)
+{
+    if (aw_is_parallel(aw)) {
+        return aw_deflate_parallel(aw, flush);
+    }
+    return aw_deflate_serial(aw, flush);
+}
+
+/* Append bytes to in_buf, compressing whenever the buffer fills up */
+static int
+aw_emit(archive_writer_t *aw, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len > 0) {
+        size_t room = ARCHIVE_IO_BUF_LEN - aw->in_len;
+        size_t n = len < room ? len : room;
+
+        memcpy(aw->in_buf + aw->in_len, p, n);
+        aw->in_len += n;
+        p += n;
+        len -= n;
+
+        if (aw->in_len == ARCHIVE_IO_BUF_LEN && aw_deflate(aw, Z_NO_FLUSH) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Append len zero bytes (tar padding) */
+static int
+aw_emit_zeros(archive_writer_t *aw, size_t len)
+{
+    static const unsigned char zeros[TAR_BLOCK_SIZE];
+
+    while (len > 0) {
+        size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+        if (aw_emit(aw, zeros, n) < 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Collects a trailer frame in tar_trailer_member[codec] */
+static int
+aw_trailer_sink(void *ctx, const void *buf, size_t len)
+{
+    int codec = *(const int *)ctx;
+
+    if (tar_trailer_len[codec] + len > sizeof(tar_trailer_member[codec])) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(tar_trailer_member[codec] + tar_trailer_len[codec], buf, len);
+    tar_trailer_len[codec] += len;
+    return 0;
+}
+
+/*
+ * Builds the frame holding the two zero blocks ending a tar stream, once
+ * per codec. Fixed level, no mtime, no dictionary: the bytes are the same
+ * for every archive, so an append can recognise them at the end of the
+ * file.
+ *
+ * @return 0 when the trailer frame is available, -1 otherwise
+ */
+static int
+aw_tar_trailer(archive_writer_t *aw, int codec)
+{
+    static const unsigned char zeros[2 * 512];
+    codec_params_t params = { .codec = codec, .level = 9 };
+    int rc = 0;
+
+    pthread_mutex_lock(&tar_trailer_lock);
+    if (tar_trailer_len[codec] == 0) {
+        if (codec_stream_begin(aw->cs, &params, aw_trailer_sink, &codec) < 0 ||
+            codec_stream_write(aw->cs, zeros, sizeof(zeros)) < 0 ||
+            codec_stream_end(aw->cs) < 0) {
+            tar_trailer_len[codec] = 0;
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&tar_trailer_lock);
+    return rc;
+}
+
+/* Total uncompressed bytes produced so far, including still buffered ones */
+static uint64_t
+aw_stream_pos(const archive_writer_t *aw)
+{
+    return aw->bytes_in + aw->in_len;
+}
+
+/* Encode a numeric tar field, falling back to GNU base-256 when it overflows */
+static void
+tar_set_number(char *field, size_t width, uint64_t value)
+{
+    if (value <= TAR_MAX_OCTAL_SIZE || width != 12) {
+        snprintf(field, width, "%0*llo", (int)(width - 1), (unsigned long long)value);
+        return;
+    }
+
+    memset(field, 0, width);
+    field[0] = (char)0x80;
+    for (size_t i = width - 1; i > 0 && value; i--) {
+        field[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+/* Resolve (and cache) user/group names for the tar header */
+static void
+aw_resolve_owner(archive_writer_t *aw, uid_t uid, gid_t gid)
+{
+    char buf[1024];
+
+    if (uid != aw->cached_uid || aw->uname[0] == '\0') {
+        struct passwd pw, *res = NULL;
+        aw->uname[0] = '\0';
+        if (getpwuid_r(uid, &pw, buf, sizeof(buf), &res) == 0 && res) {
+            snprintf(aw->uname, sizeof(aw->uname), "%s", res->pw_name);
+        }
+        aw->cached_uid = uid;
+    }
+
+    if (gid != aw->cached_gid || aw->gname[0] == '\0') {
+        struct group gr, *res = NULL;
+        aw->gname[0] = '\0';
+        if (getgrgid_r(gid, &gr, buf, sizeof(buf), &res) == 0 && res) {
+            snprintf(aw->gname, sizeof(aw->gname), "%s", res->gr_name);
+        }
+        aw->cached_gid = gid;
+    }
+}
+
+static int
+aw_emit_tar_header(archive_writer_t *aw, const char *member_name, const struct stat *st)
+{
+    struct tar_header hdr;
+    unsigned int sum = 0;
+
+    if (strlen(member_name) >= sizeof(hdr.name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    aw_resolve_owner(aw, st->st_uid, st->st_gid);
+
+    memcpy(hdr.name, member_name, strlen(member_name));
+    tar_set_number(hdr.mode, sizeof(hdr.mode), st->st_mode & 07777);
+    tar_set_number(hdr.uid, sizeof(hdr.uid), st->st_uid);
+    tar_set_number(hdr.gid, sizeof(hdr.gid), st->st_gid);
+    tar_set_number(hdr.size, sizeof(hdr.size), (uint64_t)st->st_size);
+    tar_set_number(hdr.mtime, sizeof(hdr.mtime), (uint64_t)st->st_mtime);
+    hdr.typeflag = '0';
+    memcpy(hdr.magic, "ustar  ", 8);
+    memcpy(hdr.uname, aw->uname, strlen(aw->uname));
+    memcpy(hdr.gname, aw->gname, strlen(aw->gname));
+
+    /* Checksum is computed with the checksum field filled with spaces */
+    memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+    for (size_t i = 0; i < sizeof(hdr); i++) {
+        sum += ((unsigned char *)&hdr)[i];
+    }
+    snprintf(hdr.chksum, sizeof(hdr.chksum), "%06o", sum);
+    hdr.chksum[7] = ' ';
+
+    return aw_emit(aw, &hdr, sizeof(hdr));
+}
+
+/*******************************************************************************
+ *                     SEEKABLE FRAMES
+ ******************************************************************************/
+
+/* Archive file offset of the next compressed byte */
+static uint64_t
+aw_file_pos(const archive_writer_t *aw)
+{
+    return (aw->append ? (uint64_t)aw->append_base : 0) + aw->bytes_out;
+}
+
+/* Keeps the footer [from, to) an append overwrites, restored on abort */
+static int
+aw_seek_save_footer(archive_writer_t *aw, off_t from, off_t to)
+{
+    size_t len = (size_t)(to - from);
+    unsigned char *buf = malloc(len);
+
+    if (!buf) return -1;
+    if (pread(aw->out_fd, buf, len, from) != (ssize_t)len) {
+        free(buf);
+        errno = EBADMSG;
+        return -1;
+    }
+    free(aw->seek_footer);
+    aw->seek_footer = buf;
+    aw->seek_footer_len = len;
+    return 0;
+}
+
+/* Begins the next frame of the current file at the current file offset */
+static int
+aw_seek_begin_frame(archive_writer_t *aw, uint32_t member)
+{
+    if (!seek_index_add_frame(&aw->seek, member, aw_file_pos(aw), aw->seek_member_raw) ||
+        codec_stream_begin(aw->cs, &aw->codec, aw_codec_sink, aw) < 0) {
+        return -1;
+    }
+    aw->seek_open = true;
+    return 0;
+}
+
+/* Compresses what is left in in_buf, ends the frame and records its size */
+static int
+aw_seek_end_frame(archive_writer_t *aw)
+{
+    seek_frame_t *f = &aw->seek.frames[aw->seek.nframes - 1];
+
+    if (aw_deflate_serial(aw, Z_FINISH) < 0) return -1;
+    f->comp_len = aw_file_pos(aw) - f->comp_off;
+    aw->seek_open = false;
+    return 0;
+}
+
+/*
+ * Starts a file: new member, first frame. With a full gzip index the open
+ * frame continues instead.
+ */
+static int
+aw_seek_begin_file(archive_writer_t *aw, const char *member_name)
+{
+    int member;
+
+    aw->seek_member_raw = 0;
+    memset(&aw->seek_scan, 0, sizeof(aw->seek_scan));
+    if (aw->seek_open) return 0;
+
+    member = seek_index_add_member(&aw->seek, member_name);
+    if (member < 0) return -1;
+    return aw_seek_begin_frame(aw, (uint32_t)member);
+}
+
+/* Ends the file's last frame unless it has to take the rest of the run */
+static int
+aw_seek_end_file(archive_writer_t *aw)
+{
+    if (!aw->seek_open || seek_index_full(&aw->seek)) return 0;
+    return aw_seek_end_frame(aw);
+}
+
+/**
+ * aw_seek_feed()
+ *
+ * Purpose:
+ *   Accounts n bytes just read into in_buf after in_len. The frame ends at
+ *   the first line end once it holds SEEKABLE_FRAME_LEN bytes (or anywhere
+ *   at SEEKABLE_FRAME_HARD_LEN); the bytes past the cut are moved to the
+ *   front of in_buf for the next frame.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+aw_seek_feed(archive_writer_t *aw, size_t n)
+{
+    unsigned char *p = aw->in_buf + aw->in_len;
+
+    while (n > 0) {
+        seek_frame_t *f = &aw->seek.frames[aw->seek.nframes - 1];
+        size_t cut = n;
+        bool split = false;
+
+        if (f->raw_len + n >= SEEKABLE_FRAME_LEN && !seek_index_full(&aw->seek)) {
+            size_t from = f->raw_len >= SEEKABLE_FRAME_LEN ?
+                          0 : (size_t)(SEEKABLE_FRAME_LEN - f->raw_len - 1);
+            unsigned char *nl = memchr(p + from, '\n', n - from);
+
+            if (nl) {
+                cut = (size_t)(nl - p) + 1;
+                split = true;
+            } else if (f->raw_len + n >= SEEKABLE_FRAME_HARD_LEN) {
+                cut = (size_t)(SEEKABLE_FRAME_HARD_LEN - f->raw_len);
+                split = true;
+            }
+        }
+
+        seek_scan(&aw->seek_scan, f, p, cut);
+        f->raw_len += cut;
+        aw->seek_member_raw += cut;
+        aw->in_len += cut;
+        p += cut;
+        n -= cut;
+
+        if (split) {
+            uint32_t member = f->member;
+
+            if (aw_seek_end_frame(aw) < 0 || aw_seek_begin_frame(aw, member) < 0) {
+                return -1;
+            }
+            memmove(aw->in_buf, p, n);
+            p = aw->in_buf;
+        }
+    }
+
+    if (aw->in_len == ARCHIVE_IO_BUF_LEN) {
+        return aw_deflate_serial(aw, Z_NO_FLUSH);
+    }
+    return 0;
+}
+
+/* Ends the run's frames and writes the footer with the index */
+static int
+aw_seek_finish(archive_writer_t *aw)
+{
+    unsigned char *footer;
+    size_t len;
+    int rc;
+
+    if (aw->seek_open && aw_seek_end_frame(aw) < 0) return -1;
+    if (seek_footer_build(&aw->seek, &footer, &len) < 0) return -1;
+    rc = aw_codec_sink(aw, footer, len);
+    free(footer);
+    return rc;
+}
+
+/*******************************************************************************
+ *                     PARALLEL DEFLATE POOL
+ ******************************************************************************/
+
+/**
+ * deflate_pool_worker_fn()
+ *
+ * Purpose:
+ *   Pool worker. Pops blocks from the pool FIFO and raw-deflates each one
+ *   independently. Each worker keeps a single z_stream for its lifetime.
+ */
+static void *
+deflate_pool_worker_fn(void *arg)
+{
+    deflate_pool_t *pool = arg;
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(zs));
+    /* windowBits -15 : raw deflate, the writer adds the gzip framing */
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->stop) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (!pool->head) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        deflate_slot_t *slot = pool->head;
+        pool->head = slot->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        int state = DEFLATE_SLOT_DONE;
+
+        slot->crc = crc32(crc32(0L, Z_NULL, 0), slot->in, (uInt)slot->in_len);
+
+        if (deflateReset(&zs) != Z_OK ||
+            deflateParams(&zs, slot->level, Z_DEFAULT_STRATEGY) != Z_OK ||
+            (slot->dict_len &&
+             deflateSetDictionary(&zs, slot->dict, (uInt)slot->dict_len) != Z_OK)) {
+            state = DEFLATE_SLOT_FAILED;
+        } else {
+            zs.next_in = slot->in;
+            zs.avail_in = (uInt)slot->in_len;
+            zs.next_out = slot->out;
+            zs.avail_out = (uInt)slot->out_cap;
+
+            /* Non-final blocks end byte aligned so they can be concatenated */
+            int rc = deflate(&zs, slot->last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (zs.avail_in != 0 ||
+                (slot->last ? rc != Z_STREAM_END : rc != Z_OK)) {
+                state = DEFLATE_SLOT_FAILED;
+            }
+            slot->out_len = slot->out_cap - zs.avail_out;
+        }
+
+        archive_writer_t *aw = slot->owner;
+        pthread_mutex_lock(&aw->slot_lock);
+        slot->state = state;
+        pthread_cond_broadcast(&aw->slot_cond);
+        pthread_mutex_unlock(&aw->slot_lock);
+    }
+
+    deflateEnd(&zs);
+    return NULL;
+}
+
+/**
+ * deflate_pool_create()
+ *
+ * Purpose:
+ *   Starts the shared compression worker pool.
+ *
+ * @param nthreads  Number of workers, 0 to use one per online core
+ * @return pool on success, NULL on failure
+ */
+deflate_pool_t *
+deflate_pool_create(int nthreads)
+{
+    if (nthreads <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (int)ncpu : 1;
+    }
+
+    deflate_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+
+    pool->threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, deflate_pool_worker_fn, pool) != 0) {
+            break;
+        }
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads == 0) {
+        deflate_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void
+deflate_pool_destroy(deflate_pool_t *pool)
+{
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+static void
+aw_free_slots(archive_writer_t *aw)
+{
+    for (int i = 0; i < aw->nslots; i++) {
+        free(aw->slots[i].in);
+        free(aw->slots[i].dict);
+        free(aw->slots[i].out);
+    }
+    free(aw->slots);
+    aw->slots = NULL;
+    aw->nslots = 0;
+    aw->in_buf = aw->serial_in_buf;
+}
+
+/* true once the writer's cancel flag is set, errno ECANCELED */
+static bool
+aw_cancelled(const archive_writer_t *aw)
+{
+    if (aw->cancel && atomic_load_explicit(aw->cancel, memory_order_relaxed)) {
+        errno = ECANCELED;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * archive_writer_set_pool()
+ *
+ * Purpose:
+ *   Switches the writer to block-parallel compression on the given pool.
+ *   Two slots per worker are allocated once, so the pool always has a
+ *   block queued while the writer is reading the next one.
+ *   A pool of a single thread (or NULL) keeps the plain streaming path.
+ *
+ * @return 0 on success, -1 on failure (writer keeps the serial path)
+ */
+int
+archive_writer_set_pool(archive_writer_t *aw, deflate_pool_t *pool)
+{
+    if (aw->slots) {
+        aw_free_slots(aw);
+    }
+    aw->pool = NULL;
+
+    if (!pool || pool->nthreads <= 1) {
+        return 0;
+    }
+
+    int nslots = 2 * pool->nthreads;
+    if (nslots > ARCHIVE_MAX_SLOTS) {
+        nslots = ARCHIVE_MAX_SLOTS;
+    }
+
+    aw->slots = calloc((size_t)nslots, sizeof(deflate_slot_t));
+    if (!aw->slots) {
+        return -1;
+    }
+    aw->nslots = nslots;
+
+    for (int i = 0; i < nslots; i++) {
+        deflate_slot_t *slot = &aw->slots[i];
+
+        slot->owner = aw;
+        slot->out_cap = compressBound(ARCHIVE_IO_BUF_LEN) + DEFLATE_SLOT_SLACK;
+        slot->in = malloc(ARCHIVE_IO_BUF_LEN);
+        slot->dict = malloc(ARCHIVE_DICT_LEN);
+        slot->out = malloc(slot->out_cap);
+        if (!slot->in || !slot->dict || !slot->out) {
+            aw_free_slots(aw);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    aw->pool = pool;
+    return 0;
+}
+
+/**
+ * archive_writer_set_cancel()
+ *
+ * Purpose:
+ *   Attaches a flag another thread sets to stop the writer early. Once it
+ *   is set archive_writer_add_file() and archive_recompress() fail with
+ *   ECANCELED before their next buffer; the caller aborts the archive as
+ *   for any other failure. NULL detaches it.
+ */
+void
+archive_writer_set_cancel(archive_writer_t *aw, const atomic_bool *cancel)
+{
+    aw->cancel = cancel;
+}
+
+/*******************************************************************************
+ *                     ARCHIVE WRITER API
+ ******************************************************************************/
+
+/**
+ * archive_writer_init()
+ *
+ * Purpose:
+ *   Allocates the reusable I/O buffers and the deflate state.
+ *   Called once by the owning thread.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+archive_writer_init(archive_writer_t *aw)
+{
+    memset(aw, 0, sizeof(*aw));
+    aw->out_fd = -1;
+    aw->cached_uid = (uid_t)-1;
+    aw->cached_gid = (gid_t)-1;
+
+    aw->serial_in_buf = malloc(ARCHIVE_IO_BUF_LEN);
+    aw->in_buf = aw->serial_in_buf;
+    pthread_mutex_init(&aw->slot_lock, NULL);
+    pthread_cond_init(&aw->slot_cond, NULL);
+    if (!aw->in_buf) {
+        archive_writer_destroy(aw);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* gzip is always there, the other codecs are set up on first use */
+    if (codec_stream_init(&aw->codecs[CODEC_GZIP], CODEC_GZIP) < 0) {
+        archive_writer_destroy(aw);
+        errno = ENOMEM;
+        return -1;
+    }
+    aw->codec.codec = CODEC_GZIP;
+    aw->codec.level = CODEC_LEVEL_DEFAULT;
+    aw->cs = &aw->codecs[CODEC_GZIP];
+    return 0;
+}
+
+void
+archive_writer_destroy(archive_writer_t *aw)
+{
+    if (aw->out_fd >= 0) {
+        archive_writer_abort(aw);
+    }
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        codec_stream_destroy(&aw->codecs[i]);
+    }
+    seek_index_free(&aw->seek);
+    free(aw->seek_footer);
+    aw->seek_footer = NULL;
+    aw_free_slots(aw);
+    free(aw->serial_in_buf);
+    aw->serial_in_buf = NULL;
+    aw->in_buf = NULL;
+    pthread_cond_destroy(&aw->slot_cond);
+    pthread_mutex_destroy(&aw->slot_lock);
+}
+
+/* Archive file name extension, e.g. ".tar.gz", ".zst" or ".seek.lz4" */
+const char *
+archive_format_extension(int format, int codec)
+{
+    static const char *const tar_ext[CODEC_COUNT] = {
+        [CODEC_GZIP] = ".tar.gz", [CODEC_ZSTD] = ".tar.zst", [CODEC_LZ4] = ".tar.lz4",
+    };
+    static const char *const seek_ext[CODEC_COUNT] = {
+        [CODEC_GZIP] = ".seek.gz", [CODEC_ZSTD] = ".seek.zst", [CODEC_LZ4] = ".seek.lz4",
+    };
+
+    if (codec < 0 || codec >= CODEC_COUNT) codec = CODEC_GZIP;
+    if (format == ARCHIVE_FMT_SEEKABLE) return seek_ext[codec];
+    return format == ARCHIVE_FMT_GZ ? codec_extension(codec) : tar_ext[codec];
+}
+
+/* Selects (creating it if needed) the codec stream of the next archive */
+static int
+aw_select_codec(archive_writer_t *aw, const codec_params_t *codec)
+{
+    int id = codec->codec;
+
+    if (!codec_available(id)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (!aw->codecs[id].ops && codec_stream_init(&aw->codecs[id], id) < 0) {
+        return -1;
+    }
+    aw->cs = &aw->codecs[id];
+    aw->codec = *codec;
+    return 0;
+}
+
+static int
+aw_begin_member(archive_writer_t *aw, int format);
+
+/**
+ * archive_writer_open()
+ *
+ * Purpose:
+ *   Starts a new archive. Data is written to "<path>.part" and only renamed
+ *   to <path> by archive_writer_close(), so a crash never leaves a truncated
+ *   archive under its final name.
+ *
+ * @param path    Final archive path
+ * @param format  ARCHIVE_FMT_TAR_GZ, ARCHIVE_FMT_GZ or ARCHIVE_FMT_SEEKABLE
+ * @param codec   Codec, level (CODEC_LEVEL_DEFAULT for gzip's -6) and options
+ * @return 0 on success, -1 on failure (ENOTSUP: codec not compiled in)
+ */
+int
+archive_writer_open(archive_writer_t *aw, const char *path, int format,
+                    const codec_params_t *codec)
+{
+    if (snprintf(aw->path, sizeof(aw->path), "%s", path) >= (int)sizeof(aw->path) ||
+        snprintf(aw->part_path, sizeof(aw->part_path), "%s%s",
+                 path, ARCHIVE_PART_SUFFIX) >= (int)sizeof(aw->part_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (aw_select_codec(aw, codec) < 0) {
+        return -1;
+    }
+
+    aw->out_fd = open(aw->part_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (aw->out_fd < 0) {
+        return -1;
+    }
+    aw->append = false;
+
+    return aw_begin_member(aw, format);
+}
+
+/**
+ * archive_writer_open_append()
+ *
+ * Purpose:
+ *   Continues an existing archive (or starts a new one at path): the data
+ *   of this run becomes a new gzip member (zstd / lz4 frame) at the end of
+ *   the file, nothing already archived is read or compressed again. No
+ *   temporary file: an aborted run truncates the archive back to what it
+ *   was.
+ *
+ *   A tar archive must end with the trailer frame of a previous append,
+ *   anything else (archive of the full mode, a damaged or foreign file)
+ *   is refused with EBADMSG and left untouched. So is a seekable archive
+ *   without a valid index of the same codec; one whose gzip index is full
+ *   is refused with EFBIG.
+ *
+ * @param path    Archive path, created if missing
+ * @param format  ARCHIVE_FMT_TAR_GZ, ARCHIVE_FMT_GZ or ARCHIVE_FMT_SEEKABLE
+ * @param codec   Codec, level and options, as for archive_writer_open()
+ * @return 0 on success, -1 on failure
+ */
+int
+archive_writer_open_append(archive_writer_t *aw, const char *path, int format,
+                           const codec_params_t *codec)
+{
+    int id = codec->codec;
+    struct stat st;
+    off_t base;
+
+    if (snprintf(aw->path, sizeof(aw->path), "%s", path) >= (int)sizeof(aw->path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    aw->part_path[0] = '\0';
+
+    if (aw_select_codec(aw, codec) < 0 ||
+        (format == ARCHIVE_FMT_TAR_GZ && aw_tar_trailer(aw, id) < 0)) {
+        return -1;
+    }
+
+    aw->out_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (aw->out_fd < 0) {
+        return -1;
+    }
+    if (fstat(aw->out_fd, &st) < 0) {
+        goto fail;
+    }
+    base = st.st_size;
+
+    /* The new member replaces the trailer, which is written again after it */
+    if (format == ARCHIVE_FMT_TAR_GZ && base > 0) {
+        size_t len = tar_trailer_len[id];
+        unsigned char tail[sizeof(tar_trailer_member[id])];
+
+        if (base < (off_t)len ||
+            pread(aw->out_fd, tail, len, base - (off_t)len) != (ssize_t)len ||
+            memcmp(tail, tar_trailer_member[id], len) != 0) {
+            errno = EBADMSG;
+            goto fail;
+        }
+        base -= (off_t)len;
+    }
+
+    /* The new frames replace the footer, written again with the longer index */
+    seek_index_free(&aw->seek);
+    seek_index_init(&aw->seek, id);
+    if (format == ARCHIVE_FMT_SEEKABLE && base > 0) {
+        off_t footer_off;
+
+        if (seek_index_read(aw->out_fd, &aw->seek, &footer_off) < 0) {
+            goto fail;
+        }
+        if (aw->seek.codec != id) {
+            errno = EBADMSG;
+            goto fail;
+        }
+        if (seek_index_full(&aw->seek)) {
+            errno = EFBIG;
+            goto fail;
+        }
+        if (aw_seek_save_footer(aw, footer_off, base) < 0) {
+            goto fail;
+        }
+        base = footer_off;
+    }
+    if (lseek(aw->out_fd, base, SEEK_SET) != base) {
+        goto fail;
+    }
+
+    aw->append = true;
+    aw->append_base = base;
+    aw->append_had_trailer = base != st.st_size;
+
+    return aw_begin_member(aw, format);
+
+fail:
+    {
+        int saved = errno;
+        close(aw->out_fd);
+        aw->out_fd = -1;
+        seek_index_free(&aw->seek);
+        errno = saved;
+    }
+    return -1;
+}
+
+/* Per-run writer state and the codec frame (gzip member header in parallel mode) */
+static int
+aw_begin_member(archive_writer_t *aw, int format)
+{
+    int level = aw->codec.level;
+
+    aw->format = format;
+    aw->level = level == CODEC_LEVEL_DEFAULT ? Z_DEFAULT_COMPRESSION :
+                level < 0 ? 0 : level > 9 ? 9 : level;
+    aw->in_len = 0;
+    aw->bytes_in = 0;
+    aw->bytes_out = 0;
+    aw->in_buf = aw->serial_in_buf;
+
+    if (format == ARCHIVE_FMT_SEEKABLE) {
+        /* Frames begin with the files, an append keeps the loaded index */
+        if (!aw->append) {
+            seek_index_free(&aw->seek);
+            seek_index_init(&aw->seek, aw->codec.codec);
+        }
+        aw->seek_open = false;
+    } else if (!aw_is_parallel(aw)) {
+        if (codec_stream_begin(aw->cs, &aw->codec, aw_codec_sink, aw) < 0) {
+            archive_writer_abort(aw);
+            return -1;
+        }
+    } else {
+        /* gzip member header: deflate, no flags, no mtime, Unix */
+        static const unsigned char gz_header[10] = {
+            0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3
+        };
+
+        aw->next_seq = 0;
+        aw->write_seq = 0;
+        aw->crc = crc32(0L, Z_NULL, 0);
+        aw->slots[0].dict_len = 0;
+        aw->in_buf = aw->slots[0].in;
+
+        if (write_full(aw->out_fd, gz_header, sizeof(gz_header)) < 0) {
+            archive_writer_abort(aw);
+            return -1;
+        }
+        aw->bytes_out = sizeof(gz_header);
+    }
+    return 0;
+}
+
+/**
+ * archive_writer_add_file()
+ *
+ * Purpose:
+ *   Streams one file into the open archive. For ARCHIVE_FMT_TAR_GZ a tar
+ *   header is emitted first and the data is padded to a block boundary.
+ *   File data is read straight into the free space of in_buf.
+ *
+ * @param path         File to add
+ * @param member_name  Name stored in the tar header (ignored for plain gz)
+ * @return 0 on success, -1 on failure
+ */
+int
+archive_writer_add_file(archive_writer_t *aw, const char *path, const char *member_name)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        goto fail;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (aw->format == ARCHIVE_FMT_TAR_GZ &&
+        aw_emit_tar_header(aw, member_name, &st) < 0) {
+        goto fail;
+    }
+    if (aw->format == ARCHIVE_FMT_SEEKABLE && aw_seek_begin_file(aw, member_name) < 0) {
+        goto fail;
+    }
+
+    off_t remaining = st.st_size;
+    while (remaining > 0) {
+        size_t room = ARCHIVE_IO_BUF_LEN - aw->in_len;
+        size_t want = (off_t)room < remaining ? room : (size_t)remaining;
+
+        if (aw_cancelled(aw)) goto fail;
+
+        ssize_t n = read(fd, aw->in_buf + aw->in_len, want);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            goto fail;
+        }
+        if (n == 0) {
+            /* File shrank underneath us, keep the header size truthful */
+            if (aw->format == ARCHIVE_FMT_TAR_GZ &&
+                aw_emit_zeros(aw, (size_t)remaining) < 0) {
+                goto fail;
+            }
+            break;
+        }
+
+        remaining -= n;
+
+        if (aw->format == ARCHIVE_FMT_SEEKABLE) {
+            if (aw_seek_feed(aw, (size_t)n) < 0) goto fail;
+            continue;
+        }
+
+        aw->in_len += (size_t)n;
+        if (aw->in_len == ARCHIVE_IO_BUF_LEN && aw_deflate(aw, Z_NO_FLUSH) < 0) {
+            goto fail;
+        }
+    }
+    if (aw->format == ARCHIVE_FMT_SEEKABLE && aw_seek_end_file(aw) < 0) {
+        goto fail;
+    }
+
+    if (aw->format == ARCHIVE_FMT_TAR_GZ) {
+        size_t tail = (size_t)(st.st_size % TAR_BLOCK_SIZE);
+        if (tail && aw_emit_zeros(aw, TAR_BLOCK_SIZE - tail) < 0) {
+            goto fail;
+        }
+    }
+
+    close(fd);
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+    return -1;
+}
+
+/**
+ * archive_writer_close()
+ *
+ * Purpose:
+ *   Terminates the tar stream (two zero blocks, padded to a full record),
+ *   finishes the codec frame (seekable: the last frame and the footer) and
+ *   publishes the archive under its final name.
+ *
+ * @return 0 on success, -1 on failure (the partial archive is removed)
+ */
+int
+archive_writer_close(archive_writer_t *aw)
+{
+    /* Appended runs leave the end of the tar stream to the trailer member */
+    if (aw->format == ARCHIVE_FMT_TAR_GZ && !aw->append) {
+        uint64_t end = aw_stream_pos(aw) + 2 * TAR_BLOCK_SIZE;
+        uint64_t padded = (end + TAR_RECORD_SIZE - 1) / TAR_RECORD_SIZE * TAR_RECORD_SIZE;
+
+        if (aw_emit_zeros(aw, (size_t)(padded - aw_stream_pos(aw))) < 0) {
+            goto fail;
+        }
+    }
+
+    if (aw->format == ARCHIVE_FMT_SEEKABLE) {
+        if (aw_seek_finish(aw) < 0) goto fail;
+    } else if (aw_deflate(aw, Z_FINISH) < 0) {
+        goto fail;
+    }
+
+    if (aw_is_parallel(aw)) {
+        unsigned char trailer[8];
+        uint32_t isize = (uint32_t)aw->bytes_in;
+
+        if (aw_drain_blocks(aw) < 0) {
+            goto fail;
+        }
+
+        /* gzip trailer: CRC-32 and input size mod 2^32, little endian */
+        for (int i = 0; i < 4; i++) {
+            trailer[i] = (unsigned char)(aw->crc >> (8 * i));
+            trailer[4 + i] = (unsigned char)(isize >> (8 * i));
+        }
+        if (write_full(aw->out_fd, trailer, sizeof(trailer)) < 0) {
+            goto fail;
+        }
+        aw->bytes_out += sizeof(trailer);
+    }
+
+    if (aw->append) {
+        off_t end;
+
+        if (aw->format == ARCHIVE_FMT_TAR_GZ &&
+            write_full(aw->out_fd, tar_trailer_member[aw->codec.codec],
+                       tar_trailer_len[aw->codec.codec]) < 0) {
+            goto fail;
+        }
+        end = lseek(aw->out_fd, 0, SEEK_CUR);
+        if (end < 0 || ftruncate(aw->out_fd, end) < 0) {
+            goto fail;
+        }
+        aw->archive_size = (uint64_t)end;
+        aw->append = false;
+
+        if (close(aw->out_fd) < 0) {
+            aw->out_fd = -1;
+            return -1;
+        }
+        aw->out_fd = -1;
+        return 0;
+    }
+
+    if (close(aw->out_fd) < 0) {
+        aw->out_fd = -1;
+        unlink(aw->part_path);
+        return -1;
+    }
+    aw->out_fd = -1;
+    aw->archive_size = aw->bytes_out;
+
+    if (rename(aw->part_path, aw->path) < 0) {
+        int saved = errno;
+        unlink(aw->part_path);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        archive_writer_abort(aw);
+        errno = saved;
+    }
+    return -1;
+}
+
+/**
+ * archive_writer_abort()
+ *
+ * Purpose:
+ *   Drops the archive being written and removes its temporary file. An
+ *   append is undone by truncating the archive back to its previous end.
+ */
+void
+archive_writer_abort(archive_writer_t *aw)
+{
+    if (aw_is_parallel(aw)) {
+        /* Pool workers still reference our slots, let them finish first */
+        int fd = aw->out_fd;
+        aw->out_fd = -1;
+        aw_drain_blocks(aw);
+        aw->out_fd = fd;
+    }
+    if (aw->append) {
+        const unsigned char *tail = tar_trailer_member[aw->codec.codec];
+        size_t tail_len = tar_trailer_len[aw->codec.codec];
+
+        if (aw->format == ARCHIVE_FMT_SEEKABLE) {
+            tail = aw->seek_footer;
+            tail_len = aw->seek_footer_len;
+        }
+        aw->append = false;
+        if (aw->out_fd >= 0) {
+            /* Best effort: a failure here leaves a tail the next append
+               refuses, and the caller starts a new archive */
+            if (ftruncate(aw->out_fd, aw->append_base) == 0 && aw->append_had_trailer &&
+                pwrite(aw->out_fd, tail, tail_len, aw->append_base) != (ssize_t)tail_len) {
+                (void)ftruncate(aw->out_fd, aw->append_base);
+            }
+            close(aw->out_fd);
+        }
+        aw->out_fd = -1;
+        aw->in_len = 0;
+        return;
+    }
+    if (aw->out_fd >= 0) {
+        close(aw->out_fd);
+        aw->out_fd = -1;
+    }
+    unlink(aw->part_path);
+    aw->in_len = 0;
+}
+
+/* Decoded archive data, straight into the new frame */
+static int
+aw_recompress_sink(void *ctx, const void *buf, size_t len)
+{
+    archive_writer_t *aw = ctx;
+
+    if (aw_cancelled(aw)) return -1;
+    aw->bytes_in += len;
+    return codec_stream_write(aw->cs, buf, len);
+}
+
+/**
+ * archive_recompress()
+ *
+ * Purpose:
+ *   Rewrites an existing archive as a single frame with other codec
+ *   parameters (typically a higher level), through "<path>.part" renamed
+ *   over the original. The archive's content is not interpreted, so tar
+ *   and plain archives are handled alike. Serial, on the calling thread.
+ *
+ *   The result replaces the original only when it is smaller; bytes_in and
+ *   bytes_out tell the sizes either way.
+ *
+ * @param from  Codec (and zstd dictionary) the archive was written with
+ * @param to    Codec parameters of the rewrite, same codec as from
+ * @return 1 if replaced, 0 if kept (no gain), -1 on failure (errno set,
+ *         the original is untouched)
+ */
+int
+archive_recompress(archive_writer_t *aw, const char *path,
+                   const codec_params_t *from, const codec_params_t *to)
+{
+    struct stat st;
+    int in_fd, saved;
+
+    if (snprintf(aw->path, sizeof(aw->path), "%s", path) >= (int)sizeof(aw->path) ||
+        snprintf(aw->part_path, sizeof(aw->part_path), "%s%s",
+                 path, ARCHIVE_PART_SUFFIX) >= (int)sizeof(aw->part_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (from->codec != to->codec) {
+        errno = EINVAL;     /* The name carries the codec */
+        return -1;
+    }
+    if (aw_select_codec(aw, to) < 0) {
+        return -1;
+    }
+
+    in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        return -1;
+    }
+    if (fstat(in_fd, &st) < 0) goto fail_in;
+
+    aw->out_fd = open(aw->part_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (aw->out_fd < 0) goto fail_in;
+    aw->append = false;
+    aw->bytes_in = 0;
+    aw->bytes_out = 0;
+
+    if (codec_stream_begin(aw->cs, to, aw_codec_sink, aw) < 0 ||
+        codec_decode_file(from->codec, in_fd, CODEC_DECODE_TO_EOF, from->dict,
+                          from->dict_len, aw_recompress_sink, aw) < 0 ||
+        codec_stream_end(aw->cs) < 0) {
+        goto fail_out;
+    }
+    close(in_fd);
+    in_fd = -1;
+
+    if (aw->bytes_out >= (uint64_t)st.st_size) {
+        close(aw->out_fd);
+        aw->out_fd = -1;
+        unlink(aw->part_path);
+        return 0;
+    }
+
+    /* Replaces data already archived: durable before the rename */
+    if (fsync(aw->out_fd) < 0) goto fail_out;
+    if (close(aw->out_fd) < 0) {
+        aw->out_fd = -1;
+        goto fail_out;
+    }
+    aw->out_fd = -1;
+    if (rename(aw->part_path, path) < 0) goto fail_out;
+    aw->archive_size = aw->bytes_out;
+    return 1;
+
+fail_out:
+    saved = errno;
+    if (aw->out_fd >= 0) close(aw->out_fd);
+    aw->out_fd = -1;
+    unlink(aw->part_path);
+    errno = saved;
+fail_in:
+    saved = errno;
+    if (in_fd >= 0) close(in_fd);
+    errno = saved;
+    return -1;
+}
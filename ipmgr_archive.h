@@ -0,0 +1,210 @@
+/*******************************************************************************
+ * File: ipmgr_archive.h
+ *
+ * Description:
+ *   In-process archive writer used by the zipper thread of ipmgr_log_rotator.
+ *   Streams numbered log files into a compressed tar archive (or a plain
+ *   concatenated stream) without forking tar/gzip. Compression goes through
+ *   the codecs of ipmgr_codec.h: gzip, zstd, lz4.
+ *
+ *   The tar layout follows what GNU "tar -czf" produces by default (GNU
+ *   flavoured ustar headers, 10240 byte records), so archives stay readable
+ *   by the usual tar/zcat tooling.
+ *
+ *   Archives can also grow incrementally: each run appends a gzip member
+ *   (concatenated members are a valid gzip stream) and, for tar.gz, a tar
+ *   stream that still reads as one archive. archive_recompress() rewrites
+ *   a finished archive with a stronger level when there is time for it.
+ *
+ *   The seekable format (ipmgr_seekable.h) writes the files as frames of
+ *   about 1 MiB with a footer index of their timestamps and levels, for
+ *   logquery to decompress only what a search needs.
+ *
+ *   A writer given a cancel flag (archive_writer_set_cancel()) gives up
+ *   within one buffer of the flag being set, so a shutdown does not wait
+ *   for a large archive to finish.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_ARCHIVE_H
+#define IPMGR_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "ipmgr_codec.h"
+#include "ipmgr_seekable.h"
+
+/* Size of the reusable input and output buffers of an archive writer */
+#define ARCHIVE_IO_BUF_LEN      (128 * 1024)
+
+/* Archive formats */
+#define ARCHIVE_FMT_TAR_GZ      0   /* <name>_<ts>.tar.gz, one member per file */
+#define ARCHIVE_FMT_GZ          1   /* <name>_<ts>.gz, files concatenated      */
+#define ARCHIVE_FMT_SEEKABLE    2   /* <name>_<ts>.seek.gz, indexed frames     */
+                                    /* (.tar.zst / .zst etc. with other codecs) */
+#define ARCHIVE_FMT_COUNT       3
+
+/* Parallel deflate: history carried between independently compressed blocks */
+#define ARCHIVE_DICT_LEN        (32 * 1024)
+
+/* Upper bound on in-flight blocks per writer, whatever the pool size */
+#define ARCHIVE_MAX_SLOTS       32
+
+/* Suffix of the temporary file an archive is written to before publishing */
+#define ARCHIVE_PART_SUFFIX     ".part"
+
+typedef struct archive_writer_ archive_writer_t;
+
+/*
+ * Parallel deflate pool
+ * ---------------------
+ * pigz style block-parallel compression. The archive stream is cut into
+ * ARCHIVE_IO_BUF_LEN blocks, each block is raw-deflated by a pool worker
+ * (primed with the last 32 KiB of the previous block and ended on a byte
+ * boundary with Z_SYNC_FLUSH), and the writer joins the blocks in order
+ * into a single gzip member, combining the per-block CRCs.
+ *
+ * One pool is shared by every archive writer of the process. gzip only,
+ * other codecs run on the writer's thread.
+ */
+typedef struct deflate_slot_ {
+
+    struct deflate_slot_ *next;     /* Pool FIFO linkage */
+    archive_writer_t *owner;
+
+    unsigned char *in;              /* Block data (ARCHIVE_IO_BUF_LEN) */
+    size_t in_len;
+    unsigned char *dict;            /* Tail of the previous block */
+    size_t dict_len;
+    unsigned char *out;             /* Raw deflate output */
+    size_t out_cap;
+    size_t out_len;
+
+    uLong crc;
+    int level;
+    bool last;
+    int state;                      /* DEFLATE_SLOT_* */
+} deflate_slot_t;
+
+typedef struct deflate_pool_ {
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    deflate_slot_t *head;
+    deflate_slot_t *tail;
+    bool stop;
+
+    int nthreads;
+    pthread_t *threads;
+} deflate_pool_t;
+
+deflate_pool_t *
+deflate_pool_create(int nthreads);
+
+void
+deflate_pool_destroy(deflate_pool_t *pool);
+
+/*
+ * Archive writer
+ * --------------
+ * One writer is owned by a zipper thread and reused for every archive it
+ * produces. in_buf and the codec streams are allocated once and reused.
+ */
+struct archive_writer_ {
+
+    int format;
+    int out_fd;
+
+    /* Codec of the current archive, streams created on first use */
+    codec_params_t codec;
+    codec_stream_t *cs;
+    codec_stream_t codecs[CODEC_COUNT];
+
+    unsigned char *in_buf;      /* Uncompressed bytes waiting for deflate */
+    size_t in_len;
+    unsigned char *serial_in_buf;   /* in_buf of the single threaded path */
+
+    uint64_t bytes_in;          /* Uncompressed bytes of current archive */
+    uint64_t bytes_out;         /* Compressed bytes of current archive */
+
+    /* Cached owner names for tar headers */
+    uid_t cached_uid;
+    gid_t cached_gid;
+    char uname[32];
+    char gname[32];
+
+    char path[512];             /* Final archive path */
+    char part_path[512];        /* Temporary path being written */
+    uint64_t archive_size;      /* Archive file size after the last close */
+
+    /* Append mode, see archive_writer_open_append() */
+    bool append;
+    bool append_had_trailer;    /* tar.gz trailer member to restore on abort */
+    off_t append_base;          /* Offset the run's member starts at */
+
+    /* Seekable format: index of the archive, frame being written */
+    seek_index_t seek;
+    seek_scan_t seek_scan;
+    bool seek_open;             /* Last frame of the index is being written */
+    uint64_t seek_member_raw;   /* Bytes of the current file so far */
+    unsigned char *seek_footer; /* Footer replaced by an append, for abort */
+    size_t seek_footer_len;
+
+    /* Parallel mode, active when a pool with more than one thread is attached */
+    deflate_pool_t *pool;
+    deflate_slot_t *slots;
+    int nslots;
+    uint64_t next_seq;          /* Blocks handed to the pool */
+    uint64_t write_seq;         /* Blocks written to the archive */
+    uLong crc;                  /* CRC-32 of blocks written so far */
+    int level;
+    pthread_mutex_t slot_lock;
+    pthread_cond_t slot_cond;
+
+    /* Set by another thread: add_file and recompress fail with ECANCELED */
+    const atomic_bool *cancel;
+};
+
+int
+archive_writer_init(archive_writer_t *aw);
+
+void
+archive_writer_destroy(archive_writer_t *aw);
+
+int
+archive_writer_set_pool(archive_writer_t *aw, deflate_pool_t *pool);
+
+void
+archive_writer_set_cancel(archive_writer_t *aw, const atomic_bool *cancel);
+
+int
+archive_writer_open(archive_writer_t *aw, const char *path, int format,
+                    const codec_params_t *codec);
+
+int
+archive_writer_open_append(archive_writer_t *aw, const char *path, int format,
+                           const codec_params_t *codec);
+
+int
+archive_writer_add_file(archive_writer_t *aw, const char *path, const char *member_name);
+
+int
+archive_writer_close(archive_writer_t *aw);
+
+void
+archive_writer_abort(archive_writer_t *aw);
+
+int
+archive_recompress(archive_writer_t *aw, const char *path,
+                   const codec_params_t *from, const codec_params_t *to);
+
+const char *
+archive_format_extension(int format, int codec);
+
+#endif /* IPMGR_ARCHIVE_H */
@@ -0,0 +1,736 @@
+/*******************************************************************************
+ * File: ipmgr_codec.c
+ *
+ * Description:
+ *   gzip, zstd and lz4 streaming compressors behind one interface, see
+ *   ipmgr_codec.h. Every codec writes its frame through the stream's sink
+ *   from a single output buffer allocated once per stream. The decoders
+ *   read whole files of concatenated frames, for recompression.
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <zlib.h>
+#if IPMGR_WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#if IPMGR_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "ipmgr_codec.h"
+
+/* Output buffer of the gzip codec */
+#define CODEC_GZIP_OUT_LEN  (128 * 1024)
+
+/* Input fed to LZ4F_compressUpdate() at once, bounds its output buffer */
+#define CODEC_LZ4_CHUNK     (64 * 1024)
+
+/* Read and output buffers of the gzip and lz4 decoders */
+#define CODEC_DECODE_BUF_LEN (128 * 1024)
+
+struct codec_ops_ {
+    const char *name;
+    const char *extension;
+    int min_level;              /* Fastest useful level */
+    int max_level;
+    int default_level;          /* What CODEC_LEVEL_DEFAULT selects */
+    int (*decode)(int fd, uint64_t limit, const void *dict, size_t dict_len,
+                  codec_sink_fn sink, void *sink_ctx);
+    int (*init)(codec_stream_t *cs);
+    void (*destroy)(codec_stream_t *cs);
+    int (*begin)(codec_stream_t *cs, const codec_params_t *params);
+    int (*write)(codec_stream_t *cs, const void *data, size_t len);
+    int (*end)(codec_stream_t *cs);
+};
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+/* Hands len bytes of out_buf to the sink */
+static int
+cs_emit(codec_stream_t *cs, size_t len)
+{
+    if (len == 0) return 0;
+    if (cs->sink(cs->sink_ctx, cs->out_buf, len) < 0) return -1;
+    cs->bytes_out += len;
+    return 0;
+}
+
+static int
+clamp_level(int level, int min, int max)
+{
+    return level < min ? min : level > max ? max : level;
+}
+
+/*
+ * read() retried on EINTR and capped to the *limit bytes left of the
+ * decoded range: bytes read, 0 at its end or end of file, -1 on error
+ */
+static ssize_t
+read_some(int fd, void *buf, size_t len, uint64_t *limit)
+{
+    ssize_t n;
+
+    if (len > *limit) len = (size_t)*limit;
+    if (len == 0) return 0;
+    do {
+        n = read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) *limit -= (uint64_t)n;
+    return n;
+}
+
+/*******************************************************************************
+ *                     GZIP (zlib)
+ ******************************************************************************/
+
+static int
+gzip_init(codec_stream_t *cs)
+{
+    z_stream *zs = calloc(1, sizeof(*zs));
+
+    cs->out_buf = malloc(CODEC_GZIP_OUT_LEN);
+    cs->out_cap = CODEC_GZIP_OUT_LEN;
+    if (!zs || !cs->out_buf) {
+        free(zs);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* windowBits 15 + 16 : zlib emits a gzip header/trailer */
+    if (deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(zs);
+        errno = ENOMEM;
+        return -1;
+    }
+    cs->state = zs;
+    return 0;
+}
+
+static void
+gzip_destroy(codec_stream_t *cs)
+{
+    if (cs->state) {
+        deflateEnd(cs->state);
+        free(cs->state);
+    }
+}
+
+static int
+gzip_begin(codec_stream_t *cs, const codec_params_t *params)
+{
+    int level = params->level == CODEC_LEVEL_DEFAULT ?
+                Z_DEFAULT_COMPRESSION : clamp_level(params->level, 0, 9);
+
+    if (deflateReset(cs->state) != Z_OK ||
+        deflateParams(cs->state, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+gzip_deflate(codec_stream_t *cs, const void *data, size_t len, int flush)
+{
+    z_stream *zs = cs->state;
+    int rc;
+
+    zs->next_in = (unsigned char *)data;
+    zs->avail_in = (uInt)len;
+
+    do {
+        zs->next_out = cs->out_buf;
+        zs->avail_out = (uInt)cs->out_cap;
+
+        rc = deflate(zs, flush);
+        if (rc == Z_STREAM_ERROR) {
+            errno = EIO;
+            return -1;
+        }
+        if (cs_emit(cs, cs->out_cap - zs->avail_out) < 0) return -1;
+    } while (zs->avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+
+    return 0;
+}
+
+static int
+gzip_write(codec_stream_t *cs, const void *data, size_t len)
+{
+    return gzip_deflate(cs, data, len, Z_NO_FLUSH);
+}
+
+static int
+gzip_end(codec_stream_t *cs)
+{
+    return gzip_deflate(cs, NULL, 0, Z_FINISH);
+}
+
+/* Inflates every gzip member of the range in turn */
+static int
+gzip_decode(int fd, uint64_t limit, const void *dict, size_t dict_len, codec_sink_fn sink, void *sink_ctx)
+{
+    unsigned char *in = malloc(CODEC_DECODE_BUF_LEN);
+    unsigned char *out = malloc(CODEC_DECODE_BUF_LEN);
+    z_stream zs;
+    int zrc = Z_OK, rc = -1;
+
+    (void)dict; (void)dict_len;
+    memset(&zs, 0, sizeof(zs));
+    if (!in || !out || inflateInit2(&zs, 15 + 16) != Z_OK) {
+        free(in);
+        free(out);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (1) {
+        if (zs.avail_in == 0) {
+            ssize_t n = read_some(fd, in, CODEC_DECODE_BUF_LEN, &limit);
+
+            if (n < 0) goto out;
+            if (n == 0) break;
+            zs.next_in = in;
+            zs.avail_in = (uInt)n;
+        }
+        /* Member done and more input: the next member follows */
+        if (zrc == Z_STREAM_END && inflateReset(&zs) != Z_OK) goto bad;
+
+        zs.next_out = out;
+        zs.avail_out = CODEC_DECODE_BUF_LEN;
+        zrc = inflate(&zs, Z_NO_FLUSH);
+        if (zrc != Z_OK && zrc != Z_STREAM_END) goto bad;
+        if (zs.avail_out < CODEC_DECODE_BUF_LEN &&
+            sink(sink_ctx, out, CODEC_DECODE_BUF_LEN - zs.avail_out) < 0) {
+            goto out;
+        }
+    }
+    /* Truncated last member */
+    if (zrc != Z_STREAM_END) goto bad;
+    rc = 0;
+    goto out;
+
+bad:
+    errno = EBADMSG;
+out:
+    inflateEnd(&zs);
+    free(in);
+    free(out);
+    return rc;
+}
+
+/*******************************************************************************
+ *                     ZSTD
+ ******************************************************************************/
+
+#if IPMGR_WITH_ZSTD
+
+static int
+zstd_init(codec_stream_t *cs)
+{
+    cs->state = ZSTD_createCCtx();
+    cs->out_cap = ZSTD_CStreamOutSize();
+    cs->out_buf = malloc(cs->out_cap);
+    if (!cs->state || !cs->out_buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+zstd_destroy(codec_stream_t *cs)
+{
+    ZSTD_freeCCtx(cs->state);
+}
+
+static int
+zstd_begin(codec_stream_t *cs, const codec_params_t *params)
+{
+    ZSTD_CCtx *cctx = cs->state;
+    int level = params->level == CODEC_LEVEL_DEFAULT ? ZSTD_CLEVEL_DEFAULT :
+                clamp_level(params->level, ZSTD_minCLevel(), ZSTD_maxCLevel());
+
+    if (ZSTD_isError(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1))) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Same window as "zstd --long", so the CLI decodes without flags */
+    if (params->long_mode &&
+        (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1)) ||
+         ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog,
+                                             CODEC_ZSTD_LONG_WINDOW_LOG)))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (params->dict && params->dict_len &&
+        ZSTD_isError(ZSTD_CCtx_loadDictionary(cctx, params->dict, params->dict_len))) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+zstd_write(codec_stream_t *cs, const void *data, size_t len)
+{
+    ZSTD_inBuffer in = { data, len, 0 };
+
+    while (in.pos < in.size) {
+        ZSTD_outBuffer out = { cs->out_buf, cs->out_cap, 0 };
+        size_t rc = ZSTD_compressStream2(cs->state, &out, &in, ZSTD_e_continue);
+
+        if (ZSTD_isError(rc)) {
+            errno = EIO;
+            return -1;
+        }
+        if (cs_emit(cs, out.pos) < 0) return -1;
+    }
+    return 0;
+}
+
+static int
+zstd_end(codec_stream_t *cs)
+{
+    ZSTD_inBuffer in = { NULL, 0, 0 };
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer out = { cs->out_buf, cs->out_cap, 0 };
+
+        remaining = ZSTD_compressStream2(cs->state, &out, &in, ZSTD_e_end);
+        if (ZSTD_isError(remaining)) {
+            errno = EIO;
+            return -1;
+        }
+        if (cs_emit(cs, out.pos) < 0) return -1;
+    } while (remaining != 0);
+    return 0;
+}
+
+static int
+zstd_decode(int fd, uint64_t limit, const void *dict, size_t dict_len, codec_sink_fn sink, void *sink_ctx)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t in_cap = ZSTD_DStreamInSize(), out_cap = ZSTD_DStreamOutSize();
+    unsigned char *in = malloc(in_cap), *out = malloc(out_cap);
+    size_t left = 0;            /* Non zero inside a frame */
+    ssize_t n;
+    int rc = -1;
+
+    if (!dctx || !in || !out) {
+        errno = ENOMEM;
+        goto out;
+    }
+    /* Frames of the long mode use a window above the decoder's default */
+    if (ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax,
+                                            CODEC_ZSTD_LONG_WINDOW_LOG)) ||
+        (dict && dict_len &&
+         ZSTD_isError(ZSTD_DCtx_loadDictionary(dctx, dict, dict_len)))) {
+        errno = EINVAL;
+        goto out;
+    }
+
+    while ((n = read_some(fd, in, in_cap, &limit)) > 0) {
+        ZSTD_inBuffer ib = { in, (size_t)n, 0 };
+        ZSTD_outBuffer ob;
+
+        do {
+            ob = (ZSTD_outBuffer){ out, out_cap, 0 };
+            left = ZSTD_decompressStream(dctx, &ob, &ib);
+            if (ZSTD_isError(left)) {
+                errno = EBADMSG;    /* Also a frame needing another dictionary */
+                goto out;
+            }
+            if (ob.pos && sink(sink_ctx, out, ob.pos) < 0) goto out;
+            /* A full output buffer may hold back more, unless the frame is done */
+        } while (ib.pos < ib.size || (ob.pos == ob.size && left != 0));
+    }
+    if (n < 0) goto out;
+    if (left != 0) {
+        errno = EBADMSG;
+        goto out;
+    }
+    rc = 0;
+
+out:
+    ZSTD_freeDCtx(dctx);
+    free(in);
+    free(out);
+    return rc;
+}
+
+#endif /* IPMGR_WITH_ZSTD */
+
+/*******************************************************************************
+ *                     LZ4 (frame format)
+ ******************************************************************************/
+
+#if IPMGR_WITH_LZ4
+
+static void
+lz4_prefs(LZ4F_preferences_t *prefs, int level)
+{
+    memset(prefs, 0, sizeof(*prefs));
+    prefs->compressionLevel = level;
+    prefs->frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+}
+
+static int
+lz4_init(codec_stream_t *cs)
+{
+    LZ4F_compressionContext_t ctx;
+    LZ4F_preferences_t prefs;
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&ctx, LZ4F_VERSION))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    cs->state = ctx;
+
+    /* Worst case of one chunk, whatever the level; the header is separate */
+    lz4_prefs(&prefs, 0);
+    cs->out_cap = LZ4F_compressBound(CODEC_LZ4_CHUNK, &prefs) + LZ4F_HEADER_SIZE_MAX;
+    cs->out_buf = malloc(cs->out_cap);
+    if (!cs->out_buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+lz4_destroy(codec_stream_t *cs)
+{
+    LZ4F_freeCompressionContext(cs->state);
+}
+
+static int
+lz4_begin(codec_stream_t *cs, const codec_params_t *params)
+{
+    LZ4F_preferences_t prefs;
+    int level = params->level == CODEC_LEVEL_DEFAULT ? 0 :
+                clamp_level(params->level, 0, LZ4F_compressionLevel_max());
+    size_t n;
+
+    lz4_prefs(&prefs, level);
+    n = LZ4F_compressBegin(cs->state, cs->out_buf, cs->out_cap, &prefs);
+    if (LZ4F_isError(n)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return cs_emit(cs, n);
+}
+
+static int
+lz4_write(codec_stream_t *cs, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len > 0) {
+        size_t chunk = len < CODEC_LZ4_CHUNK ? len : CODEC_LZ4_CHUNK;
+        size_t n = LZ4F_compressUpdate(cs->state, cs->out_buf, cs->out_cap,
+                                       p, chunk, NULL);
+
+        if (LZ4F_isError(n)) {
+            errno = EIO;
+            return -1;
+        }
+        if (cs_emit(cs, n) < 0) return -1;
+        p += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int
+lz4_end(codec_stream_t *cs)
+{
+    size_t n = LZ4F_compressEnd(cs->state, cs->out_buf, cs->out_cap, NULL);
+
+    if (LZ4F_isError(n)) {
+        errno = EIO;
+        return -1;
+    }
+    return cs_emit(cs, n);
+}
+
+static int
+lz4_decode(int fd, uint64_t limit, const void *dict, size_t dict_len, codec_sink_fn sink, void *sink_ctx)
+{
+    LZ4F_dctx *dctx = NULL;
+    unsigned char *in = malloc(CODEC_DECODE_BUF_LEN);
+    unsigned char *out = malloc(CODEC_DECODE_BUF_LEN);
+    size_t hint = 0;            /* Non zero inside a frame */
+    ssize_t n;
+    int rc = -1;
+
+    (void)dict; (void)dict_len;
+    if (!in || !out || LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+        errno = ENOMEM;
+        goto out;
+    }
+
+    while ((n = read_some(fd, in, CODEC_DECODE_BUF_LEN, &limit)) > 0) {
+        size_t pos = 0, dst_len;
+
+        do {
+            size_t src_len = (size_t)n - pos;
+
+            dst_len = CODEC_DECODE_BUF_LEN;
+            hint = LZ4F_decompress(dctx, out, &dst_len, in + pos, &src_len, NULL);
+            if (LZ4F_isError(hint)) {
+                errno = EBADMSG;
+                goto out;
+            }
+            pos += src_len;
+            if (dst_len && sink(sink_ctx, out, dst_len) < 0) goto out;
+        } while (pos < (size_t)n || (dst_len == CODEC_DECODE_BUF_LEN && hint != 0));
+    }
+    if (n < 0) goto out;
+    if (hint != 0) {
+        errno = EBADMSG;
+        goto out;
+    }
+    rc = 0;
+
+out:
+    if (dctx) LZ4F_freeDecompressionContext(dctx);
+    free(in);
+    free(out);
+    return rc;
+}
+
+#endif /* IPMGR_WITH_LZ4 */
+
+/*******************************************************************************
+ *                     CODEC TABLE
+ ******************************************************************************/
+
+static const codec_ops_t codec_table[CODEC_COUNT] = {
+    [CODEC_GZIP] = { "gzip", ".gz", 1, 9, 6, gzip_decode,
+                     gzip_init, gzip_destroy, gzip_begin, gzip_write, gzip_end },
+#if IPMGR_WITH_ZSTD
+    [CODEC_ZSTD] = { "zstd", ".zst", 1, 19, 3, zstd_decode,
+                     zstd_init, zstd_destroy, zstd_begin, zstd_write, zstd_end },
+#else
+    [CODEC_ZSTD] = { "zstd", ".zst", 1, 19, 3, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#if IPMGR_WITH_LZ4
+    [CODEC_LZ4]  = { "lz4", ".lz4", 0, 12, 0, lz4_decode,
+                     lz4_init, lz4_destroy, lz4_begin, lz4_write, lz4_end },
+#else
+    [CODEC_LZ4]  = { "lz4", ".lz4", 0, 12, 0, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+};
+
+/* true when the codec was compiled in */
+bool
+codec_available(int codec)
+{
+    return codec >= 0 && codec < CODEC_COUNT && codec_table[codec].init != NULL;
+}
+
+const char *
+codec_name(int codec)
+{
+    return codec >= 0 && codec < CODEC_COUNT ? codec_table[codec].name : "unknown";
+}
+
+/* @return CODEC_* for "gzip", "zstd" or "lz4" (also "gz", "zst"), -1 otherwise */
+int
+codec_from_name(const char *name)
+{
+    if (!strcasecmp(name, "gz")) return CODEC_GZIP;
+    if (!strcasecmp(name, "zst")) return CODEC_ZSTD;
+
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        if (!strcasecmp(name, codec_table[i].name)) return i;
+    }
+    return -1;
+}
+
+/* File name extension of a plain (non tar) stream, e.g. ".zst" */
+const char *
+codec_extension(int codec)
+{
+    return codec >= 0 && codec < CODEC_COUNT ? codec_table[codec].extension : "";
+}
+
+/*
+ * Levels worth stepping through, fastest to strongest (zstd's ultra levels
+ * and fast negative levels are left out), and the numeric level
+ * CODEC_LEVEL_DEFAULT stands for.
+ */
+void
+codec_level_range(int codec, int *min_level, int *max_level, int *default_level)
+{
+    const codec_ops_t *ops = &codec_table[codec >= 0 && codec < CODEC_COUNT ? codec : CODEC_GZIP];
+
+    *min_level = ops->min_level;
+    *max_level = ops->max_level;
+    *default_level = ops->default_level;
+}
+
+/*******************************************************************************
+ *                     STREAM API
+ ******************************************************************************/
+
+/**
+ * codec_stream_init()
+ *
+ * Purpose:
+ *   Allocates the codec context and output buffer, reused by every frame
+ *   the stream produces.
+ *
+ * @return 0 on success, -1 on failure (ENOTSUP: codec not compiled in)
+ */
+int
+codec_stream_init(codec_stream_t *cs, int codec)
+{
+    memset(cs, 0, sizeof(*cs));
+
+    if (!codec_available(codec)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    cs->ops = &codec_table[codec];
+    if (cs->ops->init(cs) < 0) {
+        int saved = errno;
+        codec_stream_destroy(cs);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+void
+codec_stream_destroy(codec_stream_t *cs)
+{
+    if (cs->ops && cs->state) {
+        cs->ops->destroy(cs);
+    }
+    free(cs->out_buf);
+    memset(cs, 0, sizeof(*cs));
+}
+
+/**
+ * codec_stream_begin()
+ *
+ * Purpose:
+ *   Starts a new frame with the given parameters. Compressed output goes
+ *   to sink as it is produced.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+codec_stream_begin(codec_stream_t *cs, const codec_params_t *params,
+                   codec_sink_fn sink, void *sink_ctx)
+{
+    cs->sink = sink;
+    cs->sink_ctx = sink_ctx;
+    cs->bytes_in = 0;
+    cs->bytes_out = 0;
+    return cs->ops->begin(cs, params);
+}
+
+/* Compresses len bytes into the current frame */
+int
+codec_stream_write(codec_stream_t *cs, const void *data, size_t len)
+{
+    if (len == 0) return 0;
+    cs->bytes_in += len;
+    return cs->ops->write(cs, data, len);
+}
+
+/* Flushes and terminates the current frame */
+int
+codec_stream_end(codec_stream_t *cs)
+{
+    return cs->ops->end(cs);
+}
+
+/**
+ * codec_decode_file()
+ *
+ * Purpose:
+ *   Decompresses every frame of a file (as written by a codec stream,
+ *   frames back to back) and hands the data to sink.
+ *
+ * @param fd    File open for reading, at the first frame
+ * @param len   Compressed bytes to decode from there, CODEC_DECODE_TO_EOF
+ *              for the rest of the file; a range of whole frames
+ * @param dict  zstd: dictionary the frames were compressed with, or NULL
+ * @return 0 on success, -1 on failure (EBADMSG: corrupt, truncated or
+ *         compressed with another dictionary)
+ */
+int
+codec_decode_file(int codec, int fd, uint64_t len, const void *dict, size_t dict_len,
+                  codec_sink_fn sink, void *sink_ctx)
+{
+    if (!codec_available(codec)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return codec_table[codec].decode(fd, len, dict, dict_len, sink, sink_ctx);
+}
+
+/*******************************************************************************
+ *                     DICTIONARIES
+ ******************************************************************************/
+
+/**
+ * codec_train_dictionary()
+ *
+ * Purpose:
+ *   Trains a zstd dictionary from sample buffers laid out back to back in
+ *   samples. Works best with many samples of a few KiB each and around a
+ *   hundred times dict_cap of input.
+ *
+ * @return Dictionary size, 0 on failure (too few samples, no zstd)
+ */
+size_t
+codec_train_dictionary(void *dict, size_t dict_cap, const void *samples,
+                       const size_t *sample_sizes, unsigned nsamples)
+{
+#if IPMGR_WITH_ZSTD
+    size_t n = ZDICT_trainFromBuffer(dict, dict_cap, samples, sample_sizes, nsamples);
+
+    if (ZDICT_isError(n)) {
+        errno = EINVAL;
+        return 0;
+    }
+    return n;
+#else
+    (void)dict; (void)dict_cap; (void)samples; (void)sample_sizes; (void)nsamples;
+    errno = ENOTSUP;
+    return 0;
+#endif
+}
+
+/* Dictionary ID stored in the frames compressed with it, 0 if none */
+unsigned
+codec_dictionary_id(const void *dict, size_t dict_len)
+{
+#if IPMGR_WITH_ZSTD
+    return ZSTD_getDictID_fromDict(dict, dict_len);
+#else
+    (void)dict; (void)dict_len;
+    return 0;
+#endif
+}
@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * File: ipmgr_codec.h
+ *
+ * Description:
+ *   Streaming compression codecs of the archive writer: gzip (zlib), zstd
+ *   (levels, long distance mode, trained dictionaries) and lz4 (frame
+ *   format). Each codec turns a byte stream into one self-contained frame
+ *   (gzip member, zstd frame, lz4 frame); concatenated frames are a valid
+ *   file for the codec's command line tool.
+ *
+ *   gzip is always built. zstd and lz4 are compiled in with
+ *     -DIPMGR_WITH_ZSTD=1 ... -lzstd
+ *     -DIPMGR_WITH_LZ4=1  ... -llz4
+ *   codec_available() tells at runtime which ones are there.
+ *
+ *   codec_decode_file() reads such a file back, for recompression, or a
+ *   range of its frames (seekable archives, logquery).
+ *
+ *   A codec stream is owned by a single thread; nothing here is thread safe.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_CODEC_H
+#define IPMGR_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef IPMGR_WITH_ZSTD
+#define IPMGR_WITH_ZSTD     0
+#endif
+#ifndef IPMGR_WITH_LZ4
+#define IPMGR_WITH_LZ4      0
+#endif
+
+/* Codecs */
+#define CODEC_GZIP          0
+#define CODEC_ZSTD          1
+#define CODEC_LZ4           2
+#define CODEC_COUNT         3
+
+/* Level selecting the codec's own default (same value as Z_DEFAULT_COMPRESSION) */
+#define CODEC_LEVEL_DEFAULT (-1)
+
+/* zstd long distance mode window: 128 MiB, what "zstd --long" uses */
+#define CODEC_ZSTD_LONG_WINDOW_LOG  27
+
+/* codec_decode_file() length: up to the end of the file */
+#define CODEC_DECODE_TO_EOF UINT64_MAX
+
+/* Output callback: receives compressed bytes, returns 0 or -1 with errno set */
+typedef int (*codec_sink_fn)(void *ctx, const void *buf, size_t len);
+
+/* Parameters of one frame */
+typedef struct codec_params_ {
+    int codec;                  /* CODEC_* */
+    int level;                  /* Clamped to the codec's range, CODEC_LEVEL_DEFAULT */
+    bool long_mode;             /* zstd: long distance matching */
+    const void *dict;           /* zstd: dictionary (codec_train_dictionary()), or NULL */
+    size_t dict_len;
+} codec_params_t;
+
+typedef struct codec_ops_ codec_ops_t;
+
+typedef struct codec_stream_ {
+    const codec_ops_t *ops;
+    void *state;                /* Codec context, kept across frames */
+    unsigned char *out_buf;
+    size_t out_cap;
+    codec_sink_fn sink;
+    void *sink_ctx;
+    uint64_t bytes_in;          /* Current frame */
+    uint64_t bytes_out;
+} codec_stream_t;
+
+bool
+codec_available(int codec);
+
+const char *
+codec_name(int codec);
+
+int
+codec_from_name(const char *name);
+
+const char *
+codec_extension(int codec);
+
+void
+codec_level_range(int codec, int *min_level, int *max_level, int *default_level);
+
+int
+codec_stream_init(codec_stream_t *cs, int codec);
+
+void
+codec_stream_destroy(codec_stream_t *cs);
+
+int
+codec_stream_begin(codec_stream_t *cs, const codec_params_t *params,
+                   codec_sink_fn sink, void *sink_ctx);
+
+int
+codec_stream_write(codec_stream_t *cs, const void *data, size_t len);
+
+int
+codec_stream_end(codec_stream_t *cs);
+
+int
+codec_decode_file(int codec, int fd, uint64_t len, const void *dict, size_t dict_len,
+                  codec_sink_fn sink, void *sink_ctx);
+
+size_t
+codec_train_dictionary(void *dict, size_t dict_cap, const void *samples,
+                       const size_t *sample_sizes, unsigned nsamples);
+
+unsigned
+codec_dictionary_id(const void *dict, size_t dict_len);
+
+#endif /* IPMGR_CODEC_H */
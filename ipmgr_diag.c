@@ -0,0 +1,876 @@
+/*******************************************************************************
+ * File: ipmgr_diag.c
+ *
+ * Description:
+ *   Asynchronous diagnostic logger of ipmgr_log_rotator, see ipmgr_diag.h.
+ *
+ *   Each thread owns one single producer / single consumer ring of fixed
+ *   size records; the only consumer is the drain, run by the drain thread
+ *   (or diag_flush()) under drain_lock. Rings are linked into a list that
+ *   only grows: a ring whose thread exited is marked orphan and taken over
+ *   by the next new thread once drained, so their number stays that of
+ *   the threads alive at once.
+ *
+ *   A drain pass merges the rings by record timestamp, formats the records
+ *   and writes them out in buffer sized write()s.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/* System Headers */
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+
+#include "ipmgr_diag.h"
+
+#define DIAG_DRAIN_MS           20      /* Drain thread period */
+#define DIAG_OUT_LEN            (64 * 1024)
+#define DIAG_MSG_LEN            1024    /* Formatted message, truncated past */
+#define DIAG_MERGE_MAX          64      /* Rings merged by one pass */
+
+/* Argument classes (high nibble of a type) and lengths (low nibble) */
+#define DIAG_C_INT              1
+#define DIAG_C_UINT             2
+#define DIAG_C_CHAR             3
+#define DIAG_C_DBL              4
+#define DIAG_C_STR              5
+#define DIAG_C_PTR              6
+#define DIAG_C_STAR             7       /* '*' width or precision, an int */
+
+#define DIAG_L_NONE             0
+#define DIAG_L_HH               1
+#define DIAG_L_H                2
+#define DIAG_L_L                3
+#define DIAG_L_LL               4
+#define DIAG_L_Z                5
+#define DIAG_L_J                6
+#define DIAG_L_T                7
+#define DIAG_L_LD               8       /* long double, recorded as double */
+
+#define DIAG_RING_ACTIVE        0
+#define DIAG_RING_ORPHAN        1       /* Thread gone, ring free once drained */
+#define DIAG_RING_CLAIMED       2       /* Being taken over */
+
+typedef struct diag_record_ {
+    int64_t ts_ns;              /* CLOCK_REALTIME_COARSE */
+    const diag_site_t *site;
+    int32_t err;                /* errno at the call, for %m */
+    uint8_t level;
+    uint8_t pad;
+    uint16_t len;               /* Bytes of data[] used */
+    unsigned char data[DIAG_RECORD_LEN - 24];   /* Arguments, in order */
+} diag_record_t;
+
+_Static_assert(sizeof(diag_record_t) == DIAG_RECORD_LEN, "diag record layout");
+_Static_assert((DIAG_RING_RECORDS & (DIAG_RING_RECORDS - 1)) == 0, "ring size");
+
+typedef struct diag_ring_ {
+    /* Producer side */
+    _Alignas(64) _Atomic uint64_t head;
+    uint64_t tail_cache;        /* Last tail seen by the producer */
+    _Atomic uint64_t dropped;   /* Records lost to a full ring */
+
+    /* Consumer side */
+    _Alignas(64) _Atomic uint64_t tail;
+    uint64_t dropped_reported;
+
+    _Alignas(64) _Atomic int state;
+    char name[DIAG_THREAD_NAME_LEN];
+    struct diag_ring_ *next;
+    diag_record_t records[DIAG_RING_RECORDS];
+} diag_ring_t;
+
+/* Merge cursor of one ring during a drain pass */
+typedef struct diag_cursor_ {
+    diag_ring_t *ring;
+    uint64_t tail;
+    uint64_t head;
+} diag_cursor_t;
+
+/* One conversion of a format, the text after its '%' */
+typedef struct diag_spec_ {
+    char flags[8];
+    int width;                  /* -1 none */
+    bool width_star;
+    int prec;                   /* -1 none */
+    bool prec_star;
+    int len;                    /* DIAG_L_* */
+    char conv;
+    size_t consumed;
+} diag_spec_t;
+
+_Atomic int diag_level = DIAG_WARN;
+
+static _Atomic(diag_ring_t *) diag_rings;
+static __thread diag_ring_t *diag_self;
+static pthread_key_t diag_key;
+static pthread_once_t diag_key_once = PTHREAD_ONCE_INIT;
+
+static int diag_fd = STDERR_FILENO;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t drain_thread;
+static bool drain_running;
+static atomic_bool drain_stop;
+static bool diag_atexit_set;
+
+static const char *const level_names[] = { "OFF", "ERROR", "WARN", "INFO", "DEBUG" };
+
+/*******************************************************************************
+ *                     FORMAT PARSING
+ ******************************************************************************/
+
+/**
+ * diag_spec_parse()
+ *
+ * Purpose:
+ *   Parses one printf conversion: flags, width, precision, length and
+ *   conversion character.
+ *
+ * @param p  Text right after the '%'
+ * @return false for a conversion the logger does not record (%n, wide
+ *         characters and strings, unknown)
+ */
+static bool
+diag_spec_parse(const char *p, diag_spec_t *s)
+{
+    const char *start = p;
+    size_t nflags = 0;
+
+    memset(s, 0, sizeof(*s));
+    s->width = -1;
+    s->prec = -1;
+
+    while (*p && strchr("-+ #0'", *p)) {
+        if (nflags < sizeof(s->flags) - 1) s->flags[nflags++] = *p;
+        p++;
+    }
+    if (*p == '*') {
+        s->width_star = true;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        s->width = (int)strtol(p, (char **)&p, 10);
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->prec_star = true;
+            p++;
+        } else {
+            s->prec = *p >= '0' && *p <= '9' ? (int)strtol(p, (char **)&p, 10) : 0;
+        }
+    }
+
+    if (p[0] == 'h' && p[1] == 'h') { s->len = DIAG_L_HH; p += 2; }
+    else if (p[0] == 'l' && p[1] == 'l') { s->len = DIAG_L_LL; p += 2; }
+    else if (*p == 'h') { s->len = DIAG_L_H; p++; }
+    else if (*p == 'l') { s->len = DIAG_L_L; p++; }
+    else if (*p == 'q') { s->len = DIAG_L_LL; p++; }
+    else if (*p == 'z') { s->len = DIAG_L_Z; p++; }
+    else if (*p == 'j') { s->len = DIAG_L_J; p++; }
+    else if (*p == 't') { s->len = DIAG_L_T; p++; }
+    else if (*p == 'L') { s->len = DIAG_L_LD; p++; }
+
+    s->conv = *p;
+    if (!*p || !strchr("diouxXcspfFeEgGaAm", *p)) return false;
+    if ((*p == 'c' || *p == 's') && s->len != DIAG_L_NONE) return false;
+    s->consumed = (size_t)(p + 1 - start);
+    return true;
+}
+
+static int
+diag_conv_class(char conv)
+{
+    switch (conv) {
+    case 'd': case 'i':
+        return DIAG_C_INT;
+    case 'o': case 'u': case 'x': case 'X':
+        return DIAG_C_UINT;
+    case 'c':
+        return DIAG_C_CHAR;
+    case 's':
+        return DIAG_C_STR;
+    case 'p':
+        return DIAG_C_PTR;
+    case 'm':
+        return 0;               /* errno of the record, no argument */
+    default:
+        return DIAG_C_DBL;
+    }
+}
+
+/* Adds an argument to a site being parsed, false once there are too many */
+static bool
+diag_site_push(diag_site_t *site, int cls, int len, int prec)
+{
+    if (site->nargs == DIAG_MAX_ARGS) return false;
+    site->types[site->nargs] = (uint8_t)(cls << 4 | len);
+    site->prec[site->nargs] = (int16_t)prec;
+    site->nargs++;
+    return true;
+}
+
+/**
+ * diag_site_parse()
+ *
+ * Purpose:
+ *   First record of a call site: its argument signature from the format,
+ *   and its level ("WARNING..." / "ERROR..." messages take that level
+ *   whatever the macro said). Threads racing on a new site wait for the
+ *   one parsing it.
+ */
+static void
+diag_site_parse(diag_site_t *site, const char *fmt)
+{
+    int expected = 0;
+    const char *p, *text = fmt;
+    diag_spec_t spec;
+
+    if (!atomic_compare_exchange_strong(&site->state, &expected, 1)) {
+        while (atomic_load_explicit(&site->state, memory_order_acquire) != 2) {
+        }
+        return;
+    }
+
+    site->fmt = fmt;
+    for (p = fmt; *p; p++) {
+        int cls;
+
+        if (*p != '%') continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        if (!diag_spec_parse(p + 1, &spec)) {
+            site->raw = true;
+            break;
+        }
+        p += spec.consumed;
+        cls = diag_conv_class(spec.conv);
+        if ((spec.width_star && !diag_site_push(site, DIAG_C_STAR, DIAG_L_NONE, -1)) ||
+            (spec.prec_star && !diag_site_push(site, DIAG_C_STAR, DIAG_L_NONE, -1)) ||
+            (cls && !diag_site_push(site, cls, spec.len, spec.prec_star ? -2 : spec.prec))) {
+            site->raw = true;
+            break;
+        }
+    }
+    if (site->raw) site->nargs = 0;
+
+    while (*text == '\n') text++;
+    if (!strncmp(text, "ERROR", 5) && site->level > DIAG_ERROR) {
+        site->level = DIAG_ERROR;
+    } else if (!strncmp(text, "WARNING", 7) && site->level > DIAG_WARN) {
+        site->level = DIAG_WARN;
+    }
+
+    atomic_store_explicit(&site->state, 2, memory_order_release);
+}
+
+/*******************************************************************************
+ *                     PRODUCER SIDE
+ ******************************************************************************/
+
+static void
+diag_ring_orphan(void *arg)
+{
+    diag_ring_t *r = arg;
+
+    atomic_store_explicit(&r->state, DIAG_RING_ORPHAN, memory_order_release);
+}
+
+static void
+diag_key_create(void)
+{
+    pthread_key_create(&diag_key, diag_ring_orphan);
+}
+
+/**
+ * diag_ring_get()
+ *
+ * Purpose:
+ *   Ring of the calling thread, taken over from an exited thread or
+ *   allocated on its first record.
+ *
+ * @return The ring, NULL if none could be allocated
+ */
+static diag_ring_t *
+diag_ring_get(void)
+{
+    diag_ring_t *r;
+
+    if (diag_self) return diag_self;
+    pthread_once(&diag_key_once, diag_key_create);
+
+    for (r = atomic_load_explicit(&diag_rings, memory_order_acquire); r; r = r->next) {
+        int expected = DIAG_RING_ORPHAN;
+
+        if (atomic_load(&r->state) != DIAG_RING_ORPHAN ||
+            !atomic_compare_exchange_strong(&r->state, &expected, DIAG_RING_CLAIMED)) {
+            continue;
+        }
+        /* The drain still reads its name while records are left */
+        if (atomic_load_explicit(&r->tail, memory_order_acquire) != atomic_load(&r->head)) {
+            atomic_store(&r->state, DIAG_RING_ORPHAN);
+            continue;
+        }
+        break;
+    }
+
+    if (!r) {
+        r = aligned_alloc(64, sizeof(*r));
+        if (!r) return NULL;
+        memset(r, 0, sizeof(*r));
+        r->next = atomic_load(&diag_rings);
+        while (!atomic_compare_exchange_weak(&diag_rings, &r->next, r)) {
+        }
+    }
+
+    snprintf(r->name, sizeof(r->name), "tid %ld", (long)syscall(SYS_gettid));
+    r->tail_cache = atomic_load(&r->tail);
+    atomic_store_explicit(&r->state, DIAG_RING_ACTIVE, memory_order_release);
+    pthread_setspecific(diag_key, r);
+    diag_self = r;
+    return r;
+}
+
+/* Names the calling thread's records; call before its first record */
+void
+diag_thread_name(const char *name)
+{
+    diag_ring_t *r = diag_ring_get();
+
+    if (!r) return;
+    if (atomic_load_explicit(&r->tail, memory_order_acquire) != atomic_load(&r->head)) return;
+    snprintf(r->name, sizeof(r->name), "%s", name);
+}
+
+static void
+diag_put_u64(diag_record_t *rec, uint64_t v)
+{
+    memcpy(rec->data + rec->len, &v, sizeof(v));
+    rec->len += sizeof(v);
+}
+
+/**
+ * diag_vlog()
+ *
+ * Purpose:
+ *   Copies one call's arguments into the calling thread's ring, following
+ *   the site's signature. Never blocks: a full ring drops the record.
+ */
+static void
+diag_vlog(diag_site_t *site, int level, int err, va_list ap)
+{
+    diag_ring_t *r = diag_ring_get();
+    diag_record_t *rec;
+    struct timespec ts;
+    uint64_t head;
+    size_t budget;
+    int64_t star = -1;
+    int nstr = 0;
+
+    if (!r) return;
+
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - r->tail_cache >= DIAG_RING_RECORDS) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - r->tail_cache >= DIAG_RING_RECORDS) {
+            atomic_store_explicit(&r->dropped,
+                                  atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            return;
+        }
+    }
+
+    rec = &r->records[head & (DIAG_RING_RECORDS - 1)];
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    rec->ts_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    rec->site = site;
+    rec->err = err;
+    rec->level = (uint8_t)level;
+    rec->len = 0;
+
+    /* What the fixed size arguments leave goes to the strings */
+    for (int i = 0; i < site->nargs; i++) {
+        if (site->types[i] >> 4 == DIAG_C_STR) nstr++;
+    }
+    budget = sizeof(rec->data) - (size_t)(site->nargs - nstr) * 8 - (size_t)nstr * 2;
+
+    for (int i = 0; i < site->nargs; i++) {
+        int cls = site->types[i] >> 4, len = site->types[i] & 0xf;
+        uint64_t v = 0;
+
+        switch (cls) {
+        case DIAG_C_STAR:
+            star = va_arg(ap, int);
+            v = (uint64_t)star;
+            break;
+        case DIAG_C_INT:
+            switch (len) {
+            case DIAG_L_HH: v = (uint64_t)(int64_t)(signed char)va_arg(ap, int); break;
+            case DIAG_L_H:  v = (uint64_t)(int64_t)(short)va_arg(ap, int); break;
+            case DIAG_L_L:  v = (uint64_t)(int64_t)va_arg(ap, long); break;
+            case DIAG_L_LL: v = (uint64_t)(int64_t)va_arg(ap, long long); break;
+            case DIAG_L_Z:  v = (uint64_t)(int64_t)va_arg(ap, ssize_t); break;
+            case DIAG_L_J:  v = (uint64_t)(int64_t)va_arg(ap, intmax_t); break;
+            case DIAG_L_T:  v = (uint64_t)(int64_t)va_arg(ap, ptrdiff_t); break;
+            default:        v = (uint64_t)(int64_t)va_arg(ap, int); break;
+            }
+            break;
+        case DIAG_C_UINT:
+            switch (len) {
+            case DIAG_L_HH: v = (unsigned char)va_arg(ap, unsigned); break;
+            case DIAG_L_H:  v = (unsigned short)va_arg(ap, unsigned); break;
+            case DIAG_L_L:  v = va_arg(ap, unsigned long); break;
+            case DIAG_L_LL: v = va_arg(ap, unsigned long long); break;
+            case DIAG_L_Z:  v = va_arg(ap, size_t); break;
+            case DIAG_L_J:  v = va_arg(ap, uintmax_t); break;
+            case DIAG_L_T:  v = (uint64_t)va_arg(ap, ptrdiff_t); break;
+            default:        v = va_arg(ap, unsigned); break;
+            }
+            break;
+        case DIAG_C_CHAR:
+            v = (uint64_t)va_arg(ap, int);
+            break;
+        case DIAG_C_DBL: {
+            double d = len == DIAG_L_LD ? (double)va_arg(ap, long double) : va_arg(ap, double);
+            memcpy(&v, &d, sizeof(v));
+            break;
+        }
+        case DIAG_C_PTR:
+            v = (uint64_t)(uintptr_t)va_arg(ap, void *);
+            break;
+        case DIAG_C_STR: {
+            const char *s = va_arg(ap, const char *);
+            size_t max = budget;
+            uint16_t n;
+
+            if (!s) s = "(null)";
+            if (site->prec[i] >= 0 && (size_t)site->prec[i] < max) max = (size_t)site->prec[i];
+            if (site->prec[i] == -2 && star >= 0 && (size_t)star < max) max = (size_t)star;
+            n = (uint16_t)strnlen(s, max);
+            memcpy(rec->data + rec->len, &n, sizeof(n));
+            memcpy(rec->data + rec->len + sizeof(n), s, n);
+            rec->len += (uint16_t)(sizeof(n) + n);
+            budget -= n;
+            continue;
+        }
+        }
+        diag_put_u64(rec, v);
+    }
+
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* diag_vlog() from variadic arguments */
+static void
+diag_vlog_args(diag_site_t *site, int level, int err, ...)
+{
+    va_list ap;
+
+    va_start(ap, err);
+    diag_vlog(site, level, err, ap);
+    va_end(ap);
+}
+
+/* printf style record, see DIAG_LOG() */
+void
+diag_log(diag_site_t *site, const char *fmt, ...)
+{
+    int err = errno;
+    va_list ap;
+
+    if (atomic_load_explicit(&site->state, memory_order_acquire) != 2) {
+        diag_site_parse(site, fmt);
+    }
+    if (site->level > atomic_load_explicit(&diag_level, memory_order_relaxed)) return;
+
+    va_start(ap, fmt);
+    diag_vlog(site, site->level, err, ap);
+    va_end(ap);
+    errno = err;
+}
+
+/* perror() style record; "WARNING..." messages are warnings */
+void
+diag_perror(diag_site_t *site, const char *s)
+{
+    int err = errno;
+    int level = s && !strncmp(s, "WARNING", 7) ? DIAG_WARN : site->level;
+
+    if (level > atomic_load_explicit(&diag_level, memory_order_relaxed)) return;
+    if (atomic_load_explicit(&site->state, memory_order_acquire) != 2) {
+        diag_site_parse(site, "%s: %m");
+    }
+    diag_vlog_args(site, level, err, s ? s : "");
+    errno = err;
+}
+
+/*******************************************************************************
+ *                     DRAIN
+ ******************************************************************************/
+
+static void
+diag_write_all(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(diag_fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;             /* Nowhere to report it */
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static uint64_t
+diag_get_u64(const diag_record_t *rec, size_t *off)
+{
+    uint64_t v = 0;
+
+    if (*off + sizeof(v) <= rec->len) memcpy(&v, rec->data + *off, sizeof(v));
+    *off += sizeof(v);
+    return v;
+}
+
+/* Conversion text, '*' replaced by the recorded values, length set to lmod */
+static void
+diag_spec_text(char *out, size_t len, const diag_spec_t *s, int width, int prec,
+               const char *lmod)
+{
+    int n = snprintf(out, len, "%%%s", s->flags);
+
+    if (width >= 0) n += snprintf(out + n, len - (size_t)n, "%d", width);
+    if (prec >= 0) n += snprintf(out + n, len - (size_t)n, ".%d", prec);
+    snprintf(out + n, len - (size_t)n, "%s%c", lmod, s->conv == 'm' ? 's' : s->conv);
+}
+
+/**
+ * diag_format_message()
+ *
+ * Purpose:
+ *   Formats a record's message: its site's format, each conversion run by
+ *   snprintf() on the recorded value.
+ *
+ * @return Length written to out (truncated to len - 1)
+ */
+static size_t
+diag_format_message(const diag_record_t *rec, char *out, size_t len)
+{
+    const diag_site_t *site = rec->site;
+    const char *p = site->fmt;
+    size_t pos = 0, off = 0;
+    char spec_text[48], errbuf[128];
+    diag_spec_t spec;
+
+    if (site->raw) {
+        snprintf(out, len, "%s", site->fmt);
+        return strlen(out);
+    }
+
+    while (*p && pos < len - 1) {
+        int width, prec, n = 0;
+
+        if (*p != '%' || p[1] == '%') {
+            out[pos++] = *p;
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+        diag_spec_parse(p + 1, &spec);
+        p += 1 + spec.consumed;
+
+        width = spec.width_star ? (int)diag_get_u64(rec, &off) : spec.width;
+        prec = spec.prec_star ? (int)diag_get_u64(rec, &off) : spec.prec;
+
+        switch (diag_conv_class(spec.conv)) {
+        case DIAG_C_INT:
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, prec, "ll");
+            n = snprintf(out + pos, len - pos, spec_text, (long long)diag_get_u64(rec, &off));
+            break;
+        case DIAG_C_UINT:
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, prec, "ll");
+            n = snprintf(out + pos, len - pos, spec_text,
+                         (unsigned long long)diag_get_u64(rec, &off));
+            break;
+        case DIAG_C_CHAR:
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, prec, "");
+            n = snprintf(out + pos, len - pos, spec_text, (int)diag_get_u64(rec, &off));
+            break;
+        case DIAG_C_PTR:
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, prec, "");
+            n = snprintf(out + pos, len - pos, spec_text,
+                         (void *)(uintptr_t)diag_get_u64(rec, &off));
+            break;
+        case DIAG_C_DBL: {
+            uint64_t v = diag_get_u64(rec, &off);
+            double d;
+
+            memcpy(&d, &v, sizeof(d));
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, prec, "");
+            n = snprintf(out + pos, len - pos, spec_text, d);
+            break;
+        }
+        case DIAG_C_STR: {
+            uint16_t slen = 0;
+
+            if (off + sizeof(slen) <= rec->len) memcpy(&slen, rec->data + off, sizeof(slen));
+            off += sizeof(slen);
+            /* Not NUL terminated: the copied length is the precision */
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, slen, "");
+            n = snprintf(out + pos, len - pos, spec_text,
+                         off + slen <= rec->len ? (const char *)rec->data + off : "");
+            off += slen;
+            break;
+        }
+        default:                /* %m */
+            diag_spec_text(spec_text, sizeof(spec_text), &spec, width, prec, "");
+            n = snprintf(out + pos, len - pos, spec_text,
+                         strerror_r(rec->err, errbuf, sizeof(errbuf)));
+            break;
+        }
+        if (n < 0) break;
+        pos += (size_t)n;
+        if (pos > len - 1) pos = len - 1;
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+/* Line prefix, the date part cached per second */
+static size_t
+diag_format_prefix(char *out, size_t len, int64_t ts_ns, int level, const char *thread)
+{
+    static time_t cached_sec = -1;
+    static char cached[24];
+    time_t sec = (time_t)(ts_ns / 1000000000LL);
+
+    if (sec != cached_sec) {
+        struct tm tm;
+
+        localtime_r(&sec, &tm);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+    return (size_t)snprintf(out, len, "[%s.%03d] [%s] [%s] ", cached,
+                            (int)(ts_ns / 1000000 % 1000), level_names[level], thread);
+}
+
+/* Appends one line to the output buffer, writing it out first if full */
+static void
+diag_emit(char *buf, size_t *used, int64_t ts_ns, int level, const char *thread,
+          const char *msg, size_t msg_len)
+{
+    char prefix[DIAG_THREAD_NAME_LEN + 64];
+    size_t plen = diag_format_prefix(prefix, sizeof(prefix), ts_ns, level, thread);
+
+    if (plen >= sizeof(prefix)) plen = sizeof(prefix) - 1;
+    if (*used + plen + msg_len + 1 > DIAG_OUT_LEN) {
+        diag_write_all(buf, *used);
+        *used = 0;
+    }
+    memcpy(buf + *used, prefix, plen);
+    memcpy(buf + *used + plen, msg, msg_len);
+    buf[*used + plen + msg_len] = '\n';
+    *used += plen + msg_len + 1;
+}
+
+/* One record as a line, nothing for an empty message */
+static void
+diag_emit_record(char *buf, size_t *used, const diag_ring_t *r, const diag_record_t *rec)
+{
+    char msg[DIAG_MSG_LEN];
+    size_t len = diag_format_message(rec, msg, sizeof(msg));
+    const char *m = msg;
+
+    while (len > 0 && *m == '\n') {
+        m++;
+        len--;
+    }
+    while (len > 0 && (m[len - 1] == '\n' || m[len - 1] == ' ')) len--;
+    if (len == 0) return;
+
+    diag_emit(buf, used, rec->ts_ns, rec->level, r->name, m, len);
+}
+
+/* Reports records a ring dropped since the last pass */
+static void
+diag_report_dropped(char *buf, size_t *used, diag_ring_t *r)
+{
+    uint64_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    char msg[96];
+    struct timespec ts;
+    int n;
+
+    if (dropped == r->dropped_reported) return;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    n = snprintf(msg, sizeof(msg), "%llu diagnostic records dropped, ring full",
+                 (unsigned long long)(dropped - r->dropped_reported));
+    diag_emit(buf, used, (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec, DIAG_WARN,
+              r->name, msg, (size_t)n);
+    r->dropped_reported = dropped;
+}
+
+/**
+ * diag_drain_locked()
+ *
+ * Purpose:
+ *   Formats and writes out every record published so far, the rings of a
+ *   pass merged by timestamp. Caller holds drain_lock.
+ */
+static void
+diag_drain_locked(void)
+{
+    static char buf[DIAG_OUT_LEN];
+    diag_cursor_t cur[DIAG_MERGE_MAX];
+    diag_ring_t *r = atomic_load_explicit(&diag_rings, memory_order_acquire);
+    size_t used = 0;
+
+    while (r) {
+        diag_ring_t *first = r;
+        int nrings = 0;
+
+        for (; r && nrings < DIAG_MERGE_MAX; r = r->next) {
+            cur[nrings].ring = r;
+            cur[nrings].tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            cur[nrings].head = atomic_load_explicit(&r->head, memory_order_acquire);
+            if (cur[nrings].tail != cur[nrings].head) nrings++;
+        }
+
+        while (nrings > 0) {
+            int best = 0;
+            const diag_record_t *rec;
+
+            for (int i = 1; i < nrings; i++) {
+                const diag_ring_t *ri = cur[i].ring, *rb = cur[best].ring;
+
+                if (ri->records[cur[i].tail & (DIAG_RING_RECORDS - 1)].ts_ns <
+                    rb->records[cur[best].tail & (DIAG_RING_RECORDS - 1)].ts_ns) {
+                    best = i;
+                }
+            }
+
+            rec = &cur[best].ring->records[cur[best].tail & (DIAG_RING_RECORDS - 1)];
+            diag_emit_record(buf, &used, cur[best].ring, rec);
+            cur[best].tail++;
+            atomic_store_explicit(&cur[best].ring->tail, cur[best].tail, memory_order_release);
+
+            if (cur[best].tail == cur[best].head) cur[best] = cur[--nrings];
+        }
+
+        /* Losses after the records that made it */
+        for (diag_ring_t *d = first; d != r; d = d->next) {
+            diag_report_dropped(buf, &used, d);
+        }
+    }
+    if (used > 0) diag_write_all(buf, used);
+}
+
+/* Writes out everything recorded so far, from any thread (also atexit) */
+void
+diag_flush(void)
+{
+    pthread_mutex_lock(&drain_lock);
+    diag_drain_locked();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+static void *
+diag_drain_thread_fn(void *arg)
+{
+    const struct timespec period = { 0, DIAG_DRAIN_MS * 1000000L };
+
+    (void)arg;
+    diag_thread_name("diag drain");
+
+    while (!atomic_load(&drain_stop)) {
+        diag_flush();
+        nanosleep(&period, NULL);
+    }
+    diag_flush();
+    return NULL;
+}
+
+/*******************************************************************************
+ *                     CONTROL
+ ******************************************************************************/
+
+/**
+ * diag_init()
+ *
+ * Purpose:
+ *   Starts the drain thread, writing to fd (usually STDERR_FILENO). Also
+ *   flushes at exit(), so the messages of a fatal error get out.
+ *
+ * @return 0 on success, -1 if the drain thread could not be created
+ *         (records are then written by diag_flush() only)
+ */
+int
+diag_init(int fd)
+{
+    if (drain_running) return 0;
+
+    diag_fd = fd;
+    if (!diag_atexit_set && atexit(diag_flush) == 0) diag_atexit_set = true;
+
+    atomic_store(&drain_stop, false);
+    if (pthread_create(&drain_thread, NULL, diag_drain_thread_fn, NULL) != 0) return -1;
+    drain_running = true;
+    return 0;
+}
+
+/* Stops the drain thread once everything recorded is written out */
+void
+diag_shutdown(void)
+{
+    if (!drain_running) return;
+
+    atomic_store(&drain_stop, true);
+    pthread_join(drain_thread, NULL);
+    drain_running = false;
+}
+
+void
+diag_set_level(int level)
+{
+    if (level < DIAG_OFF) level = DIAG_OFF;
+    if (level > DIAG_DEBUG) level = DIAG_DEBUG;
+    atomic_store_explicit(&diag_level, level, memory_order_relaxed);
+}
+
+/* "off", "error", "warn" (or "warning"), "info", "debug"; -1 if none */
+int
+diag_level_from_name(const char *name)
+{
+    if (!strcasecmp(name, "warning")) return DIAG_WARN;
+    for (int i = DIAG_OFF; i <= DIAG_DEBUG; i++) {
+        if (!strcasecmp(name, level_names[i])) return i;
+    }
+    return -1;
+}
+
+/* Records dropped to full rings so far, all threads */
+uint64_t
+diag_dropped(void)
+{
+    uint64_t total = 0;
+
+    for (diag_ring_t *r = atomic_load(&diag_rings); r; r = r->next) {
+        total += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    }
+    return total;
+}
@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * File: ipmgr_diag.h
+ *
+ * Description:
+ *   Asynchronous diagnostic logger of ipmgr_log_rotator. A call site does
+ *   not format anything: it copies its arguments, as binary values, into
+ *   a ring of the calling thread and returns. A drain thread formats the
+ *   records later and writes them out in large write()s. The calling
+ *   thread never locks, blocks or makes a syscall (past its first record,
+ *   which allocates its ring); when its ring is full the record is dropped
+ *   and counted, and the drain reports the loss.
+ *
+ *   Records below the runtime level (diag_set_level(), config key
+ *   diag_level) cost a load and a compare.
+ *
+ * Records:
+ *   The format string is the record's format id: each call site has a
+ *   static diag_site_t, whose format is parsed once into the argument
+ *   types it takes. A record holds the site, a timestamp, errno, and the
+ *   arguments as 64-bit words, strings copied in (and truncated to fit
+ *   DIAG_RECORD_LEN). printf conversions are supported, plus %m (errno
+ *   at the call); %n and long double are not.
+ *
+ * Output:
+ *   [YYYY-MM-DD HH:MM:SS.mmm] [LEVEL] [thread] message
+ *
+ *   Leading and trailing newlines of the message are dropped, so printf
+ *   style decorated messages come out as one line each.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_DIAG_H
+#define IPMGR_DIAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Levels, a record passes when its level <= the runtime level */
+#define DIAG_OFF                0
+#define DIAG_ERROR              1
+#define DIAG_WARN               2
+#define DIAG_INFO               3
+#define DIAG_DEBUG              4
+
+#define DIAG_MAX_ARGS           16
+#define DIAG_RECORD_LEN         512     /* Ring slot, header included */
+#define DIAG_RING_RECORDS       512     /* Per thread, power of two */
+#define DIAG_THREAD_NAME_LEN    32
+
+/* Call site: format id and its argument signature, parsed once */
+typedef struct diag_site_ {
+    int level;                  /* From the macro, WARN if fmt starts "WARNING" */
+    _Atomic int state;          /* 0 unparsed, 1 parsing, 2 ready */
+    const char *fmt;
+    bool raw;                   /* Unsupported format: printed as is, no arguments */
+    uint8_t nargs;
+    uint8_t types[DIAG_MAX_ARGS];   /* Class and length of each, ipmgr_diag.c */
+    int16_t prec[DIAG_MAX_ARGS];    /* %s precision: -1 none, -2 from the '*' before */
+} diag_site_t;
+
+extern _Atomic int diag_level;
+
+/**
+ * DIAG_LOG()
+ *
+ * printf style record at a level: DIAG_LOG(DIAG_WARN, "x %s: %d\n", s, n).
+ * The format must be a string literal.
+ */
+#define DIAG_LOG(lvl, ...) do {                                         \
+        static diag_site_t diag_site_ = { .level = (lvl) };             \
+        diag_log(&diag_site_, __VA_ARGS__);                             \
+    } while (0)
+
+/* perror() replacement: "s: strerror(errno)" */
+#define DIAG_PERROR(s) do {                                             \
+        static diag_site_t diag_site_ = { .level = DIAG_ERROR };        \
+        diag_perror(&diag_site_, (s));                                  \
+    } while (0)
+
+int
+diag_init(int fd);
+
+void
+diag_shutdown(void);
+
+void
+diag_flush(void);
+
+void
+diag_set_level(int level);
+
+int
+diag_level_from_name(const char *name);
+
+void
+diag_thread_name(const char *name);
+
+uint64_t
+diag_dropped(void);
+
+void
+diag_log(diag_site_t *site, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void
+diag_perror(diag_site_t *site, const char *s);
+
+#endif /* IPMGR_DIAG_H */
@@ -0,0 +1,618 @@
+/*******************************************************************************
+ * File: ipmgr_log_client.c
+ *
+ * Description:
+ *   Multi-producer logging frontend, see ipmgr_log_client.h.
+ *
+ *   A ring holds raw line bytes back to back, no per line header: head
+ *   (producer) and tail (flusher) are byte counts that only grow, and the
+ *   head always sits on a line end. A line may run across the end of the
+ *   ring buffer; the flusher joins the two pieces in its staging buffer
+ *   so the writer only ever sees whole lines.
+ *
+ *   Rings of a client are linked into a list that only grows, like the
+ *   rings of ipmgr_diag.c. A thread keeps the rings of the files it logs
+ *   into in thread local slots; the slots are released (the rings marked
+ *   orphan) when the thread exits, for clients still open: clients_lock
+ *   and the list of open clients keep that from touching a closed one.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/* Threading Headers */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "ipmgr_log_client.h"
+
+#define CLIENT_RING_ACTIVE      0
+#define CLIENT_RING_ORPHAN      1       /* Thread gone, ring free once drained */
+#define CLIENT_RING_CLAIMED     2       /* Being taken over */
+
+typedef struct client_ring_ {
+    /* Producer side */
+    _Alignas(64) _Atomic uint64_t head;
+    uint64_t tail_cache;        /* Last tail seen by the producer */
+    bool reserved_scratch;      /* Open reservation runs across the end */
+    _Atomic uint64_t lines;     /* Producer only, relaxed stores */
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t full_waits;
+
+    /* Consumer side */
+    _Alignas(64) _Atomic uint64_t tail;
+
+    _Alignas(64) _Atomic int state;
+    struct client_ring_ *next;
+    size_t len;                 /* Power of two */
+    char *data;
+    char *scratch;              /* LOG_CLIENT_LINE_MAX + 1, reservations across the end */
+} client_ring_t;
+
+struct log_client_ {
+    uint64_t id;                /* Never reused, unlike the address */
+    log_client_params_t params;
+    log_writer_t writer;        /* Flusher's */
+    pthread_t flusher;
+    bool flusher_running;
+    _Atomic bool stop;
+    _Atomic(client_ring_t *) rings;
+    _Atomic unsigned nrings;
+    char *staging;              /* Line across the ring end, ring_len bytes */
+
+    /* Published by the flusher after each pass */
+    _Atomic uint64_t writes;
+    _Atomic uint64_t baks;
+    _Atomic uint64_t write_errors;
+
+    struct log_client_ *open_next;  /* clients_lock */
+};
+
+/* Rings of the calling thread, one per file it logs into */
+typedef struct client_tls_ {
+    struct {
+        log_client_t *client;
+        uint64_t id;
+        client_ring_t *ring;
+    } files[LOG_CLIENT_THREAD_FILES];
+    unsigned last;              /* Slot of the last lookup */
+    client_ring_t *reserved;    /* Ring of the open reservation */
+} client_tls_t;
+
+static __thread client_tls_t *client_tls;
+static pthread_key_t client_key;
+static pthread_once_t client_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_client_t *open_clients;
+static _Atomic uint64_t next_client_id = 1;
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+/* Single writer counter update */
+static inline void
+counter_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+/* true if c is open and still the client id was given by; clients_lock held */
+static bool
+client_is_open(const log_client_t *c, uint64_t id)
+{
+    for (const log_client_t *o = open_clients; o; o = o->open_next) {
+        if (o == c) return o->id == id;
+    }
+    return false;
+}
+
+/* Gives a thread's slot up: its ring goes orphan if the client is open */
+static void
+client_slot_release(client_tls_t *t, unsigned slot)
+{
+    if (!t->files[slot].client) return;
+
+    pthread_mutex_lock(&clients_lock);
+    if (client_is_open(t->files[slot].client, t->files[slot].id)) {
+        atomic_store_explicit(&t->files[slot].ring->state, CLIENT_RING_ORPHAN,
+                              memory_order_release);
+    }
+    pthread_mutex_unlock(&clients_lock);
+    t->files[slot].client = NULL;
+}
+
+/* Thread exit */
+static void
+client_tls_destroy(void *arg)
+{
+    client_tls_t *t = arg;
+
+    for (unsigned i = 0; i < LOG_CLIENT_THREAD_FILES; i++) client_slot_release(t, i);
+    free(t);
+}
+
+static void
+client_key_create(void)
+{
+    pthread_key_create(&client_key, client_tls_destroy);
+}
+
+static void
+client_ring_free(client_ring_t *r)
+{
+    free(r->data);
+    free(r->scratch);
+    free(r);
+}
+
+/**
+ * client_ring_attach()
+ *
+ * Purpose:
+ *   Ring of the calling thread for a client, taken over from an exited
+ *   thread or allocated, in a free (or the least recently assigned)
+ *   thread local slot.
+ *
+ * @return The ring, NULL with errno set if none could be allocated
+ */
+static client_ring_t *
+client_ring_attach(log_client_t *c)
+{
+    client_tls_t *t = client_tls;
+    client_ring_t *r;
+    unsigned slot;
+
+    if (!t) {
+        pthread_once(&client_key_once, client_key_create);
+        t = calloc(1, sizeof(*t));
+        if (!t) return NULL;
+        pthread_setspecific(client_key, t);
+        client_tls = t;
+    }
+
+    for (slot = 0; slot < LOG_CLIENT_THREAD_FILES && t->files[slot].client; slot++) {
+    }
+    if (slot == LOG_CLIENT_THREAD_FILES) {
+        slot = (t->last + 1) % LOG_CLIENT_THREAD_FILES;
+        client_slot_release(t, slot);
+    }
+
+    for (r = atomic_load_explicit(&c->rings, memory_order_acquire); r; r = r->next) {
+        int expected = CLIENT_RING_ORPHAN;
+
+        if (atomic_load(&r->state) != CLIENT_RING_ORPHAN ||
+            !atomic_compare_exchange_strong(&r->state, &expected, CLIENT_RING_CLAIMED)) {
+            continue;
+        }
+        break;
+    }
+
+    if (!r) {
+        r = aligned_alloc(64, sizeof(*r));
+        if (!r) return NULL;
+        memset(r, 0, sizeof(*r));
+        r->len = c->params.ring_len;
+        r->data = malloc(r->len);
+        r->scratch = malloc(LOG_CLIENT_LINE_MAX + 1);
+        if (!r->data || !r->scratch) {
+            client_ring_free(r);
+            errno = ENOMEM;
+            return NULL;
+        }
+        r->next = atomic_load(&c->rings);
+        while (!atomic_compare_exchange_weak(&c->rings, &r->next, r)) {
+        }
+        atomic_fetch_add(&c->nrings, 1);
+    }
+
+    /* Left over lines of the previous owner are still drained in order */
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    atomic_store_explicit(&r->state, CLIENT_RING_ACTIVE, memory_order_release);
+
+    t->files[slot].client = c;
+    t->files[slot].id = c->id;
+    t->files[slot].ring = r;
+    t->last = slot;
+    return r;
+}
+
+/* Ring of the calling thread for c */
+static inline client_ring_t *
+client_ring_get(log_client_t *c)
+{
+    client_tls_t *t = client_tls;
+
+    if (t) {
+        if (t->files[t->last].client == c && t->files[t->last].id == c->id) {
+            return t->files[t->last].ring;
+        }
+        for (unsigned i = 0; i < LOG_CLIENT_THREAD_FILES; i++) {
+            if (t->files[i].client == c && t->files[i].id == c->id) {
+                t->last = i;
+                return t->files[i].ring;
+            }
+        }
+    }
+    return client_ring_attach(c);
+}
+
+/**
+ * ring_room()
+ *
+ * Purpose:
+ *   Waits for need free bytes in the calling thread's ring: rereads the
+ *   flusher's tail only when the cached one says full, then yields until
+ *   the flusher made room, or fails with drop_when_full.
+ *
+ * @return 0 once there is room, -1 (EAGAIN) for a dropped line
+ */
+static int
+ring_room(log_client_t *c, client_ring_t *r, uint64_t head, size_t need)
+{
+    bool waited = false;
+
+    while (head + need - r->tail_cache > r->len) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head + need - r->tail_cache <= r->len) break;
+
+        if (c->params.drop_when_full) {
+            counter_add(&r->dropped, 1);
+            errno = EAGAIN;
+            return -1;
+        }
+        if (!waited) counter_add(&r->full_waits, 1);
+        waited = true;
+        sched_yield();
+    }
+    return 0;
+}
+
+/* Copies bytes in at a ring position, across the end if need be */
+static void
+ring_copy_in(client_ring_t *r, uint64_t pos, const char *src, size_t len)
+{
+    size_t off = (size_t)(pos & (r->len - 1));
+    size_t first = len < r->len - off ? len : r->len - off;
+
+    memcpy(r->data + off, src, first);
+    if (len > first) memcpy(r->data, src + first, len - first);
+}
+
+/* Makes [head, head + len) visible to the flusher */
+static inline void
+ring_publish(client_ring_t *r, uint64_t head, size_t len)
+{
+    counter_add(&r->lines, 1);
+    counter_add(&r->bytes, len);
+    atomic_store_explicit(&r->head, head + len, memory_order_release);
+}
+
+/*******************************************************************************
+ *                     FLUSHER
+ ******************************************************************************/
+
+/* Hands the writer whole lines; a write error loses them, counted */
+static void
+flusher_append(log_client_t *c, const char *data, size_t len)
+{
+    if (len && log_writer_append_block(&c->writer, data, len) < 0) {
+        counter_add(&c->write_errors, 1);
+    }
+}
+
+/**
+ * flusher_drain()
+ *
+ * Purpose:
+ *   Moves everything a ring holds to the writer. A line running across
+ *   the end of the ring buffer is joined in the staging buffer first.
+ *
+ * @return Bytes moved
+ */
+static size_t
+flusher_drain(log_client_t *c, client_ring_t *r)
+{
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t n = (size_t)(head - tail), off, first;
+
+    if (n == 0) return 0;
+    off = (size_t)(tail & (r->len - 1));
+    first = n < r->len - off ? n : r->len - off;
+
+    if (first == n) {
+        flusher_append(c, r->data + off, n);
+    } else {
+        const char *nl = memrchr(r->data + off, '\n', first);
+        size_t whole = nl ? (size_t)(nl - (r->data + off)) + 1 : 0;
+        size_t part = first - whole;
+        const char *nl2 = memchr(r->data, '\n', n - first);
+        size_t rest = (size_t)(nl2 - r->data) + 1;     /* head is on a line end */
+
+        flusher_append(c, r->data + off, whole);
+        memcpy(c->staging, r->data + off + whole, part);
+        memcpy(c->staging + part, r->data, rest);
+        flusher_append(c, c->staging, part + rest);
+        flusher_append(c, r->data + rest, n - first - rest);
+    }
+
+    atomic_store_explicit(&r->tail, head, memory_order_release);
+    return n;
+}
+
+/**
+ * client_flusher_fn()
+ *
+ * Purpose:
+ *   Drains the rings of a client until it is closed, sleeping poll_us
+ *   whenever a pass found them all empty. The stop flag is read before a
+ *   pass, so the last pass sees every line committed before the close.
+ */
+static void *
+client_flusher_fn(void *arg)
+{
+    log_client_t *c = arg;
+    struct timespec idle = {
+        .tv_sec = c->params.poll_us / 1000000,
+        .tv_nsec = (long)(c->params.poll_us % 1000000) * 1000,
+    };
+
+    while (1) {
+        bool stopping = atomic_load_explicit(&c->stop, memory_order_acquire);
+        size_t moved = 0;
+
+        for (client_ring_t *r = atomic_load_explicit(&c->rings, memory_order_acquire); r;
+             r = r->next) {
+            moved += flusher_drain(c, r);
+        }
+        if (moved == 0) {
+            if (stopping) break;
+            if (log_writer_poll(&c->writer) < 0) counter_add(&c->write_errors, 1);
+        }
+
+        atomic_store_explicit(&c->writes, c->writer.stats.writes, memory_order_relaxed);
+        atomic_store_explicit(&c->baks, c->writer.stats.baks, memory_order_relaxed);
+        if (moved == 0) nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ *                     PUBLIC FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * log_client_open()
+ *
+ * Purpose:
+ *   Opens <dir>/<name>.log for any number of producer threads and starts
+ *   its flusher. One client per file: two would seal each other's files.
+ *
+ * @param params  NULL or 0 fields for the defaults
+ * @return The client, NULL with errno set
+ */
+log_client_t *
+log_client_open(const char *dir, const char *name, const log_client_params_t *params)
+{
+    log_client_t *c = calloc(1, sizeof(*c));
+    int err;
+
+    if (!c) return NULL;
+    if (params) c->params = *params;
+    if (!c->params.ring_len) c->params.ring_len = LOG_CLIENT_DEFAULT_RING;
+    if (!c->params.poll_us) c->params.poll_us = LOG_CLIENT_DEFAULT_POLL_US;
+    if ((c->params.ring_len & (c->params.ring_len - 1)) != 0 ||
+        c->params.ring_len <= LOG_CLIENT_LINE_MAX) {
+        free(c);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    c->staging = malloc(c->params.ring_len);
+    if (!c->staging) {
+        free(c);
+        return NULL;
+    }
+    if (log_writer_open(&c->writer, dir, name, &c->params.writer) < 0) {
+        err = errno;
+        free(c->staging);
+        free(c);
+        errno = err;
+        return NULL;
+    }
+    c->id = atomic_fetch_add(&next_client_id, 1);
+
+    pthread_mutex_lock(&clients_lock);
+    c->open_next = open_clients;
+    open_clients = c;
+    pthread_mutex_unlock(&clients_lock);
+
+    if ((err = pthread_create(&c->flusher, NULL, client_flusher_fn, c)) != 0) {
+        log_client_close(c, false);
+        errno = err;
+        return NULL;
+    }
+    c->flusher_running = true;
+    return c;
+}
+
+/**
+ * log_client_close()
+ *
+ * Purpose:
+ *   Writes out every line committed so far, stops the flusher and frees
+ *   the client. No thread may log into it any more.
+ *
+ * @param seal  Also seal the last file as a .bak
+ * @return 0 on success, -1 with errno set if lines were lost to write
+ *         errors
+ */
+int
+log_client_close(log_client_t *c, bool seal)
+{
+    client_ring_t *r;
+    int rc;
+
+    if (c->flusher_running) {
+        atomic_store_explicit(&c->stop, true, memory_order_release);
+        pthread_join(c->flusher, NULL);
+    }
+    rc = log_writer_close(&c->writer, seal);
+    if (rc == 0 && atomic_load(&c->write_errors)) {
+        errno = EIO;
+        rc = -1;
+    }
+
+    /* Exiting threads no longer touch its rings */
+    pthread_mutex_lock(&clients_lock);
+    for (log_client_t **p = &open_clients; *p; p = &(*p)->open_next) {
+        if (*p == c) {
+            *p = c->open_next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+
+    r = atomic_load(&c->rings);
+    while (r) {
+        client_ring_t *next = r->next;
+
+        client_ring_free(r);
+        r = next;
+    }
+    free(c->staging);
+    free(c);
+    return rc;
+}
+
+/**
+ * log_client_reserve()
+ *
+ * Purpose:
+ *   Room for a line of up to max_len bytes (<= LOG_CLIENT_LINE_MAX), to
+ *   be formatted in place and published by log_client_commit(). Nothing
+ *   else may be logged to c by the thread in between.
+ *
+ * @return Where to write the line, NULL with errno set (EAGAIN: dropped,
+ *         the ring is full)
+ */
+char *
+log_client_reserve(log_client_t *c, size_t max_len)
+{
+    client_ring_t *r = client_ring_get(c);
+    uint64_t head;
+    size_t off;
+
+    if (!r) return NULL;
+    if (max_len > LOG_CLIENT_LINE_MAX) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    /* One more for the newline commit may add */
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (ring_room(c, r, head, max_len + 1) < 0) return NULL;
+
+    client_tls->reserved = r;
+    off = (size_t)(head & (r->len - 1));
+    r->reserved_scratch = off + max_len + 1 > r->len;
+    return r->reserved_scratch ? r->scratch : r->data + off;
+}
+
+/* Publishes len bytes of the reservation, adding the newline if missing */
+void
+log_client_commit(log_client_t *c, size_t len)
+{
+    client_ring_t *r = client_tls->reserved;
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    char *p = r->reserved_scratch ? r->scratch : r->data + (head & (r->len - 1));
+
+    (void)c;
+    client_tls->reserved = NULL;
+    if (len == 0) return;
+    if (p[len - 1] != '\n') p[len++] = '\n';
+    if (r->reserved_scratch) ring_copy_in(r, head, r->scratch, len);
+    ring_publish(r, head, len);
+}
+
+/**
+ * log_client_write()
+ *
+ * Purpose:
+ *   Logs one line, newline added if missing. Lines up to the ring size
+ *   are taken, whatever LOG_CLIENT_LINE_MAX is.
+ *
+ * @return 0 on success, -1 with errno set (EAGAIN: dropped, EMSGSIZE:
+ *         longer than a ring)
+ */
+int
+log_client_write(log_client_t *c, const char *line, size_t len)
+{
+    client_ring_t *r = client_ring_get(c);
+    bool add_nl = len == 0 || line[len - 1] != '\n';
+    size_t need = len + add_nl;
+    uint64_t head;
+
+    if (!r) return -1;
+    if (need > r->len) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (ring_room(c, r, head, need) < 0) return -1;
+
+    ring_copy_in(r, head, line, len);
+    if (add_nl) ring_copy_in(r, head + len, "\n", 1);
+    ring_publish(r, head, need);
+    return 0;
+}
+
+/* printf style line, truncated to LOG_CLIENT_LINE_MAX - 1 bytes */
+int
+log_client_printf(log_client_t *c, const char *fmt, ...)
+{
+    char *p = log_client_reserve(c, LOG_CLIENT_LINE_MAX);
+    va_list ap;
+    int n;
+
+    if (!p) return -1;
+    va_start(ap, fmt);
+    n = vsnprintf(p, LOG_CLIENT_LINE_MAX, fmt, ap);
+    va_end(ap);
+    if (n < 0) n = 0;
+    if (n >= LOG_CLIENT_LINE_MAX) n = LOG_CLIENT_LINE_MAX - 1;
+    log_client_commit(c, (size_t)n);
+    return 0;
+}
+
+/* Counters summed over the rings; each is read atomically, not all at once */
+void
+log_client_get_stats(log_client_t *c, log_client_stats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    for (client_ring_t *r = atomic_load_explicit(&c->rings, memory_order_acquire); r;
+         r = r->next) {
+        st->lines += atomic_load_explicit(&r->lines, memory_order_relaxed);
+        st->bytes += atomic_load_explicit(&r->bytes, memory_order_relaxed);
+        st->dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        st->full_waits += atomic_load_explicit(&r->full_waits, memory_order_relaxed);
+    }
+    st->writes = atomic_load_explicit(&c->writes, memory_order_relaxed);
+    st->baks = atomic_load_explicit(&c->baks, memory_order_relaxed);
+    st->rings = atomic_load(&c->nrings);
+}
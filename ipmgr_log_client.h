@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * File: ipmgr_log_client.h
+ *
+ * Description:
+ *   Multi-producer logging frontend for files managed by ipmgr_log_rotator:
+ *   any number of threads log lines into one file. Each producer thread
+ *   gets a lock-free single producer / single consumer byte ring of its
+ *   own for the file; one flusher thread per file drains every ring into
+ *   an ipmgr_log_writer.h writer, which batches the write()s and seals the
+ *   file as <name>.<ts>.bak for the rotator.
+ *
+ *   A producer copies its line into its ring and publishes it with one
+ *   release store: no lock, no syscall, no shared cache line with other
+ *   producers. The flusher is never woken, it polls the rings (poll_us
+ *   when they were all empty).
+ *
+ *   Lines of one thread reach the file in order. Lines of different
+ *   threads are interleaved in ring drain order, so timestamps may step
+ *   back by up to one drain pass across threads.
+ *
+ *   A full ring (the flusher or the disk falling behind) makes the
+ *   producer yield until there is room, or with drop_when_full lose the
+ *   line (counted) so a producer never waits.
+ *
+ *   Rings of exited threads are taken over by new ones once drained, as
+ *   in ipmgr_diag.c.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_LOG_CLIENT_H
+#define IPMGR_LOG_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ipmgr_log_writer.h"
+
+#define LOG_CLIENT_LINE_MAX             4096        /* log_client_printf() line */
+#define LOG_CLIENT_THREAD_FILES         8           /* Files a thread logs into at once */
+
+/* Defaults of log_client_params_t fields left 0 */
+#define LOG_CLIENT_DEFAULT_RING         (256 * 1024)
+#define LOG_CLIENT_DEFAULT_POLL_US      500
+
+typedef struct log_client_params_ {
+    log_writer_params_t writer;     /* Rotation size, batch, flush latency */
+    size_t ring_len;                /* Bytes per producer ring, a power of two */
+    uint32_t poll_us;               /* Flusher sleep with every ring empty */
+    bool drop_when_full;            /* Full ring: lose the line, never wait */
+} log_client_params_t;
+
+typedef struct log_client_stats_ {
+    uint64_t lines;                 /* Committed by producers */
+    uint64_t bytes;
+    uint64_t dropped;               /* Lost to a full ring (drop_when_full) */
+    uint64_t full_waits;            /* Producer yields for room */
+    uint64_t writes;                /* Flusher write() / writev() calls */
+    uint64_t baks;                  /* Files sealed */
+    unsigned rings;
+} log_client_stats_t;
+
+typedef struct log_client_ log_client_t;
+
+log_client_t *
+log_client_open(const char *dir, const char *name, const log_client_params_t *params);
+
+int
+log_client_close(log_client_t *c, bool seal);
+
+char *
+log_client_reserve(log_client_t *c, size_t max_len);
+
+void
+log_client_commit(log_client_t *c, size_t len);
+
+int
+log_client_write(log_client_t *c, const char *line, size_t len);
+
+int
+log_client_printf(log_client_t *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void
+log_client_get_stats(log_client_t *c, log_client_stats_t *st);
+
+#endif /* IPMGR_LOG_CLIENT_H */
@@ -0,0 +1,711 @@
+/*******************************************************************************
+ * File: ipmgr_log_config.c
+ *
+ * Description:
+ *   Configuration file parser and log type name matcher of
+ *   ipmgr_log_rotator. See ipmgr_log_config.h for the file format.
+ *
+ *   Everything here works on a private log_config_t being built; nothing
+ *   touches rotator state, so a reload can run on any thread while the
+ *   rotator keeps using the previous snapshot.
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "ipmgr_archive.h"
+#include "ipmgr_diag.h"
+#include "ipmgr_log_config.h"
+
+/* Matcher build: keys per first level bucket, and search bounds */
+#define MATCH_KEYS_PER_BUCKET   4
+#define MATCH_MAX_SEEDS         64
+#define MATCH_MAX_DISP          (1u << 16)
+
+/* Longest accepted configuration line */
+#define CONFIG_LINE_LEN         512
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static size_t
+round_up_pow2(size_t v)
+{
+    size_t p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+/* Strips leading and trailing white space in place */
+static char *
+trim(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s)) s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+static int
+parse_bool(const char *value, bool *out)
+{
+    if (!strcasecmp(value, "yes") || !strcasecmp(value, "true") ||
+        !strcasecmp(value, "on") || !strcmp(value, "1")) {
+        *out = true;
+        return 0;
+    }
+    if (!strcasecmp(value, "no") || !strcasecmp(value, "false") ||
+        !strcasecmp(value, "off") || !strcmp(value, "0")) {
+        *out = false;
+        return 0;
+    }
+    return -1;
+}
+
+static int
+parse_int(const char *value, int min, int max, int *out)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(value, &end, 10);
+    if (errno || end == value || *end != '\0' || v < min || v > max) {
+        return -1;
+    }
+    *out = (int)v;
+    return 0;
+}
+
+/* Number with an optional unit suffix, e.g. "64M" or "12h" */
+static int
+parse_scaled(const char *value, const char *units, const uint64_t *scale,
+             uint64_t max, uint64_t *out)
+{
+    char *end;
+    unsigned long long v;
+    uint64_t mult = 1;
+    const char *u;
+
+    errno = 0;
+    v = strtoull(value, &end, 10);
+    if (errno || end == value || value[0] == '-') return -1;
+
+    if (*end != '\0') {
+        u = strchr(units, toupper((unsigned char)*end));
+        if (!u || end[1] != '\0') return -1;
+        mult = scale[u - units];
+    }
+    if (v > max / mult) return -1;
+    *out = v * mult;
+    return 0;
+}
+
+/* Byte count: K, M, G suffixes (powers of 1024) */
+static int
+parse_size(const char *value, uint64_t *out)
+{
+    static const uint64_t scale[] = { 1ULL << 10, 1ULL << 20, 1ULL << 30 };
+    return parse_scaled(value, "KMG", scale, UINT64_MAX, out);
+}
+
+/* Duration in seconds: S, M, H, D suffixes */
+static int
+parse_duration(const char *value, int *out)
+{
+    static const uint64_t scale[] = { 1, 60, 3600, 86400 };
+    uint64_t v;
+
+    if (parse_scaled(value, "SMHD", scale, INT_MAX, &v) < 0) return -1;
+    *out = (int)v;
+    return 0;
+}
+
+/* A type name is used as a file name prefix: no '/', no '.' */
+static bool
+valid_type_name(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len == 0 || len >= LOG_CONFIG_NAME_LEN) return false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = name[i];
+        if (!isalnum(c) && c != '_' && c != '-') return false;
+    }
+    return true;
+}
+
+/* Directory value: non empty, stored with a trailing '/' */
+static int
+parse_dir(const char *value, char *out, size_t out_len)
+{
+    size_t len = strlen(value);
+
+    /* Room for the trailing '/' */
+    if (len == 0 || len + 2 > out_len) return -1;
+    snprintf(out, out_len, "%s%s", value, value[len - 1] == '/' ? "" : "/");
+    return 0;
+}
+
+static void
+set_flag(uint16_t *flags, uint16_t flag, bool on)
+{
+    if (on) {
+        *flags |= flag;
+    } else {
+        *flags &= ~flag;
+    }
+}
+
+/**
+ * apply_type_key()
+ *
+ * Purpose:
+ *   Applies one per-type key, to a type section or to the defaults.
+ *
+ * @return 1 if applied, 0 if the key is not a per-type key, -1 on a bad value
+ */
+static int
+apply_type_key(log_type_config_t *t, const char *key, const char *value)
+{
+    bool b;
+
+    if (!strcmp(key, "watch_dir")) {
+        return parse_dir(value, t->watch_dir, sizeof(t->watch_dir)) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "max_files")) {
+        return parse_int(value, 1, LOG_CONFIG_MAX_FILES, &t->max_files) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "compress_files")) {
+        return parse_int(value, 0, LOG_CONFIG_MAX_FILES, &t->compress_files) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "compress_bytes")) {
+        return parse_size(value, &t->compress_bytes) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "compress_age")) {
+        return parse_duration(value, &t->compress_age) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "codec")) {
+        int codec = codec_from_name(value);
+
+        /* A codec this build lacks is a bad value, not a silent gzip */
+        if (codec < 0 || !codec_available(codec)) return -1;
+        t->codec = codec;
+        return 1;
+    }
+    if (!strcmp(key, "compression_level")) {
+        if (!strcasecmp(value, "default")) {
+            t->compression_level = CODEC_LEVEL_DEFAULT;
+            return 1;
+        }
+        /* Widest range of all codecs, each one clamps to its own */
+        return parse_int(value, -7, 22, &t->compression_level) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "adaptive_level")) {
+        if (parse_bool(value, &b) < 0) return -1;
+        t->adaptive_level = b;
+        return 1;
+    }
+    if (!strcmp(key, "compression_level_min")) {
+        if (!strcasecmp(value, "default")) {
+            t->compression_level_min = CODEC_LEVEL_DEFAULT;
+            return 1;
+        }
+        return parse_int(value, -7, 22, &t->compression_level_min) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "zstd_long")) {
+        if (parse_bool(value, &b) < 0) return -1;
+        t->zstd_long = b;
+        return 1;
+    }
+    if (!strcmp(key, "zstd_dictionary")) {
+        if (parse_bool(value, &b) < 0) return -1;
+        t->zstd_dictionary = b;
+        return 1;
+    }
+    if (!strcmp(key, "archive_format")) {
+        if (!strcasecmp(value, "tar.gz") || !strcasecmp(value, "tgz")) {
+            t->archive_format = ARCHIVE_FMT_TAR_GZ;
+        } else if (!strcasecmp(value, "gz")) {
+            t->archive_format = ARCHIVE_FMT_GZ;
+        } else if (!strcasecmp(value, "seekable")) {
+            t->archive_format = ARCHIVE_FMT_SEEKABLE;
+        } else {
+            return -1;
+        }
+        return 1;
+    }
+    if (!strcmp(key, "archive_mode")) {
+        if (!strcasecmp(value, "incremental")) {
+            set_flag(&t->flags, CTRL_F_INCREMENTAL_ARCHIVE, true);
+        } else if (!strcasecmp(value, "full")) {
+            set_flag(&t->flags, CTRL_F_INCREMENTAL_ARCHIVE, false);
+        } else {
+            return -1;
+        }
+        return 1;
+    }
+    if (!strcmp(key, "archive_max_size")) {
+        return parse_size(value, &t->archive_max_size) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "archive_max_age")) {
+        return parse_duration(value, &t->archive_max_age) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "delete_obsolete_archives")) {
+        if (parse_bool(value, &b) < 0) return -1;
+        set_flag(&t->flags, CTRL_F_DEL_OBSOLETE_TAR_FILES, b);
+        return 1;
+    }
+    if (!strcmp(key, "delete_obsolete_logs")) {
+        if (parse_bool(value, &b) < 0) return -1;
+        set_flag(&t->flags, CTRL_F_DELETE_OBSOLETE_LOG_FILES, b);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * apply_global_key()
+ *
+ * @return 1 if applied, 0 if the key is not a global key, -1 on a bad value
+ */
+static int
+apply_global_key(log_config_t *cfg, const char *key, const char *value)
+{
+    bool b;
+
+    if (!strcmp(key, "watch_dir")) {
+        /* Also the directory of every type not setting its own */
+        if (parse_dir(value, cfg->watch_dir, sizeof(cfg->watch_dir)) < 0) return -1;
+        memcpy(cfg->defaults.watch_dir, cfg->watch_dir, sizeof(cfg->watch_dir));
+        return 1;
+    }
+    if (!strcmp(key, "generation_rotation")) {
+        if (parse_bool(value, &b) < 0) return -1;
+        set_flag(&cfg->control_flags, CTRL_F_GENERATION_ROTATION, b);
+        return 1;
+    }
+    if (!strcmp(key, "archive_budget")) {
+        return parse_size(value, &cfg->archive_budget) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "shutdown_timeout")) {
+        return parse_duration(value, &cfg->shutdown_timeout) < 0 ? -1 : 1;
+    }
+    if (!strcmp(key, "diag_level")) {
+        int level = diag_level_from_name(value);
+
+        if (level < 0) return -1;
+        cfg->diag_level = level;
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *                     CONFIGURATION SNAPSHOTS
+ ******************************************************************************/
+
+/**
+ * log_config_create()
+ *
+ * Purpose:
+ *   Allocates an empty snapshot (no types) with the global settings and
+ *   per-type defaults of another one.
+ *
+ * @param defaults  Template, usually the compile-time defaults
+ * @return New snapshot, NULL on allocation failure
+ */
+log_config_t *
+log_config_create(const log_config_t *defaults)
+{
+    log_config_t *cfg = calloc(1, sizeof(*cfg));
+
+    if (!cfg) return NULL;
+
+    memcpy(cfg->watch_dir, defaults->watch_dir, sizeof(cfg->watch_dir));
+    cfg->control_flags = defaults->control_flags;
+    cfg->diag_level = defaults->diag_level;
+    cfg->archive_budget = defaults->archive_budget;
+    cfg->shutdown_timeout = defaults->shutdown_timeout;
+    cfg->defaults = defaults->defaults;
+    return cfg;
+}
+
+/**
+ * log_config_add_type()
+ *
+ * Purpose:
+ *   Appends an enabled type with the snapshot's per-type defaults.
+ *
+ * @return Index of the new type, -1 if the name is invalid, a duplicate
+ *         or the table is full
+ */
+int
+log_config_add_type(log_config_t *cfg, const char *name)
+{
+    log_type_config_t *t;
+
+    if (!valid_type_name(name) || cfg->ntypes >= LOG_CONFIG_MAX_TYPES ||
+        log_config_find_type(cfg, name) >= 0) {
+        return -1;
+    }
+
+    if (cfg->ntypes == cfg->types_cap) {
+        int cap = cfg->types_cap ? cfg->types_cap * 2 : 16;
+        log_type_config_t *types = realloc(cfg->types, cap * sizeof(*types));
+
+        if (!types) return -1;
+        cfg->types = types;
+        cfg->types_cap = cap;
+    }
+
+    t = &cfg->types[cfg->ntypes];
+    *t = cfg->defaults;
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->name_len = strlen(t->name);
+    t->enabled = true;
+    return cfg->ntypes++;
+}
+
+/* Index of a type by name, enabled or not, -1 if absent */
+int
+log_config_find_type(const log_config_t *cfg, const char *name)
+{
+    for (int i = 0; i < cfg->ntypes; i++) {
+        if (!strcmp(cfg->types[i].name, name)) return i;
+    }
+    return -1;
+}
+
+void
+log_config_free(log_config_t *cfg)
+{
+    if (!cfg) return;
+    free(cfg->types);
+    free(cfg->match_disp);
+    free(cfg->match_slot);
+    free(cfg);
+}
+
+/**
+ * log_config_load()
+ *
+ * Purpose:
+ *   Parses a configuration file into a new snapshot. Types are listed in
+ *   file order; a file without sections yields a snapshot with no types
+ *   and the caller supplies its built-in list. The matcher is not built.
+ *
+ * @param path      Configuration file
+ * @param defaults  Values for everything the file does not set
+ * @return New snapshot, NULL if the file cannot be read or has errors
+ *         (reported on stderr with the line number)
+ */
+log_config_t *
+log_config_load(const char *path, const log_config_t *defaults)
+{
+    char line[CONFIG_LINE_LEN];
+    log_type_config_t *section = NULL;
+    int lineno = 0;
+    bool failed = false;
+    log_config_t *cfg;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        return NULL;
+    }
+
+    cfg = log_config_create(defaults);
+    if (!cfg) {
+        fclose(fp);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *s, *eq, *key, *value;
+
+        lineno++;
+        if (!strchr(line, '\n') && !feof(fp)) {
+            fprintf(stderr, "%s:%d: line too long\n", path, lineno);
+            failed = true;
+            break;
+        }
+
+        /* Comments run to the end of the line */
+        s = line + strcspn(line, "#;");
+        *s = '\0';
+        s = trim(line);
+        if (*s == '\0') continue;
+
+        if (*s == '[') {
+            char *end = strchr(s, ']');
+            int idx;
+
+            if (!end || end[1] != '\0') {
+                fprintf(stderr, "%s:%d: malformed section header\n", path, lineno);
+                failed = true;
+                continue;
+            }
+            *end = '\0';
+            idx = log_config_add_type(cfg, trim(s + 1));
+            if (idx < 0) {
+                fprintf(stderr, "%s:%d: invalid or duplicate log type [%s]\n",
+                        path, lineno, trim(s + 1));
+                failed = true;
+                section = NULL;
+                continue;
+            }
+            section = &cfg->types[idx];
+            continue;
+        }
+
+        eq = strchr(s, '=');
+        if (!eq) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, lineno);
+            failed = true;
+            continue;
+        }
+        *eq = '\0';
+        key = trim(s);
+        value = trim(eq + 1);
+
+        int rc;
+        if (section) {
+            rc = apply_type_key(section, key, value);
+        } else {
+            rc = apply_global_key(cfg, key, value);
+            if (rc == 0) rc = apply_type_key(&cfg->defaults, key, value);
+        }
+
+        if (rc == 0) {
+            fprintf(stderr, "%s:%d: unknown key '%s'%s\n", path, lineno, key,
+                    section ? " in type section" : "");
+            failed = true;
+        } else if (rc < 0) {
+            fprintf(stderr, "%s:%d: bad value '%s' for %s\n", path, lineno, value, key);
+            failed = true;
+        }
+    }
+
+    if (ferror(fp)) {
+        fprintf(stderr, "%s: read error: %s\n", path, strerror(errno));
+        failed = true;
+    }
+    fclose(fp);
+
+    if (failed) {
+        log_config_free(cfg);
+        return NULL;
+    }
+    return cfg;
+}
+
+/*******************************************************************************
+ *                     LOG TYPE NAME MATCHER
+ ******************************************************************************/
+
+/* splitmix64 finalizer */
+static inline uint64_t
+mix64(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* FNV-1a of the characters before the first '.', *len set to their count */
+static inline uint64_t
+match_hash(const char *name, uint64_t seed, size_t *len)
+{
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    size_t n = 0;
+
+    while (name[n] != '\0' && name[n] != '.') {
+        h = (h ^ (unsigned char)name[n]) * 1099511628211ULL;
+        n++;
+    }
+    *len = n;
+    return mix64(h);
+}
+
+static inline uint32_t
+match_slot_of(uint64_t h, uint32_t disp, uint32_t mask)
+{
+    return (uint32_t)mix64(h ^ ((uint64_t)disp * 0x9e3779b97f4a7c15ULL)) & mask;
+}
+
+/* Bucket sort order: larger buckets are placed first */
+static const uint32_t *sort_bucket_size;
+
+static int
+bucket_cmp(const void *a, const void *b)
+{
+    uint32_t sa = sort_bucket_size[*(const uint32_t *)a];
+    uint32_t sb = sort_bucket_size[*(const uint32_t *)b];
+
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * log_config_build_matcher()
+ *
+ * Purpose:
+ *   Builds the perfect hash of the enabled type names. Names are first
+ *   hashed into buckets of about MATCH_KEYS_PER_BUCKET; each bucket, the
+ *   largest first, then searches a displacement that sends all of its
+ *   names to free slots of a table twice the number of names. If some
+ *   bucket finds none, the whole build retries with another seed.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+log_config_build_matcher(log_config_t *cfg)
+{
+    uint32_t n = 0;
+    uint32_t m, nb;
+    uint64_t *hash = NULL;
+    uint32_t *bucket_of = NULL, *bucket_size = NULL, *order = NULL;
+    uint32_t *disp = NULL;
+    int32_t *slot = NULL;
+    uint32_t taken[LOG_CONFIG_MAX_TYPES];
+    int rc = -1;
+
+    for (int i = 0; i < cfg->ntypes; i++) {
+        if (cfg->types[i].enabled) n++;
+    }
+
+    m = round_up_pow2(n * 2 < 8 ? 8 : n * 2);
+    nb = n / MATCH_KEYS_PER_BUCKET + 1;
+
+    hash = calloc(cfg->ntypes + 1, sizeof(*hash));
+    bucket_of = calloc(cfg->ntypes + 1, sizeof(*bucket_of));
+    bucket_size = calloc(nb, sizeof(*bucket_size));
+    order = calloc(nb, sizeof(*order));
+    disp = calloc(nb, sizeof(*disp));
+    slot = malloc(m * sizeof(*slot));
+    if (!hash || !bucket_of || !bucket_size || !order || !disp || !slot) {
+        goto out;
+    }
+
+    for (uint64_t seed = 0; seed < MATCH_MAX_SEEDS && rc < 0; seed++) {
+        bool ok = true;
+        size_t len;
+
+        memset(bucket_size, 0, nb * sizeof(*bucket_size));
+        for (int i = 0; i < cfg->ntypes; i++) {
+            if (!cfg->types[i].enabled) continue;
+            hash[i] = match_hash(cfg->types[i].name, seed, &len);
+            bucket_of[i] = (uint32_t)(hash[i] >> 32) % nb;
+            bucket_size[bucket_of[i]]++;
+        }
+        for (uint32_t b = 0; b < nb; b++) order[b] = b;
+        sort_bucket_size = bucket_size;
+        qsort(order, nb, sizeof(*order), bucket_cmp);
+
+        for (uint32_t s = 0; s < m; s++) slot[s] = -1;
+
+        for (uint32_t k = 0; k < nb && ok; k++) {
+            uint32_t b = order[k];
+            uint32_t d;
+
+            if (bucket_size[b] == 0) break;
+
+            for (d = 0; d < MATCH_MAX_DISP; d++) {
+                uint32_t ntaken = 0;
+                bool fits = true;
+
+                for (int i = 0; i < cfg->ntypes && fits; i++) {
+                    if (!cfg->types[i].enabled || bucket_of[i] != b) continue;
+
+                    uint32_t s = match_slot_of(hash[i], d, m - 1);
+                    if (slot[s] >= 0) {
+                        fits = false;
+                        break;
+                    }
+                    /* Claim now, undone below if a later name collides */
+                    slot[s] = i;
+                    taken[ntaken++] = s;
+                }
+                if (fits) break;
+                while (ntaken > 0) slot[taken[--ntaken]] = -1;
+            }
+
+            if (d == MATCH_MAX_DISP) {
+                ok = false;
+            } else {
+                disp[b] = d;
+            }
+        }
+
+        if (ok) {
+            free(cfg->match_disp);
+            free(cfg->match_slot);
+            cfg->match_seed = seed;
+            cfg->match_mask = m - 1;
+            cfg->match_nbuckets = nb;
+            cfg->match_disp = disp;
+            cfg->match_slot = slot;
+            disp = NULL;
+            slot = NULL;
+            rc = 0;
+        }
+    }
+
+out:
+    free(hash);
+    free(bucket_of);
+    free(bucket_size);
+    free(order);
+    free(disp);
+    free(slot);
+    return rc;
+}
+
+/**
+ * log_config_match_prefix()
+ *
+ * Purpose:
+ *   Determines the log type of a name of the form "<type>.<anything>".
+ *   Only the whole first dot separated component counts, so
+ *   "xipstrc_old.1.bak" matches no type.
+ *
+ * @param name  Filename without directory (e.g., "ipstrc.1234567890.bak")
+ * @param rest  Set to the '.' following the base name on a match
+ * @return Type id, -1 if not an enabled type
+ */
+int
+log_config_match_prefix(const log_config_t *cfg, const char *name, const char **rest)
+{
+    size_t len;
+    uint64_t h;
+    int findex;
+
+    if (!cfg->match_slot) return -1;
+
+    h = match_hash(name, cfg->match_seed, &len);
+    findex = cfg->match_slot[match_slot_of(h, cfg->match_disp[(uint32_t)(h >> 32) %
+                                                             cfg->match_nbuckets],
+                                           cfg->match_mask)];
+
+    if (findex < 0 || name[len] != '.' || cfg->types[findex].name_len != len ||
+        memcmp(name, cfg->types[findex].name, len) != 0) {
+        return -1;
+    }
+    *rest = name + len;
+    return findex;
+}
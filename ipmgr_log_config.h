@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * File: ipmgr_log_config.h
+ *
+ * Description:
+ *   Runtime configuration of ipmgr_log_rotator: watch directory, rotation
+ *   mode and the set of managed log types with their per-type rotation
+ *   and archive policy. Loaded from a small INI style file at startup and
+ *   on SIGHUP; the compile-time defaults of ipmgr_log_rotator.c fill in
+ *   whatever the file leaves out.
+ *
+ *   A loaded configuration is an immutable snapshot. The rotator swaps
+ *   snapshots with a single atomic pointer store, readers never lock.
+ *
+ * File format:
+ *   # Global keys (before any section), also defaults for every type
+ *   watch_dir           = /var/log/  # default directory of every type
+ *   generation_rotation = no         # restart required to change
+ *   diag_level          = warn       # diagnostics: off, error, warn, info, debug
+ *   archive_budget      = 20G        # all archives of all types: past it the
+ *                                    #   oldest are removed, 0 = no cap
+ *   shutdown_timeout    = 5s         # drain bound on stop, past it in-flight
+ *                                    #   archives are abandoned, 0 = fast stop
+ *   max_files           = 15
+ *
+ *   [ipstrc]                         # one section per log type
+ *   watch_dir                = /data/trace/
+ *   max_files                = 20
+ *   compress_files           = 5     # compress as soon as this many rotated
+ *   compress_bytes           = 64M   #   files / bytes built up, or the oldest
+ *   compress_age             = 1h    #   is this old, 0 = only at max_files
+ *   codec                    = zstd  # gzip, zstd or lz4 (if compiled in)
+ *   compression_level        = 9     # codec level (gzip 0-9, zstd 1-22 or
+ *                                    #   -7..-2, lz4 0-12), or "default"
+ *   adaptive_level           = yes   # lower the level under backlog, raise
+ *                                    #   it and recompress archives when idle
+ *   compression_level_min    = 1     # adaptive floor, "default" = fastest
+ *   zstd_long                = no    # zstd: long distance matching
+ *   zstd_dictionary          = yes   # zstd: dictionary trained per type
+ *   archive_format           = gz    # tar.gz or gz (.tar.zst / .zst ...), or
+ *                                    #   seekable (time indexed, logquery)
+ *   archive_mode             = incremental # or full (new archive per batch)
+ *   archive_max_size         = 256M  # incremental: start a new archive past
+ *   archive_max_age          = 1d    #   this size / age, 0 = no cap
+ *   delete_obsolete_archives = no
+ *   delete_obsolete_logs     = yes
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_LOG_CONFIG_H
+#define IPMGR_LOG_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Limits */
+#define LOG_CONFIG_NAME_LEN     64      /* Log type base name */
+#define LOG_CONFIG_PATH_LEN     128     /* Watch directory */
+#define LOG_CONFIG_MAX_TYPES    1024    /* Log types over the process lifetime */
+#define LOG_CONFIG_MAX_FILES    255     /* Upper bound of max_files */
+
+/* Per-type archive policy flags (also the CTRL_F_* control flags) */
+#define CTRL_F_DEL_OBSOLETE_TAR_FILES       1   /* Remove previous archive of the type */
+#define CTRL_F_DELETE_OBSOLETE_LOG_FILES    2   /* Remove archived log files */
+#define CTRL_F_GENERATION_ROTATION          4   /* Global: generation mode */
+#define CTRL_F_INCREMENTAL_ARCHIVE          8   /* Append batches to a running archive */
+
+/* Rotation and archive policy of one log type */
+typedef struct log_type_config_ {
+    char name[LOG_CONFIG_NAME_LEN];
+    size_t name_len;
+    char watch_dir[LOG_CONFIG_PATH_LEN];    /* Directory the type's files live in */
+    int max_files;              /* Rotated files kept before archiving */
+    int compress_files;         /* Archive earlier: files waiting, 0 = off */
+    uint64_t compress_bytes;    /* Bytes waiting, 0 = off */
+    int compress_age;           /* Seconds the oldest waits, 0 = off */
+    int codec;                  /* CODEC_* */
+    int compression_level;      /* Codec level, CODEC_LEVEL_DEFAULT allowed */
+    bool adaptive_level;        /* compression_level is the ceiling of a controller */
+    int compression_level_min;  /* Its floor, CODEC_LEVEL_DEFAULT: codec's fastest */
+    bool zstd_long;             /* zstd long distance matching */
+    bool zstd_dictionary;       /* zstd with a dictionary trained on the type's logs */
+    int archive_format;         /* ARCHIVE_FMT_* */
+    uint64_t archive_max_size;  /* Incremental: bytes before a new archive, 0 = no cap */
+    int archive_max_age;        /* Incremental: seconds before a new archive, 0 = no cap */
+    uint16_t flags;             /* CTRL_F_DEL_OBSOLETE_TAR_FILES | CTRL_F_DELETE_OBSOLETE_LOG_FILES
+                                   | CTRL_F_INCREMENTAL_ARCHIVE */
+    bool enabled;               /* false: type was dropped by a reload */
+} log_type_config_t;
+
+/*
+ * Configuration snapshot
+ * ----------------------
+ * types[] is indexed by the rotator's type id. Type ids are stable for
+ * the life of the process, a type removed from the file stays in the
+ * table with enabled == false so in-flight work can still look it up.
+ *
+ * The name matcher is a two level perfect hash (hash and displace) over
+ * the enabled type names: one pass over the name prefix, one bucket
+ * lookup, one memcmp.
+ */
+typedef struct log_config_ {
+    char watch_dir[LOG_CONFIG_PATH_LEN];    /* Default type directory, ends with '/' */
+    uint16_t control_flags;                 /* Global CTRL_F_* flags */
+    int diag_level;                         /* DIAG_*, ipmgr_diag.h */
+    uint64_t archive_budget;                /* Bytes of archives kept, 0 = no cap */
+    int shutdown_timeout;                   /* Seconds a stop may drain */
+    log_type_config_t defaults;             /* Per-type values of the global section */
+
+    int ntypes;
+    int types_cap;
+    log_type_config_t *types;
+
+    /* Name matcher, see log_config_build_matcher() */
+    uint64_t match_seed;
+    uint32_t match_mask;                    /* Slot table size - 1 */
+    uint32_t match_nbuckets;
+    uint32_t *match_disp;                   /* Displacement per bucket */
+    int32_t *match_slot;                    /* Type id per slot, -1 if empty */
+
+    uint64_t version;                       /* Bumped on every reload */
+    struct log_config_ *retired_next;       /* Retired snapshot list */
+} log_config_t;
+
+log_config_t *
+log_config_create(const log_config_t *defaults);
+
+log_config_t *
+log_config_load(const char *path, const log_config_t *defaults);
+
+int
+log_config_add_type(log_config_t *cfg, const char *name);
+
+int
+log_config_find_type(const log_config_t *cfg, const char *name);
+
+void
+log_config_free(log_config_t *cfg);
+
+int
+log_config_build_matcher(log_config_t *cfg);
+
+int
+log_config_match_prefix(const log_config_t *cfg, const char *name, const char **rest);
+
+#endif /* IPMGR_LOG_CONFIG_H */
@@ -10,8 +10,33 @@
  *   - Automatic detection of .bak file creation using inotify
  *   - Numbered log file rotation (log.0, log.1, ..., log.N)
  *   - Asynchronous compression using dedicated zipper thread
- *   - Zero-copy file concatenation using sendfile()
+ *   - In-process tar.gz streaming writer (ipmgr_archive.c), no fork/exec
+ *   - Block-parallel (pigz style) deflate across all cores
+ *   - Optional incremental archives: each batch appended to a running
+ *     archive as a new gzip member, capped by size and age
+ *   - Pluggable codecs (ipmgr_codec.c): gzip, zstd (levels, long mode,
+ *     dictionary trained per log type) and lz4, chosen per type
+ *   - Optional adaptive compression level following the zipper backlog,
+ *     with idle time spent recompressing archives written at a low level
+ *   - Seekable archive format (ipmgr_seekable.c): ~1 MiB frames indexed by
+ *     timestamp range and level, searched by logquery.c
+ *   - File concatenation by extent sharing where the filesystem allows it
+ *     (FICLONERANGE, copy_file_range), else zero-copy sendfile()
+ *   - .bak files arriving during compression staged as pending segments
+ *     (one rename each), folded into the rotation chain afterwards
  *   - Thread-safe operation with semaphores and atomic variables
+ *   - Log types and per-type policy from a config file, reloaded on SIGHUP
+ *     (ipmgr_log_config.c, default /etc/ipmgr_log_rotator.conf)
+ *   - Several watch directories, one rotator thread (shard) per directory
+ *   - Rotation renames/unlinks batched through io_uring (ipmgr_uring.c)
+ *   - Per-thread counters and latency histograms in a shared memory page
+ *     (ipmgr_metrics.c), read by rotator_stats.c
+ *   - Diagnostics through an asynchronous logger (ipmgr_diag.c): per-thread
+ *     lock-free rings drained by a background thread, level set at runtime
+ *     (diag_level)
+ *   - Global archive disk budget (ipmgr_retention.c): archive bytes of all
+ *     types tracked in memory, oldest evicted past archive_budget, archive
+ *     unlinks run by a background thread
  *
  * Managed Files:
  *   - Any logger which generate .bak file in /var/log ( customizable ) dir can
@@ -22,6 +47,19 @@
  *   - ipmgr.bak   -> IP Manager logs
  *   - inttrc.bak  -> Internal Trace logs
  *
+ *   The built-in list (target_files) is used when the config file has no
+ *   [type] sections.
+ *
+ * Build:
+ *   gcc -o ipmgr_log_rotator.exe ipmgr_log_rotator.c ipmgr_archive.c ipmgr_log_config.c ipmgr_uring.c ipmgr_codec.c ipmgr_seekable.c ipmgr_metrics.c ipmgr_diag.c ipmgr_retention.c -pthread -lz
+ *   (add -lrt for shm_open() on glibc older than 2.34)
+ *   zstd and lz4 codecs: add -DIPMGR_WITH_ZSTD=1 -lzstd -DIPMGR_WITH_LZ4=1 -llz4
+ *   Codec benchmark on real logs: see codec_bench.c
+ *   Search of seekable archives: see logquery.c
+ *   Live counters and latencies: see rotator_stats.c
+ *   Throughput, latency and loss benchmark: see rotator_bench.c
+ *   Embedding (no main()): -DIPMGR_LOG_ROTATOR_NO_MAIN, ipmgr_log_rotator.h
+ *
  ******************************************************************************/
 
 /*
@@ -34,10 +72,12 @@ File Compression could be slow as compared to file rotation
 Therefore, File compression is offloaded to separate thread “Compression thread” so that log rotator thread is quickly relieved and go back listen for inotify events 
 But it created back pressure – Log Rotator thread cannot rotate files if File Compressor thread is busy compressing them
 Back pressure is prevented by not making log rotator thread wait for compressor thread to finish. 
-Log rotator thread first checks the status of compressor thread. If the C-thread is busy, log-rotator thread append 
-    incoming .bak file logs to pdtrc.log.0 and go back listen to inotify event ( no wait here ) 
+Log rotator thread first checks the status of compressor thread. If the C-thread is busy, log-rotator thread renames 
+    incoming .bak files to pending segments pdtrc.log.0.1, pdtrc.log.0.2, ... and go back listen to inotify event ( no wait here ) 
+When the C-thread is done, the segments are folded into the numbered chain in one rotation (no data copy)
 No .bak file should be missed */
 
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 
 /* Standard Library Headers */
@@ -50,45 +90,110 @@ No .bak file should be missed */
 #include <dirent.h>
 #include <limits.h>
 #include <time.h>
+#include <signal.h>
 #include <regex.h>
+#include <ctype.h>
 
 /* System Headers */
+#include <sys/syscall.h>
 #include <sys/inotify.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include <fcntl.h>
+#include <linux/fs.h>
 
 /* Threading Headers */
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdatomic.h>
 
-#if 1
-#define printf(...) do { } while (0)
-#define fprintf(...) do { } while (0)
-#define perror(...) do { } while (0)
-#endif 
+/* Local Headers */
+#include "ipmgr_log_rotator.h"
+#include "ipmgr_archive.h"
+#include "ipmgr_log_config.h"
+#include "ipmgr_uring.h"
+#include "ipmgr_metrics.h"
+#include "ipmgr_diag.h"
+#include "ipmgr_retention.h"
+
+/* Diagnostics go to the asynchronous logger (ipmgr_diag.c): a call only
+   copies its arguments into the thread's ring, nothing blocks the rotator.
+   fprintf() and perror() messages are errors, or warnings if they start
+   with "WARNING" */
+#define printf(...)             DIAG_LOG(DIAG_INFO, __VA_ARGS__)
+#define fprintf(stream, ...)    DIAG_LOG(DIAG_ERROR, __VA_ARGS__)
+#define perror(s)               DIAG_PERROR(s)
 
 /*******************************************************************************
  *  CONFIGURATION DEFINES BEGIN 
  *  Modify below values to configure this program
  ******************************************************************************/
 
-/* Inotify buffer configuration */
+/* Inotify buffer configuration: a shard's read buffer starts at BUF_LEN
+   and doubles, up to BUF_LEN_MAX, each time a read() comes back full */
 #define EVENT_SIZE              (sizeof(struct inotify_event))
 #define MAX_FILENAME            64
 #define BUF_LEN                 (1024 * (EVENT_SIZE + MAX_FILENAME + 1))
+#define BUF_LEN_MAX             (16 * BUF_LEN)
+#define BUF_FULL_MARGIN         (EVENT_SIZE + NAME_MAX + 1) /* Room a read() may leave */
+#define BAK_BATCH_MAX           256 /* .bak events of one type rotated together */
 
 /* File path configuration */
 #define FILE_ABS_PATH_NAME_LEN  256
 
+/*
+ * Rotation backend: the unlink/rename chains of all rotations of one
+ * inotify read() go to the kernel in one io_uring submission. Falls back
+ * to plain syscalls when io_uring is unavailable at runtime.
+ */
+#define ROTATE_USE_IO_URING     1
+#define ROTATE_URING_ENTRIES    512 /* SQ size, >= operations of one rotation plan */
+#define ROTATE_BATCH_TYPES      8   /* Rotations sharing one submission */
+
+/* Buffer of the read()/write() fallback of the .bak append */
+#define APPEND_COPY_BUF_LEN     (64 * 1024)
+#define APPEND_MOUNTS_MAX       32  /* Filesystems whose append primitives are cached */
+
+/*
+ * Pending segments: each .bak arriving while its type is being compressed
+ * is renamed to <type>.log.0.<n> and folded into the numbered chain when
+ * the zipper is done. Past this many, .bak files are appended to the
+ * newest segment.
+ */
+#define PENDING_SEGMENTS_MAX    64
+
+/* Directory scan (getdents64) buffer and slot cache reconciliation period */
+#define DIR_SCAN_BUF_LEN            (64 * 1024)
+#define SLOT_CACHE_RECONCILE_SECS   60
+
+/*
+ * Runtime configuration file (see ipmgr_log_config.h), re-read on SIGHUP.
+ * Everything below is the built-in default for what the file leaves out,
+ * and the whole configuration when there is no file.
+ */
+#define DEFAULT_CONFIG_FILE     "/etc/ipmgr_log_rotator.conf"
+
 /* Customizable parameters*/
 #define DEFAULT_WATCH_DIR       "/var/log/"
+#define MAX_WATCH_DIRS          16  /* Rotator shards: one thread per watch directory */
 #define DEFAULT_MAX_FILES       15  /* Number of rotated log files to keep */
+#define DEFAULT_DIAG_LEVEL      DIAG_WARN /* Diagnostics written out (diag_level) */
+
+/* Longest a stop drains (shutdown_timeout), 0 = fast stop. Past it the
+   archives being written are abandoned, their files kept for the next
+   startup. Stopping rotators re-check the deadline this often */
+#define DEFAULT_SHUTDOWN_TIMEOUT    5   /* Seconds */
+#define SHUTDOWN_POLL_MS            10
 
 /* 
  * Target log files to monitor (without .bak extension)
- * These are the base names that will be matched in inotify events
+ * These are the base names that will be matched in inotify events.
+ * Used when the configuration file declares no [type] sections.
  */
 static const char target_files[][MAX_FILENAME] = {
     "ipstrc",   /* IP Stack Trace logs */
@@ -100,13 +205,91 @@ static const char target_files[][MAX_FILENAME] = {
 #define DEFAULT_NUM_TARGET_FILES 3
 
 
-/* CONTROL FLAGS BEGIN */
+/* Archive configuration */
+#define DEFAULT_ARCHIVE_FORMAT      ARCHIVE_FMT_TAR_GZ    /* or ARCHIVE_FMT_GZ */
+#define DEFAULT_CODEC               CODEC_GZIP  /* CODEC_ZSTD, CODEC_LZ4 need the build flags */
+#define DEFAULT_COMPRESSION_LEVEL   CODEC_LEVEL_DEFAULT /* gzip -6, zstd -3, lz4 fast */
+#define DEFAULT_ZSTD_LONG           false /* zstd long distance matching (128 MiB window) */
+#define DEFAULT_ZSTD_DICTIONARY     false /* zstd dictionary trained per log type */
+#define DEFAULT_COMPRESS_THREADS    0   /* Deflate workers, 0 = one per online core */
+#define DEFAULT_ZIPPER_THREADS      0   /* Archive jobs run in parallel, 0 = one per file type */
+#define ZIPPER_THREADS_AUTO_MAX     8   /* Cap of the one per file type default */
+#define COMPRESSION_QUEUE_LEN       16  /* Pending jobs per file type, power of 2 */
+
+/* Incremental archives (CTRL_F_INCREMENTAL_ARCHIVE): a new archive file is
+   started once the running one reaches this size or age, 0 = no cap */
+#define DEFAULT_ARCHIVE_MAX_SIZE    (256ULL * 1024 * 1024)
+#define DEFAULT_ARCHIVE_MAX_AGE     (24 * 60 * 60)  /* Seconds */
 
-/* Remove obsolete tar files after successful archive creation */
-#define CTRL_F_DEL_OBSOLETE_TAR_FILES 1
-/* Remove original files after successful archive creation */
-#define CTRL_F_DELETE_OBSOLETE_LOG_FILES 2
+/* Disk budget of all archives (archive_budget), 0 = no cap. Past it the
+   oldest archives are removed until this percentage of it is left */
+#define DEFAULT_ARCHIVE_BUDGET      0
+#define ARCHIVE_BUDGET_LOW_PERCENT  90
 
+/*
+ * Early compression (compress_files / compress_bytes / compress_age): the
+ * rotated files of a type are archived as soon as this many of them or
+ * of their bytes have built up, or the oldest has waited this long,
+ * whichever comes first, instead of only when log.N appears. 0 = off.
+ * Shift mode needs delete_obsolete_logs, or the files would be archived
+ * again by the next job. Age deadlines are brought forward by a per-type
+ * offset of up to 1/COMPRESS_AGE_SPREAD of the age, so types that started
+ * together do not all compress in the same second.
+ */
+#define DEFAULT_COMPRESS_FILES      0
+#define DEFAULT_COMPRESS_BYTES      0
+#define DEFAULT_COMPRESS_AGE        0   /* Seconds */
+#define COMPRESS_AGE_SPREAD         8
+
+/*
+ * zstd dictionaries: trained from samples of the batch being archived,
+ * used for the next ZSTD_DICT_RETRAIN_ARCHIVES archives of the type and
+ * saved next to them as <type>.zdict.<id> ("zstd -D" needs it to read the
+ * archives back, the frames carry the id).
+ */
+#define ZSTD_DICT_CAPACITY          (64 * 1024)
+#define ZSTD_DICT_TRAIN_BYTES       (4 * 1024 * 1024)   /* Sampled per training */
+#define ZSTD_DICT_SAMPLE_LEN        4096
+#define ZSTD_DICT_RETRAIN_ARCHIVES  64
+
+/*
+ * Adaptive compression level (adaptive_level = yes): before each archive
+ * the level moves between compression_level_min and compression_level,
+ * driven by the type's backlog, its archive duration and its .bak arrival
+ * rate. An archive is slow above ADAPTIVE_BUSY_FRACTION of the time the
+ * next batch takes to arrive, fast below ADAPTIVE_IDLE_FRACTION. Once the
+ * zippers have had nothing to do for ADAPTIVE_IDLE_SECS, archives written
+ * below the ceiling are recompressed at it.
+ */
+#define DEFAULT_ADAPTIVE_LEVEL          false
+#define DEFAULT_COMPRESSION_LEVEL_MIN   CODEC_LEVEL_DEFAULT /* codec's fastest */
+#define ADAPTIVE_BUSY_FRACTION          0.5
+#define ADAPTIVE_IDLE_FRACTION          0.2
+#define ADAPTIVE_EWMA_WEIGHT            0.3 /* Weight of the newest sample */
+#define ADAPTIVE_IDLE_SECS              5
+#define ADAPTIVE_RECOMPRESS_MAX         32  /* Low level archives remembered per type */
+
+/* CONTROL FLAGS BEGIN */
+
+/*
+ * Flags are defined in ipmgr_log_config.h:
+ *   CTRL_F_DEL_OBSOLETE_TAR_FILES:    Remove obsolete tar files after
+ *                                     successful archive creation
+ *   CTRL_F_DELETE_OBSOLETE_LOG_FILES: Remove original files after successful
+ *                                     archive creation
+ *   CTRL_F_GENERATION_ROTATION:       Rotate by giving each .bak a new
+ *                                     generation number instead of shifting
+ *                                     log.0..log.N (one rename per rotation
+ *                                     whatever DEFAULT_MAX_FILES is)
+ *   CTRL_F_INCREMENTAL_ARCHIVE:       Append each batch to the running
+ *                                     archive of the type as a new gzip
+ *                                     member instead of writing a new
+ *                                     archive (capped by
+ *                                     DEFAULT_ARCHIVE_MAX_SIZE/_AGE)
+ * All but generation rotation are per-type archive policy and may be
+ * overridden per type by the configuration file. Generation rotation is
+ * read at startup only.
+ */
 static uint16_t control_flags = CTRL_F_DEL_OBSOLETE_TAR_FILES | \
                                 CTRL_F_DELETE_OBSOLETE_LOG_FILES;
 
@@ -118,9 +301,6 @@ static uint16_t control_flags = CTRL_F_DEL_OBSOLETE_TAR_FILES | \
  /********************************************************************************/
 
 
-#define TAR_CMD_SIZE_LEN    (DEFAULT_MAX_FILES * FILE_ABS_PATH_NAME_LEN)
-
-
 /*******************************************************************************
  *                          GLOBAL VARIABLES
  ******************************************************************************/
@@ -128,65 +308,390 @@ static uint16_t control_flags = CTRL_F_DEL_OBSOLETE_TAR_FILES | \
 /*
  * Thread Synchronization Primitives
  * ----------------------------------
- * wake_up_zipper_thread: Zero semaphore controlling access to zipper thread.
- *                     Posted when files are ready to be compressed.
+ * wake_up_zipper_thread: Counting semaphore, posted once for every file type
+ *                     put on zipper_run_queue. Zipper workers sleep on it.
  *                     
  * wait_for_thread_init: Zero semaphore ensuring threads are initialized
  *                       before ipmgr main thread proceed further.
- * operations_on_log_files : To implement mutual exclustion betwen
- *                       rotator thread and compressor thread. Log files
- *                       compression and rotation is mutually exclusive.
+ * log_types[]->files_lock : Per-file-type mutex for mutual
+ *                       exclusion between rotator and compressor threads on
+ *                       that type's numbered files. Held for short
+ *                       transitions only (rotate, append, fold log.0), never
+ *                       across an archive run, so compressing ipstrc does
+ *                       not block rotating pdtrc.
  */
-/* Semaphore to wake up Zipper thread when files to be compressed
+/* Semaphore to wake up Zipper threads when files to be compressed
     are ready */
 static sem_t wake_up_zipper_thread;
 
 /* Semaphore to wait until the new thread is initialized */
 static sem_t wait_for_thread_init;
 
-/* Semaphore to momentarily block inotify events */
-static sem_t inotify_events_allow_sema;
+/*
+ * Lock-free bounded ring
+ * ----------------------
+ * Vyukov style ring of fixed size elements. Every cell carries a sequence
+ * number telling producers and consumers whether it is free or full for the
+ * current lap, so push/pop are a single CAS on tail/head. Safe for any number
+ * of producers and consumers; used below as MPSC job queue per file type and
+ * as the MPMC run queue of file types having work.
+ */
+typedef struct lf_ring_ {
+    size_t mask;
+    size_t elem_size;
+    size_t cell_size;
+    unsigned char *cells;
+    _Alignas(64) atomic_size_t tail;    /* Next enqueue position */
+    _Alignas(64) atomic_size_t head;    /* Next dequeue position */
+} lf_ring_t;
+
+/* A compression request produced by file_rotate() */
+typedef struct comp_job_ {
+    char terminal_fname[FILE_ABS_PATH_NAME_LEN];
+    int findex;
+    uint64_t seq;
+    uint64_t first_gen;     /* Generation mode: oldest generation to archive */
+    uint32_t ngens;         /* Generation mode: range length, 0 in shift mode */
+} comp_job_t;
+
+/*
+ * Numbered slot cache words: bit N set when <type>.log.N exists, N up to
+ * LOG_CONFIG_MAX_FILES whatever max_files a type is configured with.
+ */
+#define SLOT_BITMAP_WORDS   ((LOG_CONFIG_MAX_FILES + 1 + 63) / 64)
+
+/*
+ * Per-file-type state
+ * -------------------
+ * One log_type_t per log type ever configured, allocated when the type
+ * first appears in a configuration and kept until shutdown, so a type id
+ * (index in log_types[]) stays valid across reloads. Its rotation and
+ * archive policy lives in the current configuration snapshot,
+ * type_config(findex).
+ *
+ * Compression state
+ * Each file type (ipstrc, pdtrc, ipmgr, inttrc) owns its own job queue,
+ * so rotations of the same type can never overwrite each other's request,
+ * and its own zip_in_progress state, so compressing one type does not
+ * push the other types onto the append path.
+ *
+ * jobs_pending counts queued + running jobs. While it is non zero the
+ * rotator stages that type's .bak files as pending segments instead of
+ * rotating, so the zipper owns log.1..log.N without holding any lock.
+ * jobs_pending only changes under files_lock.
+ *
+ * A finished shift mode job does not touch the chain: the zipper bumps
+ * jobs_done and reports the type on its shard's completion ring. The
+ * rotator then retires the jobs, folding the pending segments in when
+ * none is left, so every rename of a type's live files is the rotator's.
+ *
+ * Pending segments
+ * <type>.log.0.<n> for n in [pending.first, pending.next), oldest first,
+ * all newer than log.0. The next rotation (normally the one the rotator
+ * runs when the zipper reports its last job done) shifts the chain by their number at
+ * once and renames them into the freed slots, newest as log.1. Protected
+ * by files_lock, rebuilt by the startup scan.
+ *
+ * files_lock is a (futex based) sleeping mutex: a waiter never spins.
+ * lock_contended counts acquisitions that found it held and had to sleep.
+ *
+ * Generation mode index (CTRL_F_GENERATION_ROTATION)
+ * Live files of a type are <base>.log.g<gen> for gen in [oldest_gen, next_gen).
+ * Each .bak simply becomes the next generation, nothing is ever shifted.
+ * Generations [zip_gen, zip_gen + max_files) are handed to the
+ * zipper as soon as they all exist. Rebuilt by a directory scan at startup,
+ * protected by the type's files_lock.
+ *
+ * Numbered slot cache
+ * Bit N of a type's bitmap is set when <type>.log.N exists. The rotator and
+ * zipper create, rename and delete all of these files themselves, so they
+ * keep the bitmap authoritative as they go, and "does log.N exist" is a
+ * memory lookup instead of an access() syscall. Filled by one getdents64
+ * pass at startup, corrected on ENOENT and re-checked by a periodic scan
+ * against files removed behind our back.
+ *
+ * version is bumped on every change, so the reconciliation scan can tell
+ * that its snapshot went stale while it was reading the directory.
+ */
+typedef struct log_type_ {
+    char name[MAX_FILENAME];
+    char dir[LOG_CONFIG_PATH_LEN];      /* Watch directory, fixed at creation */
+    int shard;                          /* Rotator shard watching dir */
+
+    pthread_mutex_t files_lock;
+    atomic_uint_fast64_t lock_acquired;
+    atomic_uint_fast64_t lock_contended;
+    atomic_uint_fast64_t lock_wait_ns;  /* Time slept on contended acquisitions */
+
+    lf_ring_t jobs;                     /* MPSC: rotator(s) -> zipper */
+    atomic_bool scheduled;              /* Type is sitting on zipper_run_queue */
+    atomic_uint jobs_pending;
+    atomic_uint jobs_done;              /* Finished, not yet seen by the rotator */
+    atomic_uint max_depth;              /* High watermark of the job queue */
+    atomic_uint_fast64_t jobs_enqueued;
+    atomic_uint_fast64_t jobs_completed;
+    atomic_uint_fast64_t jobs_dropped;  /* Queue full, files left for next job */
+
+    struct {
+        uint64_t oldest_gen;    /* Oldest generation not yet archived */
+        uint64_t zip_gen;       /* First generation not yet queued for compression */
+        uint64_t next_gen;      /* Generation the next .bak becomes */
+    } gen;
+
+    struct {
+        uint32_t first;         /* Oldest pending segment */
+        uint32_t next;          /* Number the next segment gets */
+    } pending;
+
+    struct {
+        atomic_uint_fast64_t bits[SLOT_BITMAP_WORDS];
+        atomic_uint_fast64_t version;
+    } slots;
+
+    char last_archive[FILE_ABS_PATH_NAME_LEN];  /* Zipper only */
+    time_t archive_created;             /* Incremental: last_archive start, zipper only */
+    uint64_t archive_size;              /* Incremental: its size after the last append */
+
+    struct {
+        void *buf;              /* zstd dictionary, NULL if none */
+        size_t len;
+        unsigned archives;      /* Archives written with dictionaries enabled */
+    } dict;                     /* Zipper only */
+
+    /* Early compression, see compress_policy_check(). Rotator only,
+       under files_lock */
+    struct {
+        uint64_t bytes;         /* .bak bytes since the last job (compress_bytes) */
+        uint64_t since_ns;      /* CLOCK_MONOTONIC arrival of the oldest, 0 = none */
+        bool scheduled;         /* On the shard's deadline heap */
+    } backlog;
+
+    /* Adaptive level controller, see adaptive_level_next() */
+    atomic_uint_fast64_t bak_arrivals;  /* .bak files handled by the rotator */
+    struct {
+        bool started;
+        int level;              /* Level of the last archive */
+        double job_secs;        /* EWMA of the archive duration */
+        double bak_interval;    /* EWMA of seconds between .bak files */
+        uint64_t arrivals;      /* bak_arrivals at the last sample */
+        double sampled_at;
+        bool running_lowered;   /* Incremental: last_archive has low level members */
+        int running_codec;
+        unsigned running_dict_id;
+        int nlowered;           /* Archives waiting for recompression, oldest first */
+        struct {
+            char path[FILE_ABS_PATH_NAME_LEN];
+            int codec;
+            unsigned dict_id;   /* zstd dictionary used, 0 if none */
+        } lowered[ADAPTIVE_RECOMPRESS_MAX];
+    } adapt;                    /* Zipper only */
+    atomic_int level_current;           /* Decisions, for diagnostics */
+    atomic_uint_fast64_t level_lowered;
+    atomic_uint_fast64_t level_raised;
+    atomic_uint_fast64_t archives_recompressed;
+    atomic_uint_fast64_t recompress_saved_bytes;
+} log_type_t;
+
+/*
+ * Type registry. Entries are published before num_log_types grows and
+ * never move, so readers index log_types[] without locking.
+ */
+static log_type_t *log_types[LOG_CONFIG_MAX_TYPES];
+static atomic_int num_log_types;
+
+/*
+ * Run queue of file type indices having queued jobs. A type is on it at
+ * most once (guarded by .scheduled) and is pushed back to the tail after
+ * each job, giving round-robin service across types.
+ */
+static lf_ring_t zipper_run_queue;
+
+/*
+ * Configuration snapshots
+ * -----------------------
+ * current_config is swapped with one atomic store by the reload thread, so
+ * the rotator never waits on a reload. Replaced snapshots go to
+ * retired_configs and are freed at shutdown, as a thread may still hold a
+ * pointer into one. control_flags and the directory of an existing type
+ * are fixed at startup.
+ */
+static _Atomic(log_config_t *) current_config;
+static log_config_t *retired_configs;
+static const char *config_file_path = DEFAULT_CONFIG_FILE;
+static atomic_uint_fast64_t config_reloads;
+static atomic_uint_fast64_t config_reload_failures;
+
+/* Cache entries found wrong by a failed syscall or by reconciliation */
+static atomic_uint_fast64_t slot_cache_corrections;
+
+/* .bak files staged as pending segments, and rotations folding them */
+static atomic_uint_fast64_t pending_segments_staged;
+static atomic_uint_fast64_t pending_segments_folds;
+
+/*
+ * .bak event collected from one inotify read(). name points into the
+ * rotator's read buffer; events are sorted by type, timestamp, arrival.
+ */
+typedef struct bak_event_ {
+    const char *name;
+    uint64_t ts;
+    uint32_t seq;
+    int findex;
+    bool dummy;                         /* <type>.dummy.bak */
+    uint64_t created_ns;                /* ctime, CLOCK_REALTIME; 0 unknown */
+} bak_event_t;
+
+/*
+ * .bak files a previous run left behind, found by the startup scan of a
+ * shard's directory and replayed by its rotator thread before it reads
+ * any inotify event. Names are strdup()'ed.
+ */
+typedef struct bak_replay_ {
+    bak_event_t *events;
+    int nevents;
+    int cap;
+} bak_replay_t;
+
+/* .bak files that rode along in another file's rotation instead of their own */
+static atomic_uint_fast64_t bak_events_coalesced;
 
-/* Spin lock for mutual exclusivity for any operation on logfiles, 
-    since they are shared data being acted upon by Rotator and
-    Compressor thread */
-static pthread_spinlock_t operations_on_log_files;
+/* Block-parallel deflate workers shared by all archive writers */
+static deflate_pool_t *compress_pool;
 
 /*
- * Atomic flag indicating compression is in progress.
- * When true, the log rotator will concatenate new .bak files to log.0
- * instead of rotating, to avoid interfering with compression.
+ * Rotation plan
+ * -------------
+ * file_rotate() split in three: the plan lists the unlinks and the
+ * renames (highest slot first) a rotation needs, they run either as plain
+ * syscalls or as io_uring SQEs, and completion applies the results to the
+ * slot cache. Renames of one plan are hard linked SQEs, so they execute in
+ * order and a failed rename does not cancel the next ones, exactly like
+ * the syscall loop. Names are relative to the shard's directory fd.
  */
-static atomic_bool zip_in_progress = false;
+#define ROTATE_OP_PENDING   INT_MIN     /* rotate_op_t.res before it ran */
+#define ROTATE_FROM_SEGMENT (-1)        /* rotate_op_t.from of a pending segment */
+
+typedef struct rotate_op_ {
+    int from;                           /* Slot renamed or removed */
+    int to;                             /* Destination slot, -1 for unlink */
+    int res;                            /* 0 or -errno */
+    char old_name[MAX_FILENAME + 16];
+    char new_name[MAX_FILENAME + 16];
+} rotate_op_t;
+
+typedef struct rotate_plan_ {
+    int findex;
+    int max_files;
+    uint32_t segments_end;              /* Pending segments folded: [first, end) */
+    int nops;
+    rotate_op_t ops[LOG_CONFIG_MAX_FILES + 1 + PENDING_SEGMENTS_MAX];
+} rotate_plan_t;
+
+/* Rotations of one read(), each type's files_lock held until completion */
+typedef struct rotate_batch_ {
+    int nplans;
+    rotate_plan_t plans[ROTATE_BATCH_TYPES];
+} rotate_batch_t;
+
+/* io_uring submissions made by the rotators */
+static atomic_uint_fast64_t rotate_uring_submits;
+
+/* Entry of a shard's deadline heap */
+typedef struct deadline_ {
+    uint64_t at_ns;                     /* CLOCK_MONOTONIC */
+    int findex;
+} deadline_t;
 
 /*
- * Per-file-type compression state
- * Each file type (ipstrc, pdtrc, ipmgr, inttrc) tracks its own terminal_fname
- * to prevent race conditions where multiple file types trigger compression
- * simultaneously and overwrite each other's filenames.
+ * Rotator shards
+ * --------------
+ * One shard per distinct watch directory: its own inotify instance and its
+ * own rotator thread, so a slow volume only delays the types living on it.
+ * Every type belongs to exactly one shard, which is therefore the only
+ * thread rotating that type's files. All shards feed the same zipper
+ * threads and deflate pool.
+ *
+ * The inotify watch is added when the shard is created, before the scan
+ * of its directory, so no .bak is missed between the two. Shards are only
+ * added (at startup or by a reload), never removed.
+ *
+ * The thread sleeps in epoll_wait() on three descriptors: the inotify
+ * instance, an eventfd the zippers signal when they completed a job of
+ * one of the shard's types (listed on the completions ring) and a
+ * CLOCK_MONOTONIC timerfd armed for the shard's next deadline: the
+ * slot cache reconciliation or the earliest compress_age deadline of its
+ * types, kept in a binary min-heap (one entry per type at most).
  */
-static struct {
-    char terminal_fname[MAX_FILENAME];
-    atomic_bool needs_compression;
-} file_compression_state[DEFAULT_NUM_TARGET_FILES];
+typedef struct log_shard_ {
+    char dir[LOG_CONFIG_PATH_LEN];
+    int id;
+    int inotify_fd;                     /* inotify instance */
+    int watch_fd;                       /* watch descriptor for dir */
+    int dir_fd;                         /* dir, for the *at() rotation calls */
+    bool use_uring;
+    uring_t ring;                       /* Rotation backend, if use_uring */
+    rotate_batch_t batch;
+    bool running;
+    pthread_t thread;
+    struct timespec last_reconcile;
+    bak_replay_t replay;                /* Startup scan or overflow rescan */
+    char *buffer;                       /* inotify read() buffer */
+    size_t buf_len;
+    bak_event_t *events;                /* Room for every event of one read() */
+    int epoll_fd;                       /* inotify_fd, wake_fd and timer_fd */
+    int wake_fd;                        /* eventfd: completions were queued */
+    int timer_fd;                       /* timerfd: next deadline */
+    uint64_t timer_armed_ns;            /* Deadline timer_fd is armed for */
+    lf_ring_t completions;              /* MPSC: zippers -> rotator, type indexes */
+    deadline_t *deadlines;              /* Min-heap on at_ns, rotator thread only */
+    int ndeadlines;
+} log_shard_t;
+
+/* epoll_event.data.u32 of the shard's descriptors */
+enum {
+    SHARD_EV_INOTIFY,
+    SHARD_EV_WAKE,
+    SHARD_EV_TIMER,
+};
 
-/* Spinlock to protect compression state updates */
-static pthread_spinlock_t compression_state_lock;
+static log_shard_t *log_shards[MAX_WATCH_DIRS];
+static int num_log_shards;              /* Startup and reload thread only */
 
 /* Thread handles */
-static pthread_t zipper_thread;
-static pthread_t log_rotator_thread;
+static pthread_t *zipper_threads;
+static int num_zipper_threads;
+static atomic_uint zipper_threads_named;    /* Metrics slot names */
 
-/* Inotify file descriptors */
-static int inotify_fd;  /* inotify instance */
-static int watch_fd;    /* watch descriptor for monitored directory */
+/*
+ * Shutdown, see ipmgr_stop_log_rotator_thread()
+ * ---------------------------------------------
+ * SHUTDOWN_DRAIN: each rotator removes its watch, rotates the .bak files
+ * already queued and, in shift mode, stays until its types' jobs are
+ * folded. The zippers then empty the run queue and exit (zippers_exit).
+ * SHUTDOWN_FAST, at shutdown_deadline_ns or on ipmgr_log_rotator_fast_stop():
+ * rotators exit as they are and zip_cancel makes the archive writers drop
+ * the archives in flight. Their files stay where they are, the next
+ * startup archives them.
+ */
+enum {
+    SHUTDOWN_NONE,
+    SHUTDOWN_DRAIN,
+    SHUTDOWN_FAST,
+};
+static atomic_int shutdown_state;
+static uint64_t shutdown_deadline_ns;   /* CLOCK_MONOTONIC, set before shutdown_state */
+static atomic_bool zippers_exit;
+static atomic_bool zip_cancel;
 
 /*******************************************************************************
  *                      FUNCTION DECLARATION
  ******************************************************************************/
 
-void 
-file_rotate(const char *base_name);
+static void
+file_rotate(int file_idx);
+
+static void
+file_rotate_sync(int file_idx, bool queue_unarchived);
 
 
 
@@ -194,756 +699,4014 @@ file_rotate(const char *base_name);
  *                     HELPER FUNCTIONS
  ******************************************************************************/
 
+/* Round up to the next power of two (ring capacities) */
+static size_t
+round_up_pow2(size_t v)
+{
+    size_t p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
 
-/**
- * get_file_type_index()
- * 
- * Purpose:
- *   Determines the index of a file type in the target_files array.
- *   Used to track archives separately for each file type.
- *
- * @param fname  Base filename (e.g., "ipstrc.log", "ipmgr.log")
- * @return Index (0-3) if found, -1 if not found
- */
 static int
-get_file_type_index(const char *fname)
+lf_ring_init(lf_ring_t *r, size_t capacity, size_t elem_size)
 {
-    for (int i = 0; i < DEFAULT_NUM_TARGET_FILES; i++) {
-        if (strstr(fname, target_files[i]) != NULL) {
-            return i;
-        }
+    capacity = round_up_pow2(capacity < 2 ? 2 : capacity);
+
+    /* Cell = sequence number followed by the element, kept aligned */
+    r->elem_size = elem_size;
+    r->cell_size = (sizeof(atomic_size_t) + elem_size + 7) & ~(size_t)7;
+    r->mask = capacity - 1;
+    r->cells = calloc(capacity, r->cell_size);
+    if (!r->cells) return -1;
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init((atomic_size_t *)(r->cells + i * r->cell_size), i);
     }
-    return -1;  /* Not found */
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->head, 0);
+    return 0;
 }
 
 static void
-generate_dummy_inotify_bak_event()
+lf_ring_destroy(lf_ring_t *r)
 {
-    int i;
-    char cmd[512];
-    char dummy_bak_fname[FILE_ABS_PATH_NAME_LEN];
+    free(r->cells);
+    r->cells = NULL;
+}
 
-    for (i = 0; i < DEFAULT_NUM_TARGET_FILES; i++)
-    {
-        snprintf(dummy_bak_fname, sizeof(dummy_bak_fname), 
-            "%s%s.dummy.bak", DEFAULT_WATCH_DIR, target_files[i]);
+static inline atomic_size_t *
+lf_ring_cell(lf_ring_t *r, size_t pos)
+{
+    return (atomic_size_t *)(r->cells + (pos & r->mask) * r->cell_size);
+}
 
-        snprintf(cmd, sizeof(cmd), "touch %s", dummy_bak_fname);
+/* @return true if queued, false if the ring is full */
+static bool
+lf_ring_push(lf_ring_t *r, const void *elem)
+{
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_size_t *cell;
 
-        printf("\n--- Executing dummy bak file creation cmd ---\n%s\n\n", cmd);
-        if (system(cmd) != 0) {
-            perror("ERROR: dummy bak file creation command failed");
+    while (1) {
+        cell = lf_ring_cell(r, pos);
+        size_t seq = atomic_load_explicit(cell, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
         }
     }
-}
 
-/* if *.log.0 exist 
-     then trigger file rotate
-   else no-op 
-*/
-static void 
-handle_dummy_bak_file_creation(int findex) {
+    memcpy(cell + 1, elem, r->elem_size);
+    atomic_store_explicit(cell, pos + 1, memory_order_release);
+    return true;
+}
 
-    char base_fname[FILE_ABS_PATH_NAME_LEN];
-    char log0_fname[FILE_ABS_PATH_NAME_LEN];
+/* @return true if an element was dequeued, false if the ring is empty */
+static bool
+lf_ring_pop(lf_ring_t *r, void *elem)
+{
+    size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_size_t *cell;
 
-    snprintf (log0_fname, sizeof (log0_fname), "%s%s.log.0", 
-        DEFAULT_WATCH_DIR, target_files[findex]);
+    while (1) {
+        cell = lf_ring_cell(r, pos);
+        size_t seq = atomic_load_explicit(cell, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
 
-    if (access (log0_fname, F_OK)) return;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+        }
+    }
 
-    pthread_spin_lock(&operations_on_log_files);
+    memcpy(elem, cell + 1, r->elem_size);
+    atomic_store_explicit(cell, pos + r->mask + 1, memory_order_release);
+    return true;
+}
 
-    snprintf (base_fname, sizeof(base_fname), "%s%s",
-        DEFAULT_WATCH_DIR, target_files[findex]);
-    /* Rotate existing numbered files */
-    file_rotate(base_fname);
-    /* Unlock the Critical section. */
-    pthread_spin_unlock(&operations_on_log_files);    
+/* Number of queued elements (exact when producers/consumers are quiet) */
+static size_t
+lf_ring_depth(lf_ring_t *r)
+{
+    size_t tail = atomic_load(&r->tail);
+    size_t head = atomic_load(&r->head);
+    return tail - head;
 }
 
+/* Adds a deadline to the shard's heap, room for every type is allocated */
 static void
-rename_all_log0_to_log1_log_file() {
+deadline_push(log_shard_t *shard, uint64_t at_ns, int findex)
+{
+    deadline_t *h = shard->deadlines;
+    int i = shard->ndeadlines++;
 
-    char log0_fname[FILE_ABS_PATH_NAME_LEN];
-    char log1_fname[FILE_ABS_PATH_NAME_LEN];
+    while (i > 0 && h[(i - 1) / 2].at_ns > at_ns) {
+        h[i] = h[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h[i].at_ns = at_ns;
+    h[i].findex = findex;
+}
 
-    for (int i = 0; i < DEFAULT_NUM_TARGET_FILES; i++)
-    {
-        snprintf(log0_fname, sizeof(log0_fname), "%s%s.log.0",
-                 DEFAULT_WATCH_DIR, target_files[i]);
+/* Removes the earliest deadline of the shard's heap */
+static void
+deadline_pop(log_shard_t *shard)
+{
+    deadline_t *h = shard->deadlines;
+    deadline_t last = h[--shard->ndeadlines];
+    int n = shard->ndeadlines;
+    int i = 0;
+
+    while (2 * i + 1 < n) {
+        int c = 2 * i + 1;
+
+        if (c + 1 < n && h[c + 1].at_ns < h[c].at_ns) c++;
+        if (last.at_ns <= h[c].at_ns) break;
+        h[i] = h[c];
+        i = c;
+    }
+    if (n > 0) h[i] = last;
+}
 
-        if (access(log0_fname, F_OK)) continue;
+/**
+ * log_files_lock() / log_files_unlock()
+ *
+ * Purpose:
+ *   Take/release the per-file-type lock guarding that type's numbered files.
+ *   The uncontended path is a single trylock; contention is counted and
+ *   timed so lock pressure between rotator and zipper can be checked.
+ */
+static void
+log_files_lock(int findex)
+{
+    pthread_mutex_t *lock = &log_types[findex]->files_lock;
 
-        snprintf(log1_fname, sizeof(log1_fname), "%s%s.log.1",
-                 DEFAULT_WATCH_DIR, target_files[i]);
+    if (pthread_mutex_trylock(lock) != 0) {
+        uint64_t t0 = metrics_now_ns(), waited;
 
-        if (rename(log0_fname, log1_fname) == 0) {
-            printf("   %s(): Renamed: %s -> %s\n", __FUNCTION__, log0_fname, log1_fname);
-        }
-        else {
-            fprintf(stderr, "%s(): ERROR: Rename failed: %s -> %s: %s\n",
-                    __FUNCTION__, log0_fname, log1_fname, strerror(errno));
-        }
+        pthread_mutex_lock(lock);
+        waited = metrics_now_ns() - t0;
+
+        atomic_fetch_add_explicit(&log_types[findex]->lock_contended, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&log_types[findex]->lock_wait_ns, waited,
+                                  memory_order_relaxed);
+        metrics_add(MC_LOCK_CONTENDED, 1);
+        metrics_record(MH_LOCK_WAIT, waited);
     }
+    atomic_fetch_add_explicit(&log_types[findex]->lock_acquired, 1,
+                              memory_order_relaxed);
+    metrics_add(MC_LOCK_ACQUIRED, 1);
 }
 
-/*******************************************************************************
- *                      FILE COMPRESSION FUNCTIONS
- ******************************************************************************/
+static void
+log_files_unlock(int findex)
+{
+    pthread_mutex_unlock(&log_types[findex]->files_lock);
+}
+
+/* Contended acquisitions of a type's files_lock, for diagnostics */
+uint64_t
+log_files_lock_contention(int findex)
+{
+    return atomic_load(&log_types[findex]->lock_contended);
+}
+
+/* true while a compression job of this type is queued or running */
+static inline bool
+zip_in_progress(int findex)
+{
+    return atomic_load(&log_types[findex]->jobs_pending) > 0;
+}
+
+/* Stop without waiting any longer, async-signal-safe */
+static void
+shutdown_go_fast(void)
+{
+    atomic_store(&zip_cancel, true);
+    atomic_store(&shutdown_state, SHUTDOWN_FAST);
+}
+
+/* true once a stop may no longer wait: fast stop, or past its deadline */
+static bool
+shutdown_expired(void)
+{
+    if (atomic_load(&shutdown_state) == SHUTDOWN_FAST) return true;
+    if (metrics_now_ns() < shutdown_deadline_ns) return false;
+    shutdown_go_fast();
+    return true;
+}
+
+/* Pending compression jobs of one file type, for diagnostics */
+size_t
+zipper_queue_depth(int findex)
+{
+    return lf_ring_depth(&log_types[findex]->jobs);
+}
+
+/* Compression level of the type's last archive with adaptive_level */
+int
+adaptive_level_current(int findex)
+{
+    return atomic_load(&log_types[findex]->level_current);
+}
 
 /**
- * compress_all_log_files_with_name()
- * 
+ * zipper_schedule()
+ *
  * Purpose:
- *   Compresses all numbered log files (log.1 to log.N) into a single
- *   timestamped tar.gz archive, then deletes the original files.
+ *   Puts a file type with queued jobs on the zipper run queue (once) and
+ *   wakes one zipper worker.
+ */
+static void
+zipper_schedule(int findex)
+{
+    if (atomic_exchange(&log_types[findex]->scheduled, true)) {
+        return;     /* Already queued, the worker will find the new job */
+    }
+    if (!lf_ring_push(&zipper_run_queue, &findex)) {
+        /* Cannot happen: run queue holds every type at once */
+        atomic_store(&log_types[findex]->scheduled, false);
+        fprintf(stderr, "ERROR: zipper run queue full\n");
+        return;
+    }
+    sem_post(&wake_up_zipper_thread);
+}
+
+/**
+ * zipper_enqueue_job()
  *
- * Input:
- *   terminal_fname_param: path to the highest numbered log file (e.g., "var/log/ipmgr.log.5")
+ * Purpose:
+ *   Queues a compression request for a file type. Called by the rotator
+ *   with the type's files_lock held.
  *
- * Process:
- *   1. Parse filename to extract base name and maximum index
- *   2. Create timestamped archive name
- *   3. Build tar command to compress all numbered files
- *   4. Execute tar command
- *   5. Delete old archive (after new one succeeds)
- *   6. Delete original files on success
+ * @param terminal_fname  Shift mode: highest numbered file (log.N)
+ * @param first_gen       Generation mode: first generation of the range
+ * @param ngens           Generation mode: range length (0 selects shift mode)
  *
- * Example:
- *   Input:  terminal_fname = "var/log/ipmgr.log.5"
- *   Output: var/log/ipmgr_2025-12-31_14-30-45.tar.gz
- *           (contains ipmgr.log.1, ipmgr.log.2, ..., ipmgr.log.5)
+ * @return 0 on success, -1 if the type's queue is full
  */
-static void 
-compress_all_log_files_with_name(const char *terminal_fname_param)
+static int
+zipper_enqueue_job(int findex, const char *terminal_fname,
+                   uint64_t first_gen, uint32_t ngens)
 {
-    int max_index = 0;
-    char base[MAX_FILENAME + 32];   /* Base path without number */
-    char fname[MAX_FILENAME];       /* Filename without path */
-    const char *name = terminal_fname_param;
-
-    printf("%s() : File compression triggered by creation of %s\n", __FUNCTION__, name);
-
-    /*
-     * Parse the file number from the end of the filename
-     * Example: "var/log/ipmgr.log.5" -> max_index = 5
-     */
-    char *last_dot = strrchr(name, '.');
-    if (!last_dot || sscanf(last_dot + 1, "%d", &max_index) != 1) {
-        fprintf(stderr, "ERROR: Invalid file format: %s (expected base.number)\n", name);
-        return;
+    static atomic_uint_fast64_t job_seq;
+    comp_job_t job;
+
+    snprintf(job.terminal_fname, sizeof(job.terminal_fname), "%s", terminal_fname);
+    job.findex = findex;
+    job.seq = atomic_fetch_add(&job_seq, 1);
+    job.first_gen = first_gen;
+    job.ngens = ngens;
+
+    /* Mark busy before the job is visible so no rotation can slip in */
+    atomic_fetch_add(&log_types[findex]->jobs_pending, 1);
+
+    if (!lf_ring_push(&log_types[findex]->jobs, &job)) {
+        atomic_fetch_sub(&log_types[findex]->jobs_pending, 1);
+        atomic_fetch_add(&log_types[findex]->jobs_dropped, 1);
+        fprintf(stderr, "ERROR: compression queue full for %s\n", terminal_fname);
+        return -1;
     }
+    atomic_fetch_add(&log_types[findex]->jobs_enqueued, 1);
 
-    /* Extract base path without the number (e.g., "var/log/ipmgr.log") */
-    size_t len = last_dot - name;
-    strncpy(base, name, len);
-    base[len] = '\0';
-
-    /* extract filename from the path */
-    char *slash = strrchr(base, '/');
-    if (slash) {
-        strcpy(fname, slash + 1);
-    } else {
-        strcpy(fname, base);
+    unsigned depth = (unsigned)zipper_queue_depth(findex);
+    unsigned prev = atomic_load(&log_types[findex]->max_depth);
+    while (depth > prev &&
+           !atomic_compare_exchange_weak(&log_types[findex]->max_depth,
+                                         &prev, depth)) {
     }
 
-    /*
-     * Generate timestamp for archive name
-     * Format: YYYY-MM-DD_HH-MM-SS
-     * 
-     * Store archives separately for each file type (ipstrc, pdtrc, ipmgr, inttrc)
-     * Array size is 4 to match the 4 target file types
-     */
-    static char archives[DEFAULT_NUM_TARGET_FILES][256] = {{0}};
-    char timestamp[64];
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    
-    /* Determine which file type we're compressing */
-    int file_idx = get_file_type_index(fname);
-    if (file_idx < 0) {
-        fprintf(stderr, "ERROR: Unknown file type: %s\n", fname);
-        return;
-    }
-    
-    /* Generate timestamp and new archive name */
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H-%M-%S", tm);
-    
-    /* Save old archive name before overwriting */
-    char old_archive[256];
-    strncpy(old_archive, archives[file_idx], sizeof(old_archive));
-    old_archive[sizeof(old_archive) - 1] = '\0';
-    
-    /* Create new archive name */
-    snprintf(archives[file_idx], sizeof(archives[file_idx]), "%s%s_%s.tar.gz", 
-             DEFAULT_WATCH_DIR, fname, timestamp);
+    zipper_schedule(findex);
+    return 0;
+}
 
-    /*
-     * Build tar command
-     * -c: create archive
-     * -z: compress with gzip
-     * -f: output filename
-     * -C: change to directory (so archive contains only filenames, not full paths)
-     */
-    char cmd[TAR_CMD_SIZE_LEN];
-    char file_only[MAX_FILENAME * 2];
-    char fullpath[FILE_ABS_PATH_NAME_LEN];
-    bool do_archive = false;
 
-    snprintf(cmd, sizeof(cmd), "tar -czf \"%s\" -C \"%s\"", archives[file_idx], DEFAULT_WATCH_DIR);
+/* Current configuration snapshot. Never freed while the rotator runs. */
+static inline log_config_t *
+config_get(void)
+{
+    return atomic_load_explicit(&current_config, memory_order_acquire);
+}
 
-    /* Iterate through all numbered files and add them to the tar command */
-    printf("\n--- Collecting Files for Archive ---\n");
-    for (int i = 1; i <= max_index; i++) {
-        snprintf(file_only, sizeof(file_only), "%s.%d", fname, i);
-        snprintf(fullpath, sizeof(fullpath), "%s%s.%d", DEFAULT_WATCH_DIR, fname, i);
-
-        if (access(fullpath, F_OK) == 0) {
-            printf("   Found: %s\n", fullpath);
-            strcat(cmd, " ");
-            strcat(cmd, file_only);
-            do_archive = true;
-        } else {
-            printf("   Missing: %s\n", fullpath);
-        }
-    }
+/* Rotation and archive policy of a type, from the current snapshot */
+static inline const log_type_config_t *
+type_config(int findex)
+{
+    return &config_get()->types[findex];
+}
 
-    /* Exit if no files found */
-    if (!do_archive) {
-        printf("Nothing to archive.\n");
-        return;
-    }
+/**
+ * target_match_bak_event()
+ *
+ * Purpose:
+ *   Classifies an inotify event name: "<type>.<ts>.bak" or the zipper's
+ *   "<type>.dummy.bak". Everything else is ignored. One pass over the
+ *   name with the snapshot's perfect hash, see log_config_match_prefix().
+ *
+ * @param cfg    Configuration snapshot the event is matched against
+ * @param name   Event filename
+ * @param dummy  Set to true for a dummy event
+ * @return Type index, -1 if the name is not a .bak of a target type
+ */
+static int
+target_match_bak_event(const log_config_t *cfg, const char *name, bool *dummy)
+{
+    const char *rest;
+    int findex = log_config_match_prefix(cfg, name, &rest);
 
-    /* Now delete old archive before creating the new one */
-    if ((control_flags & CTRL_F_DEL_OBSOLETE_TAR_FILES) && 
-            old_archive[0] != '\0' && 
-            access(old_archive, F_OK) == 0) {
+    if (findex < 0) return -1;
 
-        /* Old archive exists, try to remove it */
-        if (remove(old_archive) == 0) {
-            printf("Obsolete Archive %s Removed\n", old_archive);
-        } else {
-            printf("Obsolete Archive %s Failed to remove: ", old_archive);
-            perror("Archive delete failed");
-        }
-    }
+    size_t n = strlen(rest);
+    if (n < 5 || memcmp(rest + n - 4, ".bak", 4) != 0) return -1;
 
-    /* Execute tar command */
-    printf("\n--- Executing TAR Command ---\n%s\n\n", cmd);
-    if (system(cmd) != 0) {
-        perror("ERROR: tar command failed");
-        return;
-    }
+    *dummy = (n == 10 && memcmp(rest, ".dummy", 6) == 0);
+    return findex;
+}
 
-    printf("\n[SUCCESS] Archive created: %s\n\n", archives[file_idx]);
+static void
+generation_queue_ready_batches(int findex);
 
-    /* Remove original files after successful archive creation */
-    if (control_flags & CTRL_F_DELETE_OBSOLETE_LOG_FILES) {
+static inline bool
+log_slot_exists(int findex, int slot)
+{
+    return (atomic_load_explicit(&log_types[findex]->slots.bits[slot / 64],
+                                 memory_order_relaxed) >> (slot % 64)) & 1;
+}
 
-        printf("--- Cleaning Up Original Files ---\n");
+static inline void
+log_slot_set(int findex, int slot)
+{
+    atomic_fetch_or(&log_types[findex]->slots.bits[slot / 64], 1ULL << (slot % 64));
+    atomic_fetch_add(&log_types[findex]->slots.version, 1);
+}
+
+static inline void
+log_slot_clear(int findex, int slot)
+{
+    atomic_fetch_and(&log_types[findex]->slots.bits[slot / 64], ~(1ULL << (slot % 64)));
+    atomic_fetch_add(&log_types[findex]->slots.version, 1);
+}
+
+/* The cache claimed a file that is not there: fix it after a failed syscall */
+static void
+log_slot_stale(int findex, int slot)
+{
+    if (errno == ENOENT) {
+        log_slot_clear(findex, slot);
+        atomic_fetch_add(&slot_cache_corrections, 1);
+    }
+}
+
+/* Directory entry layout returned by getdents64(2) */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef void (*dir_scan_cb_t)(const char *name, void *ctx);
+
+/**
+ * watch_dir_scan()
+ *
+ * Purpose:
+ *   Reads a whole watch directory with large getdents64 batches (no
+ *   per-entry stat) and calls cb for every regular entry name.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+watch_dir_scan(const char *dir, dir_scan_cb_t cb, void *ctx)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char *buf;
+    long n;
+
+    if (fd < 0) {
+        perror("ERROR: open watch dir failed");
+        return -1;
+    }
+
+    buf = malloc(DIR_SCAN_BUF_LEN);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+
+    while ((n = syscall(SYS_getdents64, fd, buf, DIR_SCAN_BUF_LEN)) > 0) {
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+
+            if (de->d_type == DT_DIR) continue;
+            cb(de->d_name, ctx);
+        }
+    }
+
+    if (n < 0) {
+        perror("ERROR: getdents64 failed");
+    }
+    free(buf);
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ * Parses "<type>.log.<suffix>" for one of the target types.
+ * @return type index with *suffix pointing after ".log.", or -1
+ */
+static int
+parse_log_file_name(const log_config_t *cfg, const char *name, const char **suffix)
+{
+    const char *rest;
+    int findex = log_config_match_prefix(cfg, name, &rest);
+
+    if (findex < 0 || strncmp(rest, ".log.", 5) != 0) {
+        return -1;
+    }
+    *suffix = rest + 5;
+    return findex;
+}
+
+/* What one pass over the watch directory found for one type */
+typedef struct dir_type_scan_ {
+    uint64_t bits[SLOT_BITMAP_WORDS];
+    uint64_t min_gen;
+    uint64_t max_gen;
+    bool gen_found;
+    uint32_t min_seg;
+    uint32_t max_seg;
+    bool seg_found;
+    uint64_t version;       /* Slot cache version before the scan */
+} dir_type_scan_t;
+
+/* What one pass over a shard's directory found, types [first, ntypes) */
+typedef struct dir_state_scan_ {
+    const log_config_t *cfg;
+    int shard;
+    int first;
+    int ntypes;
+    dir_type_scan_t *types;
+    /* .bak files found, when set: startup and inotify overflow rescans */
+    bak_replay_t *replay;
+    /* Startup only: newest archive of each type, older ones removed as
+       obsolete */
+    bool startup;
+    char (*archives)[FILE_ABS_PATH_NAME_LEN];
+    unsigned archives_removed;
+} dir_state_scan_t;
+
+static uint64_t
+bak_file_timestamp(const char *name);
+
+/*
+ * Parses the rest of an archive name after "<type>":
+ * ".log_<YYYY-MM-DD_HH-MM-SS>[.<n>]<ext>", see archive_start_new().
+ * @return true with the timestamp and the same second counter (0 for
+ *         none), false if rest is not an archive name
+ */
+static bool
+parse_archive_name(const char *rest, const char **stamp, unsigned long *n)
+{
+    static const char pattern[] = "dddd-dd-dd_dd-dd-dd";
+    const char *p;
+    char *end;
+
+    if (strncmp(rest, ".log_", 5) != 0) return false;
+    rest += 5;
+    for (int i = 0; pattern[i]; i++) {
+        if (pattern[i] == 'd' ? (rest[i] < '0' || rest[i] > '9') : rest[i] != pattern[i]) {
+            return false;
+        }
+    }
+    *stamp = rest;
+    *n = 0;
+    p = rest + sizeof(pattern) - 1;
+    if (p[0] == '.' && p[1] >= '0' && p[1] <= '9') {
+        *n = strtoul(p + 1, &end, 10);
+        if (*end != '.') return false;
+        p = end;
+    }
+
+    for (int f = 0; f < ARCHIVE_FMT_COUNT; f++) {
+        for (int c = 0; c < CODEC_COUNT; c++) {
+            if (!strcmp(p, archive_format_extension(f, c))) return true;
+        }
+    }
+    return false;
+}
+
+/* Archive names of one type: true when a was created after b */
+static bool
+archive_name_newer(const char *a, const char *b)
+{
+    const char *sa, *sb;
+    unsigned long na, nb;
+
+    if (!parse_archive_name(a, &sa, &na) || !parse_archive_name(b, &sb, &nb)) return false;
+
+    int c = memcmp(sa, sb, 19);
+    return c > 0 || (c == 0 && na > nb);
+}
+
+/*
+ * Startup: keeps the newest archive of a type in scan->archives. With
+ * CTRL_F_DEL_OBSOLETE_TAR_FILES every older one is removed, as the run
+ * that wrote them would have done had it not stopped; the newest is
+ * removed when the next archive is started.
+ */
+static void
+dir_state_scan_archive(dir_state_scan_t *scan, int findex, const char *name)
+{
+    char *newest = scan->archives[findex - scan->first];
+    const char *rest = name + strlen(log_types[findex]->name);
+    const char *obsolete = NULL;
+    char path[FILE_ABS_PATH_NAME_LEN];
+    struct stat st;
+
+    /* Every archive counts against the budget until it is removed */
+    snprintf(path, sizeof(path), "%s%s", log_types[findex]->dir, name);
+    if (fstatat(log_shards[scan->shard]->dir_fd, name, &st, 0) == 0) {
+        retention_track(path, findex, (uint64_t)st.st_size, st.st_mtime);
+    }
+
+    if (newest[0] == '\0') {
+        snprintf(newest, FILE_ABS_PATH_NAME_LEN, "%s", name);
+        return;
+    }
+
+    if (archive_name_newer(rest, newest + strlen(log_types[findex]->name))) {
+        snprintf(path, sizeof(path), "%s%s", log_types[findex]->dir, newest);
+        snprintf(newest, FILE_ABS_PATH_NAME_LEN, "%s", name);
+        obsolete = path;
+    } else {
+        snprintf(path, sizeof(path), "%s%s", log_types[findex]->dir, name);
+        obsolete = path;
+    }
+
+    if (!(scan->cfg->types[findex].flags & CTRL_F_DEL_OBSOLETE_TAR_FILES)) return;
+
+    /* Entries already returned by getdents64 can go while it runs */
+    if (retention_unlink(obsolete) == 0) {
+        scan->archives_removed++;
+    } else {
+        fprintf(stderr, "ERROR: Failed to remove obsolete archive %s: %s\n",
+                obsolete, strerror(errno));
+    }
+}
+
+/* Startup: a .bak file of a type of the shard, for the rotator to replay */
+static void
+dir_state_scan_bak(dir_state_scan_t *scan, int findex, const char *name, bool dummy)
+{
+    bak_replay_t *r = scan->replay;
+
+    if (r->nevents == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 256;
+        bak_event_t *events = realloc(r->events, (size_t)cap * sizeof(*events));
+
+        if (!events) return;
+        r->events = events;
+        r->cap = cap;
+    }
+
+    bak_event_t *e = &r->events[r->nevents];
+    e->name = strdup(name);
+    if (!e->name) return;
+    e->ts = dummy ? 0 : bak_file_timestamp(name);
+    e->seq = (uint32_t)r->nevents;
+    e->findex = findex;
+    e->dummy = dummy;
+    r->nevents++;
+}
+
+static void
+dir_state_scan_cb(const char *name, void *ctx)
+{
+    dir_state_scan_t *scan = ctx;
+    const char *suffix = NULL;
+    char *end;
+
+    if (scan->replay) {
+        const char *rest, *stamp;
+        unsigned long n;
+        bool dummy;
+        int j = target_match_bak_event(scan->cfg, name, &dummy);
+
+        if (j >= scan->first && j < scan->ntypes && log_types[j]->shard == scan->shard) {
+            dir_state_scan_bak(scan, j, name, dummy);
+            return;
+        }
+
+        j = log_config_match_prefix(scan->cfg, name, &rest);
+        if (scan->archives && j >= scan->first && j < scan->ntypes && log_types[j]->shard == scan->shard &&
+            parse_archive_name(rest, &stamp, &n)) {
+            dir_state_scan_archive(scan, j, name);
+            return;
+        }
+    }
+
+    int findex = parse_log_file_name(scan->cfg, name, &suffix);
+
+    if (findex < scan->first || findex >= scan->ntypes) return;
+    if (log_types[findex]->shard != scan->shard) return;
+
+    dir_type_scan_t *t = &scan->types[findex - scan->first];
+
+    if (*suffix == 'g') {
+        /* Generation file <type>.log.g<gen> */
+        unsigned long long gen = strtoull(suffix + 1, &end, 10);
+        if (end == suffix + 1 || *end != '\0') return;
+
+        if (!t->gen_found || gen < t->min_gen) t->min_gen = gen;
+        if (!t->gen_found || gen > t->max_gen) t->max_gen = gen;
+        t->gen_found = true;
+        return;
+    }
+
+    if (suffix[0] == '0' && suffix[1] == '.') {
+        /* Pending segment <type>.log.0.<n> */
+        unsigned long seg = strtoul(suffix + 2, &end, 10);
+        if (end == suffix + 2 || *end != '\0' || seg == 0 || seg >= UINT32_MAX) return;
+
+        if (!t->seg_found || seg < t->min_seg) t->min_seg = (uint32_t)seg;
+        if (!t->seg_found || seg > t->max_seg) t->max_seg = (uint32_t)seg;
+        t->seg_found = true;
+        return;
+    }
+
+    /* Numbered slot <type>.log.<N> */
+    unsigned long slot = strtoul(suffix, &end, 10);
+    if (end == suffix || *end != '\0' || slot > LOG_CONFIG_MAX_FILES) return;
+    t->bits[slot / 64] |= 1ULL << (slot % 64);
+}
+
+/**
+ * dir_state_scan()
+ *
+ * Purpose:
+ *   One getdents64 pass over a shard's directory collecting numbered slots,
+ *   pending segments and generation ranges of its types in [first, cfg->ntypes). Entries of
+ *   other shards' types are left zero. With scan->replay set it also
+ *   collects .bak files, and with scan->startup archives. The caller sets
+ *   both, and frees scan->types and scan->archives.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+dir_state_scan(dir_state_scan_t *scan, const log_config_t *cfg, int first,
+               const log_shard_t *shard)
+{
+    scan->cfg = cfg;
+    scan->shard = shard->id;
+    scan->first = first;
+    scan->ntypes = cfg->ntypes;
+    scan->types = calloc(cfg->ntypes - first + 1, sizeof(*scan->types));
+    if (!scan->types) return -1;
+    if (scan->startup) {
+        scan->archives = calloc(cfg->ntypes - first + 1, sizeof(*scan->archives));
+        if (!scan->archives) {
+            free(scan->types);
+            return -1;
+        }
+    }
+
+    for (int i = first; i < cfg->ntypes; i++) {
+        scan->types[i - first].version = atomic_load(&log_types[i]->slots.version);
+    }
+
+    if (watch_dir_scan(shard->dir, dir_state_scan_cb, scan) < 0) {
+        free(scan->types);
+        free(scan->archives);
+        scan->types = NULL;
+        scan->archives = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * log_slot_cache_reconcile()
+ *
+ * Purpose:
+ *   Periodic safety net against files created or removed by someone else.
+ *   Re-reads the shard's directory and replaces the bitmap of every type
+ *   of the shard that is idle (no compression running) and did not change
+ *   during the scan. Runs on the shard's rotator thread.
+ *
+ * @param replay  Also collect the directory's .bak files there, NULL not to
+ */
+static void
+log_slot_cache_reconcile(const log_shard_t *shard, bak_replay_t *replay)
+{
+    dir_state_scan_t scan = { .replay = replay };
+    const log_config_t *cfg = config_get();
+
+    if (dir_state_scan(&scan, cfg, 0, shard) < 0) return;
+
+    for (int i = 0; i < scan.ntypes; i++) {
+        const uint64_t *bits = scan.types[i].bits;
+
+        if (!cfg->types[i].enabled || log_types[i]->shard != shard->id) continue;
+
+        log_files_lock(i);
+        if (!zip_in_progress(i) &&
+            atomic_load(&log_types[i]->slots.version) == scan.types[i].version) {
+            for (int w = 0; w < SLOT_BITMAP_WORDS; w++) {
+                uint64_t old = atomic_exchange(&log_types[i]->slots.bits[w], bits[w]);
+                if (old != bits[w]) {
+                    atomic_fetch_add(&slot_cache_corrections,
+                                     __builtin_popcountll(old ^ bits[w]));
+                }
+            }
+        }
+        log_files_unlock(i);
+    }
+    free(scan.types);
+}
+
+/* Path of one generation file: <dir><type>.log.g<gen> */
+static void
+log_generation_path(char *buf, size_t len, int findex, uint64_t gen)
+{
+    snprintf(buf, len, "%s%s.log.g%llu", log_types[findex]->dir,
+             log_types[findex]->name, (unsigned long long)gen);
+}
+
+/* log_dir_state_init() for the types of one shard */
+static void
+log_dir_state_init_shard(const log_config_t *cfg, int first, log_shard_t *shard)
+{
+    dir_state_scan_t scan = { .replay = NULL };
+    struct timespec t0, t1;
+    bool wanted = false;
+
+    for (int i = first; i < cfg->ntypes && !wanted; i++) {
+        wanted = log_types[i]->shard == shard->id;
+    }
+    /* The replay needs the shard's thread, which reads events from its start */
+    if (!shard->running) {
+        scan.replay = &shard->replay;
+        scan.startup = true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (!wanted || dir_state_scan(&scan, cfg, first, shard) < 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (scan.replay) {
+        printf("Startup scan %s: %.1f ms, %d .bak file(s) to replay, "
+               "%u obsolete archive(s) removed\n", shard->dir,
+               (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6,
+               shard->replay.nevents, scan.archives_removed);
+    }
+
+    for (int i = first; i < cfg->ntypes; i++) {
+        const dir_type_scan_t *t = &scan.types[i - first];
+
+        if (log_types[i]->shard != shard->id) continue;
+
+        if (scan.archives && scan.archives[i - first][0] != '\0') {
+            /* Removed as obsolete when the next archive is started; never
+               appended to, a crash may have cut it short */
+            snprintf(log_types[i]->last_archive, sizeof(log_types[i]->last_archive), "%s%s",
+                     log_types[i]->dir, scan.archives[i - first]);
+            log_types[i]->archive_size = UINT64_MAX;
+            printf("Last archive %s: %s\n", log_types[i]->name, log_types[i]->last_archive);
+        }
+
+        for (int w = 0; w < SLOT_BITMAP_WORDS; w++) {
+            atomic_store(&log_types[i]->slots.bits[w], t->bits[w]);
+        }
+
+        if (t->seg_found) {
+            /* Left by a run stopped during compression, folded once live */
+            log_types[i]->pending.first = t->min_seg;
+            log_types[i]->pending.next = t->max_seg + 1;
+            printf("Pending segments %s: [%u, %u)\n", log_types[i]->name,
+                   t->min_seg, t->max_seg + 1);
+        }
+
+        if (!(control_flags & CTRL_F_GENERATION_ROTATION) || !t->gen_found) {
+            continue;
+        }
+
+        log_types[i]->gen.oldest_gen = t->min_gen;
+        log_types[i]->gen.zip_gen = t->min_gen;
+        log_types[i]->gen.next_gen = t->max_gen + 1;
+        printf("Generation index %s: [%llu, %llu)\n", log_types[i]->name,
+               (unsigned long long)t->min_gen, (unsigned long long)t->max_gen + 1);
+    }
+    free(scan.types);
+    free(scan.archives);
+}
+
+/**
+ * log_dir_state_init()
+ *
+ * Purpose:
+ *   Startup pass for types [first, cfg->ntypes), at startup and for types
+ *   added by a reload before they are published: one getdents64 scan of
+ *   each directory holding such types fills the numbered slot cache and
+ *   the pending segment list and, in generation mode, rebuilds the
+ *   generation index. Complete batches and pending segments left by a
+ *   previous run are handled by the caller once the types are live.
+ *
+ *   For a directory not watched yet, the same pass also collects the .bak
+ *   files left by a previous run, replayed by the shard's rotator thread
+ *   when it starts (log_shard_replay()), and picks up the newest archive
+ *   of each type as its last archive, removing the older ones under
+ *   delete_obsolete_archives. Types added by a reload to a directory
+ *   already watched only get their slots, segments and generations here.
+ */
+static void
+log_dir_state_init(const log_config_t *cfg, int first)
+{
+    for (int s = 0; s < num_log_shards; s++) {
+        log_dir_state_init_shard(cfg, first, log_shards[s]);
+    }
+}
+
+/* Rotated files of a type not queued for compression yet, files_lock held */
+static int
+compress_waiting_files(int findex, int *top)
+{
+    int n = 0;
+
+    if (control_flags & CTRL_F_GENERATION_ROTATION) {
+        return (int)(log_types[findex]->gen.next_gen - log_types[findex]->gen.zip_gen);
+    }
+    for (int i = 1; i <= LOG_CONFIG_MAX_FILES; i++) {
+        if (!log_slot_exists(findex, i)) continue;
+        n++;
+        *top = i;
+    }
+    return n;
+}
+
+/* When the oldest waiting file of a type reaches compress_age, spread */
+static uint64_t
+compress_age_deadline(int findex, const log_type_config_t *tc)
+{
+    uint64_t age_ns = (uint64_t)tc->compress_age * 1000000000ull;
+    uint32_t phase = ((uint32_t)findex * 2654435761u) >> 22;    /* 0..1023 */
+
+    return log_types[findex]->backlog.since_ns + age_ns -
+           age_ns / COMPRESS_AGE_SPREAD / 1024 * phase;
+}
+
+/* Files of the last job are gone: restart the backlog. files_lock held */
+static inline void
+compress_backlog_reset(int findex)
+{
+    log_types[findex]->backlog.bytes = 0;
+    log_types[findex]->backlog.since_ns = 0;
+}
+
+/**
+ * compress_backlog_add()
+ *
+ * Purpose:
+ *   Accounts .bak data joining a type's rotated files and, with
+ *   compress_age, puts the type on the shard's deadline heap. Rotator
+ *   thread of the type's shard, files_lock held.
+ *
+ * @param bytes  Size of the .bak files, only needed with compress_bytes
+ */
+static void
+compress_backlog_add(log_shard_t *shard, int findex, uint64_t bytes)
+{
+    const log_type_config_t *tc = type_config(findex);
+    log_type_t *t = log_types[findex];
+
+    t->backlog.bytes += bytes;
+    if (!t->backlog.since_ns) t->backlog.since_ns = metrics_now_ns();
+
+    if (tc->compress_age && !t->backlog.scheduled) {
+        deadline_push(shard, compress_age_deadline(findex, tc), findex);
+        t->backlog.scheduled = true;
+    }
+}
+
+/**
+ * compress_policy_check()
+ *
+ * Purpose:
+ *   Queues the rotated files of a type for compression before max_files
+ *   is reached, once compress_files, compress_bytes or compress_age says
+ *   so. Runs after each rotation and on the type's age deadline. Called
+ *   with the type's files_lock held.
+ *
+ * @param now_ns  CLOCK_MONOTONIC
+ */
+static void
+compress_policy_check(int findex, uint64_t now_ns)
+{
+    const log_type_config_t *tc = type_config(findex);
+    log_type_t *t = log_types[findex];
+    bool generation = control_flags & CTRL_F_GENERATION_ROTATION;
+    const char *why;
+    int top = 0;
+    int nfiles;
+
+    if (!tc->enabled || (!tc->compress_files && !tc->compress_bytes && !tc->compress_age)) {
+        return;
+    }
+    /* Shift mode: the pending job takes the whole chain anyway */
+    if (!generation && (zip_in_progress(findex) ||
+                        !(tc->flags & CTRL_F_DELETE_OBSOLETE_LOG_FILES))) {
+        return;
+    }
+
+    nfiles = compress_waiting_files(findex, &top);
+    if (nfiles == 0) {
+        compress_backlog_reset(findex);
+        return;
+    }
+
+    if (tc->compress_files && nfiles >= tc->compress_files) {
+        why = "files";
+    } else if (tc->compress_bytes && t->backlog.bytes >= tc->compress_bytes) {
+        why = "bytes";
+    } else if (tc->compress_age && t->backlog.since_ns &&
+               now_ns >= compress_age_deadline(findex, tc)) {
+        why = "age";
+    } else {
+        return;
+    }
+
+    if (generation) {
+        if (zipper_enqueue_job(findex, "", t->gen.zip_gen, (uint32_t)nfiles) < 0) return;
+        t->gen.zip_gen += (uint32_t)nfiles;
+    } else {
+        char terminal[FILE_ABS_PATH_NAME_LEN];
+
+        snprintf(terminal, sizeof(terminal), "%s%s.log.%d", t->dir, t->name, top);
+        if (zipper_enqueue_job(findex, terminal, 0, 0) < 0) return;
+    }
+    printf("Early compression of %d %s file(s) (compress_%s)\n", nfiles, t->name, why);
+    metrics_add(MC_COMPRESS_EARLY, 1);
+    compress_backlog_reset(findex);
+}
+
+/**
+ * shard_deadlines_run()
+ *
+ * Purpose:
+ *   Handles the compress_age deadlines of the shard that are due. The
+ *   heap holds one entry per type: an entry outliving its backlog is
+ *   moved to the deadline of the current one, or dropped.
+ */
+static void
+shard_deadlines_run(log_shard_t *shard)
+{
+    uint64_t now_ns = metrics_now_ns();
+
+    while (shard->ndeadlines > 0 && shard->deadlines[0].at_ns <= now_ns) {
+        int findex = shard->deadlines[0].findex;
+        const log_type_config_t *tc = type_config(findex);
+        log_type_t *t = log_types[findex];
+
+        deadline_pop(shard);
+        log_files_lock(findex);
+        t->backlog.scheduled = false;
+        if (tc->compress_age && t->backlog.since_ns) {
+            uint64_t at_ns = compress_age_deadline(findex, tc);
+
+            if (at_ns > now_ns) {
+                deadline_push(shard, at_ns, findex);
+                t->backlog.scheduled = true;
+            } else {
+                /* Not queued while a job runs: the fold after it rechecks */
+                compress_policy_check(findex, now_ns);
+            }
+        }
+        log_files_unlock(findex);
+    }
+}
+
+/**
+ * generation_queue_ready_batches()
+ *
+ * Purpose:
+ *   Queues every complete batch of max_files generations of a type
+ *   for compression. Called with the type's files_lock held.
+ */
+static void
+generation_queue_ready_batches(int findex)
+{
+    uint32_t batch = type_config(findex)->max_files;
+
+    while (log_types[findex]->gen.next_gen - log_types[findex]->gen.zip_gen >= batch) {
+        if (zipper_enqueue_job(findex, "", log_types[findex]->gen.zip_gen, batch) < 0) {
+            break;  /* Retried on the next rotation */
+        }
+        log_types[findex]->gen.zip_gen += batch;
+    }
+    if (log_types[findex]->gen.zip_gen == log_types[findex]->gen.next_gen) {
+        compress_backlog_reset(findex);
+    }
+}
+
+/**
+ * generation_rotate()
+ *
+ * Purpose:
+ *   Generation mode rotation: the .bak file becomes <base>.log.g<next_gen>
+ *   with a single rename, "<base>.log.latest" is repointed at it, and a
+ *   full batch is queued for compression. Cost does not depend on
+ *   max_files. Called with the type's files_lock held.
+ */
+static void
+generation_rotate(int findex, const char *full_bak_path)
+{
+    char gen_path[FILE_ABS_PATH_NAME_LEN];
+    char link_path[FILE_ABS_PATH_NAME_LEN];
+    char tmp_link[FILE_ABS_PATH_NAME_LEN + 8];
+    uint64_t gen = log_types[findex]->gen.next_gen;
+
+    log_generation_path(gen_path, sizeof(gen_path), findex, gen);
+
+    if (rename(full_bak_path, gen_path) != 0) {
+        fprintf(stderr, "ERROR: Rename failed: %s -> %s: %s\n",
+                full_bak_path, gen_path, strerror(errno));
+        return;
+    }
+    log_types[findex]->gen.next_gen = gen + 1;
+    printf("   Renamed: %s -> %s\n", full_bak_path, gen_path);
+
+    /* Compatibility: "<base>.log.latest" always names the newest file.
+       Relative target, swapped atomically with rename() */
+    snprintf(link_path, sizeof(link_path), "%s%s.log.latest",
+             log_types[findex]->dir, log_types[findex]->name);
+    snprintf(tmp_link, sizeof(tmp_link), "%s.tmp", link_path);
+    unlink(tmp_link);
+    if (symlink(strrchr(gen_path, '/') + 1, tmp_link) != 0 ||
+        rename(tmp_link, link_path) != 0) {
+        fprintf(stderr, "WARNING: Failed to update %s: %s\n", link_path, strerror(errno));
+    }
+
+    generation_queue_ready_batches(findex);
+    compress_policy_check(findex, metrics_now_ns());
+}
+
+static void
+generate_dummy_inotify_bak_event()
+{
+    int i;
+    char cmd[512];
+    char dummy_bak_fname[FILE_ABS_PATH_NAME_LEN];
+    const log_config_t *cfg = config_get();
+
+    for (i = 0; i < cfg->ntypes; i++)
+    {
+        if (!cfg->types[i].enabled) continue;
+
+        snprintf(dummy_bak_fname, sizeof(dummy_bak_fname), 
+            "%s%s.dummy.bak", log_types[i]->dir, log_types[i]->name);
+
+        snprintf(cmd, sizeof(cmd), "touch %s", dummy_bak_fname);
+
+        printf("\n--- Executing dummy bak file creation cmd ---\n%s\n\n", cmd);
+        if (system(cmd) != 0) {
+            perror("ERROR: dummy bak file creation command failed");
+        }
+    }
+}
+
+/* Pending segments of a type, called with its files_lock held */
+static inline uint32_t
+log_pending_segments(int findex)
+{
+    return log_types[findex]->pending.next - log_types[findex]->pending.first;
+}
+
+/* if *.log.0 or pending segments exist 
+     then trigger file rotate
+   else no-op 
+*/
+static void 
+handle_dummy_bak_file_creation(int findex) {
+
+    log_files_lock(findex);
+
+    /* While compressing, the zipper folds log.0 itself when it is done */
+    if (!zip_in_progress(findex) &&
+        (log_slot_exists(findex, 0) || log_pending_segments(findex) > 0)) {
+        /* Rotate existing numbered files */
+        file_rotate(findex);
+    }
+    /* Unlock the Critical section. */
+    log_files_unlock(findex);
+}
+
+/**
+ * fold_pending_into_log_chain()
+ *
+ * Purpose:
+ *   Runs the rotation held back while the type was being compressed:
+ *   log.0 and the pending segments join the numbered chain in one plan
+ *   (only renames). Called by the zipper after the type's last job, with
+ *   the type's files_lock held.
+ */
+static void
+fold_pending_into_log_chain(int findex) {
+
+    if (!log_slot_exists(findex, 0) && log_pending_segments(findex) == 0) return;
+
+    /* Slots the archive left behind are not queued again from here, the
+       next .bak retries them, so a failing archive cannot spin the zipper */
+    file_rotate_sync(findex, false);
+}
+
+/*******************************************************************************
+ *                      FILE COMPRESSION FUNCTIONS
+ ******************************************************************************/
+
+/* Archive list of one compression run: source path and tar member name */
+typedef struct archive_file_list_ {
+    int nfiles;
+    char path[LOG_CONFIG_MAX_FILES + 1][FILE_ABS_PATH_NAME_LEN];
+    char member[LOG_CONFIG_MAX_FILES + 1][MAX_FILENAME * 2];
+    int slot[LOG_CONFIG_MAX_FILES + 1];    /* Numbered slot, -1 for generations */
+} archive_file_list_t;
+
+/*
+ * Adaptive compression level
+ * --------------------------
+ * All state is the zipper's (log_type_t.adapt), only .bak arrivals are
+ * counted by the rotator. Levels are the codec's numeric levels, from
+ * codec_level_range().
+ */
+static double
+monotonic_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+ewma(double avg, double sample)
+{
+    return avg == 0.0 ? sample : avg + ADAPTIVE_EWMA_WEIGHT * (sample - avg);
+}
+
+/* Floor and ceiling of the type's level: compression_level_min, compression_level */
+static void
+adaptive_bounds(const log_type_config_t *tc, int *floor_level, int *ceiling)
+{
+    int min, max, def;
+
+    codec_level_range(tc->codec, &min, &max, &def);
+    *ceiling = tc->compression_level == CODEC_LEVEL_DEFAULT ? def : tc->compression_level;
+    *floor_level = tc->compression_level_min == CODEC_LEVEL_DEFAULT ? min :
+                   tc->compression_level_min;
+    if (*floor_level > *ceiling) *floor_level = *ceiling;
+}
+
+/* Queues an archive written below the ceiling for idle recompression */
+static void
+adaptive_remember(log_type_t *t, const char *path, int codec, unsigned dict_id)
+{
+    if (t->adapt.nlowered == ADAPTIVE_RECOMPRESS_MAX) {
+        /* Oldest one loses its chance */
+        memmove(&t->adapt.lowered[0], &t->adapt.lowered[1],
+                (ADAPTIVE_RECOMPRESS_MAX - 1) * sizeof(t->adapt.lowered[0]));
+        t->adapt.nlowered--;
+    }
+    snprintf(t->adapt.lowered[t->adapt.nlowered].path,
+             sizeof(t->adapt.lowered[0].path), "%s", path);
+    t->adapt.lowered[t->adapt.nlowered].codec = codec;
+    t->adapt.lowered[t->adapt.nlowered].dict_id = dict_id;
+    t->adapt.nlowered++;
+}
+
+/**
+ * adaptive_level_next()
+ *
+ * Purpose:
+ *   Picks the level of the type's next archive, starting at the ceiling.
+ *
+ *   - Backlog (jobs queued behind this one, pending segments staged):
+ *     halves the distance to the floor
+ *   - Archives slower than ADAPTIVE_BUSY_FRACTION of the time max_files
+ *     .bak files take to arrive: one step down
+ *   - Faster than ADAPTIVE_IDLE_FRACTION of it: one step up
+ *
+ *   The band in between holds the level, so it does not flap between two
+ *   neighbours. Each move is counted in level_lowered / level_raised.
+ */
+static int
+adaptive_level_next(int file_idx, const log_type_config_t *tc)
+{
+    log_type_t *t = log_types[file_idx];
+    uint64_t arrivals = atomic_load(&t->bak_arrivals);
+    double now = monotonic_secs(), budget;
+    int floor_level, ceiling, level;
+    unsigned backlog;
+
+    adaptive_bounds(tc, &floor_level, &ceiling);
+
+    if (!t->adapt.started) {
+        t->adapt.started = true;
+        t->adapt.level = ceiling;
+        t->adapt.arrivals = arrivals;
+        t->adapt.sampled_at = now;
+    } else if (arrivals > t->adapt.arrivals) {
+        t->adapt.bak_interval = ewma(t->adapt.bak_interval,
+                                     (now - t->adapt.sampled_at) /
+                                     (double)(arrivals - t->adapt.arrivals));
+        t->adapt.arrivals = arrivals;
+        t->adapt.sampled_at = now;
+    }
+
+    log_files_lock(file_idx);
+    backlog = (unsigned)zipper_queue_depth(file_idx) + log_pending_segments(file_idx);
+    log_files_unlock(file_idx);
+
+    /* Bounds may have moved with a reload */
+    level = t->adapt.level;
+    if (level > ceiling) level = ceiling;
+    if (level < floor_level) level = floor_level;
+
+    budget = tc->max_files * t->adapt.bak_interval;
+    if (backlog > 0) {
+        level = floor_level + (level - floor_level) / 2;
+    } else if (budget > 0.0 && t->adapt.job_secs > 0.0) {
+        if (t->adapt.job_secs > budget * ADAPTIVE_BUSY_FRACTION && level > floor_level) {
+            level--;
+        } else if (t->adapt.job_secs < budget * ADAPTIVE_IDLE_FRACTION && level < ceiling) {
+            level++;
+        }
+    }
+
+    if (level < t->adapt.level) {
+        atomic_fetch_add(&t->level_lowered, 1);
+    } else if (level > t->adapt.level) {
+        atomic_fetch_add(&t->level_raised, 1);
+    }
+    if (level != t->adapt.level) {
+        printf("%s: compression level %d -> %d (backlog %u, job %.3fs, batch %.3fs)\n",
+               t->name, t->adapt.level, level, backlog, t->adapt.job_secs, budget);
+    }
+    t->adapt.level = level;
+    atomic_store(&t->level_current, level);
+    return level;
+}
+
+/**
+ * archive_start_new()
+ *
+ * Purpose:
+ *   Names a new timestamped archive for a type in last_archive and, with
+ *   CTRL_F_DEL_OBSOLETE_TAR_FILES, removes the previous one.
+ *
+ * @param fname  Archive base name (e.g., "ipmgr.log")
+ */
+static void
+archive_start_new(int file_idx, const log_type_config_t *tc, const char *fname, time_t now)
+{
+    /*
+     * Generate timestamp for archive name
+     * Format: YYYY-MM-DD_HH-MM-SS
+     * 
+     * The last archive is remembered separately for each file type
+     * (ipstrc, pdtrc, ipmgr, inttrc), in its log_type_t
+     */
+    char *archive = log_types[file_idx]->last_archive;
+    char timestamp[64];
+    struct tm *tm = localtime(&now);
+    
+    /* Generate timestamp and new archive name */
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H-%M-%S", tm);
+    
+    /* Save old archive name before overwriting */
+    char old_archive[FILE_ABS_PATH_NAME_LEN];
+    memcpy(old_archive, archive, sizeof(old_archive));
+    
+    /* Create new archive name */
+    const char *ext = archive_format_extension(tc->archive_format, tc->codec);
+    int len = snprintf(archive, sizeof(old_archive), "%s%s_%s",
+                       log_types[file_idx]->dir, fname, timestamp);
+
+    /*
+     * A second archive within the same second must not overwrite the
+     * first: it takes the sequence number after the previous archive's
+     * (".1" after none). last_archive is the type's newest archive, also
+     * across a restart, so no probing of the directory is needed.
+     */
+    int seq = 0;
+    if (len > 0 && (size_t)len < sizeof(old_archive) &&
+        strncmp(old_archive, archive, (size_t)len) == 0) {
+        const char *rest = old_archive + len;
+
+        seq = (rest[0] == '.' && isdigit((unsigned char)rest[1])) ? atoi(rest + 1) + 1 : 1;
+    }
+    if (seq > 0) {
+        snprintf(archive, sizeof(old_archive), "%s%s_%s.%d%s",
+                 log_types[file_idx]->dir, fname, timestamp, seq, ext);
+    } else {
+        snprintf(archive, sizeof(old_archive), "%s%s_%s%s",
+                 log_types[file_idx]->dir, fname, timestamp, ext);
+    }
+    log_types[file_idx]->archive_created = now;
+    log_types[file_idx]->archive_size = 0;
+
+    /* Now delete old archive before creating the new one */
+    if ((tc->flags & CTRL_F_DEL_OBSOLETE_TAR_FILES) && 
+            old_archive[0] != '\0' && strcmp(old_archive, archive) != 0) {
+
+        /* Removed by the retention thread, it may already be gone */
+        if (retention_unlink(old_archive) == 0) {
+            printf("Obsolete Archive %s queued for removal\n", old_archive);
+        } else {
+            printf("Obsolete Archive %s Failed to remove: ", old_archive);
+            perror("Archive delete failed");
+        }
+    } else if (log_types[file_idx]->adapt.running_lowered && old_archive[0] != '\0') {
+        /* Finished incremental archive with low level members */
+        adaptive_remember(log_types[file_idx], old_archive,
+                          log_types[file_idx]->adapt.running_codec,
+                          log_types[file_idx]->adapt.running_dict_id);
+    }
+    log_types[file_idx]->adapt.running_lowered = false;
+}
+
+/*
+ * Incremental mode: true when the next batch can go to the running archive
+ * of the type. It must be ours (same format, unchanged since our last
+ * append) and below the size and age caps.
+ */
+static bool
+archive_running_usable(int file_idx, const log_type_config_t *tc, time_t now)
+{
+    const log_type_t *t = log_types[file_idx];
+    const char *ext = archive_format_extension(tc->archive_format, tc->codec);
+    size_t len = strlen(t->last_archive), ext_len = strlen(ext);
+    struct stat st;
+
+    /* Same format and codec as configured now */
+    if (len <= ext_len || strcmp(t->last_archive + len - ext_len, ext) != 0) {
+        return false;
+    }
+    /* ".tar.gz" and ".seek.gz" also end with ".gz" */
+    for (int f = 0; f < ARCHIVE_FMT_COUNT; f++) {
+        const char *other = archive_format_extension(f, tc->codec);
+        size_t other_len = strlen(other);
+
+        if (other_len > ext_len && len > other_len &&
+            strcmp(t->last_archive + len - other_len, other) == 0) {
+            return false;
+        }
+    }
+    if (tc->archive_max_size && t->archive_size >= tc->archive_max_size) return false;
+    if (tc->archive_max_age && now - t->archive_created >= tc->archive_max_age) return false;
+
+    return stat(t->last_archive, &st) == 0 && (uint64_t)st.st_size == t->archive_size;
+}
+
+/* Writes a trained dictionary to <dir><type>.zdict.<id>, atomically */
+static int
+zstd_dict_save(int file_idx, const void *dict, size_t len)
+{
+    char path[FILE_ABS_PATH_NAME_LEN], tmp[FILE_ABS_PATH_NAME_LEN + 8];
+    const unsigned char *p = dict;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s%s.zdict.%08x", log_types[file_idx]->dir,
+             log_types[file_idx]->name, codec_dictionary_id(dict, len));
+    snprintf(tmp, sizeof(tmp), "%s.part", path);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto fail;
+        p += n;
+        len -= (size_t)n;
+    }
+    /* Archives are unreadable without it: on disk before any archive uses it */
+    if (fsync(fd) < 0 || close(fd) < 0) {
+        fd = -1;
+        goto fail;
+    }
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    printf("zstd dictionary saved: %s\n", path);
+    return 0;
+
+fail:
+    if (fd >= 0) close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+/**
+ * zstd_dict_refresh()
+ *
+ * Purpose:
+ *   Keeps the zstd dictionary of a type current: on its first archive and
+ *   then every ZSTD_DICT_RETRAIN_ARCHIVES archives, trains a new one from
+ *   samples spread evenly over the files about to be archived. On any
+ *   failure the previous dictionary (or none) stays in use.
+ */
+static void
+zstd_dict_refresh(int file_idx, const archive_file_list_t *files)
+{
+    log_type_t *t = log_types[file_idx];
+    unsigned max_samples = ZSTD_DICT_TRAIN_BYTES / ZSTD_DICT_SAMPLE_LEN;
+    unsigned per_file, nsamples = 0;
+    unsigned char *samples = NULL, *dict = NULL;
+    size_t *sizes = NULL, used = 0, dict_len;
+
+    if (t->dict.archives++ % ZSTD_DICT_RETRAIN_ARCHIVES != 0 || files->nfiles == 0) {
+        return;
+    }
+
+    samples = malloc(ZSTD_DICT_TRAIN_BYTES);
+    sizes = malloc(max_samples * sizeof(*sizes));
+    dict = malloc(ZSTD_DICT_CAPACITY);
+    if (!samples || !sizes || !dict) goto out;
+
+    per_file = max_samples / (unsigned)files->nfiles;
+    if (per_file == 0) per_file = 1;
+
+    for (int i = 0; i < files->nfiles && nsamples < max_samples; i++) {
+        int fd = open(files->path[i], O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if (fd < 0) continue;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            off_t step = st.st_size / per_file;
+
+            if (step < ZSTD_DICT_SAMPLE_LEN) step = ZSTD_DICT_SAMPLE_LEN;
+            for (off_t off = 0; off < st.st_size && nsamples < max_samples; off += step) {
+                ssize_t n = pread(fd, samples + used, ZSTD_DICT_SAMPLE_LEN, off);
+
+                if (n <= 0) break;
+                sizes[nsamples++] = (size_t)n;
+                used += (size_t)n;
+            }
+        }
+        close(fd);
+    }
+
+    dict_len = codec_train_dictionary(dict, ZSTD_DICT_CAPACITY, samples, sizes, nsamples);
+    if (dict_len == 0) {
+        /* Typically too little data yet, retried after the next period */
+        fprintf(stderr, "WARNING: %s: zstd dictionary training failed (%u samples)\n",
+                t->name, nsamples);
+        goto out;
+    }
+    if (zstd_dict_save(file_idx, dict, dict_len) < 0) {
+        perror("WARNING: cannot save zstd dictionary");
+        goto out;
+    }
+
+    free(t->dict.buf);
+    t->dict.buf = dict;
+    t->dict.len = dict_len;
+    dict = NULL;
+
+out:
+    free(samples);
+    free(sizes);
+    free(dict);
+}
+
+/**
+ * archive_log_files()
+ *
+ * Purpose:
+ *   Writes the collected files of one file type into a new timestamped
+ *   archive, removes the previous archive of that type and, on success,
+ *   the source files. Shared by both rotation modes.
+ *
+ *   With CTRL_F_INCREMENTAL_ARCHIVE the files are appended to the running
+ *   archive of the type as one new gzip member instead, so what is already
+ *   archived is never read or compressed again. A new archive is started
+ *   when the running one reaches archive_max_size or archive_max_age.
+ *
+ *   The type's codec comes from its configuration; zstd with a dictionary
+ *   refreshes the dictionary from this batch first. With adaptive_level
+ *   the level is the controller's choice, and an archive written below
+ *   the configured level is remembered for idle recompression.
+ *
+ * @param fname  Archive base name (e.g., "ipmgr.log")
+ */
+static void
+archive_log_files(archive_writer_t *aw, int file_idx, const char *fname,
+                  const archive_file_list_t *files)
+{
+    char *archive = log_types[file_idx]->last_archive;
+    const log_type_config_t *tc = type_config(file_idx);
+    bool incremental = tc->flags & CTRL_F_INCREMENTAL_ARCHIVE;
+    time_t now = time(NULL);
+    double started = monotonic_secs();
+    uint64_t started_ns = metrics_now_ns();
+    codec_params_t codec = {
+        .codec = tc->codec,
+        .level = tc->compression_level,
+        .long_mode = tc->zstd_long,
+    };
+    int floor_level, ceiling = 0;
+    int rc;
+
+    if (tc->codec == CODEC_ZSTD && tc->zstd_dictionary) {
+        zstd_dict_refresh(file_idx, files);
+        codec.dict = log_types[file_idx]->dict.buf;
+        codec.dict_len = log_types[file_idx]->dict.len;
+    }
+    if (tc->adaptive_level) {
+        adaptive_bounds(tc, &floor_level, &ceiling);
+        codec.level = adaptive_level_next(file_idx, tc);
+    }
+
+    bool append = incremental && archive_running_usable(file_idx, tc, now);
+    if (!append) {
+        archive_start_new(file_idx, tc, fname, now);
+    }
+
+    /* Stream all collected files into the archive */
+    if (incremental) {
+        printf("\n--- Appending to Archive %s ---\n", archive);
+        rc = archive_writer_open_append(aw, archive, tc->archive_format, &codec);
+        if (rc < 0 && append) {
+            /* Not an archive we can extend after all: start a new one */
+            perror("WARNING: cannot append to running archive");
+            archive_start_new(file_idx, tc, fname, now);
+            rc = archive_writer_open_append(aw, archive, tc->archive_format, &codec);
+        }
+    } else {
+        printf("\n--- Writing Archive %s ---\n", archive);
+        rc = archive_writer_open(aw, archive, tc->archive_format, &codec);
+    }
+    if (rc < 0) {
+        perror("ERROR: archive creation failed");
+        metrics_add(MC_ARCHIVE_FAILURES, 1);
+        return;
+    }
+
+    bool added[LOG_CONFIG_MAX_FILES + 1];
+
+    for (int i = 0; i < files->nfiles; i++) {
+        added[i] = true;
+        if (archive_writer_add_file(aw, files->path[i], files->member[i]) < 0) {
+            if (errno == ENOENT) {
+                /* Listed from the cache but gone: skip it */
+                printf("   Missing: %s\n", files->path[i]);
+                added[i] = false;
+                if (files->slot[i] >= 0) log_slot_stale(file_idx, files->slot[i]);
+                continue;
+            }
+            if (errno == ECANCELED) {
+                /* Fast stop: the files stay, the next startup archives them */
+                printf("Archive %s abandoned for shutdown\n", archive);
+                archive_writer_abort(aw);
+                return;
+            }
+            perror("ERROR: adding file to archive failed");
+            archive_writer_abort(aw);
+            metrics_add(MC_ARCHIVE_FAILURES, 1);
+            return;
+        }
+    }
+
+    if (archive_writer_close(aw) < 0) {
+        perror("ERROR: archive finalization failed");
+        metrics_add(MC_ARCHIVE_FAILURES, 1);
+        return;
+    }
+    metrics_record(MH_ARCHIVE, metrics_now_ns() - started_ns);
+    metrics_record(MH_ARCHIVE_SIZE, aw->bytes_out);
+    metrics_add(MC_ARCHIVES, 1);
+    metrics_add(MC_ARCHIVE_BYTES_IN, aw->bytes_in);
+    metrics_add(MC_ARCHIVE_BYTES_OUT, aw->bytes_out);
+
+    printf("\n[SUCCESS] Archive created: %s (%llu -> %llu bytes)\n\n", archive,
+           (unsigned long long)aw->bytes_in, (unsigned long long)aw->bytes_out);
+    log_types[file_idx]->archive_size = aw->archive_size;
+    retention_track(archive, file_idx, aw->archive_size, log_types[file_idx]->archive_created);
+
+    if (tc->adaptive_level) {
+        log_type_t *t = log_types[file_idx];
+
+        t->adapt.job_secs = ewma(t->adapt.job_secs, monotonic_secs() - started);
+        /* A recompressed seekable archive would lose its frames and index */
+        if (codec.level < ceiling && tc->archive_format != ARCHIVE_FMT_SEEKABLE) {
+            unsigned dict_id = codec.dict ? codec_dictionary_id(codec.dict, codec.dict_len) : 0;
+
+            if (incremental) {
+                /* Remembered once the archive is finished */
+                t->adapt.running_lowered = true;
+                t->adapt.running_codec = codec.codec;
+                t->adapt.running_dict_id = dict_id;
+            } else {
+                adaptive_remember(t, archive, codec.codec, dict_id);
+            }
+        }
+    }
+
+    /* Remove original files after successful archive creation */
+    if (tc->flags & CTRL_F_DELETE_OBSOLETE_LOG_FILES) {
+
+        printf("--- Cleaning Up Original Files ---\n");
+
+        for (int i = 0; i < files->nfiles; i++) {
+            if (!added[i]) continue;
+            if (remove(files->path[i]) == 0) {
+                printf("   Deleted: %s\n", files->path[i]);
+            } else {
+                perror(files->path[i]);
+            }
+            if (files->slot[i] >= 0) log_slot_clear(file_idx, files->slot[i]);
+        }
+    }
+}
+
+/**
+ * compress_all_log_files_with_name()
+ * 
+ * Purpose:
+ *   Compresses all numbered log files (log.1 to log.N) into a single
+ *   timestamped tar.gz archive, then deletes the original files.
+ *
+ * Input:
+ *   aw: archive writer owned by the zipper thread (buffers are reused)
+ *   file_idx: file type index carried by the job
+ *   terminal_fname_param: path to the highest numbered log file (e.g., "var/log/ipmgr.log.5")
+ *
+ * Process:
+ *   1. Parse filename to extract the maximum index
+ *   2. Collect all numbered files that exist, including any above the
+ *      maximum index left over from a larger max_files before a reload
+ *   3. Hand them to archive_log_files() which creates the timestamped
+ *      archive, deletes the old archive and the original files
+ *
+ * Example:
+ *   Input:  terminal_fname = "var/log/ipmgr.log.5"
+ *   Output: var/log/ipmgr_2025-12-31_14-30-45.tar.gz
+ *           (contains ipmgr.log.1, ipmgr.log.2, ..., ipmgr.log.5)
+ */
+static void 
+compress_all_log_files_with_name(archive_writer_t *aw, int file_idx,
+                                 const char *terminal_fname_param)
+{
+    int max_index = 0;
+    char fname[MAX_FILENAME + 8];   /* Filename without path and number */
+    const char *name = terminal_fname_param;
+    archive_file_list_t *files;
+
+    printf("%s() : File compression triggered by creation of %s\n", __FUNCTION__, name);
+
+    /*
+     * Parse the file number from the end of the filename
+     * Example: "var/log/ipmgr.log.5" -> max_index = 5
+     */
+    char *last_dot = strrchr(name, '.');
+    if (!last_dot || sscanf(last_dot + 1, "%d", &max_index) != 1) {
+        fprintf(stderr, "ERROR: Invalid file format: %s (expected base.number)\n", name);
+        return;
+    }
+
+    /* The job carries the file type, e.g. "ipmgr.log" */
+    snprintf(fname, sizeof(fname), "%s.log", log_types[file_idx]->name);
+
+    files = malloc(sizeof(*files));
+    if (!files) {
+        fprintf(stderr, "ERROR: Out of memory collecting %s\n", name);
+        return;
+    }
+
+    /*
+     * Collect the numbered files to archive. Members are stored without
+     * the directory part, as "tar -C <watch dir>" used to do. While this
+     * job is pending the rotator leaves every slot above log.0 alone.
+     */
+    files->nfiles = 0;
+    printf("\n--- Collecting Files for Archive ---\n");
+    for (int i = 1; i <= LOG_CONFIG_MAX_FILES; i++) {
+        int n = files->nfiles;
+
+        if (!log_slot_exists(file_idx, i)) {
+            if (i <= max_index) printf("   Missing: %s.%d\n", fname, i);
+            continue;
+        }
+
+        snprintf(files->member[n], sizeof(files->member[n]), "%s.%d", fname, i);
+        snprintf(files->path[n], sizeof(files->path[n]), "%s%s.%d", 
+                 log_types[file_idx]->dir, fname, i);
+        printf("   Found: %s\n", files->path[n]);
+        files->slot[n] = i;
+        files->nfiles++;
+    }
+
+    /* Exit if no files found */
+    if (files->nfiles == 0) {
+        printf("Nothing to archive.\n");
+    } else {
+        archive_log_files(aw, file_idx, fname, files);
+    }
+    free(files);
+}
+
+/**
+ * compress_log_generations()
+ *
+ * Purpose:
+ *   Generation mode counterpart of compress_all_log_files_with_name().
+ *   Archives generations [first_gen, first_gen + ngens) of one type. Tar
+ *   members get the numbered names shift mode would have produced (newest
+ *   generation is log.1), so archive contents do not depend on the mode.
+ */
+static void
+compress_log_generations(archive_writer_t *aw, const comp_job_t *job)
+{
+    int findex = job->findex;
+    char fname[MAX_FILENAME + 8];
+    archive_file_list_t *files = malloc(sizeof(*files));
+
+    snprintf(fname, sizeof(fname), "%s.log", log_types[findex]->name);
+
+    if (!files) {
+        /* Range stays on disk, reported and skipped */
+        fprintf(stderr, "ERROR: Out of memory collecting %s generations\n", fname);
+    } else {
+        files->nfiles = 0;
+        for (uint32_t i = 0; i < job->ngens && i < LOG_CONFIG_MAX_FILES; i++) {
+            uint64_t gen = job->first_gen + job->ngens - 1 - i;   /* newest first */
+            int n = files->nfiles;
+
+            snprintf(files->member[n], sizeof(files->member[n]), "%s.%u", fname, i + 1);
+            log_generation_path(files->path[n], sizeof(files->path[n]), findex, gen);
+
+            /* Every generation in the range exists unless removed externally,
+               archive_log_files() skips the ones that are gone */
+            files->slot[n] = -1;
+            files->nfiles++;
+        }
+
+        if (files->nfiles == 0) {
+            printf("Nothing to archive.\n");
+        } else {
+            archive_log_files(aw, findex, fname, files);
+        }
+        free(files);
+    }
+
+    /* Archived generations are no longer live */
+    log_files_lock(findex);
+    if (log_types[findex]->gen.oldest_gen < job->first_gen + job->ngens) {
+        log_types[findex]->gen.oldest_gen = job->first_gen + job->ngens;
+    }
+    log_files_unlock(findex);
+}
+
+/**
+ * zip_job_complete()
+ *
+ * Purpose:
+ *   Retires finished shift mode jobs of a type and, once the type has no
+ *   more pending jobs, folds the pending segments staged meanwhile back
+ *   into the rotation chain. Only this type's lock is taken, for one
+ *   rotation's renames.
+ *
+ * @param njobs  Jobs finished since the last call
+ */
+static void
+zip_job_complete(int findex, unsigned njobs)
+{
+    log_files_lock(findex);
+    if (atomic_load(&log_types[findex]->jobs_pending) == njobs) {
+        fold_pending_into_log_chain(findex);
+    }
+    /* Last pending job done: rotator goes back to normal rotation */
+    atomic_fetch_sub(&log_types[findex]->jobs_pending, njobs);
+    log_files_unlock(findex);
+}
+
+/**
+ * zipper_report_done()
+ *
+ * Purpose:
+ *   Tells the rotator of the type's shard that one more shift mode job is
+ *   done. Types already reported and not yet picked up just count up, so
+ *   a type sits on the completion ring at most once.
+ */
+static void
+zipper_report_done(int findex)
+{
+    log_type_t *t = log_types[findex];
+    log_shard_t *shard = log_shards[t->shard];
+    uint64_t one = 1;
+
+    if (atomic_fetch_add(&t->jobs_done, 1) != 0) {
+        return;     /* Already reported, the rotator will take this one too */
+    }
+    if (!lf_ring_push(&shard->completions, &findex)) {
+        /* Cannot happen: the ring holds every type at once */
+        fprintf(stderr, "ERROR: completion ring full for %s\n", shard->dir);
+        zip_job_complete(findex, atomic_exchange(&t->jobs_done, 0));
+        return;
+    }
+    if (write(shard->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("ERROR: eventfd write failed");
+    }
+}
+
+/**
+ * zip_run_job()
+ *
+ * Purpose:
+ *   Executes one compression job. A shift mode job reports completion to
+ *   the rotator, which folds the pending segments staged meanwhile back
+ *   into the rotation chain.
+ */
+static void
+zip_run_job(archive_writer_t *aw, const comp_job_t *job)
+{
+    int findex = job->findex;
+
+    if (job->ngens) {
+        /* Generation mode: the job owns a fixed generation range, new
+           .bak files keep getting fresh generations meanwhile */
+        compress_log_generations(aw, job);
+        log_files_lock(findex);
+        atomic_fetch_sub(&log_types[findex]->jobs_pending, 1);
+        log_files_unlock(findex);
+        atomic_fetch_add(&log_types[findex]->jobs_completed, 1);
+        return;
+    }
+
+    /* No lock here: while jobs_pending is set the rotator leaves
+       log.1..log.N of this type alone and stages pending segments instead */
+    compress_all_log_files_with_name(aw, findex, job->terminal_fname);
+
+    #if 0
+    /* Generate dummy bak log file to handle .log.0 file created
+        while the zipper thread was busy compressing logs. This will generate 
+        inotify event which guide log rotator thread to perform one more log 
+        rotation to rename .log.0 file to .log.1 through file rotation. IF we dont
+        do this, user may see ipstrc.log.0 file in /var/log dir which would persists
+        until next .bak create event. ipstrc.log.0 is transient file and must not
+        exist persistently. We use dummy event to avoid extra thread sync headache.
+        Here, zipper thread is signaling the log rotator thread indirectly. */
+
+        generate_dummy_inotify_bak_event ();
+
+    #else
+        
+        /* Alternate Approach : seems better than above approach.
+           A completion event on the shard's eventfd, the rotator
+           renames log.0 and the pending segments itself */
+        zipper_report_done(findex);
+    
+    #endif 
+
+    atomic_fetch_add(&log_types[findex]->jobs_completed, 1);
+}
+
+/**
+ * adaptive_recompress_one()
+ *
+ * Purpose:
+ *   Rewrites the oldest archive of the type that the adaptive level wrote
+ *   below its ceiling, at the ceiling. Called by an idle zipper owning the
+ *   type. Archives gone, of another codec than the one configured now or
+ *   needing a dictionary no longer at hand are dropped from the list.
+ *
+ * @return true if an archive was taken off the list, whatever the outcome
+ */
+static bool
+adaptive_recompress_one(archive_writer_t *aw, int file_idx)
+{
+    log_type_t *t = log_types[file_idx];
+    const log_type_config_t *tc = type_config(file_idx);
+    codec_params_t from = { .level = CODEC_LEVEL_DEFAULT }, to;
+    char path[FILE_ABS_PATH_NAME_LEN];
+    int codec, floor_level, ceiling, rc;
+    unsigned dict_id;
+    struct stat st;
+
+    if (t->adapt.nlowered == 0) return false;
+
+    memcpy(path, t->adapt.lowered[0].path, sizeof(path));
+    codec = t->adapt.lowered[0].codec;
+    dict_id = t->adapt.lowered[0].dict_id;
+    t->adapt.nlowered--;
+    memmove(&t->adapt.lowered[0], &t->adapt.lowered[1],
+            t->adapt.nlowered * sizeof(t->adapt.lowered[0]));
+
+    if (codec != tc->codec) return true;
+    from.codec = codec;
+    if (dict_id) {
+        if (!t->dict.buf || codec_dictionary_id(t->dict.buf, t->dict.len) != dict_id) {
+            return true;
+        }
+        from.dict = t->dict.buf;
+        from.dict_len = t->dict.len;
+    }
+
+    adaptive_bounds(tc, &floor_level, &ceiling);
+    to = from;
+    to.level = ceiling;
+    to.long_mode = tc->zstd_long;
+
+    if (stat(path, &st) < 0) return true;   /* Removed as obsolete meanwhile */
+
+    rc = archive_recompress(aw, path, &from, &to);
+    if (rc < 0 && errno != ECANCELED) {
+        perror("WARNING: archive recompression failed");
+    } else if (rc > 0) {
+        atomic_fetch_add(&t->archives_recompressed, 1);
+        atomic_fetch_add(&t->recompress_saved_bytes, (uint64_t)st.st_size - aw->bytes_out);
+        retention_resize(path, aw->bytes_out);
+        printf("Recompressed %s at level %d: %lld -> %llu bytes\n", path, ceiling,
+               (long long)st.st_size, (unsigned long long)aw->bytes_out);
+    }
+    return true;
+}
+
+/**
+ * zip_idle_recompress()
+ *
+ * Purpose:
+ *   Idle zipper work: recompresses one low level archive of the first
+ *   type that has one. The type is claimed through .scheduled like a run
+ *   queue entry, so no job of it runs meanwhile; jobs queued while it is
+ *   claimed are scheduled on release, as after a job.
+ *
+ * @return true if an archive was processed
+ */
+static bool
+zip_idle_recompress(archive_writer_t *aw)
+{
+    int n = atomic_load(&num_log_types);
+
+    for (int i = 0; i < n; i++) {
+        bool expected = false;
+        bool done = false;
+
+        if (!atomic_compare_exchange_strong(&log_types[i]->scheduled, &expected, true)) {
+            continue;   /* Being compressed or about to be */
+        }
+        if (zipper_queue_depth(i) == 0) {
+            done = adaptive_recompress_one(aw, i);
+        }
+        atomic_store(&log_types[i]->scheduled, false);
+        if (zipper_queue_depth(i) > 0) {
+            zipper_schedule(i);
+        }
+        if (done) return true;
+    }
+    return false;
+}
+
+/**
+ * zip_log_file_thread_fn()
+ * 
+ * Purpose:
+ *   Zipper worker. Several of them share zipper_run_queue: each wakeup pops
+ *   the next file type, runs exactly one of its jobs and puts the type back
+ *   at the tail of the run queue if it still has work. A slow archive of
+ *   one type therefore never holds back the jobs of another type.
+ *
+ * Thread Safety:
+ *   - A type is on the run queue at most once, so its job queue only ever
+ *     has a single consumer (MPSC)
+ *   - jobs_pending tells the rotator which types are being compressed
+ *
+ * Stopping:
+ *   Exits once zippers_exit is set and the run queue is empty, without
+ *   running the queued jobs when zip_cancel is set too
+ */
+static void *
+zip_log_file_thread_fn(void *arg)
+{
+    (void)arg;  /* Unused parameter */
+    archive_writer_t aw;
+    comp_job_t job;
+    int findex;
+    char name[METRICS_THREAD_NAME_LEN];
+
+    snprintf(name, sizeof(name), "zipper %u", atomic_fetch_add(&zipper_threads_named, 1));
+    metrics_thread_attach(name);
+    diag_thread_name(name);
+
+    /* Archive writer buffers are allocated once and reused for every job */
+    if (archive_writer_init(&aw) < 0) {
+        perror("ERROR: archive writer init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Spread each archive over the compression pool (serial if single core) */
+    if (archive_writer_set_pool(&aw, compress_pool) < 0) {
+        perror("WARNING: parallel compression unavailable");
+    }
+
+    /* A fast stop abandons the archive being written */
+    archive_writer_set_cancel(&aw, &zip_cancel);
+
+    /* Signal that thread initialization is complete */
+    sem_post(&wait_for_thread_init);
+
+    /* Main work loop */
+    int idle_secs = ADAPTIVE_IDLE_SECS;
+
+    while (1) {
+        struct timespec deadline;
+        uint64_t wait_start = metrics_now_ns();
+
+        /* Fast stop: queued jobs are left to the next startup */
+        if (atomic_load(&zippers_exit) && atomic_load(&zip_cancel)) break;
+
+        /* Wait for compression request. Idle time goes to recompressing
+           archives the adaptive level wrote low, one at a time while
+           there are some, never once stopping */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += idle_secs;
+        if (sem_timedwait(&wake_up_zipper_thread, &deadline) < 0) {
+            if (atomic_load(&zippers_exit)) break;
+            if (errno == ETIMEDOUT) {
+                idle_secs = zip_idle_recompress(&aw) ? 0 : ADAPTIVE_IDLE_SECS;
+            }
+            continue;
+        }
+        metrics_record(MH_ZIPPER_WAIT, metrics_now_ns() - wait_start);
+        idle_secs = ADAPTIVE_IDLE_SECS;
+
+        if (!lf_ring_pop(&zipper_run_queue, &findex)) {
+            /* Stopping, each worker is posted once more: queue drained */
+            if (atomic_load(&zippers_exit)) break;
+            continue;   /* Another worker took it */
+        }
+
+        /* The type is ours until it is unscheduled or requeued */
+        if (lf_ring_pop(&log_types[findex]->jobs, &job)) {
+            zip_run_job(&aw, &job);
+        }
+
+        /* Unschedule, then re-check: a producer may have queued a job
+           while .scheduled was still set and skipped the run queue */
+        atomic_store(&log_types[findex]->scheduled, false);
+        if (zipper_queue_depth(findex) > 0) {
+            zipper_schedule(findex);
+        }
+    }
+    
+    archive_writer_destroy(&aw);
+    return NULL;
+}
+
+/*******************************************************************************
+ *                      LOG ROTATION FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * file_rotate_plan()
+ * 
+ * Purpose:
+ *   Plans the rotation of numbered log files by incrementing their numbers.
+ *   When the maximum number of files is reached, the completion signals the
+ *   zipper thread. Called with the type's files_lock held, which stays held
+ *   until file_rotate_complete().
+ *
+ * Process:
+ *   1. Delete oldest file (log.N) if it exists
+ *   2. Rename files backwards: log.N-1 -> log.N, ..., log.0 -> log.1
+ *   3. If log.N-1 was renamed to log.N, signal zipper to compress
+ *
+ *   N is the type's max_files. Slots at or above N found in step 1 that
+ *   were never archived (a failed archive, or a reload lowering max_files)
+ *   are queued for compression instead of being deleted, and the shift
+ *   waits for that job: log.0 is folded in when it completes.
+ *
+ *   With S pending segments the chain shifts by S (+1 for log.0) in the
+ *   same pass and the segments take the freed slots, newest as log.1.
+ *   Every file landing at or above log.N is archived by one job.
+ *
+ * Example:
+ *   Before: log.0, log.1, log.2, log.3, log.4
+ *   After:  log.1, log.2, log.3, log.4, log.5
+ *           (and log.5 gets queued for compression)
+ *
+ *   Before: log.0, log.1, log.2, log.0.1, log.0.2 (max_files 5)
+ *   After:  log.1 (was log.0.2), log.2 (log.0.1), log.3 (log.0),
+ *           log.4, log.5 (and log.5 gets queued for compression)
+ *
+ * @param file_idx          File type index (e.g., of "ipmgr")
+ * @param queue_unarchived  Queue unarchived slots of step 1 for compression
+ * @return false when there is nothing to run (plan->nops == 0)
+ */
+static bool
+file_rotate_plan(int file_idx, rotate_plan_t *plan, bool queue_unarchived)
+{
+    const log_type_config_t *tc = type_config(file_idx);
+    const char *name = log_types[file_idx]->name;
+    uint32_t seg_first = log_types[file_idx]->pending.first;
+    uint32_t nsegs = log_pending_segments(file_idx);
+    int max_files = tc->max_files;
+    int has_log0 = log_slot_exists(file_idx, 0);
+    int shift;
+    rotate_op_t *op;
+
+    plan->findex = file_idx;
+    plan->max_files = max_files;
+    plan->segments_end = seg_first;
+    plan->nops = 0;
+
+    /* The shifted chain must stay within LOG_CONFIG_MAX_FILES (a reload
+       may have raised max_files since staging): newer segments wait */
+    if (nsegs > (uint32_t)(LOG_CONFIG_MAX_FILES + 1 - max_files - has_log0)) {
+        nsegs = (uint32_t)(LOG_CONFIG_MAX_FILES + 1 - max_files - has_log0);
+    }
+    if (nsegs > PENDING_SEGMENTS_MAX) nsegs = PENDING_SEGMENTS_MAX;
+    shift = (int)nsegs + (has_log0 || nsegs == 0);
+
+    /* Delete the oldest file if it exists (e.g., ipmgr.log.5) */
+    for (int i = max_files; i <= LOG_CONFIG_MAX_FILES; i++) {
+        if (!log_slot_exists(file_idx, i)) continue;
+
+        if (tc->flags & CTRL_F_DELETE_OBSOLETE_LOG_FILES) {
+            /* Archiving would have removed it: not archived yet */
+            char old_name[FILE_ABS_PATH_NAME_LEN];
+
+            if (queue_unarchived) {
+                snprintf(old_name, sizeof(old_name), "%s%s.log.%d",
+                         log_types[file_idx]->dir, name, i);
+                zipper_enqueue_job(file_idx, old_name, 0, 0);
+            }
+            plan->nops = 0;
+            return false;
+        }
+
+        op = &plan->ops[plan->nops++];
+        op->from = i;
+        op->to = -1;
+        op->res = ROTATE_OP_PENDING;
+        snprintf(op->old_name, sizeof(op->old_name), "%s.log.%d", name, i);
+    }
+
+    /* 
+     * Rotate files backwards (N-1 -> N, N-2 -> N-1, ..., 0 -> 1)
+     * This makes room for the new log.0 file. Only slots the cache
+     * knows to exist cost a syscall.
+     */
+    for (int i = max_files - 1; i >= 0; i--) {
+        if (!log_slot_exists(file_idx, i)) continue;
+
+        op = &plan->ops[plan->nops++];
+        op->from = i;
+        op->to = i + shift;
+        op->res = ROTATE_OP_PENDING;
+        snprintf(op->old_name, sizeof(op->old_name), "%s.log.%d", name, i);
+        snprintf(op->new_name, sizeof(op->new_name), "%s.log.%d", name, i + shift);
+    }
+
+    /* Pending segments into the slots just freed, oldest highest */
+    for (uint32_t k = 0; k < nsegs; k++) {
+        op = &plan->ops[plan->nops++];
+        op->from = ROTATE_FROM_SEGMENT;
+        op->to = (int)(nsegs - k);
+        op->res = ROTATE_OP_PENDING;
+        snprintf(op->old_name, sizeof(op->old_name), "%s.log.0.%u", name, seg_first + k);
+        snprintf(op->new_name, sizeof(op->new_name), "%s.log.%d", name, op->to);
+    }
+    plan->segments_end = seg_first + nsegs;
+
+    return plan->nops > 0;
+}
+
+/* Runs the operations of a plan not executed yet with plain syscalls */
+static void
+file_rotate_run_sync(int dir_fd, rotate_plan_t *plan)
+{
+    for (int i = 0; i < plan->nops; i++) {
+        rotate_op_t *op = &plan->ops[i];
+        int rc;
+
+        if (op->res != ROTATE_OP_PENDING) continue;
+
+        if (op->to < 0) {
+            rc = unlinkat(dir_fd, op->old_name, 0);
+        } else {
+            rc = renameat(dir_fd, op->old_name, dir_fd, op->new_name);
+        }
+        op->res = rc == 0 ? 0 : -errno;
+    }
+}
+
+/**
+ * file_rotate_complete()
+ *
+ * Purpose:
+ *   Applies the results of an executed plan: slot cache, messages and the
+ *   compression job when log.N was just created. Called with the type's
+ *   files_lock held.
+ */
+static void
+file_rotate_complete(const rotate_plan_t *plan)
+{
+    int file_idx = plan->findex;
+    const char *dir = log_types[file_idx]->dir;
+    int zip_slot = 0;
+
+    /* Folded segments leave the list whatever their rename gave */
+    if (plan->segments_end != log_types[file_idx]->pending.first) {
+        log_types[file_idx]->pending.first = plan->segments_end;
+        atomic_fetch_add(&pending_segments_folds, 1);
+    }
+
+    for (int i = 0; i < plan->nops; i++) {
+        const rotate_op_t *op = &plan->ops[i];
+
+        if (op->to < 0) {
+            if (op->res == 0) {
+                printf("Deleted oldest file: %s%s\n", dir, op->old_name);
+            }
+            log_slot_clear(file_idx, op->from);
+            continue;
+        }
+
+        if (op->res == 0) {
+            if (op->from != ROTATE_FROM_SEGMENT) log_slot_clear(file_idx, op->from);
+            log_slot_set(file_idx, op->to);
+            printf("Renamed: %s%s -> %s%s\n", dir, op->old_name, dir, op->new_name);
+
+            /* 
+             * If we just created the highest numbered file (log.N, or
+             * above when segments were folded), mark it for compression
+             */
+            if (op->to >= plan->max_files && op->to > zip_slot) {
+                zip_slot = op->to;
+            }
+        } else {
+            if (op->from != ROTATE_FROM_SEGMENT) log_slot_stale(file_idx, op->from);
+            fprintf(stderr, "Error renaming %s%s to %s%s: %s\n",
+                    dir, op->old_name, dir, op->new_name, strerror(-op->res));
+        }
+    }
+
+    /* Signal zipper thread if maximum files reached */
+    if (zip_slot > 0) {
+        char terminal[FILE_ABS_PATH_NAME_LEN];
+
+        /* Queue the job and wake up a zipper worker */
+        snprintf(terminal, sizeof(terminal), "%s%s.log.%d",
+                 dir, log_types[file_idx]->name, zip_slot);
+        if (zipper_enqueue_job(file_idx, terminal, 0, 0) == 0) {
+            compress_backlog_reset(file_idx);
+        }
+    } else {
+        compress_policy_check(file_idx, metrics_now_ns());
+    }
+}
+
+/**
+ * file_rotate()
+ *
+ * Purpose:
+ *   Rotates the numbered log files of one type right away, with plain
+ *   syscalls (see file_rotate_plan()). Called with the type's files_lock
+ *   held.
+ *
+ * @param file_idx  File type index (e.g., of "ipmgr")
+ */
+static void
+file_rotate(int file_idx)
+{
+    file_rotate_sync(file_idx, true);
+}
+
+static void
+file_rotate_sync(int file_idx, bool queue_unarchived)
+{
+    rotate_plan_t *plan = malloc(sizeof(*plan));
+
+    if (!plan) {
+        fprintf(stderr, "ERROR: Out of memory rotating %s\n", log_types[file_idx]->name);
+        return;
+    }
+    if (file_rotate_plan(file_idx, plan, queue_unarchived)) {
+        uint64_t t0 = metrics_now_ns();
+
+        file_rotate_run_sync(log_shards[log_types[file_idx]->shard]->dir_fd, plan);
+        file_rotate_complete(plan);
+        metrics_record(MH_ROTATE, metrics_now_ns() - t0);
+        metrics_add(MC_ROTATIONS, 1);
+    }
+    free(plan);
+}
+
+/* Submits the prepared SQEs, waits for all of them and records the results */
+static int
+rotate_batch_reap(log_shard_t *shard, unsigned inflight)
+{
+    rotate_batch_t *batch = &shard->batch;
+    struct io_uring_cqe cqe;
+
+    if (uring_submit_and_wait(&shard->ring, inflight) < 0) {
+        /* Unknown state of the ring: syscalls from now on */
+        fprintf(stderr, "ERROR: io_uring submit failed on %s: %s\n",
+                shard->dir, strerror(errno));
+        shard->use_uring = false;
+        return -1;
+    }
+    atomic_fetch_add(&rotate_uring_submits, 1);
+
+    while (uring_pop_cqe(&shard->ring, &cqe)) {
+        batch->plans[cqe.user_data >> 16].ops[cqe.user_data & 0xffff].res = cqe.res;
+    }
+    return 0;
+}
+
+/**
+ * rotate_batch_submit()
+ *
+ * Purpose:
+ *   Executes every plan of the shard's batch. With io_uring, each plan is
+ *   one hard-linked chain of SQEs, run in plan order like the syscall
+ *   path, and all chains go in a single io_uring_enter() that
+ *   also waits for their completions; a plan that does not fit in the
+ *   remaining SQ space starts a new submission. Whatever the ring could not
+ *   run falls back to plain syscalls.
+ */
+static void
+rotate_batch_submit(log_shard_t *shard)
+{
+    rotate_batch_t *batch = &shard->batch;
+    unsigned inflight = 0;
+
+    for (int p = 0; p < batch->nplans && shard->use_uring; p++) {
+        rotate_plan_t *plan = &batch->plans[p];
+        struct io_uring_sqe *prev = NULL;
+
+        /* Whole chain in one submission */
+        if (uring_sq_space(&shard->ring) < (unsigned)plan->nops) {
+            if (rotate_batch_reap(shard, inflight) < 0) break;
+            inflight = 0;
+        }
+
+        for (int i = 0; i < plan->nops; i++) {
+            rotate_op_t *op = &plan->ops[i];
+            struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+            uint64_t tag = ((uint64_t)p << 16) | (uint64_t)i;
+
+            if (op->to < 0) {
+                uring_prep_unlinkat(sqe, shard->dir_fd, op->old_name, tag);
+            } else {
+                uring_prep_renameat(sqe, shard->dir_fd, op->old_name, op->new_name, tag);
+            }
+            /* Every operation in plan order, the unlinks of log.N included:
+               one running beside the renames could remove the file just
+               rotated into its slot. A failure does not cancel the rest */
+            if (prev) prev->flags |= IOSQE_IO_HARDLINK;
+            prev = sqe;
+            inflight++;
+        }
+    }
+
+    if (inflight > 0 && shard->use_uring) {
+        rotate_batch_reap(shard, inflight);
+    }
+
+    /* No ring, or operations it did not run */
+    for (int p = 0; p < batch->nplans; p++) {
+        file_rotate_run_sync(shard->dir_fd, &batch->plans[p]);
+    }
+}
+
+/**
+ * rotate_batch_run()
+ *
+ * Purpose:
+ *   Runs the rotations collected by handle_bak_files() for this read(),
+ *   completes them and releases the files_lock of each type.
+ */
+static void
+rotate_batch_run(log_shard_t *shard)
+{
+    rotate_batch_t *batch = &shard->batch;
+    uint64_t t0;
+
+    if (batch->nplans == 0) return;
+
+    t0 = metrics_now_ns();
+    rotate_batch_submit(shard);
+
+    for (int p = 0; p < batch->nplans; p++) {
+        file_rotate_complete(&batch->plans[p]);
+        log_files_unlock(batch->plans[p].findex);
+    }
+    metrics_record(MH_ROTATE, metrics_now_ns() - t0);
+    metrics_add(MC_ROTATIONS, (uint64_t)batch->nplans);
+    batch->nplans = 0;
+}
+
+/*
+ * Append primitives
+ * -----------------
+ * Cheapest first: FICLONERANGE shares the extents (XFS, btrfs; needs the
+ * append offset on a block boundary), copy_file_range() lets the
+ * filesystem clone or copy in kernel, sendfile() copies through the page
+ * cache, read()/write() always works. A filesystem answering "not
+ * supported" loses that primitive for good: the result is cached per
+ * st_dev so the probe is not repeated on every .bak.
+ */
+#define APPEND_PRIM_CLONE       0
+#define APPEND_PRIM_COPY_RANGE  1
+#define APPEND_PRIM_SENDFILE    2
+#define APPEND_PRIM_RW          3
+#define APPEND_PRIM_COUNT       4
+
+typedef struct append_mount_ {
+    dev_t dev;
+    unsigned disabled;              /* Bit per APPEND_PRIM_* found unsupported */
+} append_mount_t;
+
+static append_mount_t append_mounts[APPEND_MOUNTS_MAX];
+static int num_append_mounts;
+static pthread_mutex_t append_mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bytes appended with each primitive */
+static atomic_uint_fast64_t append_bytes[APPEND_PRIM_COUNT];
+
+/* Primitives a filesystem was found not to support */
+static unsigned
+append_mount_disabled(dev_t dev)
+{
+    unsigned disabled = 0;
+
+    pthread_mutex_lock(&append_mounts_lock);
+    for (int i = 0; i < num_append_mounts; i++) {
+        if (append_mounts[i].dev == dev) {
+            disabled = append_mounts[i].disabled;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&append_mounts_lock);
+    return disabled;
+}
+
+static void
+append_mount_disable(dev_t dev, int prim, const char *prim_name)
+{
+    int i;
+
+    (void)prim_name;  /* Only used in messages */
+
+    pthread_mutex_lock(&append_mounts_lock);
+    for (i = 0; i < num_append_mounts && append_mounts[i].dev != dev; i++);
+    if (i == num_append_mounts && num_append_mounts < APPEND_MOUNTS_MAX) {
+        append_mounts[num_append_mounts].dev = dev;
+        append_mounts[num_append_mounts].disabled = 0;
+        num_append_mounts++;
+    }
+    if (i < num_append_mounts && !(append_mounts[i].disabled & (1u << prim))) {
+        append_mounts[i].disabled |= 1u << prim;
+        printf("Append: %s not supported on device %lu, falling back\n",
+               prim_name, (unsigned long)dev);
+    }
+    pthread_mutex_unlock(&append_mounts_lock);
+}
+
+/* errno values meaning "this filesystem / kernel cannot do it" */
+static bool
+append_errno_unsupported(int err)
+{
+    return err == EOPNOTSUPP || err == ENOTSUP || err == ENOSYS ||
+           err == EXDEV || err == ENOTTY || err == EINVAL;
+}
+
+/* read()/write() copy of [*src_off, len) to dest at *dest_off */
+static int
+append_copy_rw(int src_fd, int dest_fd, off_t *src_off, off_t *dest_off, off_t len)
+{
+    char *buf = malloc(APPEND_COPY_BUF_LEN);
+    off_t end = *src_off + len;
+
+    if (!buf) return -1;
+
+    while (*src_off < end) {
+        size_t want = end - *src_off < APPEND_COPY_BUF_LEN ?
+                      (size_t)(end - *src_off) : APPEND_COPY_BUF_LEN;
+        ssize_t n = pread(src_fd, buf, want, *src_off);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;    /* Source shrank under us */
+            free(buf);
+            return -1;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = pwrite(dest_fd, buf + done, n - done, *dest_off);
+
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                free(buf);
+                return -1;
+            }
+            done += w;
+            *dest_off += w;
+        }
+        *src_off += n;
+    }
+    free(buf);
+    return 0;
+}
+
+/**
+ * append_file_contents()
+ *
+ * Purpose:
+ *   Appends the whole content of src_path to dest_path with the cheapest
+ *   primitive the filesystem supports (see "Append primitives" above),
+ *   then removes src_path. A primitive failing part way hands the rest of
+ *   the range to the next one, so the result is always a plain append.
+ *
+ * @param src_path   File to append and remove (a .bak file)
+ * @param dest_path  Existing file to append to
+ * @return 0 on success, -2 if dest_path cannot be opened, -1 on any other
+ *         failure (errno set, src_path left in place)
+ */
+static int
+append_file_contents(const char *src_path, const char *dest_path)
+{
+    struct stat src_st, dest_st;
+    off_t src_off = 0, dest_off;
+    unsigned disabled;
+    int saved_errno;
+    int rc = -1;
+
+    int src_fd = open(src_path, O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0) {
+        return -1;
+    }
+    /* Not O_APPEND: sendfile() and copy_file_range() reject an append-mode
+       destination. Only the rotator writes these files, under files_lock */
+    int dest_fd = open(dest_path, O_WRONLY | O_CLOEXEC);
+    if (dest_fd < 0) {
+        saved_errno = errno;
+        close(src_fd);
+        errno = saved_errno;
+        return -2;
+    }
+
+    /* Source size, and the end of dest where the data goes */
+    if (fstat(src_fd, &src_st) != 0 || fstat(dest_fd, &dest_st) != 0) {
+        goto out;
+    }
+    dest_off = dest_st.st_size;
+    disabled = append_mount_disabled(dest_st.st_dev);
+
+    /* Whole file in one ioctl; offsets must be block aligned */
+    if (!(disabled & (1u << APPEND_PRIM_CLONE)) && src_st.st_dev == dest_st.st_dev &&
+        src_st.st_size > 0 && dest_st.st_blksize > 0 && dest_off % dest_st.st_blksize == 0) {
+        struct file_clone_range fcr = {
+            .src_fd = src_fd, .src_offset = 0,
+            .src_length = 0,                    /* To source EOF */
+            .dest_offset = (uint64_t)dest_off,
+        };
+
+        if (ioctl(dest_fd, FICLONERANGE, &fcr) == 0) {
+            src_off = src_st.st_size;
+            dest_off += src_st.st_size;
+            atomic_fetch_add(&append_bytes[APPEND_PRIM_CLONE], src_st.st_size);
+        } else if (append_errno_unsupported(errno) && errno != EINVAL) {
+            /* EINVAL is alignment of this file, not the filesystem */
+            append_mount_disable(dest_st.st_dev, APPEND_PRIM_CLONE, "FICLONERANGE");
+        }
+    }
+
+    /* In kernel copy, reflinked by filesystems that can */
+    if (!(disabled & (1u << APPEND_PRIM_COPY_RANGE))) {
+        while (src_off < src_st.st_size) {
+            ssize_t n = copy_file_range(src_fd, &src_off, dest_fd, &dest_off,
+                                        src_st.st_size - src_off, 0);
+            if (n > 0) {
+                atomic_fetch_add(&append_bytes[APPEND_PRIM_COPY_RANGE], n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && append_errno_unsupported(errno)) {
+                append_mount_disable(dest_st.st_dev, APPEND_PRIM_COPY_RANGE, "copy_file_range");
+            }
+            break;      /* 0: nothing copied here, let sendfile try */
+        }
+    }
+
+    /* Zero-copy through the page cache, writes at the dest file offset */
+    if (src_off < src_st.st_size && !(disabled & (1u << APPEND_PRIM_SENDFILE)) &&
+        lseek(dest_fd, dest_off, SEEK_SET) == dest_off) {
+        while (src_off < src_st.st_size) {
+            ssize_t n = sendfile(dest_fd, src_fd, &src_off, src_st.st_size - src_off);
+
+            if (n > 0) {
+                dest_off += n;
+                atomic_fetch_add(&append_bytes[APPEND_PRIM_SENDFILE], n);
+                continue;
+            }
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (n < 0 && append_errno_unsupported(errno)) {
+                append_mount_disable(dest_st.st_dev, APPEND_PRIM_SENDFILE, "sendfile");
+            }
+            break;
+        }
+    }
+
+    /* Last resort, always available */
+    if (src_off < src_st.st_size) {
+        off_t before = src_off;
+
+        if (append_copy_rw(src_fd, dest_fd, &src_off, &dest_off,
+                           src_st.st_size - src_off) < 0) {
+            fprintf(stderr, "ERROR: read/write append failed: %s\n", strerror(errno));
+            goto out;
+        }
+        atomic_fetch_add(&append_bytes[APPEND_PRIM_RW], src_off - before);
+    }
+    rc = 0;
+
+out:
+    saved_errno = errno;
+    close(src_fd);
+    close(dest_fd);
+
+    if (rc != 0) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    /* Remove .bak file after successful append */
+    if (remove(src_path) != 0) {
+        fprintf(stderr, "ERROR: Failed to remove %s: %s\n",
+                src_path, strerror(errno));
+        return -1;
+    }
+
+    metrics_add(MC_BAK_APPENDS, 1);
+    metrics_add(MC_BAK_APPEND_BYTES, (uint64_t)src_st.st_size);
+    printf("   Appended %ld bytes to %s\n", (long)src_st.st_size, dest_path);
+    return 0;
+}
+
+/**
+ * absorb_bak_into_log0()
+ *
+ * Purpose:
+ *   Moves one .bak file into <base>.log.0: a plain rename when log.0 does
+ *   not exist yet, an append otherwise. Called with the type's
+ *   files_lock held.
+ *
+ * @param findex         File type index
+ * @param full_bak_path  Absolute path of the .bak file
+ */
+static void
+absorb_bak_into_log0(int findex, const char *full_bak_path)
+{
+    char numbered_file[FILE_ABS_PATH_NAME_LEN];
+
+    snprintf(numbered_file, sizeof(numbered_file), "%s%s.log.0",
+             log_types[findex]->dir, log_types[findex]->name);
+
+    /* Check if log.0 exists */
+    if (!log_slot_exists(findex, 0)) {
+        /* log.0 doesn't exist - simply rename .bak to log.0 */
+        if (rename(full_bak_path, numbered_file) == 0) {
+            log_slot_set(findex, 0);
+            printf("   Created: %s (renamed from .bak)\n", numbered_file);
+        } else {
+            fprintf(stderr, "ERROR: Failed to rename %s to %s: %s\n",
+                    full_bak_path, numbered_file, strerror(errno));
+        }
+        return;
+    }
+
+    /* log.0 exists - append .bak content to it */
+    int rc = append_file_contents(full_bak_path, numbered_file);
+    if (rc != 0) {
+        if (rc == -2 && errno == ENOENT) {
+            /* log.0 vanished behind our back: fix the cache, start over */
+            log_slot_stale(findex, 0);
+            absorb_bak_into_log0(findex, full_bak_path);
+            return;
+        }
+        fprintf(stderr, "ERROR: Failed to append %s to %s: %s\n",
+                full_bak_path, numbered_file, strerror(errno));
+    }
+}
+
+/**
+ * stage_bak_as_pending_segment()
+ *
+ * Purpose:
+ *   Moves one .bak file to the end of the type's pending segment list,
+ *   <base>.log.0.<n>: a single rename, nothing is copied. When the list
+ *   is full the .bak is appended to the newest segment instead (or to
+ *   log.0 when max_files leaves no room for segments). Called with the
+ *   type's files_lock held.
+ *
+ * @param findex         File type index
+ * @param full_bak_path  Absolute path of the .bak file
+ */
+static void
+stage_bak_as_pending_segment(int findex, const char *full_bak_path)
+{
+    log_type_t *t = log_types[findex];
+    uint32_t nsegs = log_pending_segments(findex);
+    int cap = LOG_CONFIG_MAX_FILES - type_config(findex)->max_files;
+    char seg_path[FILE_ABS_PATH_NAME_LEN];
+
+    if (cap > PENDING_SEGMENTS_MAX) cap = PENDING_SEGMENTS_MAX;
+
+    if (nsegs >= (uint32_t)cap) {
+        if (nsegs == 0) {
+            absorb_bak_into_log0(findex, full_bak_path);
+            return;
+        }
+
+        snprintf(seg_path, sizeof(seg_path), "%s%s.log.0.%u",
+                 t->dir, t->name, t->pending.next - 1);
+        int rc = append_file_contents(full_bak_path, seg_path);
+        if (rc == 0) return;
+        if (rc != -2 || errno != ENOENT) {
+            fprintf(stderr, "ERROR: Failed to append %s to %s: %s\n",
+                    full_bak_path, seg_path, strerror(errno));
+            return;
+        }
+        /* Newest segment vanished: the .bak takes a new one */
+    }
+
+    snprintf(seg_path, sizeof(seg_path), "%s%s.log.0.%u",
+             t->dir, t->name, t->pending.next);
+    if (rename(full_bak_path, seg_path) != 0) {
+        fprintf(stderr, "ERROR: Failed to rename %s to %s: %s\n",
+                full_bak_path, seg_path, strerror(errno));
+        return;
+    }
+    t->pending.next++;
+    atomic_fetch_add(&pending_segments_staged, 1);
+    metrics_add(MC_BAK_STAGED, 1);
+    printf("   Staged: %s (renamed from .bak)\n", seg_path);
+}
+
+/**
+ * handle_bak_files()
+ * 
+ * Purpose:
+ *   Handles a batch of new .bak files of one file type, oldest first, as a
+ *   single rotation:
+ *   - Normal case: The .bak files become log.0 (concatenated in order),
+ *                  then existing files are rotated once
+ *   - Zipper busy: Every .bak is renamed to the next pending segment
+ *                  (log.0.1, log.0.2, ...), folded in when the zipper is
+ *                  done. Segments left unfolded (e.g. by a failed archive)
+ *                  keep the normal case staging too, so order is kept
+ *   - Generation mode: The .bak files are concatenated into the oldest one,
+ *                  which becomes the next generation
+ *
+ * The "zipper busy" case prevents data loss when compression is taking a
+ * long time and new .bak files arrive before rotation can complete.
+ *
+ * In the normal case the rotation joins the shard's batch and the type's
+ * files_lock stays held until rotate_batch_run() completes it.
+ *
+ * @param shard      Rotator shard of the type
+ * @param findex     File type index
+ * @param bak_files  Filenames of the .bak files (e.g., "ipmgr.1234567890.bak"),
+ *                   sorted by timestamp
+ * @param nfiles     Number of entries in bak_files
+ */
+static void 
+handle_bak_files(log_shard_t *shard, int findex, const char *const *bak_files, int nfiles)
+{
+    char full_bak_path[FILE_ABS_PATH_NAME_LEN];
+    char first_bak_path[FILE_ABS_PATH_NAME_LEN];
+
+    if (nfiles <= 0) return;
+    atomic_fetch_add_explicit(&log_types[findex]->bak_arrivals, (uint64_t)nfiles,
+                              memory_order_relaxed);
+
+    printf("\n=== Processing %d .bak file(s) for %s ===\n",
+           nfiles, log_types[findex]->name);
+
+    /* Sizes only matter to compress_bytes: no stat() otherwise */
+    uint64_t bytes = 0;
+
+    if (type_config(findex)->compress_bytes) {
+        struct stat st;
+
+        for (int i = 0; i < nfiles; i++) {
+            if (fstatat(shard->dir_fd, bak_files[i], &st, 0) == 0) bytes += (uint64_t)st.st_size;
+        }
+    }
+
+    /* No existence probe here: a .bak that vanished makes the rename/open
+       below fail with ENOENT, which is reported there */
+
+    /*
+     * SPECIAL CASE: Zipper thread is busy compressing files
+     * 
+     * Problem: If we rotate files now, we might interfere with the
+     * compression process or lose data if rotation happens too fast.
+     * 
+     * Solution: Instead of rotating, rename the new .bak to a pending
+     * segment. This preserves all log data without interfering with
+     * compression, and costs one rename however large log files get.
+     *
+     * The decision and the file operations are made under this type's
+     * files_lock, so the zipper cannot fold the segments in between.
+     */
+    log_files_lock(findex);
+    compress_backlog_add(shard, findex, bytes);
+
+    /* Generation mode never shifts files, so never needs to append */
+    if (control_flags & CTRL_F_GENERATION_ROTATION) {
+        snprintf(first_bak_path, sizeof(first_bak_path),
+                 "%s%s", log_types[findex]->dir, bak_files[0]);
+
+        /* The oldest .bak collects the others before becoming a generation,
+           so the zipper never sees a half built file */
+        int left = nfiles;
+
+        for (int i = 1; i < nfiles; i++) {
+            snprintf(full_bak_path, sizeof(full_bak_path),
+                     "%s%s", log_types[findex]->dir, bak_files[i]);
+            if (append_file_contents(full_bak_path, first_bak_path) != 0) {
+                fprintf(stderr, "ERROR: Failed to append %s to %s: %s\n",
+                        full_bak_path, first_bak_path, strerror(errno));
+                left = i;
+                break;
+            }
+        }
+        generation_rotate(findex, first_bak_path);
+
+        /* Past a failed append each .bak becomes a generation of its own,
+           after the oldest and in timestamp order, so generation numbers
+           (and the archives) keep time order */
+        for (int i = left; i < nfiles; i++) {
+            snprintf(full_bak_path, sizeof(full_bak_path),
+                     "%s%s", log_types[findex]->dir, bak_files[i]);
+            generation_rotate(findex, full_bak_path);
+        }
+        log_files_unlock(findex);
+        return;
+    }
+
+    /* Oldest first, so log.0 and the segments end up in timestamp order */
+    bool busy = zip_in_progress(findex);
+
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(full_bak_path, sizeof(full_bak_path),
+                 "%s%s", log_types[findex]->dir, bak_files[i]);
+        if (busy || log_pending_segments(findex) > 0) {
+            stage_bak_as_pending_segment(findex, full_bak_path);
+        } else {
+            absorb_bak_into_log0(findex, full_bak_path);
+        }
+    }
+
+    if (busy) {
+        printf("INFO: Compression in progress, staged as pending segments\n");
+        log_files_unlock(findex);
+        return;
+    }
+
+    /*
+     * NORMAL CASE: Zipper is not busy
+     * log.0 (and any pending segments) now hold the whole batch, rotate
+     * all files once, together with the other types of this read()
+     */
+    if (file_rotate_plan(findex, &shard->batch.plans[shard->batch.nplans], true)) {
+        if (++shard->batch.nplans == ROTATE_BATCH_TYPES) {
+            rotate_batch_run(shard);
+        }
+        return;
+    }
+    /* Unlock the Critical section. */
+    log_files_unlock(findex);
+}
+
+/**
+ * bak_file_timestamp()
+ *
+ * Purpose:
+ *   Extracts the creation timestamp of a .bak file from its name, the
+ *   last dot separated field before ".bak" (e.g., "ipmgr.1234567890.bak").
+ *
+ * @param name  .bak filename
+ * @return Timestamp, or UINT64_MAX when the name carries none
+ */
+static uint64_t
+bak_file_timestamp(const char *name)
+{
+    const char *end = strrchr(name, '.');
+    const char *start = end;
+
+    while (start > name && start[-1] >= '0' && start[-1] <= '9') start--;
+
+    if (start == end || start == name || start[-1] != '.') {
+        return UINT64_MAX;
+    }
+    return strtoull(start, NULL, 10);
+}
+
+/* CLOCK_REALTIME in nanoseconds, the clock of file timestamps */
+static uint64_t
+realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Granularity of file timestamps: the coarse clock they are read from */
+static uint64_t
+file_time_resolution_ns(void)
+{
+    struct timespec res;
+
+    if (clock_getres(CLOCK_REALTIME_COARSE, &res) < 0) return 0;
+    return (uint64_t)res.tv_sec * 1000000000ull + (uint64_t)res.tv_nsec;
+}
+
+/* Sort order of collected events: type, then timestamp, then arrival */
+static int
+bak_event_cmp(const void *a, const void *b)
+{
+    const bak_event_t *x = a;
+    const bak_event_t *y = b;
+
+    if (x->findex != y->findex) return x->findex < y->findex ? -1 : 1;
+    if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/**
+ * bak_events_dispatch()
+ *
+ * Purpose:
+ *   Processes the .bak events of one inotify read(): sorted by type and
+ *   timestamp, each type's .bak files go through handle_bak_files() as one
+ *   rotation (in chunks of BAK_BATCH_MAX), then the type's dummy event if
+ *   one was seen. The rotations of all types run as one batch at the end.
+ */
+static void
+bak_events_dispatch(log_shard_t *shard, bak_event_t *events, int nevents)
+{
+    const char *names[BAK_BATCH_MAX];
+    char dummy_path[FILE_ABS_PATH_NAME_LEN];
+
+    qsort(events, nevents, sizeof(*events), bak_event_cmp);
+
+    for (int i = 0; i < nevents; ) {
+        int findex = events[i].findex;
+        bool dummy = false;
+        int nfiles = 0;
+
+        for (; i < nevents && events[i].findex == findex; i++) {
+            if (events[i].dummy) {
+                dummy = true;
+                continue;
+            }
+            if (nfiles == BAK_BATCH_MAX) {
+                handle_bak_files(shard, findex, names, nfiles);
+                atomic_fetch_add(&bak_events_coalesced, nfiles - 1);
+                /* Next chunk needs this type's lock again */
+                rotate_batch_run(shard);
+                nfiles = 0;
+            }
+            names[nfiles++] = events[i].name;
+        }
+
+        if (nfiles > 0) {
+            handle_bak_files(shard, findex, names, nfiles);
+            atomic_fetch_add(&bak_events_coalesced, nfiles - 1);
+        }
+
+        if (dummy) {
+            rotate_batch_run(shard);
+            handle_dummy_bak_file_creation(findex);
+
+            snprintf(dummy_path, sizeof(dummy_path), "%s%s.dummy.bak",
+                     log_types[findex]->dir, log_types[findex]->name);
+            if (remove (dummy_path) != 0) {
+                fprintf (stderr, "Error : Deletion of dummy bak file %s failed\n", dummy_path);
+            }
+        }
+    }
+
+    /* Rotations of every type of this read() */
+    rotate_batch_run(shard);
+}
+
+/* bsearch() order of the replayed names */
+static int
+replay_name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/**
+ * shard_handle_events()
+ *
+ * Purpose:
+ *   Handles the length bytes of events one inotify read() left in the
+ *   shard's buffer: .bak events of the shard's types are collected, then
+ *   dispatched as one rotation per type.
+ *
+ * @param skip   Sorted names to ignore (already replayed), NULL for none
+ * @param nskip  Entries in skip
+ * @return true if the kernel reported a queue overflow: events were lost,
+ *         the caller rescans the directory
+ */
+static bool
+shard_handle_events(log_shard_t *shard, int length, const char *const *skip, int nskip)
+{
+    bool overflow = false;
+    struct stat st;
+    uint64_t read_ns = realtime_ns();
+
+    metrics_add(MC_INOTIFY_READS, 1);
+
+    /*
+     * Parse the whole buffer first, grouping .bak events by file type,
+     * then rotate each type once with all of its .bak files. Types are
+     * resolved against the configuration current at this read().
+     */
+    const log_config_t *cfg = config_get();
+    bak_event_t *events = shard->events;
+    int nevents = 0;
+    int i = 0;
+    while (i < length) {
+        struct inotify_event *event = (struct inotify_event *)&shard->buffer[i];
+        const char *name = event->name;
+
+        metrics_add(MC_INOTIFY_EVENTS, 1);
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            metrics_add(MC_INOTIFY_OVERFLOWS, 1);
+            overflow = true;
+        }
+
+        /* Only process events with a filename */
+        if (event->len > 0 &&
+            !(skip && bsearch(&name, skip, nskip, sizeof(*skip), replay_name_cmp))) {
+            /* One pass over the name: target type and .bak suffix */
+            bool dummy;
+            int j = target_match_bak_event(cfg, event->name, &dummy);
+
+            /* A type of the same name in another directory is not ours */
+            if (j >= 0 && log_types[j]->shard == shard->id) {
+                printf("\n[inotify] event detected: %s (%s)\n",
+                       event->name, log_types[j]->name);
+                events[nevents].name = event->name;
+                events[nevents].ts = dummy ? 0 : bak_file_timestamp(event->name);
+                events[nevents].seq = nevents;
+                events[nevents].findex = j;
+                events[nevents].dummy = dummy;
+                /* The rename making the .bak sets its ctime: latency counts
+                   the wait in the inotify queue and the backlog too. Taken
+                   now, before the rotation renames the .bak away */
+                events[nevents].created_ns = 0;
+                if (!dummy && fstatat(shard->dir_fd, event->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    events[nevents].created_ns = (uint64_t)st.st_ctim.tv_sec * 1000000000ull +
+                                                 (uint64_t)st.st_ctim.tv_nsec;
+                }
+                nevents++;
+            }
+        }
+
+        /* Move to next event */
+        i += EVENT_SIZE + event->len;
+    }
+
+    /* One rotation per file type */
+    bak_events_dispatch(shard, events, nevents);
+
+    /*
+     * Every .bak of the read() is only rotated once all of them are. File
+     * timestamps come from the coarse clock: the .bak appeared between its
+     * ctime and one coarse tick later, and before the read(). The latest
+     * of those bounds starts the clock, so a sample is never longer than
+     * the real latency and short of it by one tick at most.
+     */
+    if (nevents > 0) {
+        uint64_t now_ns = realtime_ns();
+        uint64_t res_ns = file_time_resolution_ns();
+
+        metrics_add(MC_BAK_EVENTS, (uint64_t)nevents);
+        for (int e = 0; e < nevents; e++) {
+            uint64_t start = read_ns;
+
+            if (events[e].dummy) continue;
+            if (events[e].created_ns && events[e].created_ns + res_ns < start) {
+                start = events[e].created_ns + res_ns;
+            }
+            metrics_record(MH_BAK_TO_ROTATED, now_ns > start ? now_ns - start : 0);
+        }
+    }
+    return overflow;
+}
+
+/*
+ * After a read() that came back full, more events were waiting than fit:
+ * doubles the shard's buffer (and its event array) up to BUF_LEN_MAX, so
+ * a burst is drained in fewer syscalls before the kernel queue fills up.
+ * Keeps the current buffer if memory is short.
+ */
+static void
+shard_buffer_grow(log_shard_t *shard)
+{
+    size_t len = shard->buf_len * 2;
+    char *buffer;
+    bak_event_t *events;
+
+    if (shard->buf_len >= BUF_LEN_MAX) return;
+    if (len > BUF_LEN_MAX) len = BUF_LEN_MAX;
+
+    buffer = malloc(len);
+    events = malloc(len / EVENT_SIZE * sizeof(*events));
+    if (!buffer || !events) {
+        free(buffer);
+        free(events);
+        return;
+    }
+    free(shard->buffer);
+    free(shard->events);
+    shard->buffer = buffer;
+    shard->events = events;
+    shard->buf_len = len;
+    printf("inotify buffer of %s grown to %zu bytes\n", shard->dir, len);
+}
+
+/**
+ * log_shard_replay()
+ *
+ * Purpose:
+ *   Startup recovery of one shard, on its rotator thread before the first
+ *   read(): the .bak files a previous run left (collected by the startup
+ *   scan) go through bak_events_dispatch() as one batch, oldest first per
+ *   type, exactly as if their events had just arrived. A type with no
+ *   .bak but a log.0 or pending segments left by a crash is rotated as on
+ *   a dummy event, so log.0 does not linger until the next .bak.
+ *
+ *   The watch was added before the scan, so a .bak created in between
+ *   also has an event queued. The queue is drained here, without
+ *   blocking, ignoring the replayed names; every such event is already
+ *   queued by now.
+ *
+ *   Also the second half of an overflow rescan, see log_shard_rescan().
+ *
+ * @return true if the queue overflowed again while being drained
+ */
+static bool
+log_shard_replay(log_shard_t *shard)
+{
+    bak_replay_t *r = &shard->replay;
+    const log_config_t *cfg = config_get();
+    const char **skip = NULL;
+    struct pollfd pfd = { .fd = shard->inotify_fd, .events = POLLIN };
+    struct timespec t0, t1;
+    bool *replayed;
+    bool overflow = false;
+    int n = r->nevents;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    replayed = calloc(cfg->ntypes + 1, sizeof(*replayed));
+
+    if (n > 0) {
+        skip = malloc((size_t)n * sizeof(*skip));
+        for (int i = 0; i < n; i++) {
+            if (skip) skip[i] = r->events[i].name;
+            if (replayed && r->events[i].findex < cfg->ntypes) {
+                replayed[r->events[i].findex] = true;
+            }
+        }
+        if (skip) qsort(skip, n, sizeof(*skip), replay_name_cmp);
+
+        bak_events_dispatch(shard, r->events, n);
+        metrics_add(MC_BAK_REPLAYED, (uint64_t)n);
+    }
+
+    for (int i = 0; i < cfg->ntypes; i++) {
+        int top;
+
+        if (log_types[i]->shard != shard->id || !cfg->types[i].enabled) continue;
+
+        /* Rotated files found by the scan start their age from now */
+        log_files_lock(i);
+        if (!log_types[i]->backlog.since_ns && compress_waiting_files(i, &top) > 0) {
+            compress_backlog_add(shard, i, 0);
+            compress_policy_check(i, metrics_now_ns());
+        }
+        log_files_unlock(i);
+
+        if ((replayed && replayed[i]) || (control_flags & CTRL_F_GENERATION_ROTATION)) continue;
+        handle_dummy_bak_file_creation(i);
+    }
+
+    while (n > 0 && poll(&pfd, 1, 0) > 0) {
+        int length = read(shard->inotify_fd, shard->buffer, shard->buf_len);
+
+        if (length <= 0) break;
+        overflow |= shard_handle_events(shard, length, skip, skip ? n : 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (n > 0) {
+        printf("Replayed %d .bak file(s) left in %s in %.1f ms\n", n, shard->dir,
+               (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6);
+    }
+
+    for (int i = 0; i < n; i++) free((void *)r->events[i].name);
+    free(r->events);
+    free(skip);
+    free(replayed);
+    memset(r, 0, sizeof(*r));
+    return overflow;
+}
+
+/**
+ * log_shard_rescan()
+ *
+ * Purpose:
+ *   Recovery from an inotify queue overflow: the kernel dropped events,
+ *   so whatever .bak files they named are found by one directory scan
+ *   instead (which also reconciles the slot cache) and replayed at once,
+ *   oldest first per type, as at startup.
+ *
+ * @return true if the queue overflowed again meanwhile: rescan
+ */
+static bool
+log_shard_rescan(log_shard_t *shard)
+{
+    fprintf(stderr, "WARNING: inotify queue overflow on %s, rescanning\n", shard->dir);
+
+    log_slot_cache_reconcile(shard, &shard->replay);
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &shard->last_reconcile);
+    return log_shard_replay(shard);
+}
+
+/**
+ * shard_timer_arm()
+ *
+ * Purpose:
+ *   Arms the shard's timerfd for its earliest deadline: the next slot
+ *   cache reconciliation or the top of the deadline heap. Only touches
+ *   the timer when the deadline moved.
+ */
+static void
+shard_timer_arm(log_shard_t *shard)
+{
+    struct itimerspec its = { 0 };
+    uint64_t deadline_ns;
+
+    deadline_ns = (uint64_t)(shard->last_reconcile.tv_sec + SLOT_CACHE_RECONCILE_SECS) *
+                  1000000000ull + (uint64_t)shard->last_reconcile.tv_nsec;
+    if (shard->ndeadlines > 0 && shard->deadlines[0].at_ns < deadline_ns) {
+        deadline_ns = shard->deadlines[0].at_ns;
+    }
+    if (deadline_ns == shard->timer_armed_ns) return;
+
+    /* 0 would disarm it: an instant already past fires at once instead */
+    if (deadline_ns == 0) deadline_ns = 1;
+    its.it_value.tv_sec = (time_t)(deadline_ns / 1000000000ull);
+    its.it_value.tv_nsec = (long)(deadline_ns % 1000000000ull);
+
+    if (timerfd_settime(shard->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("ERROR: timerfd_settime failed");
+        return;
+    }
+    shard->timer_armed_ns = deadline_ns;
+}
+
+/**
+ * shard_handle_completions()
+ *
+ * Purpose:
+ *   Retires the compression jobs the zippers reported done for this
+ *   shard's types, see zipper_report_done().
+ */
+static void
+shard_handle_completions(log_shard_t *shard)
+{
+    uint64_t count;
+    int findex;
+
+    if (read(shard->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("ERROR: eventfd read failed");
+    }
+    while (lf_ring_pop(&shard->completions, &findex)) {
+        unsigned njobs = atomic_exchange(&log_types[findex]->jobs_done, 0);
+
+        if (njobs) zip_job_complete(findex, njobs);
+    }
+}
+
+/**
+ * shard_handle_inotify()
+ *
+ * Purpose:
+ *   Reads and processes whatever the shard's inotify instance has queued.
+ *
+ * @return -1 if the inotify read failed (reported), 0 if the queue was
+ *         empty, 1 if events were handled
+ */
+static int
+shard_handle_inotify(log_shard_t *shard)
+{
+    int length = read(shard->inotify_fd, shard->buffer, shard->buf_len);
+
+    if (length < 0) {
+        if (errno == EAGAIN || errno == EINTR) return 0;
+        perror("ERROR: inotify read failed");
+        return -1;
+    }
+    if (length == 0) return 0;
+    bool overflow = shard_handle_events(shard, length, NULL, 0);
+
+    if ((size_t)length > shard->buf_len - BUF_FULL_MARGIN) {
+        shard_buffer_grow(shard);
+    }
+    while (overflow) overflow = log_shard_rescan(shard);
+    return 1;
+}
+
+/* true while a shift mode job of one of the shard's types is not folded
+   yet. Generation mode jobs are retired by the zippers alone */
+static bool
+shard_jobs_pending(const log_shard_t *shard)
+{
+    const log_config_t *cfg = config_get();
+
+    if (control_flags & CTRL_F_GENERATION_ROTATION) return false;
+    for (int i = 0; i < cfg->ntypes; i++) {
+        if (log_types[i]->shard == shard->id && zip_in_progress(i)) return true;
+    }
+    return false;
+}
+
+/**
+ * shard_drain()
+ *
+ * Purpose:
+ *   One step of the shard's stop. The first call removes the inotify
+ *   watch and rotates the .bak files whose events were already queued,
+ *   a .bak arriving later is left to the next startup's replay. In shift
+ *   mode the rotator then stays for its types' jobs, to fold the pending
+ *   segments staged meanwhile back into the chain.
+ *
+ * @return true when the thread can exit: drained, or past the deadline
+ */
+static bool
+shard_drain(log_shard_t *shard)
+{
+    if (shard->watch_fd >= 0) {
+        /* Events queued before the removal are still read (IN_IGNORED last) */
+        inotify_rm_watch(shard->inotify_fd, shard->watch_fd);
+        shard->watch_fd = -1;
+        while (shard_handle_inotify(shard) > 0) {
+            if (shutdown_expired()) break;
+        }
+        printf("Stopped watching %s\n", shard->dir);
+    }
+    return shutdown_expired() || !shard_jobs_pending(shard);
+}
+
+/**
+ * log_rotate_thread_fn()
+ * 
+ * Purpose:
+ *   Rotator thread of one shard: monitors the shard's directory for .bak
+ *   file creation using inotify and processes them as they arrive.
+ *
+ * Process:
+ *   1. Replay the .bak files a previous run left, see log_shard_replay()
+ *   2. Enter infinite loop waiting on the shard's epoll instance
+ *   3. Zipper completions: fold the pending segments of types done
+ *   4. inotify: filter for .bak files of the target log types living in
+ *      this directory, grouped by type, and process each type's .bak
+ *      files as a single rotation. On a queue overflow, rescan the
+ *      directory for the lost events
+ *   5. Timer: compress_age deadlines and the periodic slot cache
+ *      reconciliation
+ *
+ * Stopping:
+ *   Once shutdown_state is set, see shard_drain()
+ *
+ * @param arg  The log_shard_t, watch already added by log_shard_get()
+ */
+static void *
+log_rotate_thread_fn(void *arg)
+{
+    log_shard_t *shard = arg;
+    struct timespec now;
+    char name[METRICS_THREAD_NAME_LEN];
+
+    snprintf(name, sizeof(name), "rotator %.23s", shard->dir);
+    metrics_thread_attach(name);
+    diag_thread_name(name);
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &shard->last_reconcile);
+
+    printf("Monitoring directory: %s\n", shard->dir);
+
+    /* What happened while no rotator was running */
+    bool overflow = log_shard_replay(shard);
+
+    while (overflow) overflow = log_shard_rescan(shard);
+
+    /*
+     * Main event processing loop
+     * Blocks on epoll_wait() for inotify events, completions and deadlines
+     */
+    while (1) {
+        struct epoll_event evs[3];
+        bool wake = false, inotify = false, timer = false;
+        int timeout = -1;
+
+        if (atomic_load(&shutdown_state) != SHUTDOWN_NONE) {
+            if (shard_drain(shard)) break;
+            timeout = SHUTDOWN_POLL_MS;
+        }
+        shard_timer_arm(shard);
+
+        /* Wait for any of the shard's descriptors */
+        int n = epoll_wait(shard->epoll_fd, evs, 3, timeout);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("ERROR: epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            wake |= evs[i].data.u32 == SHARD_EV_WAKE;
+            inotify |= evs[i].data.u32 == SHARD_EV_INOTIFY;
+            timer |= evs[i].data.u32 == SHARD_EV_TIMER;
+        }
+
+        /* Completions first: their folds let the new .bak files rotate
+           normally instead of being staged as pending segments */
+        if (wake) shard_handle_completions(shard);
+        if (inotify && shard_handle_inotify(shard) < 0) break;
+
+        if (timer) {
+            uint64_t expirations;
+
+            if (read(shard->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+                errno != EAGAIN) {
+                perror("ERROR: timerfd read failed");
+            }
+            shard->timer_armed_ns = 0;      /* Expired, re-arm even if unchanged */
+            if (atomic_load(&shutdown_state) != SHUTDOWN_NONE) continue;
+            shard_deadlines_run(shard);
+
+            /* Periodically re-check the slot cache against the directory.
+               Not the coarse clock: it may lag the timer's expiry */
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec - shard->last_reconcile.tv_sec >= SLOT_CACHE_RECONCILE_SECS) {
+                log_slot_cache_reconcile(shard, NULL);
+                shard->last_reconcile = now;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+ *                      ROTATOR SHARD FUNCTIONS
+ ******************************************************************************/
+
+/* Releases a shard whose thread is not running, set up or not */
+static void
+log_shard_free(log_shard_t *shard)
+{
+    if (shard->watch_fd >= 0) inotify_rm_watch(shard->inotify_fd, shard->watch_fd);
+    if (shard->inotify_fd >= 0) close(shard->inotify_fd);
+    if (shard->dir_fd >= 0) close(shard->dir_fd);
+    if (shard->epoll_fd >= 0) close(shard->epoll_fd);
+    if (shard->wake_fd >= 0) close(shard->wake_fd);
+    if (shard->timer_fd >= 0) close(shard->timer_fd);
+    if (shard->use_uring) uring_destroy(&shard->ring);
+    lf_ring_destroy(&shard->completions);
+    free(shard->deadlines);
+    free(shard->buffer);
+    free(shard->events);
+    free(shard);
+}
+
+/* Adds fd to the shard's epoll instance, tagged with one of SHARD_EV_* */
+static int
+shard_epoll_add(log_shard_t *shard, int fd, uint32_t tag)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = tag };
+
+    return epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * log_shard_get()
+ *
+ * Purpose:
+ *   Returns the shard watching dir, creating it when dir is new: a fresh
+ *   inotify instance with its watch already added, so events queue up from
+ *   here on even though the thread only starts in log_shards_start().
+ *   Startup and reload thread only.
+ *
+ * @param dir  Watch directory, with a trailing '/'
+ * @return Shard id, -1 on failure (reported)
+ */
+static int
+log_shard_get(const char *dir)
+{
+    log_shard_t *shard;
+
+    for (int i = 0; i < num_log_shards; i++) {
+        if (!strcmp(log_shards[i]->dir, dir)) return i;
+    }
+
+    if (num_log_shards >= MAX_WATCH_DIRS) {
+        fprintf(stderr, "ERROR: More than %d watch directories\n", MAX_WATCH_DIRS);
+        return -1;
+    }
+
+    shard = calloc(1, sizeof(*shard));
+    if (!shard) return -1;
+    snprintf(shard->dir, sizeof(shard->dir), "%s", dir);
+    shard->id = num_log_shards;
+    shard->inotify_fd = shard->watch_fd = shard->dir_fd = -1;
+    shard->epoll_fd = shard->wake_fd = shard->timer_fd = -1;
+
+    shard->buf_len = BUF_LEN;
+    shard->buffer = malloc(shard->buf_len);
+    shard->events = malloc(shard->buf_len / EVENT_SIZE * sizeof(*shard->events));
+    shard->deadlines = malloc(LOG_CONFIG_MAX_TYPES * sizeof(*shard->deadlines));
+    if (!shard->buffer || !shard->events || !shard->deadlines ||
+        lf_ring_init(&shard->completions, LOG_CONFIG_MAX_TYPES, sizeof(int)) < 0) {
+        log_shard_free(shard);
+        return -1;
+    }
+
+    /* Initialize inotify instance */
+    shard->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (shard->inotify_fd < 0) {
+        perror("ERROR: inotify_init failed");
+        log_shard_free(shard);
+        return -1;
+    }
+
+    /* 
+     * Add watch for log directory
+     * IN_CREATE: Triggered when files are created
+     * IN_MOVED_TO: Triggered when files are moved into directory
+     */
+    shard->watch_fd = inotify_add_watch(shard->inotify_fd, dir, 
+                                        IN_CREATE | IN_MOVED_TO);
+    if (shard->watch_fd < 0) {
+        fprintf(stderr, "ERROR: inotify_add_watch %s failed: %s\n", dir, strerror(errno));
+        log_shard_free(shard);
+        return -1;
+    }
+
+    shard->dir_fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (shard->dir_fd < 0) {
+        fprintf(stderr, "ERROR: open %s failed: %s\n", dir, strerror(errno));
+        log_shard_free(shard);
+        return -1;
+    }
+
+    /* Event loop: inotify, zipper completions and deadlines */
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shard->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (shard->epoll_fd < 0 || shard->wake_fd < 0 || shard->timer_fd < 0 ||
+        shard_epoll_add(shard, shard->inotify_fd, SHARD_EV_INOTIFY) < 0 ||
+        shard_epoll_add(shard, shard->wake_fd, SHARD_EV_WAKE) < 0 ||
+        shard_epoll_add(shard, shard->timer_fd, SHARD_EV_TIMER) < 0) {
+        perror("ERROR: rotator event loop setup failed");
+        log_shard_free(shard);
+        return -1;
+    }
+
+#if ROTATE_USE_IO_URING
+    /* Optional: rotations keep working with plain syscalls without it */
+    shard->use_uring = uring_init(&shard->ring, ROTATE_URING_ENTRIES) == 0;
+    if (!shard->use_uring) {
+        printf("io_uring unavailable for %s (%s), using syscalls\n", dir, strerror(errno));
+    }
+#endif
+
+    log_shards[num_log_shards++] = shard;
+    return shard->id;
+}
+
+/* Starts the rotator thread of every shard not running yet */
+static void
+log_shards_start(void)
+{
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+    for (int i = 0; i < num_log_shards; i++) {
+        log_shard_t *shard = log_shards[i];
+
+        if (shard->running) continue;
+        if (pthread_create(&shard->thread, &attr, log_rotate_thread_fn, shard) != 0) {
+            fprintf(stderr, "ERROR: Failed to create log rotator thread for %s\n", shard->dir);
+            exit(EXIT_FAILURE);
+        }
+        shard->running = true;
+        printf(" Log Rotator thread started for %s\n", shard->dir);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* Wakes every shard thread into its drain (shutdown_state set) and joins it */
+static void
+log_shards_drain(void)
+{
+    uint64_t one = 1;
+
+    for (int i = 0; i < num_log_shards; i++) {
+        if (log_shards[i]->running &&
+            write(log_shards[i]->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("ERROR: eventfd write failed");
+        }
+    }
+    for (int i = 0; i < num_log_shards; i++) {
+        if (log_shards[i]->running) {
+            pthread_join(log_shards[i]->thread, NULL);
+            log_shards[i]->running = false;
+        }
+    }
+}
 
-        for (int i = 1; i <= max_index; i++) {
+/*
+ * Releases the shards, their threads and the zippers gone. The renames of
+ * the rotators were never synced one by one: one fsync per directory
+ * makes them all durable before the process exits.
+ */
+static void
+log_shards_stop(void)
+{
+    for (int i = 0; i < num_log_shards; i++) {
+        log_shard_t *shard = log_shards[i];
+        /* dir_fd is O_PATH, fsync() needs a real descriptor */
+        int fd = open(shard->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-            char rm[256];
-            snprintf(rm, sizeof(rm), "%s%s.%d", DEFAULT_WATCH_DIR, fname, i);
-            
-            if (remove(rm) == 0) {
-                printf("   Deleted: %s\n", rm);
-            } else {
-                perror(rm);
-            }
+        if (fd < 0 || fsync(fd) < 0) {
+            fprintf(stderr, "WARNING: fsync of %s failed: %s\n", shard->dir, strerror(errno));
         }
+        if (fd >= 0) close(fd);
+        log_shard_free(shard);
+        log_shards[i] = NULL;
     }
+    num_log_shards = 0;
+}
+
+/*******************************************************************************
+ *                      CONFIGURATION FUNCTIONS
+ ******************************************************************************/
 
-    printf("\n[SUCCESS] Archive created: %s\n\n", archives[file_idx]);
+/* Log types allocated so far, reload thread only (>= num_log_types) */
+static int num_log_types_allocated;
+
+/* Built-in configuration: the CONFIGURATION DEFINES of this file */
+static void
+config_builtin_defaults(log_config_t *d)
+{
+    memset(d, 0, sizeof(*d));
+    snprintf(d->watch_dir, sizeof(d->watch_dir), "%s", DEFAULT_WATCH_DIR);
+    memcpy(d->defaults.watch_dir, d->watch_dir, sizeof(d->watch_dir));
+    d->control_flags = control_flags;
+    d->diag_level = DEFAULT_DIAG_LEVEL;
+    d->archive_budget = DEFAULT_ARCHIVE_BUDGET;
+    d->shutdown_timeout = DEFAULT_SHUTDOWN_TIMEOUT;
+    d->defaults.max_files = DEFAULT_MAX_FILES;
+    d->defaults.compress_files = DEFAULT_COMPRESS_FILES;
+    d->defaults.compress_bytes = DEFAULT_COMPRESS_BYTES;
+    d->defaults.compress_age = DEFAULT_COMPRESS_AGE;
+    d->defaults.codec = DEFAULT_CODEC;
+    d->defaults.compression_level = DEFAULT_COMPRESSION_LEVEL;
+    d->defaults.adaptive_level = DEFAULT_ADAPTIVE_LEVEL;
+    d->defaults.compression_level_min = DEFAULT_COMPRESSION_LEVEL_MIN;
+    d->defaults.zstd_long = DEFAULT_ZSTD_LONG;
+    d->defaults.zstd_dictionary = DEFAULT_ZSTD_DICTIONARY;
+    d->defaults.archive_format = DEFAULT_ARCHIVE_FORMAT;
+    d->defaults.archive_max_size = DEFAULT_ARCHIVE_MAX_SIZE;
+    d->defaults.archive_max_age = DEFAULT_ARCHIVE_MAX_AGE;
+    d->defaults.flags = control_flags & (CTRL_F_DEL_OBSOLETE_TAR_FILES |
+                                         CTRL_F_DELETE_OBSOLETE_LOG_FILES |
+                                         CTRL_F_INCREMENTAL_ARCHIVE);
 }
 
 /**
- * zip_log_file_thread_fn()
- * 
- * Purpose:
- *   Worker thread that waits for compression requests and processes them.
- *   Runs in an infinite loop waiting on the wake_up_zipper_thread semaphore.
+ * log_type_create()
  *
- * Thread Safety:
- *   - Uses atomic operations to set/clear zip_in_progress flag
- *   - Synchronized with log rotator via semaphore
+ * Purpose:
+ *   Allocates the persistent state of a newly configured log type in the
+ *   next free registry entry, attached to the shard watching its
+ *   directory (created if needed). The entry is published later, by
+ *   config_publish(), so no other thread sees it half built.
  *
- * Cancellation:
- *   Thread is cancellable at sem_wait() cancellation point
+ * @return Type id, -1 on failure
  */
-static void *
-zip_log_file_thread_fn(void *arg)
+static int
+log_type_create(const char *name, const char *dir)
 {
-    (void)arg;  /* Unused parameter */
-    char local_terminal_fname[MAX_FILENAME];
-    char log0_fname[FILE_ABS_PATH_NAME_LEN];
+    int id = num_log_types_allocated;
+    log_type_t *t;
+    int shard;
 
-    /* Configure thread cancellation behavior */
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-
-    /* Signal that thread initialization is complete */
-    sem_post(&wait_for_thread_init);
+    if (id >= LOG_CONFIG_MAX_TYPES) {
+        fprintf(stderr, "ERROR: More than %d log types\n", LOG_CONFIG_MAX_TYPES);
+        return -1;
+    }
 
-    /* Main work loop */
-    while (1) {
-        /* Wait for compression request (cancellation point) */
-        sem_wait(&wake_up_zipper_thread);
-        
-        /* Find which file type needs compression */
-        int file_idx_to_compress = -1;
-        
-        pthread_spin_lock(&compression_state_lock);
-        for (int i = 0; i < DEFAULT_NUM_TARGET_FILES; i++) {
-            if (atomic_load(&file_compression_state[i].needs_compression)) {
-                file_idx_to_compress = i;
-                
-                /* Copy terminal filename to local variable */
-                strncpy(local_terminal_fname, 
-                        file_compression_state[i].terminal_fname,
-                        sizeof(local_terminal_fname));
-                local_terminal_fname[sizeof(local_terminal_fname) - 1] = '\0';
-                
-                /* Clear the flag */
-                atomic_store(&file_compression_state[i].needs_compression, false);
-                break;
-            }
-        }
-        pthread_spin_unlock(&compression_state_lock);
-        
-        if (file_idx_to_compress < 0) {
-            fprintf(stderr, "WARNING: Zipper woke up but no file needs compression\n");
-            continue;
-        }
-        
-        /* lock the Critical section. Any operation on numbered files
-        is defined as C.S */
-        pthread_spin_lock(&operations_on_log_files);
+    shard = log_shard_get(dir);
+    if (shard < 0) return -1;
 
-        /* Set atomic flag to indicate compression in progress */
-        atomic_store(&zip_in_progress, true);
-        
-        /* Perform compression using the local copy */
-        compress_all_log_files_with_name(local_terminal_fname);
-
-        #if 0
-        /* Generate dummy bak log file to handle .log.0 file created
-            while the zipper thread was busy compressing logs. This will generate 
-            inotify event which guide log rotator thread to perform one more log 
-            rotation to rename .log.0 file to .log.1 through file rotation. IF we dont
-            do this, user may see ipstrc.log.0 file in /var/log dir which would persists
-            until next .bak create event. ipstrc.log.0 is transient file and must not
-            exist persistently. We use dummy event to avoid extra thread sync headache.
-            Here, zipper thread is signaling the log rotator thread indirectly. */
-
-            generate_dummy_inotify_bak_event ();
-
-        #else
-            
-            /* Alternate Approach : seems better than above approach */
-            sem_wait(&inotify_events_allow_sema);
-            rename_all_log0_to_log1_log_file();
-            sem_post(&inotify_events_allow_sema);
-        
-        #endif 
+    t = calloc(1, sizeof(*t));
+    if (!t) return -1;
 
-        /* Clear atomic flag */
-        atomic_store(&zip_in_progress, false);
-        
-        /* Unlock the Critical section. */
-        pthread_spin_unlock(&operations_on_log_files);
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    snprintf(t->dir, sizeof(t->dir), "%s", dir);
+    t->shard = shard;
+    if (lf_ring_init(&t->jobs, COMPRESSION_QUEUE_LEN, sizeof(comp_job_t)) < 0) {
+        fprintf(stderr, "ERROR: Failed to allocate compression queue\n");
+        free(t);
+        return -1;
     }
-    
-    return NULL;
+    atomic_store(&t->scheduled, false);
+    atomic_store(&t->jobs_pending, 0);
+    atomic_store(&t->jobs_done, 0);
+    t->pending.first = t->pending.next = 1;
+    pthread_mutex_init(&t->files_lock, NULL);
+
+    log_types[id] = t;
+    num_log_types_allocated++;
+    return id;
 }
 
-/*******************************************************************************
- *                      LOG ROTATION FUNCTIONS
- ******************************************************************************/
-
 /**
- * file_rotate()
- * 
- * Purpose:
- *   Rotates numbered log files by incrementing their numbers.
- *   When the maximum number of files is reached, signals the zipper thread.
- *
- * Process:
- *   1. Delete oldest file (log.N) if it exists
- *   2. Rename files backwards: log.N-1 -> log.N, ..., log.0 -> log.1
- *   3. If log.N-1 was renamed to log.N, signal zipper to compress
+ * config_build()
  *
- * Example:
- *   Before: log.0, log.1, log.2, log.3, log.4
- *   After:  log.1, log.2, log.3, log.4, log.5
- *           (and log.5 gets queued for compression)
+ * Purpose:
+ *   Reads the configuration file (built-in defaults when it does not
+ *   exist) and turns it into a snapshot indexed by type id: known types
+ *   keep their id, new types get registry entries, types no longer listed
+ *   stay in the table disabled. Runs off the rotator thread.
  *
- * @param base_name  Base path of log file (e.g., "var/log/ipmgr")
+ * @param first_new  Set to the id of the first type created by this build
+ * @return New snapshot, NULL on error (the caller keeps the current one)
  */
-void 
-file_rotate(const char *base_name)
+static log_config_t *
+config_build(int *first_new)
 {
-    char old_name[FILE_ABS_PATH_NAME_LEN];
-    char new_name[FILE_ABS_PATH_NAME_LEN];
-    bool ready_to_zip = false;
-
-    /* Delete the oldest file if it exists (e.g., ipmgr.log.5) */
-    snprintf(old_name, sizeof(old_name), "%s.log.%d", 
-             base_name, DEFAULT_MAX_FILES);
+    log_config_t builtin;
+    log_config_t *parsed, *snap;
+    const log_config_t *prev = config_get();
+
+    config_builtin_defaults(&builtin);
+
+    errno = 0;
+    parsed = log_config_load(config_file_path, &builtin);
+    if (!parsed) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "ERROR: Cannot load configuration %s\n", config_file_path);
+            return NULL;
+        }
+        /* No file: the built-in configuration */
+        parsed = log_config_create(&builtin);
+        if (!parsed) return NULL;
+    }
 
-    if (access(old_name, F_OK) == 0) {
-        if (remove(old_name) == 0) {
-            printf("Deleted oldest file: %s\n", old_name);
+    /* No [type] sections: the built-in target list */
+    if (parsed->ntypes == 0) {
+        for (int i = 0; i < DEFAULT_NUM_TARGET_FILES; i++) {
+            log_config_add_type(parsed, target_files[i]);
         }
     }
 
-    /* 
-     * Rotate files backwards (N-1 -> N, N-2 -> N-1, ..., 0 -> 1)
-     * This makes room for the new log.0 file
-     */
-    for (int i = DEFAULT_MAX_FILES - 1; i >= 0; i--) {
-        snprintf(old_name, sizeof(old_name), "%s.log.%d", base_name, i);
-        snprintf(new_name, sizeof(new_name), "%s.log.%d", base_name, i + 1);
-
-        if (access(old_name, F_OK) == 0) {
-            if (rename(old_name, new_name) == 0) {
-                printf("Renamed: %s -> %s\n", old_name, new_name);
-
-                /* 
-                 * If we just created the highest numbered file (log.N),
-                 * mark it for compression
-                 */
-                if (i == DEFAULT_MAX_FILES - 1) {
-                    ready_to_zip = true;
-                }
-            } else {
-                fprintf(stderr, "Error renaming %s to %s: %s\n",
-                        old_name, new_name, strerror(errno));
+    snap = log_config_create(parsed);
+    if (!snap) goto fail;
+
+    /* Known types keep their id, enabled only if still listed */
+    for (int id = 0; id < num_log_types_allocated; id++) {
+        int j = log_config_find_type(parsed, log_types[id]->name);
+
+        if (log_config_add_type(snap, log_types[id]->name) != id) goto fail;
+        if (j >= 0) {
+            snap->types[id] = parsed->types[j];
+        } else {
+            if (prev && id < prev->ntypes) snap->types[id] = prev->types[id];
+            snap->types[id].enabled = false;
+        }
+
+        /* A type stays in the directory it was created in */
+        if (strcmp(snap->types[id].watch_dir, log_types[id]->dir) != 0) {
+            if (j >= 0) {
+                fprintf(stderr, "WARNING: %s: watch_dir change to %s needs a restart\n",
+                        log_types[id]->name, snap->types[id].watch_dir);
             }
+            memcpy(snap->types[id].watch_dir, log_types[id]->dir, sizeof(log_types[id]->dir));
         }
     }
 
-    /* Signal zipper thread if maximum files reached */
-    if (ready_to_zip) {
-        /* Determine which file type this is */
-        int file_idx = get_file_type_index(base_name);
-        if (file_idx < 0) {
-            fprintf(stderr, "ERROR: Unknown file type for compression: %s\n", base_name);
-            return;
-        }
-        
-        /* Store filename for zipper thread with lock protection */
-        pthread_spin_lock(&compression_state_lock);
-        snprintf(file_compression_state[file_idx].terminal_fname, 
-                 sizeof(file_compression_state[file_idx].terminal_fname), 
-                 "%s.log.%d", base_name, DEFAULT_MAX_FILES);
-        atomic_store(&file_compression_state[file_idx].needs_compression, true);
-        pthread_spin_unlock(&compression_state_lock);
-
-        /* Wake up zipper thread to start compression */
-        sem_post(&wake_up_zipper_thread);
-        ready_to_zip = false;
+    /* New types */
+    *first_new = num_log_types_allocated;
+    for (int j = 0; j < parsed->ntypes; j++) {
+        if (log_config_find_type(snap, parsed->types[j].name) >= 0) continue;
+
+        int id = log_type_create(parsed->types[j].name, parsed->types[j].watch_dir);
+        if (id < 0 || log_config_add_type(snap, parsed->types[j].name) != id) goto fail;
+        snap->types[id] = parsed->types[j];
     }
+
+    if (log_config_build_matcher(snap) < 0) {
+        fprintf(stderr, "ERROR: Failed to build log type matcher\n");
+        goto fail;
+    }
+
+    snap->version = prev ? prev->version + 1 : 0;
+    log_config_free(parsed);
+    return snap;
+
+fail:
+    log_config_free(parsed);
+    log_config_free(snap);
+    return NULL;
 }
 
 /**
- * base_file_name_extract()
- * 
- * Purpose:
- *   Extracts the base filename from a .bak file path.
- *   Modifies the input buffer in-place by truncating at the first dot.
+ * config_publish()
  *
- * Example:
- *   Input:  "var/log/ipmgr.log.1234567890.bak"
- *   Output: "var/log/ipmgr"
+ * Purpose:
+ *   Makes a snapshot from config_build() current. New types get their
+ *   directory state before they become matchable; the swap itself is one
+ *   atomic store, the rotator picks the snapshot up on its next read().
+ *   The previous snapshot is retired, not freed.
  *
- * @param base_name  Buffer containing full path (modified in-place)
- * @return 0 on success, -1 on failure
+ * @param first_new  First type id created by the build
  */
-static int
-base_file_name_extract(char *base_name)
+static void
+config_publish(log_config_t *snap, int first_new)
 {
-    /* Find last dot (should be ".bak") */
-    char *last = strrchr(base_name, '.');
+    log_config_t *old;
 
-    if (last && strcmp(last, ".bak") == 0) {
-        /* Find first dot after the base filename */
-        char *first = strchr(base_name, '.');
-        
-        if (first) {
-            /* Truncate at first dot to get base name */
-            *first = '\0';
-        } else {
-            /* Edge case: filename has .bak but no other dots */
-            *last = '\0';
-        }
-        return 0;
+    /* Before the scan, which reports what it found */
+    diag_set_level(snap->diag_level);
+    if (first_new < snap->ntypes) {
+        log_dir_state_init(snap, first_new);
+    }
+    /* After the scan: it reports the archives found to the budget */
+    retention_set_budget(snap->archive_budget,
+                         snap->archive_budget / 100 * ARCHIVE_BUDGET_LOW_PERCENT);
+
+    atomic_store_explicit(&num_log_types, snap->ntypes, memory_order_release);
+    old = atomic_exchange_explicit(&current_config, snap, memory_order_acq_rel);
+    if (old) {
+        old->retired_next = retired_configs;
+        retired_configs = old;
     }
 
-    return -1;  /* Not a valid .bak file */
+    /* Batches and segments found by the scan can only be queued and
+       folded once the type is live */
+    for (int i = first_new; i < snap->ntypes; i++) {
+        log_files_lock(i);
+        if (control_flags & CTRL_F_GENERATION_ROTATION) {
+            generation_queue_ready_batches(i);
+        } else if (log_pending_segments(i) > 0 && !zip_in_progress(i)) {
+            file_rotate(i);
+        }
+        log_files_unlock(i);
+    }
 }
 
+/* Serializes reloads with each other and with the start of a stop */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
- * handle_bak_file()
- * 
- * Purpose:
- *   Handles the creation of a new .bak file by either:
- *   - Normal case: Rename .bak to log.0 and rotate existing files
- *   - Zipper busy: Append .bak content to log.0 (or create log.0 if missing)
+ * ipmgr_log_rotator_reload_config()
  *
- * The "zipper busy" case prevents data loss when compression is taking a
- * long time and new .bak files arrive before rotation can complete.
+ * Purpose:
+ *   Re-reads the configuration file and swaps it in. Called on SIGHUP by
+ *   the reload thread, or directly by an embedding application. On any
+ *   error the running configuration is kept. A type in a new directory
+ *   starts a new rotator shard. Moving an existing type to another
+ *   watch_dir, and generation_rotation, only take effect on restart.
  *
- * @param bak_file  Filename of the .bak file (e.g., "ipmgr.log.1234567890.bak")
+ * @return 0 on success, -1 if the file was rejected or a stop has begun
  */
-void 
-handle_bak_file(const char *bak_file, int findex)
+int
+ipmgr_log_rotator_reload_config(void)
 {
-    char full_bak_path[FILE_ABS_PATH_NAME_LEN];
-    char numbered_file[512];
-    char base_name[FILE_ABS_PATH_NAME_LEN];
-
-    /* Build absolute path to .bak file */
-    snprintf(full_bak_path, sizeof(full_bak_path), 
-             "%s%s", DEFAULT_WATCH_DIR, bak_file);
-    
-    printf ("%s called to handle : %s\n", __FUNCTION__, full_bak_path);
-
-    /* Verify the .bak file exists before processing */
-    if (access(full_bak_path, F_OK) != 0) {
-        fprintf(stderr, "ERROR: File not found: %s\n", full_bak_path);
-        return;
-    }
-
-    if (strstr (full_bak_path, "dummy")) {
-
-        handle_dummy_bak_file_creation(findex);
-
-        if (remove (full_bak_path) != 0) {
-            fprintf (stderr, "Error : Deletion of dummy bak file %s failed\n", full_bak_path);
-        }
-        return;
+    log_config_t *snap;
+    int first_new;
+
+    /* Reloads are serialized with each other and a stop, never with the rotator */
+    pthread_mutex_lock(&reload_lock);
+    if (atomic_load(&shutdown_state) != SHUTDOWN_NONE) {
+        printf("Stopping: configuration %s not reloaded\n", config_file_path);
+        pthread_mutex_unlock(&reload_lock);
+        return -1;
     }
 
-    /* Extract base name (e.g., "var/log/ipmgr") */
-    snprintf(base_name, sizeof(base_name), "%s", full_bak_path);
-    if (base_file_name_extract(base_name) < 0) {
-        fprintf(stderr, "ERROR: Invalid .bak filename format\n");
-        return;
+    snap = config_build(&first_new);
+    if (!snap) {
+        atomic_fetch_add(&config_reload_failures, 1);
+        pthread_mutex_unlock(&reload_lock);
+        return -1;
     }
 
-    printf("\n=== Processing .bak file ===\n");
-    printf("Full path: %s\n", full_bak_path);
-    printf("Base name: %s\n", base_name);
-
-    /*
-     * SPECIAL CASE: Zipper thread is busy compressing files
-     * 
-     * Problem: If we rotate files now, we might interfere with the
-     * compression process or lose data if rotation happens too fast.
-     * 
-     * Solution: Instead of rotating, append the new .bak content to
-     * log.0 (or create log.0 if it doesn't exist). This preserves
-     * all log data without interfering with compression.
-     */
-    if (atomic_load(&zip_in_progress)) {
-        printf("INFO: Compression in progress, using append strategy\n");
-
-        snprintf(numbered_file, sizeof(numbered_file), "%s.log.0", base_name);
-
-        /* Check if log.0 exists */
-        if (access(numbered_file, F_OK) != 0) {
-            /* log.0 doesn't exist - simply rename .bak to log.0 */
-            if (rename(full_bak_path, numbered_file) == 0) {
-                printf("   Created: %s (renamed from .bak)\n", numbered_file);
-            } else {
-                fprintf(stderr, "ERROR: Failed to rename %s to %s: %s\n",
-                        full_bak_path, numbered_file, strerror(errno));
-            }
-        } else {
-            /* 
-             * log.0 exists - append .bak content to it using sendfile()
-             * for efficient zero-copy kernel-space transfer
-             */
-            int src_fd = open(full_bak_path, O_RDONLY);
-            int dest_fd = open(numbered_file, O_WRONLY | O_APPEND);
-
-            if (src_fd >= 0 && dest_fd >= 0) {
-                struct stat stat_buf;
-
-                /* Get source file size */
-                if (fstat(src_fd, &stat_buf) == 0) {
-                    off_t offset = 0;
-                    ssize_t bytes_sent;
-
-                    /* Transfer data using zero-copy sendfile() */
-                    while (offset < stat_buf.st_size) {
-                        bytes_sent = sendfile(dest_fd, src_fd, &offset, 
-                                              stat_buf.st_size - offset);
-                        
-                        if (bytes_sent <= 0) {
-                            /* Handle interrupts and temporary errors */
-                            if (errno == EINTR || errno == EAGAIN) {
-                                continue;
-                            }
-                            fprintf(stderr, "ERROR: sendfile failed: %s\n", 
-                                    strerror(errno));
-                            break;
-                        }
-                    }
-
-                    close(src_fd);
-                    close(dest_fd);
-
-                    /* Remove .bak file after successful append */
-                    if (offset == stat_buf.st_size && remove(full_bak_path) == 0) {
-                        printf("   Appended %ld bytes to %s\n", 
-                               stat_buf.st_size, numbered_file);
-                    } else {
-                        fprintf(stderr, "ERROR: Failed to remove %s: %s\n",
-                                full_bak_path, strerror(errno));
-                    }
-                } else {
-                    close(src_fd);
-                    close(dest_fd);
-                    fprintf(stderr, "ERROR: Failed to get file size: %s\n", 
-                            strerror(errno));
-                }
-            } else {
-                if (src_fd >= 0) close(src_fd);
-                if (dest_fd >= 0) close(dest_fd);
-                fprintf(stderr, "ERROR: Failed to open files: %s\n", 
-                        strerror(errno));
-            }
-        }
-        return;
+    if ((snap->control_flags ^ control_flags) & CTRL_F_GENERATION_ROTATION) {
+        fprintf(stderr, "WARNING: generation_rotation change needs a restart\n");
     }
 
-    /*
-     * NORMAL CASE: Zipper is not busy
-     * Perform standard rotation: .bak -> log.0, then rotate all files
-     */
-    snprintf(numbered_file, sizeof(numbered_file), "%s.log.0", base_name);
+    config_publish(snap, first_new);
+    log_shards_start();
+    atomic_fetch_add(&config_reloads, 1);
+    printf("Configuration %s reloaded: %d log types\n", config_file_path, snap->ntypes);
 
-    if (rename(full_bak_path, numbered_file) == 0) {
-        printf("   Renamed: %s -> %s\n", full_bak_path, numbered_file);
-    } else {
-        fprintf(stderr, "ERROR: Rename failed: %s -> %s: %s\n",
-                full_bak_path, numbered_file, strerror(errno));
-    }
+    pthread_mutex_unlock(&reload_lock);
+    return 0;
+}
 
-    /* lock the Critical section. Any operation on numbered files
-        is defined as C.S */
-    pthread_spin_lock(&operations_on_log_files);
-    /* Rotate existing numbered files */
-    file_rotate(base_name);
-    /* Unlock the Critical section. */
-    pthread_spin_unlock(&operations_on_log_files);
+/* Configuration file read at startup and on SIGHUP, before starting */
+void
+ipmgr_log_rotator_set_config_file(const char *path)
+{
+    config_file_path = path;
 }
 
+/* Signals handled by the reload thread, blocked in every other thread */
+static sigset_t reload_sigset;
+static pthread_t config_reload_thread;
+
 /**
- * log_rotate_thread_fn()
- * 
- * Purpose:
- *   Main worker thread that monitors the log directory for .bak file creation
- *   using inotify and processes them as they arrive.
+ * config_reload_thread_fn()
  *
- * Process:
- *   1. Initialize inotify and watch the log directory
- *   2. Enter infinite loop reading inotify events
- *   3. Filter for .bak files matching target log types
- *   4. Process each matching .bak file
+ * Purpose:
+ *   Waits for SIGHUP with sigwait() and reloads the configuration. Running
+ *   the reload here, not in a signal handler, keeps it free to allocate,
+ *   read files and take locks.
  *
- * Thread Safety:
- *   Cancellable at read() cancellation point
+ * Stopping:
+ *   Exits at the first signal once shutdown_state is set: the stop sends
+ *   it a SIGHUP, never a reload by then
  */
 static void *
-log_rotate_thread_fn(void *arg)
+config_reload_thread_fn(void *arg)
 {
     (void)arg;  /* Unused parameter */
-    
-    char buffer[BUF_LEN];
+    int sig;
 
-    /* Initialize inotify instance */
-    inotify_fd = inotify_init();
-    if (inotify_fd < 0) {
-        perror("ERROR: inotify_init failed");
-        return NULL;
-    }
-
-    /* 
-     * Add watch for log directory
-     * IN_CREATE: Triggered when files are created
-     * IN_MOVED_TO: Triggered when files are moved into directory
-     */
-    watch_fd = inotify_add_watch(inotify_fd, DEFAULT_WATCH_DIR, 
-                                  IN_CREATE | IN_MOVED_TO);
-
-    if (watch_fd < 0) {
-        perror("ERROR: inotify_add_watch failed");
-        close(inotify_fd);
-        return NULL;
-    }
-
-    printf("Monitoring directory: %s\n", DEFAULT_WATCH_DIR);
+    metrics_thread_attach("config reload");
+    diag_thread_name("config reload");
 
-    /* Configure thread cancellation behavior */
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-
-    /* Signal that thread initialization is complete */
     sem_post(&wait_for_thread_init);
 
-    /*
-     * Main event processing loop
-     * Blocks on read() waiting for inotify events
-     */
     while (1) {
-        /* Read events from inotify (cancellation point) */
-        int length = read(inotify_fd, buffer, BUF_LEN);
-
-        if (length < 0) {
-            perror("ERROR: inotify read failed");
-            break;
-        }
+        if (sigwait(&reload_sigset, &sig) != 0) continue;
+        if (atomic_load(&shutdown_state) != SHUTDOWN_NONE) break;
 
-        /* Process all events in the buffer */
-        int i = 0;
-        while (i < length) {
-            struct inotify_event *event = (struct inotify_event *)&buffer[i];
-
-            /* Only process events with a filename */
-            if (event->len > 0) {
-                /* Check if this is a .bak file */
-                    if (strstr(event->name, ".bak") == NULL ) {
-                        i += EVENT_SIZE + event->len;
-                        continue;
-                    }
-
-                    printf("\n[inotify] event detected: %s\n", event->name);
-                    /* Check if it matches one of our target log types */
-                    
-                    for (int j = 0; j < DEFAULT_NUM_TARGET_FILES; j++) {
-                        if (strstr(event->name, target_files[j])) {
-                            printf("[inotify] Matches target: %s\n", target_files[j]);
-                            sem_wait(&inotify_events_allow_sema);
-                            handle_bak_file(event->name, j);
-                            sem_post(&inotify_events_allow_sema);
-                            break;
-                        }
-                    }
-            }
-
-            /* Move to next event */
-            i += EVENT_SIZE + event->len;
+        if (sig == SIGHUP) {
+            printf("SIGHUP: reloading %s\n", config_file_path);
+            ipmgr_log_rotator_reload_config();
         }
     }
-
-    /* Cleanup (unreachable code - thread is cancelled) */
-    inotify_rm_watch(inotify_fd, watch_fd);
-    close(inotify_fd);
     return NULL;
 }
 
@@ -955,51 +4718,65 @@ log_rotate_thread_fn(void *arg)
  * ipmgr_log_rotator_threads_init()
  * 
  * Purpose:
- *   Creates and initializes both worker threads (log rotator and zipper).
- *   Waits for each thread to signal successful initialization before
- *   proceeding.
+ *   Creates and initializes the worker threads (one log rotator per
+ *   watch directory, zippers, config reload). Waits for each zipper and
+ *   the reload thread to signal successful initialization before
+ *   proceeding; rotator shards are ready once created.
  *
  * Thread Attributes:
  *   - PTHREAD_CREATE_JOINABLE: Threads can be joined for cleanup
  */
-void 
+static void
 ipmgr_log_rotator_threads_init(void)
 {
-    pthread_attr_t attr1, attr2;
+    pthread_attr_t attr2;
 
     /*
-     * Create Log Rotator Thread
-     * Monitors directory and processes .bak files
+     * Create Log Rotator Threads
+     * Each monitors one directory and processes its .bak files
      */
-    pthread_attr_init(&attr1);
-    pthread_attr_setdetachstate(&attr1, PTHREAD_CREATE_JOINABLE);
-
-    if (pthread_create(&log_rotator_thread, &attr1, log_rotate_thread_fn, NULL) != 0) {
-        fprintf(stderr, "ERROR: Failed to create log rotator thread\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    /* Wait for thread to initialize */
-    sem_wait(&wait_for_thread_init);
-    printf(" Log Rotator thread started\n");
-
-    pthread_attr_destroy(&attr1);
+    log_shards_start();
 
     /*
-     * Create Zipper Thread
-     * Compresses old log files into archives
+     * Create Zipper Threads
+     * Compress old log files into archives, one job at a time each
      */
     pthread_attr_init(&attr2);
     pthread_attr_setdetachstate(&attr2, PTHREAD_CREATE_JOINABLE);
 
-    if (pthread_create(&zipper_thread, &attr2, zip_log_file_thread_fn, NULL) != 0) {
-        fprintf(stderr, "ERROR: Failed to create zipper thread\n");
+    num_zipper_threads = DEFAULT_ZIPPER_THREADS;
+    if (num_zipper_threads <= 0) {
+        num_zipper_threads = atomic_load(&num_log_types);
+        if (num_zipper_threads > ZIPPER_THREADS_AUTO_MAX) num_zipper_threads = ZIPPER_THREADS_AUTO_MAX;
+        if (num_zipper_threads < 1) num_zipper_threads = 1;
+    }
+    zipper_threads = calloc(num_zipper_threads, sizeof(pthread_t));
+    if (!zipper_threads) {
+        fprintf(stderr, "ERROR: Failed to allocate zipper threads\n");
         exit(EXIT_FAILURE);
     }
 
-    /* Wait for thread to initialize */
+    for (int i = 0; i < num_zipper_threads; i++) {
+        if (pthread_create(&zipper_threads[i], &attr2, zip_log_file_thread_fn, NULL) != 0) {
+            fprintf(stderr, "ERROR: Failed to create zipper thread\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Wait for thread to initialize */
+        sem_wait(&wait_for_thread_init);
+    }
+    printf(" %d Zipper threads started\n", num_zipper_threads);
+
+    /*
+     * Create Configuration Reload Thread
+     * Takes SIGHUP, blocked in every other thread
+     */
+    if (pthread_create(&config_reload_thread, &attr2, config_reload_thread_fn, NULL) != 0) {
+        fprintf(stderr, "ERROR: Failed to create config reload thread\n");
+        exit(EXIT_FAILURE);
+    }
     sem_wait(&wait_for_thread_init);
-    printf(" Zipper thread started\n");
+    printf(" Config reload thread started\n");
 
     pthread_attr_destroy(&attr2);
 }
@@ -1014,22 +4791,58 @@ ipmgr_log_rotator_threads_init(void)
 void 
 ipmgr_start_log_rotator_thread(void)
 {
+    log_config_t *cfg;
+    int first_new;
+
+    /* SIGHUP goes to the reload thread only: block it before any thread exists */
+    sigemptyset(&reload_sigset);
+    sigaddset(&reload_sigset, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_sigset, NULL);
+
+    /* Diagnostics drain, SIGHUP blocked like every thread but the reloader */
+    if (diag_init(STDERR_FILENO) < 0) {
+        perror("WARNING: diagnostics drain thread not started");
+    }
+    diag_thread_name("main");
+
+    /* Configuration file, or the built-in defaults when there is none */
+    cfg = config_build(&first_new);
+    if (!cfg) {
+        fprintf(stderr, "ERROR: Invalid configuration %s\n", config_file_path);
+        exit(EXIT_FAILURE);
+    }
+    control_flags = cfg->control_flags;
+
+    /* Metrics page, before any thread records */
+    if (metrics_init() < 0) {
+        perror("WARNING: metrics page " METRICS_SHM_NAME " not created");
+    }
+
     /* Initialize synchronization primitives */
     sem_init(&wake_up_zipper_thread, 0, 0);      /* Zero semaphore (starts at 0) */
     sem_init(&wait_for_thread_init, 0, 0);    /* Zero semaphore for init sync */
-    sem_init(&inotify_events_allow_sema, 0,1); /* Binary semaphore to momentarily 
-                                                    pause inotify events*/
-    pthread_spin_init(
-        &operations_on_log_files, PTHREAD_PROCESS_PRIVATE); /* Spinlock for mutual ex*/
-    pthread_spin_init(
-        &compression_state_lock, PTHREAD_PROCESS_PRIVATE); /* Spinlock for compression state */
     
-    /* Initialize per-file-type compression state */
-    for (int i = 0; i < DEFAULT_NUM_TARGET_FILES; i++) {
-        file_compression_state[i].terminal_fname[0] = '\0';
-        atomic_store(&file_compression_state[i].needs_compression, false);
+    /* Start the compression worker pool before the zipper thread uses it */
+    compress_pool = deflate_pool_create(DEFAULT_COMPRESS_THREADS);
+    if (!compress_pool) {
+        fprintf(stderr, "WARNING: compression pool not started, compressing serially\n");
+    }
+
+    /* Ring of runnable types: a type is queued at most once */
+    if (lf_ring_init(&zipper_run_queue, LOG_CONFIG_MAX_TYPES, sizeof(int)) < 0) {
+        fprintf(stderr, "ERROR: Failed to allocate zipper run queue\n");
+        exit(EXIT_FAILURE);
     }
 
+    /* Archive budget and unlinks, before the scan reports archives */
+    if (retention_init() < 0) {
+        fprintf(stderr, "WARNING: retention thread not started, unlinking inline\n");
+    }
+
+    /* One directory scan: numbered slot cache and generation index */
+    config_publish(cfg, first_new);
+    printf(" Configuration: %s, %d log types\n", config_file_path, cfg->ntypes);
+
     printf("\n========================================\n");
     printf("  Log Rotation System Starting\n");
     printf("========================================\n");
@@ -1045,69 +4858,198 @@ ipmgr_start_log_rotator_thread(void)
     printf("========================================\n\n");
 }
 
+/*
+ * Lets the zippers run the jobs still queued, until the stop's deadline:
+ * past it the archives in flight are abandoned.
+ */
+static void
+zippers_stop(void)
+{
+    struct timespec deadline;
+    uint64_t now = metrics_now_ns();
+    uint64_t left = shutdown_deadline_ns > now ? shutdown_deadline_ns - now : 0;
+
+    /* One wakeup more per worker: each exits on the empty pop it gets */
+    atomic_store(&zippers_exit, true);
+    for (int i = 0; i < num_zipper_threads; i++) {
+        sem_post(&wake_up_zipper_thread);
+    }
+
+    /* pthread_timedjoin_np() takes a CLOCK_REALTIME instant */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(left / 1000000000ull);
+    deadline.tv_nsec += (long)(left % 1000000000ull);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (int i = 0; i < num_zipper_threads; i++) {
+        if (pthread_timedjoin_np(zipper_threads[i], NULL, &deadline) != 0) {
+            shutdown_go_fast();
+            pthread_join(zipper_threads[i], NULL);
+        }
+    }
+    free(zipper_threads);
+    zipper_threads = NULL;
+}
+
+/**
+ * ipmgr_log_rotator_fast_stop()
+ *
+ * Purpose:
+ *   Cuts a running ipmgr_stop_log_rotator_thread() short, as if its
+ *   deadline had passed: the rotators exit within SHUTDOWN_POLL_MS and
+ *   the zippers drop the archives they are writing. Nothing before a stop
+ *   has begun. Async-signal-safe, meant for a second SIGTERM.
+ */
+void
+ipmgr_log_rotator_fast_stop(void)
+{
+    if (atomic_load(&shutdown_state) != SHUTDOWN_NONE) {
+        shutdown_go_fast();
+    }
+}
+
 /**
  * ipmgr_stop_log_rotator_thread()
  * 
  * Purpose:
- *   Public API to stop the log rotation system.
- *   Cancels both threads, waits for them to exit, and cleans up resources.
+ *   Public API to stop the log rotation system. The stop drains for at
+ *   most shutdown_timeout seconds:
+ *   1. Rotators stop watching, rotate the .bak files already queued and
+ *      fold the jobs of their types (shift mode)
+ *   2. Zippers run the jobs still queued
+ *   3. One fsync per watch directory
+ *   Past the deadline (or at once with shutdown_timeout 0, or on
+ *   ipmgr_log_rotator_fast_stop()) the archives being written are
+ *   abandoned and queued jobs skipped. Their files stay in place and the
+ *   next startup rotates and archives them, see log_shard_replay().
  */
 void 
 ipmgr_stop_log_rotator_thread(void)
 {
+    int timeout = config_get()->shutdown_timeout;
+
     printf("\n========================================\n");
     printf("  Shutting Down Log Rotation System\n");
     printf("========================================\n");
 
-    /* Cancel and join log rotator thread */
-    pthread_cancel(log_rotator_thread);
-    pthread_join(log_rotator_thread, NULL);
-    printf(" Log rotator thread stopped\n");
+    /* A reload in progress completes, none starts after this */
+    pthread_mutex_lock(&reload_lock);
+    shutdown_deadline_ns = metrics_now_ns() + (uint64_t)timeout * 1000000000ull;
+    if (timeout > 0) {
+        atomic_store(&shutdown_state, SHUTDOWN_DRAIN);
+    } else {
+        shutdown_go_fast();
+    }
+    pthread_mutex_unlock(&reload_lock);
+
+    /* Wakes its sigwait(): SIGHUP is blocked there, so it stays pending
+       until taken, even if a reload was still finishing */
+    pthread_kill(config_reload_thread, SIGHUP);
+    pthread_join(config_reload_thread, NULL);
+
+    /* Rotators first: the zippers run the jobs of their last rotations */
+    log_shards_drain();
+    printf(" Log rotator threads stopped\n");
+
+    zippers_stop();
+    printf(" Zipper threads stopped%s\n",
+           atomic_load(&zip_cancel) ? " (deadline reached, files left for next start)" : "");
+
+    /* Zippers no longer signal the shards: sync the directories, close */
+    log_shards_stop();
 
-    /* Cancel and join zipper thread */
-    pthread_cancel(zipper_thread);
-    pthread_join(zipper_thread, NULL);
-    printf(" Zipper thread stopped\n");
+    /* Queued archive unlinks run before the retention thread exits */
+    retention_shutdown();
 
     /* Clean up resources */
     sem_destroy(&wake_up_zipper_thread);
-    sem_destroy(&inotify_events_allow_sema);
 
-    pthread_spin_destroy(&operations_on_log_files);
-    pthread_spin_destroy(&compression_state_lock);
-    inotify_rm_watch(inotify_fd, watch_fd);
-    close(inotify_fd);
+    lf_ring_destroy(&zipper_run_queue);
+    for (int i = 0; i < num_log_types_allocated; i++) {
+        lf_ring_destroy(&log_types[i]->jobs);
+        pthread_mutex_destroy(&log_types[i]->files_lock);
+        free(log_types[i]->dict.buf);
+        free(log_types[i]);
+        log_types[i] = NULL;
+    }
+    num_log_types_allocated = 0;
+    atomic_store(&num_log_types, 0);
+
+    /* Readers are gone: current and retired snapshots can go */
+    log_config_free(atomic_exchange(&current_config, NULL));
+    while (retired_configs) {
+        log_config_t *next = retired_configs->retired_next;
+        log_config_free(retired_configs);
+        retired_configs = next;
+    }
+    deflate_pool_destroy(compress_pool);
+    compress_pool = NULL;
+    metrics_shutdown();
 
     printf("========================================\n");
     printf("  System Stopped Successfully\n");
     printf("========================================\n\n");
+
+    /* Last, so everything above gets written out */
+    diag_shutdown();
 }
 
 /*******************************************************************************
  *                              MAIN FUNCTION
  ******************************************************************************/
 
+#ifndef IPMGR_LOG_ROTATOR_NO_MAIN
+
+/* Second SIGTERM / SIGINT while draining: stop now */
+static void
+fast_stop_handler(int sig)
+{
+    (void)sig;
+    ipmgr_log_rotator_fast_stop();
+}
+
 /**
  * main()
  * 
  * Test driver for the log rotation system.
- * Starts the system, runs for 60 seconds, then shuts down.
+ * Starts the system and runs until SIGTERM or SIGINT, then drains and
+ * shuts down (shutdown_timeout). A second signal makes it a fast stop.
+ * Usage: ipmgr_log_rotator.exe [config file]
  */
 int 
 main(int argc, char **argv)
 {
-    (void)argc;  /* Unused parameters */
-    (void)argv;
+    struct sigaction sa = { .sa_handler = fast_stop_handler };
+    sigset_t stop_sigset;
+    int sig;
+
+    if (argc > 1) {
+        ipmgr_log_rotator_set_config_file(argv[1]);
+    }
+
+    /* Blocked before any thread exists, taken here with sigwait() */
+    sigemptyset(&stop_sigset);
+    sigaddset(&stop_sigset, SIGTERM);
+    sigaddset(&stop_sigset, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stop_sigset, NULL);
 
     /* Start the log rotation system */
     ipmgr_start_log_rotator_thread();
 
-    /* Run for 60 seconds (or forever in production) */
-    //sleep(60);
+    while (sigwait(&stop_sigset, &sig) != 0);
+    printf("%s: stopping\n", strsignal(sig));
 
-    /* Graceful shutdown */
-    //ipmgr_stop_log_rotator_thread();
+    /* Graceful shutdown, the handler runs on this thread only */
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stop_sigset, NULL);
 
-    pthread_exit(NULL);
+    ipmgr_stop_log_rotator_thread();
     return EXIT_SUCCESS;
 }
+
+#endif /* IPMGR_LOG_ROTATOR_NO_MAIN */
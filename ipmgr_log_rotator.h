@@ -0,0 +1,45 @@
+/*******************************************************************************
+ * File: ipmgr_log_rotator.h
+ *
+ * Description:
+ *   Public API of ipmgr_log_rotator, for applications embedding the
+ *   rotator instead of running ipmgr_log_rotator.exe (rotator_bench.c
+ *   runs it in-process this way). Build ipmgr_log_rotator.c with
+ *   -DIPMGR_LOG_ROTATOR_NO_MAIN to leave its test driver main() out.
+ *
+ *   The rotator takes SIGHUP for configuration reloads: start it before
+ *   creating other threads, so they inherit the blocked signal mask.
+ *
+ *   Stopping drains for up to shutdown_timeout seconds (queued .bak files
+ *   rotated, queued archives written); ipmgr_log_rotator_fast_stop(), safe
+ *   in a signal handler, cuts it short. What a stop leaves behind is picked
+ *   up by the next start.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_LOG_ROTATOR_H
+#define IPMGR_LOG_ROTATOR_H
+
+#include <stdint.h>
+
+/* Configuration file read at startup and on SIGHUP, before starting */
+void
+ipmgr_log_rotator_set_config_file(const char *path);
+
+void
+ipmgr_start_log_rotator_thread(void);
+
+void
+ipmgr_stop_log_rotator_thread(void);
+
+void
+ipmgr_log_rotator_fast_stop(void);
+
+int
+ipmgr_log_rotator_reload_config(void);
+
+/* Diagnostics: contended acquisitions of a type's files_lock */
+uint64_t
+log_files_lock_contention(int findex);
+
+#endif /* IPMGR_LOG_ROTATOR_H */
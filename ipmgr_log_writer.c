@@ -0,0 +1,439 @@
+/*******************************************************************************
+ * File: ipmgr_log_writer.c
+ *
+ * Description:
+ *   Batched, size-rotated line writer (see ipmgr_log_writer.h): lines are
+ *   copied into a batch buffer, written out in one syscall when the batch
+ *   is full, its oldest line is flush_latency_us old or the file is
+ *   sealed, and the file renamed to a .bak once it holds rotate_size
+ *   bytes. With use_mmap lines skip the batch and go straight into a
+ *   mapping of the preallocated file.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/* System Headers */
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "ipmgr_log_writer.h"
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Length of the file without the zero padding a use_mmap writer leaves
+ * behind when it dies before truncating: lines never hold NUL bytes.
+ */
+static uint64_t
+file_data_len(int fd, uint64_t size)
+{
+    char block[4096];
+
+    while (size > 0) {
+        size_t n = size < sizeof(block) ? (size_t)size : sizeof(block);
+        uint64_t at = size - n;
+
+        if (pread(fd, block, n, (off_t)at) != (ssize_t)n) return size;
+        while (n > 0 && block[n - 1] == '\0') n--;
+        if (n > 0) return at + n;
+        size = at;
+    }
+    return 0;
+}
+
+/* Opens the current file, appending to what a previous run left in it */
+static int
+writer_open_file(log_writer_t *w)
+{
+    struct stat st;
+
+    w->fd = open(w->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (w->fd < 0) return -1;
+    w->alloc_bytes = 0;
+    w->file_bytes = 0;
+    if (fstat(w->fd, &st) == 0 && st.st_size > 0) {
+        uint64_t len = file_data_len(w->fd, (uint64_t)st.st_size);
+
+        if (len < (uint64_t)st.st_size && ftruncate(w->fd, (off_t)len) < 0) len = (uint64_t)st.st_size;
+        w->file_bytes = len;
+    }
+    return 0;
+}
+
+/* Drops the mapping and gives the file its real length (use_mmap) */
+static int
+writer_unmap(log_writer_t *w)
+{
+    int rc = 0;
+
+    if (w->map) {
+        munmap(w->map, LOG_WRITER_MMAP_WINDOW);
+        w->map = NULL;
+    }
+    if (w->alloc_bytes > w->file_bytes && w->fd >= 0) {
+        rc = ftruncate(w->fd, (off_t)w->file_bytes);
+    }
+    w->alloc_bytes = 0;
+    return rc;
+}
+
+/**
+ * writer_map_put()
+ *
+ * Purpose:
+ *   use_mmap version of writer_put(): preallocates the file to
+ *   rotate_size (or to what the data needs, for an oversized line) and
+ *   copies the data into the mapped window, sliding it along the file.
+ *
+ * @return 0 on success, -1 with errno set, 1 when the file system cannot
+ *         preallocate: use_mmap is then turned off, nothing was written
+ */
+static int
+writer_map_put(log_writer_t *w, const char *data, size_t len)
+{
+    if (w->fd < 0 && writer_open_file(w) < 0) return -1;
+
+    if (w->file_bytes + len > w->alloc_bytes) {
+        uint64_t want = w->params.rotate_size;
+
+        if (want < w->file_bytes + len) want = w->file_bytes + len;
+        if (fallocate(w->fd, 0, 0, (off_t)want) < 0) {
+            if (errno != EOPNOTSUPP && errno != ENOSYS) return -1;
+            writer_unmap(w);
+            w->params.use_mmap = false;
+            return 1;
+        }
+        w->alloc_bytes = want;
+    }
+
+    while (len > 0) {
+        uint64_t off = w->file_bytes;
+        size_t n;
+
+        if (!w->map || off < w->map_off || off >= w->map_off + LOG_WRITER_MMAP_WINDOW) {
+            void *p;
+
+            if (w->map) munmap(w->map, LOG_WRITER_MMAP_WINDOW);
+            w->map = NULL;
+            w->map_off = off & ~((uint64_t)LOG_WRITER_MMAP_WINDOW - 1);
+            p = mmap(NULL, LOG_WRITER_MMAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     w->fd, (off_t)w->map_off);
+            if (p == MAP_FAILED) return -1;
+            w->map = p;
+            w->stats.maps++;
+        }
+
+        /* Only preallocated bytes are touched: no SIGBUS, no ENOSPC here */
+        n = (size_t)(w->map_off + LOG_WRITER_MMAP_WINDOW - off);
+        if (n > len) n = len;
+        memcpy(w->map + (off - w->map_off), data, n);
+        w->file_bytes += n;
+        w->stats.bytes += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * writer_write_out()
+ *
+ * Purpose:
+ *   Writes iov in one writev() (more only on a short write) to the
+ *   current file, opening it first if the last one was sealed.
+ *
+ * @return 0 on success, -1 with errno set (the data is dropped)
+ */
+static int
+writer_write_out(log_writer_t *w, struct iovec *iov, int iovcnt)
+{
+    if (w->fd < 0) {
+        uint64_t pending = w->file_bytes;
+
+        if (writer_open_file(w) < 0) return -1;
+        w->file_bytes += pending;
+    }
+
+    while (iovcnt > 0) {
+        ssize_t n = writev(w->fd, iov, iovcnt);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        w->stats.writes++;
+
+        /* Short write: carry on from where it stopped */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *                     PUBLIC FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * log_writer_open()
+ *
+ * Purpose:
+ *   Sets up a writer of <dir>/<name>.log. A file left by a previous run is
+ *   appended to, its size counting toward the first seal.
+ *
+ * @param params  Batch and rotation settings, NULL or 0 fields for the
+ *                LOG_WRITER_DEFAULT_* values
+ * @return 0 on success, -1 with errno set
+ */
+int
+log_writer_open(log_writer_t *w, const char *dir, const char *name,
+                const log_writer_params_t *params)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    if (params) w->params = *params;
+    if (!w->params.rotate_size) w->params.rotate_size = LOG_WRITER_DEFAULT_ROTATE;
+    if (!w->params.batch_len) w->params.batch_len = LOG_WRITER_DEFAULT_BATCH;
+    if (!w->params.flush_latency_us) w->params.flush_latency_us = LOG_WRITER_DEFAULT_LATENCY_US;
+
+    if ((size_t)snprintf(w->path, sizeof(w->path), "%s/%s.log", dir, name) >= sizeof(w->path) ||
+        (size_t)snprintf(w->bak_prefix, sizeof(w->bak_prefix), "%s/%s.", dir, name) >=
+            sizeof(w->bak_prefix) - 32) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    w->buf = malloc(w->params.batch_len);
+    if (!w->buf) return -1;
+    if (writer_open_file(w) < 0) {
+        int err = errno;
+
+        free(w->buf);
+        w->buf = NULL;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Writes the batch out now */
+int
+log_writer_flush(log_writer_t *w)
+{
+    struct iovec iov;
+    int rc;
+
+    if (w->buf_len == 0) return 0;
+    iov.iov_base = w->buf;
+    iov.iov_len = w->buf_len;
+    rc = writer_write_out(w, &iov, 1);
+    w->buf_len = 0;
+    return rc;
+}
+
+/**
+ * log_writer_seal()
+ *
+ * Purpose:
+ *   Flushes and renames the current file to <name>.<ts>.bak, for the
+ *   rotator. The next line starts a new file. Nothing to do for an empty
+ *   file.
+ *
+ * @return 0 on success, -1 with errno set
+ */
+int
+log_writer_seal(log_writer_t *w)
+{
+    char bak[LOG_WRITER_PATH_LEN + 32];
+    struct timespec ts;
+    uint64_t us;
+    int rc = log_writer_flush(w);
+
+    if (w->file_bytes == 0) return rc;
+
+    if (writer_unmap(w) < 0 && rc == 0) rc = -1;
+    if (w->fd >= 0) close(w->fd);
+    w->fd = -1;
+    w->file_bytes = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    us = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+    if (us <= w->last_bak_us) us = w->last_bak_us + 1;
+    w->last_bak_us = us;
+
+    snprintf(bak, sizeof(bak), "%s%llu.bak", w->bak_prefix, (unsigned long long)us);
+    if (rename(w->path, bak) < 0) return -1;
+    w->stats.baks++;
+    return rc;
+}
+
+/**
+ * writer_put()
+ *
+ * Purpose:
+ *   Adds whole lines of the current file to the batch: copied in, or
+ *   when too big to copy written out right away with the batch in one
+ *   writev(). The batch goes out once full or past its flush deadline.
+ *
+ * @return 0 on success, -1 with errno set
+ */
+static int
+writer_put(log_writer_t *w, const char *data, size_t len)
+{
+    uint64_t now;
+
+    if (w->params.use_mmap) {
+        int rc = writer_map_put(w, data, len);
+
+        if (rc <= 0) return rc;
+    }
+
+    w->file_bytes += len;
+    w->stats.bytes += len;
+
+    if (len >= w->params.batch_len) {
+        struct iovec iov[2] = {
+            { .iov_base = w->buf, .iov_len = w->buf_len },
+            { .iov_base = (void *)data, .iov_len = len },
+        };
+        int rc = w->buf_len ? writer_write_out(w, iov, 2) : writer_write_out(w, iov + 1, 1);
+
+        w->buf_len = 0;
+        return rc;
+    }
+
+    if (w->buf_len + len > w->params.batch_len && log_writer_flush(w) < 0) return -1;
+    now = monotonic_ns();
+    if (w->buf_len == 0) {
+        w->flush_deadline_ns = now + (uint64_t)w->params.flush_latency_us * 1000;
+    }
+    memcpy(w->buf + w->buf_len, data, len);
+    w->buf_len += len;
+    return now >= w->flush_deadline_ns ? log_writer_flush(w) : 0;
+}
+
+/**
+ * log_writer_append()
+ *
+ * Purpose:
+ *   Appends one line (newline included). The file is sealed before a
+ *   line that would take it past rotate_size, and right after one that
+ *   fills it exactly.
+ *
+ * @return 0 on success, -1 with errno set
+ */
+int
+log_writer_append(log_writer_t *w, const char *line, size_t len)
+{
+    if (w->file_bytes > 0 && w->file_bytes + len > w->params.rotate_size &&
+        log_writer_seal(w) < 0) {
+        return -1;
+    }
+    w->stats.lines++;
+    if (writer_put(w, line, len) < 0) return -1;
+    return w->file_bytes >= w->params.rotate_size ? log_writer_seal(w) : 0;
+}
+
+/**
+ * log_writer_append_block()
+ *
+ * Purpose:
+ *   Appends a run of whole lines (data ends with a newline), sealing
+ *   files inside it as log_writer_append() would line by line: each file
+ *   is cut at the last line end that fits. For callers holding lines back
+ *   to back, such as the flusher of ipmgr_log_client.c. Lines are not
+ *   counted in stats.lines.
+ *
+ * @return 0 on success, -1 with errno set
+ */
+int
+log_writer_append_block(log_writer_t *w, const char *data, size_t len)
+{
+    while (len > 0) {
+        uint64_t room = w->params.rotate_size > w->file_bytes ?
+                        w->params.rotate_size - w->file_bytes : 0;
+        size_t take = len;
+
+        if (len > room) {
+            const char *cut = room ? memrchr(data, '\n', (size_t)room) : NULL;
+
+            if (cut) {
+                take = (size_t)(cut - data) + 1;
+            } else if (w->file_bytes > 0) {
+                if (log_writer_seal(w) < 0) return -1;
+                continue;
+            } else {
+                /* One line longer than a whole file: a file of its own */
+                cut = memchr(data, '\n', len);
+                take = cut ? (size_t)(cut - data) + 1 : len;
+            }
+        }
+
+        if (writer_put(w, data, take) < 0) return -1;
+        if (w->file_bytes >= w->params.rotate_size || take < len) {
+            if (log_writer_seal(w) < 0) return -1;
+        }
+        data += take;
+        len -= take;
+    }
+    return 0;
+}
+
+/* Flushes a batch past its deadline; for owners going idle between lines */
+int
+log_writer_poll(log_writer_t *w)
+{
+    if (w->buf_len == 0 || monotonic_ns() < w->flush_deadline_ns) return 0;
+    return log_writer_flush(w);
+}
+
+/**
+ * log_writer_close()
+ *
+ * @param seal  Also seal the last file as a .bak, else it stays
+ *              <name>.log for the next run to append to
+ * @return 0 on success, -1 with errno set if the last lines were not
+ *         written
+ */
+int
+log_writer_close(log_writer_t *w, bool seal)
+{
+    int rc = seal ? log_writer_seal(w) : log_writer_flush(w);
+
+    if (writer_unmap(w) < 0 && rc == 0) rc = -1;
+    if (w->fd >= 0) close(w->fd);
+    w->fd = -1;
+    free(w->buf);
+    w->buf = NULL;
+    return rc;
+}
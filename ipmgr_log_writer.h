@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * File: ipmgr_log_writer.h
+ *
+ * Description:
+ *   Line writer of the processes logging into files that ipmgr_log_rotator
+ *   manages (logger.c). Lines are gathered into large batches written with
+ *   one write() (writev() for a line too big to copy), and the file is
+ *   sealed as <name>.<ts>.bak for the rotator once it holds rotate_size
+ *   bytes. The size is counted in the writer, nothing is stat()'ed: the
+ *   file is the writer's own, nobody else appends to it.
+ *
+ *   Lines are never split: a file is sealed as soon as the next line would
+ *   take it past rotate_size (a single line longer than that gets a file
+ *   of its own). Buffered lines wait for at most flush_latency_us, checked
+ *   on every append and by log_writer_poll() when the owner goes idle.
+ *
+ *   <ts> is the seal time in microseconds, kept strictly increasing per
+ *   writer so two .bak files never share a name (the rotator matches any
+ *   <name>.<anything>.bak).
+ *
+ *   With use_mmap, each file is preallocated to rotate_size with
+ *   fallocate() and lines are copied straight into a shared mapping of it
+ *   (LOG_WRITER_MMAP_WINDOW bytes at a time), so the file system neither
+ *   extends the size nor allocates blocks append by append. The file is
+ *   truncated to the bytes written when sealed or closed; until then it
+ *   reads as rotate_size bytes, zero padded after the last line. A file
+ *   left padded by a crash is trimmed when reopened. Where fallocate() is
+ *   not supported the writer goes back to write().
+ *
+ *   A writer is owned by a single thread; nothing here is thread safe.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_LOG_WRITER_H
+#define IPMGR_LOG_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_WRITER_PATH_LEN             256
+
+/* Defaults of log_writer_params_t fields left 0 */
+#define LOG_WRITER_DEFAULT_ROTATE       10240       /* logger.c MAX_LOG_SIZE */
+#define LOG_WRITER_DEFAULT_BATCH        (64 * 1024)
+#define LOG_WRITER_DEFAULT_LATENCY_US   10000
+#define LOG_WRITER_MMAP_WINDOW          (1024 * 1024)   /* Mapped at a time, use_mmap */
+
+typedef struct log_writer_params_ {
+    uint64_t rotate_size;       /* Bytes of a file before it is sealed as .bak */
+    size_t batch_len;           /* Bytes buffered before a write() */
+    uint32_t flush_latency_us;  /* Longest a buffered line waits */
+    bool use_mmap;              /* Preallocate files, write through mmap */
+} log_writer_params_t;
+
+/* Counters since log_writer_open() */
+typedef struct log_writer_stats_ {
+    uint64_t lines;             /* By log_writer_append() */
+    uint64_t bytes;
+    uint64_t writes;            /* write() / writev() calls */
+    uint64_t baks;              /* Files sealed */
+    uint64_t maps;              /* mmap windows (use_mmap) */
+} log_writer_stats_t;
+
+typedef struct log_writer_ {
+    char path[LOG_WRITER_PATH_LEN];     /* <dir>/<name>.log */
+    char bak_prefix[LOG_WRITER_PATH_LEN]; /* <dir>/<name>. */
+    log_writer_params_t params;
+    int fd;                     /* -1 until the first write of a file */
+    uint64_t file_bytes;        /* In the current file, buffered bytes included */
+    char *buf;
+    size_t buf_len;
+    uint64_t flush_deadline_ns; /* Of the oldest buffered line */
+    uint64_t last_bak_us;       /* <ts> of the last .bak */
+    char *map;                  /* use_mmap window, NULL when unmapped */
+    uint64_t map_off;           /* File offset of the window */
+    uint64_t alloc_bytes;       /* Preallocated size of the current file */
+    log_writer_stats_t stats;
+} log_writer_t;
+
+int
+log_writer_open(log_writer_t *w, const char *dir, const char *name,
+                const log_writer_params_t *params);
+
+int
+log_writer_append(log_writer_t *w, const char *line, size_t len);
+
+int
+log_writer_append_block(log_writer_t *w, const char *data, size_t len);
+
+int
+log_writer_poll(log_writer_t *w);
+
+int
+log_writer_flush(log_writer_t *w);
+
+int
+log_writer_seal(log_writer_t *w);
+
+int
+log_writer_close(log_writer_t *w, bool seal);
+
+#endif /* IPMGR_LOG_WRITER_H */
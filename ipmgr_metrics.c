@@ -0,0 +1,316 @@
+/*******************************************************************************
+ * File: ipmgr_metrics.c
+ *
+ * Description:
+ *   Shared memory page of the rotator metrics (see ipmgr_metrics.h):
+ *   creation by the rotator, slot hand-out to its threads, and the reader
+ *   side used by rotator_stats.c: mapping, summing slots, percentiles.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* System Headers */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "ipmgr_metrics.h"
+
+#define METRICS_NSLOTS      (METRICS_MAX_THREADS + 1)
+#define METRICS_PAGE_LEN    (sizeof(metrics_page_t) + METRICS_NSLOTS * sizeof(metrics_slot_t))
+
+/* Records made before metrics_init() (or after shutdown) land here */
+static metrics_slot_t metrics_boot_slot;
+
+__thread metrics_slot_t *metrics_self;
+metrics_slot_t *metrics_shared = &metrics_boot_slot;
+
+static metrics_page_t *metrics_page;
+static bool metrics_page_shm;       /* Page is the shared memory object */
+
+static const char *const counter_names[MC_COUNT] = {
+    [MC_INOTIFY_READS]      = "inotify_reads",
+    [MC_INOTIFY_EVENTS]     = "inotify_events",
+    [MC_BAK_EVENTS]         = "bak_events",
+    [MC_ROTATIONS]          = "rotations",
+    [MC_BAK_APPENDS]        = "bak_appends",
+    [MC_BAK_APPEND_BYTES]   = "bak_append_bytes",
+    [MC_BAK_STAGED]         = "bak_staged",
+    [MC_LOCK_ACQUIRED]      = "files_lock_acquired",
+    [MC_LOCK_CONTENDED]     = "files_lock_contended",
+    [MC_ARCHIVES]           = "archives",
+    [MC_ARCHIVE_FAILURES]   = "archive_failures",
+    [MC_ARCHIVE_BYTES_IN]   = "archive_bytes_in",
+    [MC_ARCHIVE_BYTES_OUT]  = "archive_bytes_out",
+    [MC_BAK_REPLAYED]       = "bak_replayed",
+    [MC_INOTIFY_OVERFLOWS]  = "inotify_overflows",
+    [MC_COMPRESS_EARLY]     = "compress_early",
+    [MC_RETENTION_EVICTED]  = "retention_evicted",
+    [MC_RETENTION_EVICTED_BYTES] = "retention_evicted_bytes",
+    [MC_RETENTION_UNLINKS]  = "retention_unlinks",
+};
+
+static const char *const hist_names[MH_COUNT] = {
+    [MH_BAK_TO_ROTATED]     = "bak_to_rotated",
+    [MH_ROTATE]             = "rotate",
+    [MH_LOCK_WAIT]          = "files_lock_wait",
+    [MH_ZIPPER_WAIT]        = "zipper_sem_wait",
+    [MH_ARCHIVE]            = "archive_run",
+    [MH_ARCHIVE_SIZE]       = "archive_run_bytes",
+};
+
+/*******************************************************************************
+ *                     WRITER SIDE
+ ******************************************************************************/
+
+/* Fills the header of a zeroed page */
+static void
+metrics_page_setup(metrics_page_t *page)
+{
+    memcpy(page->magic, METRICS_MAGIC, sizeof(page->magic));
+    page->version = METRICS_VERSION;
+    page->counters = MC_COUNT;
+    page->hists = MH_COUNT;
+    page->buckets = METRICS_HIST_BUCKETS;
+    page->nslots = METRICS_NSLOTS;
+    page->slot_size = sizeof(metrics_slot_t);
+    page->pid = getpid();
+    page->started = time(NULL);
+    snprintf(page->slots[0].name, sizeof(page->slots[0].name), "shared");
+    atomic_store(&page->slots[0].in_use, 1);
+}
+
+/**
+ * metrics_init()
+ *
+ * Purpose:
+ *   Creates the metrics page as METRICS_SHM_NAME, replacing the page of a
+ *   previous run. Called once at startup, before any thread attaches.
+ *
+ * @return 0 on success, -1 if the shared memory object could not be set
+ *         up (metrics are then kept in private memory)
+ */
+int
+metrics_init(void)
+{
+    int fd, rc = 0;
+    void *p = MAP_FAILED;
+
+    fd = shm_open(METRICS_SHM_NAME, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        if (ftruncate(fd, (off_t)METRICS_PAGE_LEN) == 0) {
+            p = mmap(NULL, METRICS_PAGE_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+
+    if (p == MAP_FAILED) {
+        rc = -1;
+        shm_unlink(METRICS_SHM_NAME);
+        p = mmap(NULL, METRICS_PAGE_LEN, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return -1;    /* Boot slot takes everything */
+    } else {
+        metrics_page_shm = true;
+    }
+
+    metrics_page = p;
+    metrics_page_setup(metrics_page);
+    metrics_shared = &metrics_page->slots[0];
+    return rc;
+}
+
+/* Unpublishes the page; called once every recording thread is gone */
+void
+metrics_shutdown(void)
+{
+    if (!metrics_page) return;
+
+    metrics_shared = &metrics_boot_slot;
+    metrics_self = NULL;
+    if (metrics_page_shm) shm_unlink(METRICS_SHM_NAME);
+    munmap(metrics_page, METRICS_PAGE_LEN);
+    metrics_page = NULL;
+    metrics_page_shm = false;
+}
+
+/**
+ * metrics_thread_attach()
+ *
+ * Purpose:
+ *   Gives the calling thread a slot of its own, named for the readers.
+ *   Slots are never given back; once METRICS_MAX_THREADS are out, later
+ *   threads keep recording into the shared slot.
+ */
+void
+metrics_thread_attach(const char *name)
+{
+    uint32_t idx;
+    metrics_slot_t *slot;
+
+    if (!metrics_page || metrics_self) return;
+
+    idx = atomic_fetch_add(&metrics_page->attached, 1);
+    if (idx >= METRICS_MAX_THREADS) return;
+
+    slot = &metrics_page->slots[1 + idx];
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    atomic_store_explicit(&slot->in_use, 1, memory_order_release);
+    metrics_self = slot;
+}
+
+const char *
+metrics_counter_name(int counter)
+{
+    return counter >= 0 && counter < MC_COUNT ? counter_names[counter] : "?";
+}
+
+const char *
+metrics_hist_name(int hist)
+{
+    return hist >= 0 && hist < MH_COUNT ? hist_names[hist] : "?";
+}
+
+/* true for histograms of sizes, false for durations in nanoseconds */
+bool
+metrics_hist_is_bytes(int hist)
+{
+    return hist == MH_ARCHIVE_SIZE;
+}
+
+/*******************************************************************************
+ *                     READER SIDE
+ ******************************************************************************/
+
+/**
+ * metrics_map()
+ *
+ * Purpose:
+ *   Maps the metrics page of a running rotator read only.
+ *
+ * @param shm_name  Shared memory object, NULL for METRICS_SHM_NAME
+ * @return The page, NULL on failure (EPROTO: written by another version)
+ */
+const metrics_page_t *
+metrics_map(const char *shm_name)
+{
+    const metrics_page_t *page;
+    struct stat st;
+    void *p;
+    int fd = shm_open(shm_name ? shm_name : METRICS_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != METRICS_PAGE_LEN) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    p = mmap(NULL, METRICS_PAGE_LEN, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+
+    page = p;
+    if (memcmp(page->magic, METRICS_MAGIC, sizeof(page->magic)) != 0 ||
+        page->version != METRICS_VERSION || page->counters != MC_COUNT ||
+        page->hists != MH_COUNT || page->buckets != METRICS_HIST_BUCKETS ||
+        page->nslots != METRICS_NSLOTS || page->slot_size != sizeof(metrics_slot_t)) {
+        munmap(p, METRICS_PAGE_LEN);
+        errno = EPROTO;
+        return NULL;
+    }
+    return page;
+}
+
+void
+metrics_unmap(const metrics_page_t *page)
+{
+    munmap((void *)page, METRICS_PAGE_LEN);
+}
+
+/**
+ * metrics_sum()
+ *
+ * Purpose:
+ *   Snapshot of the page into total: the sum of every slot in use, or of
+ *   one slot only. Each word is read atomically, the snapshot as a whole
+ *   is not (a histogram count may run a record ahead of its buckets).
+ *
+ * @param only_slot  Slot index, -1 for all of them
+ */
+void
+metrics_sum(const metrics_page_t *page, int only_slot, metrics_slot_t *total)
+{
+    memset(total, 0, sizeof(*total));
+
+    for (uint32_t i = 0; i < page->nslots; i++) {
+        const metrics_slot_t *s = &page->slots[i];
+
+        if ((only_slot >= 0 && (uint32_t)only_slot != i) ||
+            !atomic_load_explicit(&s->in_use, memory_order_acquire)) {
+            continue;
+        }
+        for (int c = 0; c < MC_COUNT; c++) {
+            total->counters[c] += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+        }
+        for (int h = 0; h < MH_COUNT; h++) {
+            const metrics_hist_t *src = &s->hists[h];
+            metrics_hist_t *dst = &total->hists[h];
+            uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+
+            dst->count += atomic_load_explicit(&src->count, memory_order_relaxed);
+            dst->sum += atomic_load_explicit(&src->sum, memory_order_relaxed);
+            if (max > dst->max) dst->max = max;
+            for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+                dst->buckets[b] += atomic_load_explicit(&src->buckets[b], memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/* Highest value of a bucket */
+static uint64_t
+metrics_bucket_high(unsigned b)
+{
+    unsigned sub_count = 1U << METRICS_HIST_SUB_BITS;
+    unsigned e;
+
+    if (b < sub_count) return b;
+    e = (b >> METRICS_HIST_SUB_BITS) + METRICS_HIST_SUB_BITS - 1;
+    return (((uint64_t)(sub_count + (b & (sub_count - 1))) + 1) << (e - METRICS_HIST_SUB_BITS)) - 1;
+}
+
+/**
+ * metrics_hist_percentile()
+ *
+ * @param pct  Percentile, 0 to 100
+ * @return Upper bound of the bucket holding it (within 12.5%), capped by
+ *         the largest value recorded; 0 for an empty histogram
+ */
+uint64_t
+metrics_hist_percentile(const metrics_hist_t *h, double pct)
+{
+    uint64_t count = atomic_load(&h->count), max = atomic_load(&h->max);
+    uint64_t target, seen = 0;
+
+    if (count == 0) return 0;
+    target = (uint64_t)(pct / 100.0 * (double)count + 0.5);
+    if (target == 0) target = 1;
+
+    for (unsigned b = 0; b < METRICS_HIST_BUCKETS; b++) {
+        seen += atomic_load(&h->buckets[b]);
+        if (seen >= target) {
+            uint64_t high = metrics_bucket_high(b);
+            return high < max ? high : max;
+        }
+    }
+    return max;
+}
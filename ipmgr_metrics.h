@@ -0,0 +1,203 @@
+/*******************************************************************************
+ * File: ipmgr_metrics.h
+ *
+ * Description:
+ *   Counters and latency histograms of the rotator and zipper internals,
+ *   published in a shared memory page (/dev/shm/ipmgr_log_rotator.metrics)
+ *   that rotator_stats.c, or any reader mapping it, scrapes without a
+ *   syscall or lock on the rotator side.
+ *
+ *   Every thread that records attaches to its own slot of the page and is
+ *   its only writer: an update is a relaxed load and store of a 64-bit
+ *   word in a cache line no other thread writes, no atomic read-modify-
+ *   write, no contention. Readers sum the slots. Threads that never
+ *   attached share one extra slot, updated with atomic adds.
+ *
+ *   Histograms are HDR style, log-linear: METRICS_HIST_SUB_BITS bits of
+ *   precision under each power of two (values within 12.5%), from 0 to
+ *   2^METRICS_HIST_MAX_EXP, clamped above.
+ *
+ *   If the page cannot be created the same structures live in private
+ *   memory, so recording never checks.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_METRICS_H
+#define IPMGR_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define METRICS_SHM_NAME        "/ipmgr_log_rotator.metrics"
+#define METRICS_MAGIC           "IPMGRMX1"
+#define METRICS_VERSION         1
+#define METRICS_MAX_THREADS     64  /* Attached slots, the shared slot aside */
+#define METRICS_THREAD_NAME_LEN 32
+
+#define METRICS_HIST_SUB_BITS   3
+#define METRICS_HIST_MAX_EXP    47  /* 2^47 ns = 39 h, 2^47 bytes = 128 TiB */
+#define METRICS_HIST_BUCKETS    ((METRICS_HIST_MAX_EXP - METRICS_HIST_SUB_BITS + 2) << \
+                                 METRICS_HIST_SUB_BITS)
+
+/* Counters */
+enum {
+    MC_INOTIFY_READS,           /* inotify read() calls returning events */
+    MC_INOTIFY_EVENTS,          /* Events of all kinds */
+    MC_BAK_EVENTS,              /* .bak events of our types */
+    MC_ROTATIONS,               /* Rotation plans executed */
+    MC_BAK_APPENDS,             /* .bak appended to log.0, a segment or a generation */
+    MC_BAK_APPEND_BYTES,
+    MC_BAK_STAGED,              /* .bak renamed to a pending segment */
+    MC_LOCK_ACQUIRED,           /* files_lock */
+    MC_LOCK_CONTENDED,
+    MC_ARCHIVES,                /* Archive runs completed */
+    MC_ARCHIVE_FAILURES,
+    MC_ARCHIVE_BYTES_IN,        /* Uncompressed */
+    MC_ARCHIVE_BYTES_OUT,       /* Compressed */
+    MC_BAK_REPLAYED,            /* .bak replayed: left by a previous run, or lost to an overflow */
+    MC_INOTIFY_OVERFLOWS,       /* IN_Q_OVERFLOW events, each followed by a rescan */
+    MC_COMPRESS_EARLY,          /* Jobs queued by compress_files/_bytes/_age before max_files */
+    MC_RETENTION_EVICTED,       /* Archives removed for archive_budget */
+    MC_RETENTION_EVICTED_BYTES,
+    MC_RETENTION_UNLINKS,       /* Archive unlinks run by the retention thread */
+    MC_COUNT
+};
+
+/* Histograms, nanoseconds unless noted */
+enum {
+    MH_BAK_TO_ROTATED,          /* .bak created (ctime, within a tick) to its rotation done */
+    MH_ROTATE,                  /* Executing one rotation batch (or file_rotate()) */
+    MH_LOCK_WAIT,               /* Contended files_lock acquisition */
+    MH_ZIPPER_WAIT,             /* Zipper asleep on its semaphore, per wake-up */
+    MH_ARCHIVE,                 /* One archive run, files to closed archive */
+    MH_ARCHIVE_SIZE,            /* Bytes written by one run */
+    MH_COUNT
+};
+
+typedef struct metrics_hist_ {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[METRICS_HIST_BUCKETS];
+} metrics_hist_t;
+
+typedef struct metrics_slot_ {
+    _Alignas(64) _Atomic uint32_t in_use;
+    char name[METRICS_THREAD_NAME_LEN]; /* Written before in_use is set */
+    _Alignas(64) _Atomic uint64_t counters[MC_COUNT];
+    metrics_hist_t hists[MH_COUNT];
+} metrics_slot_t;
+
+/* Start of the shared page, followed by the slots (shared slot first) */
+typedef struct metrics_page_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t counters;          /* MC_COUNT */
+    uint32_t hists;             /* MH_COUNT */
+    uint32_t buckets;           /* METRICS_HIST_BUCKETS */
+    uint32_t nslots;            /* METRICS_MAX_THREADS + 1 */
+    uint32_t slot_size;
+    int64_t pid;
+    int64_t started;            /* time(), tells restarts apart */
+    _Atomic uint32_t attached;  /* Slots handed out */
+    _Alignas(64) metrics_slot_t slots[];
+} metrics_page_t;
+
+/* Slot of the calling thread, NULL before metrics_thread_attach() */
+extern __thread metrics_slot_t *metrics_self;
+extern metrics_slot_t *metrics_shared;
+
+int
+metrics_init(void);
+
+void
+metrics_shutdown(void);
+
+void
+metrics_thread_attach(const char *name);
+
+const char *
+metrics_counter_name(int counter);
+
+const char *
+metrics_hist_name(int hist);
+
+bool
+metrics_hist_is_bytes(int hist);
+
+const metrics_page_t *
+metrics_map(const char *shm_name);
+
+void
+metrics_unmap(const metrics_page_t *page);
+
+void
+metrics_sum(const metrics_page_t *page, int only_slot, metrics_slot_t *total);
+
+uint64_t
+metrics_hist_percentile(const metrics_hist_t *h, double pct);
+
+/* Bucket of a value, see the header comment */
+static inline unsigned
+metrics_hist_bucket(uint64_t v)
+{
+    unsigned e;
+
+    if (v < (1U << METRICS_HIST_SUB_BITS)) return (unsigned)v;
+    e = 63U - (unsigned)__builtin_clzll(v);
+    if (e > METRICS_HIST_MAX_EXP) return METRICS_HIST_BUCKETS - 1;
+    return ((e - METRICS_HIST_SUB_BITS + 1) << METRICS_HIST_SUB_BITS) +
+           (unsigned)((v >> (e - METRICS_HIST_SUB_BITS)) & ((1U << METRICS_HIST_SUB_BITS) - 1));
+}
+
+/* Single writer update of an own slot word, atomic add on the shared one */
+static inline void
+metrics_word_add(metrics_slot_t *s, _Atomic uint64_t *w, uint64_t n)
+{
+    if (s == metrics_shared) {
+        atomic_fetch_add_explicit(w, n, memory_order_relaxed);
+    } else {
+        atomic_store_explicit(w, atomic_load_explicit(w, memory_order_relaxed) + n,
+                              memory_order_relaxed);
+    }
+}
+
+static inline void
+metrics_add(int counter, uint64_t n)
+{
+    metrics_slot_t *s = metrics_self ? metrics_self : metrics_shared;
+
+    metrics_word_add(s, &s->counters[counter], n);
+}
+
+static inline void
+metrics_record(int hist, uint64_t value)
+{
+    metrics_slot_t *s = metrics_self ? metrics_self : metrics_shared;
+    metrics_hist_t *h = &s->hists[hist];
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+    metrics_word_add(s, &h->buckets[metrics_hist_bucket(value)], 1);
+    metrics_word_add(s, &h->count, 1);
+    metrics_word_add(s, &h->sum, value);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, value, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+/* Monotonic clock in nanoseconds, for the durations recorded */
+static inline uint64_t
+metrics_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#endif /* IPMGR_METRICS_H */
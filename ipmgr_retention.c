@@ -0,0 +1,555 @@
+/*******************************************************************************
+ * File: ipmgr_retention.c
+ *
+ * Description:
+ *   Archive disk budget and background unlinks (see ipmgr_retention.h).
+ *
+ *   Every archive tracked is one record, found by path through a chained
+ *   hash table and ordered by age in a binary min-heap. A record dropped
+ *   by retention_unlink() leaves the hash at once and the heap lazily: it
+ *   is skipped when it reaches the top, and the heap is compacted once
+ *   dropped records outnumber live ones.
+ *
+ *   Records are counted per owner (log type), so an eviction pass can
+ *   tell the newest archive of a type (the last one of its owner) without
+ *   looking at the others. Everything is protected by one mutex, held for
+ *   memory updates only: the unlink() calls run without it.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* Threading Headers */
+#include <pthread.h>
+
+#include "ipmgr_retention.h"
+#include "ipmgr_metrics.h"
+#include "ipmgr_diag.h"
+
+#define RETENTION_HASH_MIN      256     /* Buckets, grown with the records */
+
+typedef struct retention_rec_ {
+    struct retention_rec_ *hnext;       /* Hash chain */
+    uint64_t bytes;
+    uint64_t seq;                       /* Report order, ties of created */
+    time_t created;
+    int owner;
+    bool dead;                          /* Dropped, still on the heap */
+    char path[];
+} retention_rec_t;
+
+typedef struct retention_unlink_ {
+    struct retention_unlink_ *next;
+    bool evicted;
+    char path[];
+} retention_unlink_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    bool stop;
+    bool evict;                         /* Total crossed the high watermark */
+
+    retention_rec_t **buckets;
+    size_t nbuckets;                    /* Power of two */
+    retention_rec_t **heap;             /* Oldest first, dead records included */
+    size_t nheap;
+    size_t heap_cap;
+    size_t nlive;
+    uint64_t seq;
+    unsigned *owner_count;              /* Live records per owner */
+    int owners_cap;
+
+    retention_unlink_t *queue;          /* FIFO of unlinks to run */
+    retention_unlink_t **queue_tail;
+    uint64_t queued;
+
+    uint64_t bytes;
+    uint64_t high;
+    uint64_t low;
+    uint64_t evicted;
+    uint64_t evicted_bytes;
+    uint64_t unlinks;
+    uint64_t unlink_failures;
+} rt = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .queue_tail = &rt.queue,
+};
+
+/*******************************************************************************
+ *                     HASH AND HEAP
+ ******************************************************************************/
+
+/* FNV-1a */
+static size_t
+path_hash(const char *path)
+{
+    uint64_t h = 1469598103934665603ULL;
+
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = (h ^ *p) * 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static retention_rec_t **
+hash_slot(const char *path)
+{
+    retention_rec_t **slot = &rt.buckets[path_hash(path) & (rt.nbuckets - 1)];
+
+    while (*slot && strcmp((*slot)->path, path) != 0) slot = &(*slot)->hnext;
+    return slot;
+}
+
+/* Doubles the bucket table once records outnumber buckets */
+static void
+hash_grow(void)
+{
+    size_t n = rt.nbuckets ? rt.nbuckets * 2 : RETENTION_HASH_MIN;
+    retention_rec_t **buckets = calloc(n, sizeof(*buckets));
+
+    if (!buckets) return;   /* Longer chains, still correct */
+
+    for (size_t i = 0; i < rt.nbuckets; i++) {
+        retention_rec_t *r = rt.buckets[i];
+
+        while (r) {
+            retention_rec_t *next = r->hnext;
+            size_t b = path_hash(r->path) & (n - 1);
+
+            r->hnext = buckets[b];
+            buckets[b] = r;
+            r = next;
+        }
+    }
+    free(rt.buckets);
+    rt.buckets = buckets;
+    rt.nbuckets = n;
+}
+
+static bool
+rec_older(const retention_rec_t *a, const retention_rec_t *b)
+{
+    return a->created < b->created || (a->created == b->created && a->seq < b->seq);
+}
+
+static void
+heap_sift_up(size_t i)
+{
+    retention_rec_t *r = rt.heap[i];
+
+    while (i > 0 && rec_older(r, rt.heap[(i - 1) / 2])) {
+        rt.heap[i] = rt.heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    rt.heap[i] = r;
+}
+
+static void
+heap_sift_down(size_t i)
+{
+    retention_rec_t *r = rt.heap[i];
+
+    while (2 * i + 1 < rt.nheap) {
+        size_t c = 2 * i + 1;
+
+        if (c + 1 < rt.nheap && rec_older(rt.heap[c + 1], rt.heap[c])) c++;
+        if (!rec_older(rt.heap[c], r)) break;
+        rt.heap[i] = rt.heap[c];
+        i = c;
+    }
+    rt.heap[i] = r;
+}
+
+static int
+heap_push(retention_rec_t *r)
+{
+    if (rt.nheap == rt.heap_cap) {
+        size_t cap = rt.heap_cap ? rt.heap_cap * 2 : RETENTION_HASH_MIN;
+        retention_rec_t **heap = realloc(rt.heap, cap * sizeof(*heap));
+
+        if (!heap) return -1;
+        rt.heap = heap;
+        rt.heap_cap = cap;
+    }
+    rt.heap[rt.nheap++] = r;
+    heap_sift_up(rt.nheap - 1);
+    return 0;
+}
+
+static retention_rec_t *
+heap_pop(void)
+{
+    retention_rec_t *top = rt.heap[0];
+
+    rt.heap[0] = rt.heap[--rt.nheap];
+    if (rt.nheap > 0) heap_sift_down(0);
+    return top;
+}
+
+/* Drops the dead records from the heap once they outnumber live ones */
+static void
+heap_compact(void)
+{
+    size_t n = 0;
+
+    if (rt.nheap - rt.nlive <= rt.nlive + RETENTION_HASH_MIN) return;
+
+    for (size_t i = 0; i < rt.nheap; i++) {
+        if (rt.heap[i]->dead) {
+            free(rt.heap[i]);
+        } else {
+            rt.heap[n++] = rt.heap[i];
+        }
+    }
+    rt.nheap = n;
+    for (size_t i = n / 2; i-- > 0; ) heap_sift_down(i);
+}
+
+/* Takes a live record out of the accounting, it stays on the heap */
+static void
+rec_drop(retention_rec_t **slot)
+{
+    retention_rec_t *r = *slot;
+
+    *slot = r->hnext;
+    r->dead = true;
+    rt.nlive--;
+    rt.bytes -= r->bytes;
+    rt.owner_count[r->owner]--;
+}
+
+/* Queues an unlink, lock held. @return -1 if out of memory */
+static int
+queue_unlink(const char *path, bool evicted)
+{
+    size_t len = strlen(path) + 1;
+    retention_unlink_t *u = malloc(sizeof(*u) + len);
+
+    if (!u) return -1;
+    u->next = NULL;
+    u->evicted = evicted;
+    memcpy(u->path, path, len);
+    *rt.queue_tail = u;
+    rt.queue_tail = &u->next;
+    rt.queued++;
+    return 0;
+}
+
+/*******************************************************************************
+ *                     EVICTION THREAD
+ ******************************************************************************/
+
+/**
+ * retention_evict_locked()
+ *
+ * Purpose:
+ *   Queues the oldest archives for removal until the total is under the
+ *   low watermark. The last archive of an owner is set aside and put back,
+ *   so a pass may end above the watermark when only those are left.
+ */
+static void
+retention_evict_locked(void)
+{
+    retention_rec_t **aside = NULL;
+    size_t naside = 0;
+
+    aside = malloc(rt.nheap * sizeof(*aside));
+    if (!aside) return;
+
+    while (rt.bytes > rt.low && rt.nheap > 0) {
+        retention_rec_t *r = heap_pop();
+
+        if (r->dead) {
+            free(r);
+            continue;
+        }
+        if (rt.owner_count[r->owner] == 1) {
+            aside[naside++] = r;        /* The newest of its type */
+            continue;
+        }
+        if (queue_unlink(r->path, true) < 0) {
+            aside[naside++] = r;
+            break;
+        }
+        rec_drop(hash_slot(r->path));
+        rt.evicted++;
+        rt.evicted_bytes += r->bytes;
+        metrics_add(MC_RETENTION_EVICTED, 1);
+        metrics_add(MC_RETENTION_EVICTED_BYTES, r->bytes);
+        free(r);
+    }
+    for (size_t i = 0; i < naside; i++) {
+        rt.heap[rt.nheap++] = aside[i];
+        heap_sift_up(rt.nheap - 1);
+    }
+    free(aside);
+}
+
+/* Evicts when asked to, runs queued unlinks; exits once stopped and drained */
+static void *
+retention_thread_fn(void *arg)
+{
+    (void)arg;
+
+    metrics_thread_attach("retention");
+    diag_thread_name("retention");
+
+    pthread_mutex_lock(&rt.lock);
+    while (1) {
+        while (!rt.queue && !rt.evict && !rt.stop) {
+            pthread_cond_wait(&rt.cond, &rt.lock);
+        }
+        if (rt.evict) {
+            rt.evict = false;
+            retention_evict_locked();
+        }
+        if (!rt.queue && rt.stop) break;
+
+        while (rt.queue) {
+            retention_unlink_t *u = rt.queue;
+
+            rt.queue = u->next;
+            if (!rt.queue) rt.queue_tail = &rt.queue;
+            rt.queued--;
+            pthread_mutex_unlock(&rt.lock);
+
+            int rc = unlink(u->path);
+            int err = errno;
+
+            if (rc == 0) {
+                DIAG_LOG(DIAG_INFO, "%s %s\n", u->evicted ? "Evicted archive" :
+                         "Obsolete Archive removed:", u->path);
+            } else if (err != ENOENT) {
+                DIAG_LOG(DIAG_ERROR, "ERROR: Failed to remove %s: %s\n", u->path, strerror(err));
+            }
+            metrics_add(MC_RETENTION_UNLINKS, 1);
+
+            pthread_mutex_lock(&rt.lock);
+            rt.unlinks++;
+            if (rc != 0 && err != ENOENT) rt.unlink_failures++;
+            free(u);
+        }
+    }
+    pthread_mutex_unlock(&rt.lock);
+    return NULL;
+}
+
+/*******************************************************************************
+ *                     PUBLIC API
+ ******************************************************************************/
+
+/**
+ * retention_init()
+ *
+ * Purpose:
+ *   Starts the eviction and unlink thread. No budget until
+ *   retention_set_budget(); archives are tracked from now on either way.
+ *
+ * @return 0 on success, -1 if the thread could not be created
+ */
+int
+retention_init(void)
+{
+    pthread_mutex_lock(&rt.lock);
+    if (rt.running) {
+        pthread_mutex_unlock(&rt.lock);
+        return 0;
+    }
+    if (!rt.buckets) hash_grow();
+    rt.stop = false;
+    if (!rt.buckets || pthread_create(&rt.thread, NULL, retention_thread_fn, NULL) != 0) {
+        pthread_mutex_unlock(&rt.lock);
+        return -1;
+    }
+    rt.running = true;
+    pthread_mutex_unlock(&rt.lock);
+    return 0;
+}
+
+/* Stops the thread once every queued unlink ran, then forgets everything */
+void
+retention_shutdown(void)
+{
+    pthread_mutex_lock(&rt.lock);
+    if (!rt.running) {
+        pthread_mutex_unlock(&rt.lock);
+        return;
+    }
+    rt.stop = true;
+    pthread_cond_signal(&rt.cond);
+    pthread_mutex_unlock(&rt.lock);
+    pthread_join(rt.thread, NULL);
+
+    pthread_mutex_lock(&rt.lock);
+    rt.running = false;
+    for (size_t i = 0; i < rt.nheap; i++) free(rt.heap[i]);
+    free(rt.heap);
+    free(rt.buckets);
+    free(rt.owner_count);
+    rt.heap = NULL;
+    rt.buckets = NULL;
+    rt.owner_count = NULL;
+    rt.nheap = rt.heap_cap = rt.nbuckets = rt.nlive = 0;
+    rt.owners_cap = 0;
+    rt.bytes = 0;
+    pthread_mutex_unlock(&rt.lock);
+}
+
+/**
+ * retention_set_budget()
+ *
+ * Purpose:
+ *   Sets the watermarks: past high bytes of archives, the oldest are
+ *   evicted down to low. high 0 turns eviction off.
+ */
+void
+retention_set_budget(uint64_t high, uint64_t low)
+{
+    pthread_mutex_lock(&rt.lock);
+    rt.high = high;
+    rt.low = low < high ? low : high;
+    if (rt.high && rt.bytes > rt.high) {
+        rt.evict = true;
+        pthread_cond_signal(&rt.cond);
+    }
+    pthread_mutex_unlock(&rt.lock);
+}
+
+/**
+ * retention_track()
+ *
+ * Purpose:
+ *   Reports an archive written, grown or found at startup. A path already
+ *   tracked only gets its new size.
+ *
+ * @param owner    Log type id, >= 0
+ * @param bytes    Size of the archive now
+ * @param created  Its creation time, orders the evictions
+ * @return 0 on success, -1 if out of memory (the archive is not counted)
+ */
+int
+retention_track(const char *path, int owner, uint64_t bytes, time_t created)
+{
+    retention_rec_t **slot, *r;
+    size_t len = strlen(path) + 1;
+
+    pthread_mutex_lock(&rt.lock);
+    if (!rt.buckets) hash_grow();
+    if (!rt.buckets) goto fail;
+
+    slot = hash_slot(path);
+    if (*slot) {
+        rt.bytes += bytes - (*slot)->bytes;
+        (*slot)->bytes = bytes;
+    } else {
+        if (owner >= rt.owners_cap) {
+            int cap = owner < 64 ? 64 : owner * 2;
+            unsigned *counts = realloc(rt.owner_count, (size_t)cap * sizeof(*counts));
+
+            if (!counts) goto fail;
+            memset(counts + rt.owners_cap, 0, (size_t)(cap - rt.owners_cap) * sizeof(*counts));
+            rt.owner_count = counts;
+            rt.owners_cap = cap;
+        }
+        r = malloc(sizeof(*r) + len);
+        if (!r) goto fail;
+        r->bytes = bytes;
+        r->seq = rt.seq++;
+        r->created = created;
+        r->owner = owner;
+        r->dead = false;
+        memcpy(r->path, path, len);
+        if (heap_push(r) < 0) {
+            free(r);
+            goto fail;
+        }
+        r->hnext = NULL;
+        *slot = r;
+        rt.nlive++;
+        rt.bytes += bytes;
+        rt.owner_count[owner]++;
+        if (rt.nlive > rt.nbuckets) hash_grow();
+    }
+
+    if (rt.high && rt.bytes > rt.high) {
+        rt.evict = true;
+        pthread_cond_signal(&rt.cond);
+    }
+    pthread_mutex_unlock(&rt.lock);
+    return 0;
+
+fail:
+    pthread_mutex_unlock(&rt.lock);
+    return -1;
+}
+
+/* New size of an archive rewritten in place; untracked paths are ignored */
+void
+retention_resize(const char *path, uint64_t bytes)
+{
+    retention_rec_t **slot;
+
+    pthread_mutex_lock(&rt.lock);
+    if (rt.buckets && *(slot = hash_slot(path))) {
+        rt.bytes += bytes - (*slot)->bytes;
+        (*slot)->bytes = bytes;
+    }
+    pthread_mutex_unlock(&rt.lock);
+}
+
+/**
+ * retention_unlink()
+ *
+ * Purpose:
+ *   Forgets an archive and has the retention thread unlink it. Also for
+ *   files that were never tracked. Without the thread the unlink runs
+ *   right here.
+ *
+ * @return 0 if queued or done, -1 on failure (errno set)
+ */
+int
+retention_unlink(const char *path)
+{
+    retention_rec_t **slot;
+
+    pthread_mutex_lock(&rt.lock);
+    if (rt.buckets && *(slot = hash_slot(path))) {
+        rec_drop(slot);
+        heap_compact();
+    }
+    if (!rt.running || queue_unlink(path, false) < 0) {
+        pthread_mutex_unlock(&rt.lock);
+        return unlink(path) == 0 || errno == ENOENT ? 0 : -1;
+    }
+    pthread_cond_signal(&rt.cond);
+    pthread_mutex_unlock(&rt.lock);
+    return 0;
+}
+
+void
+retention_get_stats(retention_stats_t *st)
+{
+    pthread_mutex_lock(&rt.lock);
+    st->bytes = rt.bytes;
+    st->archives = rt.nlive;
+    st->high = rt.high;
+    st->low = rt.low;
+    st->evicted = rt.evicted;
+    st->evicted_bytes = rt.evicted_bytes;
+    st->unlinks = rt.unlinks;
+    st->unlink_failures = rt.unlink_failures;
+    st->queued = rt.queued;
+    pthread_mutex_unlock(&rt.lock);
+}
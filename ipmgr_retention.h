@@ -0,0 +1,68 @@
+/*******************************************************************************
+ * File: ipmgr_retention.h
+ *
+ * Description:
+ *   Disk budget of the archives written by ipmgr_log_rotator, across all
+ *   log types and watch directories. The rotator tells the manager about
+ *   every archive it finds at startup, writes or grows
+ *   (retention_track()) and every archive it wants gone
+ *   (retention_unlink()), so the total is known in memory at all times:
+ *   no directory walk, no du.
+ *
+ *   Once the total crosses the high watermark a background thread evicts
+ *   the oldest archives of all types, oldest first, until it is back
+ *   under the low watermark. The newest archive of each type is never
+ *   evicted: it may be the running incremental archive, and it is the
+ *   only history the type has left.
+ *
+ *   The same thread runs every unlink handed to retention_unlink(), so
+ *   removing a multi-gigabyte archive (which can take the filesystem a
+ *   while to free) never holds up a zipper or the startup scan.
+ *
+ *   Archives are ordered by creation time (their mtime when found at
+ *   startup), ties by the order they were reported.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_RETENTION_H
+#define IPMGR_RETENTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+typedef struct retention_stats_ {
+    uint64_t bytes;                 /* Archives tracked now */
+    uint64_t archives;
+    uint64_t high;                  /* Watermarks, 0 = no budget */
+    uint64_t low;
+    uint64_t evicted;               /* Archives removed for the budget */
+    uint64_t evicted_bytes;
+    uint64_t unlinks;               /* Background unlinks done, evictions included */
+    uint64_t unlink_failures;
+    uint64_t queued;                /* Unlinks waiting */
+} retention_stats_t;
+
+int
+retention_init(void);
+
+void
+retention_shutdown(void);
+
+void
+retention_set_budget(uint64_t high, uint64_t low);
+
+int
+retention_track(const char *path, int owner, uint64_t bytes, time_t created);
+
+void
+retention_resize(const char *path, uint64_t bytes);
+
+int
+retention_unlink(const char *path);
+
+void
+retention_get_stats(retention_stats_t *st);
+
+#endif /* IPMGR_RETENTION_H */
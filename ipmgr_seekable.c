@@ -0,0 +1,511 @@
+/*******************************************************************************
+ * File: ipmgr_seekable.c
+ *
+ * Description:
+ *   Index of the seekable archive format: building it while frames are
+ *   written, encoding it into the footer frame, reading it back from the
+ *   end of an archive, and the logger line parsing behind the timestamp
+ *   ranges and level tags. See ipmgr_seekable.h for the layout.
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* System Headers */
+#include <sys/stat.h>
+
+#include "ipmgr_codec.h"
+#include "ipmgr_seekable.h"
+
+#define SEEK_INDEX_MAGIC        "IPSKIDX1"
+#define SEEK_LOCATOR_MAGIC      "IPSKEND1"
+#define SEEK_INDEX_HEADER_LEN   16      /* Magic, nframes, nmembers */
+
+/* zstd / lz4 skippable frame (0x184D2A50 - 0x184D2A5F, both formats) */
+#define SEEK_SKIPPABLE_MAGIC    0x184D2A5EU
+#define SEEK_SKIPPABLE_HDR_LEN  8
+
+/* gzip member header with FEXTRA, XLEN and subfield header ("IX", len) */
+#define SEEK_GZIP_HDR_LEN       (10 + 2 + 4)
+
+/* Longest index read back, bounds the allocation for a corrupt locator */
+#define SEEK_INDEX_READ_MAX     (256U * 1024 * 1024)
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static unsigned char *
+put_le(unsigned char *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        *p++ = (unsigned char)(v >> (8 * i));
+    }
+    return p;
+}
+
+static uint64_t
+get_le(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+
+    for (int i = bytes - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* Days from 1970-01-01 of a proleptic Gregorian date */
+static int64_t
+days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static bool
+parse_digits(const char *s, int n, unsigned *out)
+{
+    unsigned v = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        v = v * 10 + (unsigned)(s[i] - '0');
+    }
+    *out = v;
+    return true;
+}
+
+/* Size the index encodes to with nframes frames and names of total name_bytes */
+static size_t
+seek_encoded_len(uint32_t nframes, uint32_t nmembers, size_t name_bytes)
+{
+    return SEEK_INDEX_HEADER_LEN + 2 * (size_t)nmembers + name_bytes +
+           (size_t)nframes * SEEKABLE_ENTRY_LEN + SEEKABLE_LOCATOR_LEN;
+}
+
+/*******************************************************************************
+ *                     LINE PARSING
+ ******************************************************************************/
+
+/**
+ * seek_parse_time()
+ *
+ * Purpose:
+ *   Parses "YYYY-MM-DD HH:MM:SS" (get_timestamp() of logger.c) into
+ *   seconds, without any time zone conversion.
+ *
+ * @return true if s starts with a valid timestamp
+ */
+bool
+seek_parse_time(const char *s, int64_t *ts)
+{
+    unsigned y, mo, d, h, mi, se;
+
+    if (!parse_digits(s, 4, &y) || s[4] != '-' || !parse_digits(s + 5, 2, &mo) ||
+        s[7] != '-' || !parse_digits(s + 8, 2, &d) || s[10] != ' ' ||
+        !parse_digits(s + 11, 2, &h) || s[13] != ':' || !parse_digits(s + 14, 2, &mi) ||
+        s[16] != ':' || !parse_digits(s + 17, 2, &se)) {
+        return false;
+    }
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || se > 60) {
+        return false;
+    }
+    *ts = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + se;
+    return true;
+}
+
+/* SEEK_LEVEL_* of a level name, SEEK_LEVEL_OTHER if unknown */
+uint32_t
+seek_level_from_name(const char *name, size_t len)
+{
+    static const struct { const char *name; uint32_t bit; } levels[] = {
+        { "INFO", SEEK_LEVEL_INFO }, { "WARN", SEEK_LEVEL_WARN },
+        { "ERROR", SEEK_LEVEL_ERROR }, { "DEBUG", SEEK_LEVEL_DEBUG },
+    };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strlen(levels[i].name) == len && !memcmp(levels[i].name, name, len)) {
+            return levels[i].bit;
+        }
+    }
+    return SEEK_LEVEL_OTHER;
+}
+
+/**
+ * seek_parse_line()
+ *
+ * Purpose:
+ *   Reads the "[YYYY-MM-DD HH:MM:SS] [LEVEL]" prefix of a log line.
+ *
+ * @param line  Start of the line, len bytes available (no newline needed)
+ * @return false for a line without timestamp (e.g. a continuation line)
+ */
+bool
+seek_parse_line(const char *line, size_t len, int64_t *ts, uint32_t *level)
+{
+    const char *end;
+
+    if (len < 21 || line[0] != '[' || line[20] != ']' || !seek_parse_time(line + 1, ts)) {
+        return false;
+    }
+    *level = SEEK_LEVEL_OTHER;
+    if (len > 23 && line[21] == ' ' && line[22] == '[' &&
+        (end = memchr(line + 23, ']', len - 23)) != NULL) {
+        *level = seek_level_from_name(line + 23, (size_t)(end - (line + 23)));
+    }
+    return true;
+}
+
+/**
+ * seek_scan()
+ *
+ * Purpose:
+ *   Folds the lines starting in data into the frame's timestamp range and
+ *   level tags. A line prefix split between two calls is reassembled in
+ *   the scanner, so data can be cut anywhere.
+ */
+void
+seek_scan(seek_scan_t *scan, seek_frame_t *frame, const void *data, size_t len)
+{
+    const char *p = data, *end = p + len;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *stop = nl ? nl : end;
+
+        if (!scan->in_line) {
+            scan->in_line = true;
+            scan->parsed = false;
+            scan->prefix_len = 0;
+        }
+        if (!scan->parsed) {
+            size_t n = (size_t)(stop - p);
+
+            if (n > sizeof(scan->prefix) - scan->prefix_len) {
+                n = sizeof(scan->prefix) - scan->prefix_len;
+            }
+            memcpy(scan->prefix + scan->prefix_len, p, n);
+            scan->prefix_len += n;
+
+            if (nl || scan->prefix_len == sizeof(scan->prefix)) {
+                int64_t ts;
+                uint32_t level;
+
+                if (seek_parse_line(scan->prefix, scan->prefix_len, &ts, &level)) {
+                    if (ts < frame->ts_min) frame->ts_min = ts;
+                    if (ts > frame->ts_max) frame->ts_max = ts;
+                    frame->levels |= level;
+                }
+                scan->parsed = true;
+            }
+        }
+        if (!nl) break;
+        scan->in_line = false;
+        p = nl + 1;
+    }
+}
+
+/*******************************************************************************
+ *                     INDEX
+ ******************************************************************************/
+
+void
+seek_index_init(seek_index_t *idx, int codec)
+{
+    memset(idx, 0, sizeof(*idx));
+    idx->codec = codec;
+    idx->encoded_len = seek_encoded_len(0, 0, 0);
+}
+
+void
+seek_index_free(seek_index_t *idx)
+{
+    for (uint32_t i = 0; i < idx->nmembers; i++) {
+        free(idx->members[i]);
+    }
+    free(idx->members);
+    free(idx->frames);
+    seek_index_init(idx, idx->codec);
+}
+
+/*
+ * true when a gzip index has no room left for one more member and frame:
+ * the FEXTRA field caps it at SEEKABLE_GZIP_INDEX_MAX bytes (about 1100
+ * frames). zstd and lz4 indexes are not limited.
+ */
+bool
+seek_index_full(const seek_index_t *idx)
+{
+    return idx->codec == CODEC_GZIP &&
+           idx->encoded_len + SEEKABLE_ENTRY_LEN + 2 + SEEKABLE_NAME_MAX > SEEKABLE_GZIP_INDEX_MAX;
+}
+
+/* @return Member index of name, added at the end, -1 on failure */
+int
+seek_index_add_member(seek_index_t *idx, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > SEEKABLE_NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (idx->nmembers == idx->members_cap) {
+        uint32_t cap = idx->members_cap ? idx->members_cap * 2 : 16;
+        char **members = realloc(idx->members, cap * sizeof(*members));
+
+        if (!members) return -1;
+        idx->members = members;
+        idx->members_cap = cap;
+    }
+    idx->members[idx->nmembers] = strdup(name);
+    if (!idx->members[idx->nmembers]) return -1;
+    idx->encoded_len += 2 + len;
+    return (int)idx->nmembers++;
+}
+
+/* Appends an empty frame entry, NULL on allocation failure */
+seek_frame_t *
+seek_index_add_frame(seek_index_t *idx, uint32_t member, uint64_t comp_off, uint64_t raw_off)
+{
+    seek_frame_t *f;
+
+    if (idx->nframes == idx->frames_cap) {
+        uint32_t cap = idx->frames_cap ? idx->frames_cap * 2 : 64;
+        seek_frame_t *frames = realloc(idx->frames, cap * sizeof(*frames));
+
+        if (!frames) return NULL;
+        idx->frames = frames;
+        idx->frames_cap = cap;
+    }
+    f = &idx->frames[idx->nframes++];
+    memset(f, 0, sizeof(*f));
+    f->comp_off = comp_off;
+    f->raw_off = raw_off;
+    f->member = member;
+    f->ts_min = SEEK_TS_NONE_MIN;
+    f->ts_max = SEEK_TS_NONE_MAX;
+    idx->encoded_len += SEEKABLE_ENTRY_LEN;
+    return f;
+}
+
+/**
+ * seek_footer_build()
+ *
+ * Purpose:
+ *   Encodes the index into the footer frame of its codec: an empty gzip
+ *   member carrying the index in FEXTRA, or a zstd / lz4 skippable frame.
+ *
+ * @param footer      Set to a malloc'ed buffer, freed by the caller
+ * @return 0 on success, -1 on failure (EFBIG: gzip index over the FEXTRA cap)
+ */
+int
+seek_footer_build(const seek_index_t *idx, unsigned char **footer, size_t *footer_len)
+{
+    size_t index_len = idx->encoded_len;
+    bool gzip = idx->codec == CODEC_GZIP;
+    size_t hdr_len = gzip ? SEEK_GZIP_HDR_LEN : SEEK_SKIPPABLE_HDR_LEN;
+    size_t len = hdr_len + index_len + (gzip ? SEEKABLE_GZIP_TAIL_LEN : 0);
+    unsigned char *buf, *p;
+
+    if ((gzip && index_len > SEEKABLE_GZIP_INDEX_MAX) || index_len > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    buf = malloc(len);
+    if (!buf) return -1;
+    p = buf;
+
+    if (gzip) {
+        /* deflate, FEXTRA, no mtime, Unix; one "IX" subfield */
+        static const unsigned char gz_header[10] = {
+            0x1f, 0x8b, 8, 0x04, 0, 0, 0, 0, 0, 3
+        };
+
+        memcpy(p, gz_header, sizeof(gz_header));
+        p += sizeof(gz_header);
+        p = put_le(p, index_len + 4, 2);
+        *p++ = 'I';
+        *p++ = 'X';
+        p = put_le(p, index_len, 2);
+    } else {
+        p = put_le(p, SEEK_SKIPPABLE_MAGIC, 4);
+        p = put_le(p, index_len, 4);
+    }
+
+    memcpy(p, SEEK_INDEX_MAGIC, 8);
+    p = put_le(p + 8, idx->nframes, 4);
+    p = put_le(p, idx->nmembers, 4);
+    for (uint32_t i = 0; i < idx->nmembers; i++) {
+        size_t n = strlen(idx->members[i]);
+
+        p = put_le(p, n, 2);
+        memcpy(p, idx->members[i], n);
+        p += n;
+    }
+    for (uint32_t i = 0; i < idx->nframes; i++) {
+        const seek_frame_t *f = &idx->frames[i];
+
+        p = put_le(p, f->comp_off, 8);
+        p = put_le(p, f->comp_len, 8);
+        p = put_le(p, f->raw_len, 8);
+        p = put_le(p, f->raw_off, 8);
+        p = put_le(p, f->member, 4);
+        p = put_le(p, f->levels, 4);
+        p = put_le(p, (uint64_t)f->ts_min, 8);
+        p = put_le(p, (uint64_t)f->ts_max, 8);
+    }
+    p = put_le(p, index_len, 4);
+    p = put_le(p, (uint64_t)idx->codec, 4);
+    memcpy(p, SEEK_LOCATOR_MAGIC, 8);
+    p += 8;
+
+    if (gzip) {
+        /* Empty final fixed Huffman block, then CRC-32 and ISIZE of nothing */
+        static const unsigned char gz_tail[SEEKABLE_GZIP_TAIL_LEN] = { 0x03, 0x00 };
+
+        memcpy(p, gz_tail, sizeof(gz_tail));
+        p += sizeof(gz_tail);
+    }
+
+    *footer = buf;
+    *footer_len = (size_t)(p - buf);
+    return 0;
+}
+
+/* Decodes an index body (no locator), -1 with EBADMSG on any inconsistency */
+static int
+seek_index_decode(seek_index_t *idx, const unsigned char *p, size_t len, off_t data_end)
+{
+    const unsigned char *end = p + len;
+    uint32_t nframes, nmembers;
+
+    if (len < SEEK_INDEX_HEADER_LEN || memcmp(p, SEEK_INDEX_MAGIC, 8) != 0) goto bad;
+    nframes = (uint32_t)get_le(p + 8, 4);
+    nmembers = (uint32_t)get_le(p + 12, 4);
+    p += SEEK_INDEX_HEADER_LEN;
+
+    for (uint32_t i = 0; i < nmembers; i++) {
+        char name[SEEKABLE_NAME_MAX + 1];
+        size_t n;
+
+        if (end - p < 2) goto bad;
+        n = (size_t)get_le(p, 2);
+        p += 2;
+        if (n > SEEKABLE_NAME_MAX || (size_t)(end - p) < n) goto bad;
+        memcpy(name, p, n);
+        name[n] = '\0';
+        p += n;
+        if (seek_index_add_member(idx, name) < 0) return -1;
+    }
+
+    if ((size_t)(end - p) != (size_t)nframes * SEEKABLE_ENTRY_LEN) goto bad;
+    for (uint32_t i = 0; i < nframes; i++, p += SEEKABLE_ENTRY_LEN) {
+        seek_frame_t *f = seek_index_add_frame(idx, (uint32_t)get_le(p + 32, 4),
+                                               get_le(p, 8), get_le(p + 24, 8));
+
+        if (!f) return -1;
+        f->comp_len = get_le(p + 8, 8);
+        f->raw_len = get_le(p + 16, 8);
+        f->levels = (uint32_t)get_le(p + 36, 4);
+        f->ts_min = (int64_t)get_le(p + 40, 8);
+        f->ts_max = (int64_t)get_le(p + 48, 8);
+        if (f->member >= nmembers || f->comp_off > (uint64_t)data_end ||
+            f->comp_len > (uint64_t)data_end - f->comp_off) {
+            goto bad;
+        }
+    }
+    return 0;
+
+bad:
+    errno = EBADMSG;
+    return -1;
+}
+
+/**
+ * seek_index_read()
+ *
+ * Purpose:
+ *   Loads the index of a seekable archive from its footer.
+ *
+ * @param idx         Initialised empty index, filled (codec included)
+ * @param footer_off  Set to the footer frame offset: where the data frames
+ *                    end and an append starts
+ * @return 0 on success, -1 on failure (EBADMSG: not a seekable archive)
+ */
+int
+seek_index_read(int fd, seek_index_t *idx, off_t *footer_off)
+{
+    unsigned char tail[SEEKABLE_LOCATOR_LEN + SEEKABLE_GZIP_TAIL_LEN];
+    const unsigned char *loc = NULL;
+    unsigned char *buf;
+    struct stat st;
+    size_t index_len, hdr_len, tail_len = 0;
+    off_t index_off;
+    int codec, rc;
+
+    if (fstat(fd, &st) < 0) return -1;
+    if (st.st_size < (off_t)sizeof(tail) ||
+        pread(fd, tail, sizeof(tail), st.st_size - (off_t)sizeof(tail)) != (ssize_t)sizeof(tail)) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    /* Locator last (skippable frame) or before the gzip tail */
+    if (!memcmp(tail + sizeof(tail) - 8, SEEK_LOCATOR_MAGIC, 8)) {
+        loc = tail + SEEKABLE_GZIP_TAIL_LEN;
+    } else if (!memcmp(tail + SEEKABLE_LOCATOR_LEN - 8, SEEK_LOCATOR_MAGIC, 8)) {
+        loc = tail;
+        tail_len = SEEKABLE_GZIP_TAIL_LEN;
+    } else {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    index_len = (size_t)get_le(loc, 4);
+    codec = (int)get_le(loc + 4, 4);
+    if (codec < 0 || codec >= CODEC_COUNT || (codec == CODEC_GZIP) != (tail_len != 0)) {
+        errno = EBADMSG;
+        return -1;
+    }
+    hdr_len = codec == CODEC_GZIP ? SEEK_GZIP_HDR_LEN : SEEK_SKIPPABLE_HDR_LEN;
+    index_off = st.st_size - (off_t)tail_len - (off_t)index_len;
+    if (index_len < SEEK_INDEX_HEADER_LEN + SEEKABLE_LOCATOR_LEN ||
+        index_len > SEEK_INDEX_READ_MAX || index_off < (off_t)hdr_len) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    buf = malloc(index_len);
+    if (!buf) return -1;
+    if (pread(fd, buf, index_len, index_off) != (ssize_t)index_len) {
+        free(buf);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    seek_index_free(idx);
+    idx->codec = codec;
+    *footer_off = index_off - (off_t)hdr_len;
+    rc = seek_index_decode(idx, buf, index_len - SEEKABLE_LOCATOR_LEN, *footer_off);
+    free(buf);
+    if (rc < 0) {
+        int saved = errno;
+        seek_index_free(idx);
+        errno = saved;
+    }
+    return rc;
+}
@@ -0,0 +1,134 @@
+/*******************************************************************************
+ * File: ipmgr_seekable.h
+ *
+ * Description:
+ *   Seekable archive format (ARCHIVE_FMT_SEEKABLE) of ipmgr_log_rotator and
+ *   its query tool logquery: the log files of an archive, concatenated, as
+ *   independently compressed frames of about SEEKABLE_FRAME_LEN bytes cut
+ *   at line ends, followed by a footer indexing every frame by timestamp
+ *   range and level tags of the lines it holds. A query decompresses only
+ *   the frames overlapping its time window and levels.
+ *
+ *   Lines are those of logger.c: "[YYYY-MM-DD HH:MM:SS] [LEVEL] message".
+ *   Timestamps are indexed as written (local wall clock), as seconds of a
+ *   proleptic calendar with no time zone applied.
+ *
+ * File layout:
+ *   frame 0 .. frame N-1        codec frames (gzip member, zstd / lz4 frame)
+ *   footer                      gzip: empty member, index in its FEXTRA field
+ *                               zstd, lz4: skippable frame holding the index
+ *
+ *   The footer decompresses to nothing, so zcat / zstd -d / lz4 -d still
+ *   read the whole archive as the concatenated files.
+ *
+ * Index (little endian):
+ *   "IPSKIDX1"  u32 nframes  u32 nmembers
+ *   nmembers x  { u16 name_len, name }
+ *   nframes  x  { u64 comp_off, u64 comp_len, u64 raw_len, u64 raw_off,
+ *                 u32 member, u32 levels, i64 ts_min, i64 ts_max }
+ *   locator     { u32 index_len (all of the above plus the locator),
+ *                 u32 codec, "IPSKEND1" }
+ *
+ *   The locator ends the file (zstd, lz4) or sits right before the empty
+ *   deflate block and gzip trailer, SEEKABLE_GZIP_TAIL_LEN bytes from the
+ *   end.
+ *
+ *   A frame holds a single file (member), except once a gzip index is full
+ *   (seek_index_full(), the FEXTRA field caps it at about 1100 frames): the
+ *   last frame then takes the rest of the run, from its member on.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_SEEKABLE_H
+#define IPMGR_SEEKABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Uncompressed bytes per frame before it is cut at the next line end */
+#define SEEKABLE_FRAME_LEN          (1024 * 1024)
+#define SEEKABLE_FRAME_HARD_LEN     (4 * SEEKABLE_FRAME_LEN) /* Cut anyway (no newline) */
+
+#define SEEKABLE_ENTRY_LEN          56  /* Encoded frame entry */
+#define SEEKABLE_LOCATOR_LEN        16
+#define SEEKABLE_GZIP_TAIL_LEN      10  /* Empty deflate block, CRC-32, ISIZE */
+#define SEEKABLE_GZIP_INDEX_MAX     (65535 - 4) /* FEXTRA minus subfield header */
+#define SEEKABLE_NAME_MAX           255
+
+/* Level tags, logger.c log_levels[] */
+#define SEEK_LEVEL_INFO             0x01
+#define SEEK_LEVEL_WARN             0x02
+#define SEEK_LEVEL_ERROR            0x04
+#define SEEK_LEVEL_DEBUG            0x08
+#define SEEK_LEVEL_OTHER            0x10    /* Timestamped, unknown level */
+
+/* No timestamped line in the frame */
+#define SEEK_TS_NONE_MIN            INT64_MAX
+#define SEEK_TS_NONE_MAX            INT64_MIN
+
+typedef struct seek_frame_ {
+    uint64_t comp_off;          /* Frame start in the archive file */
+    uint64_t comp_len;
+    uint64_t raw_len;           /* Uncompressed bytes */
+    uint64_t raw_off;           /* Offset of those bytes in the member */
+    uint32_t member;            /* Index into members[] */
+    uint32_t levels;            /* SEEK_LEVEL_* of the frame's lines */
+    int64_t ts_min;             /* Timestamp range of the frame's lines */
+    int64_t ts_max;
+} seek_frame_t;
+
+typedef struct seek_index_ {
+    int codec;                  /* CODEC_* of the frames */
+    uint32_t nframes;
+    uint32_t frames_cap;
+    seek_frame_t *frames;
+    uint32_t nmembers;
+    uint32_t members_cap;
+    char **members;             /* Log file names, as archive members */
+    size_t encoded_len;         /* Encoded index size, kept current */
+} seek_index_t;
+
+/* Line scanner state, carried across the buffers of one file */
+typedef struct seek_scan_ {
+    bool in_line;
+    bool parsed;                /* Prefix of the current line looked at */
+    size_t prefix_len;
+    char prefix[32];            /* "[YYYY-MM-DD HH:MM:SS] [LEVEL]" */
+} seek_scan_t;
+
+void
+seek_index_init(seek_index_t *idx, int codec);
+
+void
+seek_index_free(seek_index_t *idx);
+
+int
+seek_index_add_member(seek_index_t *idx, const char *name);
+
+seek_frame_t *
+seek_index_add_frame(seek_index_t *idx, uint32_t member, uint64_t comp_off, uint64_t raw_off);
+
+bool
+seek_index_full(const seek_index_t *idx);
+
+int
+seek_footer_build(const seek_index_t *idx, unsigned char **footer, size_t *footer_len);
+
+int
+seek_index_read(int fd, seek_index_t *idx, off_t *footer_off);
+
+void
+seek_scan(seek_scan_t *scan, seek_frame_t *frame, const void *data, size_t len);
+
+bool
+seek_parse_line(const char *line, size_t len, int64_t *ts, uint32_t *level);
+
+bool
+seek_parse_time(const char *s, int64_t *ts);
+
+uint32_t
+seek_level_from_name(const char *name, size_t len);
+
+#endif /* IPMGR_SEEKABLE_H */
@@ -0,0 +1,294 @@
+/*******************************************************************************
+ * File: ipmgr_uring.c
+ *
+ * Description:
+ *   Raw io_uring ring for the rotator: setup, SQE preparation for the few
+ *   opcodes a rotation needs, submission and completion reaping. See
+ *   ipmgr_uring.h.
+ *
+ *   uring_init() fails cleanly (errno set) when the kernel lacks io_uring,
+ *   forbids it (seccomp, io_uring_disabled sysctl) or lacks IORING_OP_RENAMEAT
+ *   or IORING_OP_UNLINKAT (before 5.11); the caller then keeps using plain
+ *   syscalls.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+/* System Headers */
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+
+#include "ipmgr_uring.h"
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Ring indices shared with the kernel */
+static inline unsigned
+load_acquire(const unsigned *p)
+{
+    return atomic_load_explicit((_Atomic unsigned *)p, memory_order_acquire);
+}
+
+static inline void
+store_release(unsigned *p, unsigned v)
+{
+    atomic_store_explicit((_Atomic unsigned *)p, v, memory_order_release);
+}
+
+/* true when the kernel implements every opcode in ops */
+static bool
+uring_supports(int ring_fd, const int *ops, int nops)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    bool ok = true;
+
+    if (!probe) return false;
+
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        return false;
+    }
+    for (int i = 0; i < nops && ok; i++) {
+        ok = ops[i] <= probe->last_op &&
+             (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+/*******************************************************************************
+ *                     RING SETUP
+ ******************************************************************************/
+
+/**
+ * uring_init()
+ *
+ * Purpose:
+ *   Creates a ring of at least `entries` SQEs (CQ twice that) and maps its
+ *   queues.
+ *
+ * @return 0 on success, -1 with errno set (EOPNOTSUPP: opcodes missing)
+ */
+int
+uring_init(uring_t *ring, unsigned entries)
+{
+    static const int needed_ops[] = { IORING_OP_RENAMEAT, IORING_OP_UNLINKAT };
+    struct io_uring_params p;
+    int saved_errno;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->ring_fd = sys_io_uring_setup(entries, &p);
+    if (ring->ring_fd < 0) {
+        return -1;
+    }
+
+    if (!uring_supports(ring->ring_fd, needed_ops,
+                        sizeof(needed_ops) / sizeof(needed_ops[0]))) {
+        close(ring->ring_fd);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    ring->entries = p.sq_entries;
+    ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    /* Kernels with IORING_FEAT_SINGLE_MMAP share one mapping for both rings */
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_len > ring->sq_ring_len) ring->sq_ring_len = ring->cq_ring_len;
+        ring->cq_ring_len = ring->sq_ring_len;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->sq_submitted = ring->sq_local_tail;
+    return 0;
+
+fail:
+    saved_errno = errno;
+    if (ring->sq_ring == MAP_FAILED) ring->sq_ring = NULL;
+    uring_destroy(ring);
+    errno = saved_errno;
+    return -1;
+}
+
+void
+uring_destroy(uring_t *ring)
+{
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_len);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_len);
+    if (ring->ring_fd >= 0) close(ring->ring_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+}
+
+/*******************************************************************************
+ *                     SUBMISSION AND COMPLETION
+ ******************************************************************************/
+
+/* SQEs that can still be prepared before the next submission */
+unsigned
+uring_sq_space(const uring_t *ring)
+{
+    return ring->entries - (ring->sq_local_tail - load_acquire(ring->sq_head));
+}
+
+/* Next free SQE, zeroed, or NULL if the submission queue is full */
+struct io_uring_sqe *
+uring_get_sqe(uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    if (uring_sq_space(ring) == 0) return NULL;
+
+    sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+void
+uring_prep_renameat(struct io_uring_sqe *sqe, int dfd, const char *oldpath,
+                    const char *newpath, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = dfd;
+    sqe->addr = (uint64_t)(uintptr_t)oldpath;
+    sqe->len = (uint32_t)dfd;                   /* newdirfd */
+    sqe->addr2 = (uint64_t)(uintptr_t)newpath;
+    sqe->rename_flags = 0;
+    sqe->user_data = user_data;
+}
+
+void
+uring_prep_unlinkat(struct io_uring_sqe *sqe, int dfd, const char *path,
+                    uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_UNLINKAT;
+    sqe->fd = dfd;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->unlink_flags = 0;
+    sqe->user_data = user_data;
+}
+
+/**
+ * uring_submit_and_wait()
+ *
+ * Purpose:
+ *   Publishes every prepared SQE and waits until at least wait_nr
+ *   completions are available, in a single io_uring_enter() call.
+ *
+ * @return Number of SQEs submitted, -1 with errno set on failure
+ */
+int
+uring_submit_and_wait(uring_t *ring, unsigned wait_nr)
+{
+    unsigned to_submit = ring->sq_local_tail - ring->sq_submitted;
+    unsigned left = to_submit;
+    int rc;
+
+    /* Identity index array: SQE i sits in array slot i */
+    for (unsigned i = ring->sq_submitted; i != ring->sq_local_tail; i++) {
+        ring->sq_array[i & *ring->sq_mask] = i & *ring->sq_mask;
+    }
+    store_release(ring->sq_tail, ring->sq_local_tail);
+    ring->sq_submitted = ring->sq_local_tail;
+
+    /* An interrupted wait still reports what it submitted: loop on the rest */
+    while (1) {
+        rc = sys_io_uring_enter(ring->ring_fd, left, wait_nr,
+                                wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if ((unsigned)rc >= left) {
+            left = 0;
+        } else if (rc == 0) {
+            errno = EBUSY;
+            return -1;
+        } else {
+            left -= (unsigned)rc;
+        }
+        if (left == 0 && load_acquire(ring->cq_tail) - *ring->cq_head >= wait_nr) break;
+    }
+    return (int)to_submit;
+}
+
+/* Copies out and consumes the oldest completion, false if none is ready */
+bool
+uring_pop_cqe(uring_t *ring, struct io_uring_cqe *cqe)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == load_acquire(ring->cq_tail)) return false;
+
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    store_release(ring->cq_head, head + 1);
+    return true;
+}
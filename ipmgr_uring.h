@@ -0,0 +1,75 @@
+/*******************************************************************************
+ * File: ipmgr_uring.h
+ *
+ * Description:
+ *   Minimal io_uring submission/completion ring used by the rotator threads
+ *   of ipmgr_log_rotator to batch the metadata operations of a rotation
+ *   (renameat, unlinkat) into one io_uring_enter() call. Talks to the
+ *   kernel through the raw syscalls and <linux/io_uring.h>, no liburing.
+ *
+ *   A ring is owned by a single thread; nothing here is thread safe.
+ *
+ ******************************************************************************/
+
+#ifndef IPMGR_URING_H
+#define IPMGR_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+typedef struct uring_ {
+
+    int ring_fd;
+    unsigned entries;           /* SQ size */
+
+    /* Submission queue (mmap'ed) */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail;     /* SQEs prepared, not yet published */
+    unsigned sq_submitted;      /* SQEs published to the kernel */
+
+    /* Completion queue (mmap'ed) */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+} uring_t;
+
+int
+uring_init(uring_t *ring, unsigned entries);
+
+void
+uring_destroy(uring_t *ring);
+
+unsigned
+uring_sq_space(const uring_t *ring);
+
+struct io_uring_sqe *
+uring_get_sqe(uring_t *ring);
+
+void
+uring_prep_renameat(struct io_uring_sqe *sqe, int dfd, const char *oldpath,
+                    const char *newpath, uint64_t user_data);
+
+void
+uring_prep_unlinkat(struct io_uring_sqe *sqe, int dfd, const char *path,
+                    uint64_t user_data);
+
+int
+uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+
+bool
+uring_pop_cqe(uring_t *ring, struct io_uring_cqe *cqe);
+
+#endif /* IPMGR_URING_H */
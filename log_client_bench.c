@@ -0,0 +1,394 @@
+/*******************************************************************************
+ * File: log_client_bench.c
+ *
+ * Description:
+ *   Scaling benchmark of the multi-producer logging frontend
+ *   (ipmgr_log_client.c): 1 to 64 producer threads log fixed size lines
+ *   into one file as fast as they can, through per-thread rings and one
+ *   flusher ("ring"), and for comparison through one ipmgr_log_writer.c
+ *   writer shared under a mutex ("mutex").
+ *
+ *   For each producer count and mode it reports lines/s while producing
+ *   and end to end (until every line is written out), MB/s, producer
+ *   time per line, write() calls and .bak files, and the lines lost, from
+ *   the bytes found in the .bak files and the last live file. A reaper
+ *   thread removes .bak files as they appear, standing in for the rotator.
+ *
+ * Usage:
+ *   log_client_bench.exe [-p 1,2,4,...] [-d secs] [-l line size]
+ *                        [-s rotation size] [-D dir] [-m ring|mutex|both] [-M]
+ *     -p  producer counts (default 1,2,4,8,16,32,64)
+ *     -d  seconds per run (2)
+ *     -l  bytes per line, newline included (100)
+ *     -s  bytes per file before it is sealed as .bak (16M)
+ *     -D  directory of the log file (bench_logs/)
+ *     -m  frontends compared (both)
+ *     -M  preallocated files written through mmap (use_mmap)
+ *
+ * Build:
+ *   gcc -O2 -o log_client_bench.exe log_client_bench.c ipmgr_log_client.c ipmgr_log_writer.c -pthread
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+
+/* System Headers */
+#include <sys/stat.h>
+
+/* Threading Headers */
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Local Headers */
+#include "ipmgr_log_client.h"
+#include "ipmgr_log_writer.h"
+
+/*******************************************************************************
+ *  CONFIGURATION DEFINES BEGIN
+ ******************************************************************************/
+
+#define BENCH_DEFAULT_PRODUCERS "1,2,4,8,16,32,64"
+#define BENCH_DEFAULT_SECONDS   2
+#define BENCH_DEFAULT_LINE_LEN  100
+#define BENCH_DEFAULT_ROTATE    (16 * 1024 * 1024)
+#define BENCH_DEFAULT_DIR       "bench_logs"
+#define BENCH_MAX_PRODUCERS     1024
+#define BENCH_LINE_MIN          48
+#define BENCH_REAP_MS           20      /* Reaper pass period */
+#define BENCH_FILE_NAME         "clientbench"
+
+/*******************************************************************************
+ *  CONFIGURATION DEFINES END
+ ******************************************************************************/
+
+#define MODE_RING               1
+#define MODE_MUTEX              2
+
+typedef struct producer_ {
+    pthread_t thread;
+    unsigned id;
+    uint64_t lines;
+    uint64_t busy_ns;           /* Thread CPU time while producing */
+} producer_t;
+
+static unsigned opt_seconds = BENCH_DEFAULT_SECONDS;
+static size_t opt_line_len = BENCH_DEFAULT_LINE_LEN;
+static uint64_t opt_rotate = BENCH_DEFAULT_ROTATE;
+static const char *opt_dir = BENCH_DEFAULT_DIR;
+static bool opt_mmap;
+
+/* Current run */
+static int run_mode;
+static log_client_t *client;
+static log_writer_t shared_writer;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool go, stop;
+static char line_template[4096];
+static size_t seq_offset;       /* Of the 12 sequence digits in the template */
+
+/* Reaper */
+static atomic_bool reaper_stop;
+static uint64_t reaped_bytes;
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Sequence number into the line, as 12 digits */
+static void
+put_seq(char *line, uint64_t seq)
+{
+    for (int i = 11; i >= 0; i--) {
+        line[seq_offset + (size_t)i] = (char)('0' + seq % 10);
+        seq /= 10;
+    }
+}
+
+/* Removes the .bak files of the run, adding up their sizes */
+static void
+reap(void)
+{
+    DIR *d = opendir(opt_dir);
+    struct dirent *de;
+    size_t prefix = strlen(BENCH_FILE_NAME);
+
+    if (!d) return;
+    while ((de = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+        struct stat st;
+        size_t n = strlen(de->d_name);
+
+        if (strncmp(de->d_name, BENCH_FILE_NAME ".", prefix + 1) != 0 || n < 4 ||
+            strcmp(de->d_name + n - 4, ".bak") != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", opt_dir, de->d_name);
+        if (stat(path, &st) == 0 && unlink(path) == 0) reaped_bytes += (uint64_t)st.st_size;
+    }
+    closedir(d);
+}
+
+static void *
+reaper_thread_fn(void *arg)
+{
+    struct timespec period = { 0, BENCH_REAP_MS * 1000000L };
+
+    (void)arg;
+    while (!atomic_load(&reaper_stop)) {
+        reap();
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ *                     PRODUCERS
+ ******************************************************************************/
+
+/**
+ * producer_thread_fn()
+ *
+ * Purpose:
+ *   Logs lines back to back until told to stop: formatted in place in the
+ *   thread's ring (reserve / commit), or into a local buffer appended to
+ *   the shared writer under its mutex.
+ */
+static void *
+producer_thread_fn(void *arg)
+{
+    producer_t *p = arg;
+    char line[4096];
+    uint64_t seq = 0, cpu0;
+
+    memcpy(line, line_template, opt_line_len);
+    snprintf(line + 1, 5, "%04u", p->id);
+    line[5] = ']';
+
+    while (!atomic_load_explicit(&go, memory_order_acquire)) {
+    }
+    cpu0 = thread_cpu_ns();
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if (run_mode == MODE_RING) {
+            char *dst = log_client_reserve(client, opt_line_len);
+
+            if (!dst) continue;
+            memcpy(dst, line, opt_line_len);
+            put_seq(dst, seq);
+            log_client_commit(client, opt_line_len);
+        } else {
+            put_seq(line, seq);
+            pthread_mutex_lock(&shared_lock);
+            log_writer_append(&shared_writer, line, opt_line_len);
+            pthread_mutex_unlock(&shared_lock);
+        }
+        seq++;
+    }
+
+    p->busy_ns = thread_cpu_ns() - cpu0;
+    p->lines = seq;
+    return NULL;
+}
+
+/* Size of the live file left by a run, removed */
+static uint64_t
+live_file_take(void)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    uint64_t size = 0;
+
+    snprintf(path, sizeof(path), "%s/%s.log", opt_dir, BENCH_FILE_NAME);
+    if (stat(path, &st) == 0) size = (uint64_t)st.st_size;
+    unlink(path);
+    return size;
+}
+
+/**
+ * bench_run()
+ *
+ * Purpose:
+ *   One run: nprod producers for opt_seconds, then the close (rings
+ *   drained, last lines written), and one result line.
+ */
+static void
+bench_run(int mode, unsigned nprod)
+{
+    static producer_t producers[BENCH_MAX_PRODUCERS];
+    log_writer_params_t wp = { .rotate_size = opt_rotate, .use_mmap = opt_mmap };
+    log_client_params_t cp = { .writer = wp };
+    log_client_stats_t cs = { 0 };
+    pthread_t reaper;
+    uint64_t t0, t1, t2, lines = 0, busy = 0, written, writes, baks;
+
+    run_mode = mode;
+    atomic_store(&go, false);
+    atomic_store(&stop, false);
+    atomic_store(&reaper_stop, false);
+    live_file_take();
+    reap();
+    reaped_bytes = 0;
+
+    if (mode == MODE_RING) {
+        client = log_client_open(opt_dir, BENCH_FILE_NAME, &cp);
+        if (!client) {
+            perror("log_client_open");
+            exit(EXIT_FAILURE);
+        }
+    } else if (log_writer_open(&shared_writer, opt_dir, BENCH_FILE_NAME, &wp) < 0) {
+        perror("log_writer_open");
+        exit(EXIT_FAILURE);
+    }
+    pthread_create(&reaper, NULL, reaper_thread_fn, NULL);
+
+    for (unsigned i = 0; i < nprod; i++) {
+        producers[i].id = i;
+        if (pthread_create(&producers[i].thread, NULL, producer_thread_fn, &producers[i]) != 0) {
+            fprintf(stderr, "Failed to create producer %u\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    t0 = now_ns();
+    atomic_store_explicit(&go, true, memory_order_release);
+    sleep(opt_seconds);
+    atomic_store(&stop, true);
+    for (unsigned i = 0; i < nprod; i++) {
+        pthread_join(producers[i].thread, NULL);
+        lines += producers[i].lines;
+        busy += producers[i].busy_ns;
+    }
+    t1 = now_ns();
+
+    if (mode == MODE_RING) {
+        /* As of the end of production: the client is gone after the close */
+        log_client_get_stats(client, &cs);
+        if (log_client_close(client, false) < 0) perror("log_client_close");
+        writes = cs.writes;
+        baks = cs.baks;
+    } else {
+        if (log_writer_close(&shared_writer, false) < 0) perror("log_writer_close");
+        writes = shared_writer.stats.writes;
+        baks = shared_writer.stats.baks;
+    }
+    t2 = now_ns();
+
+    atomic_store(&reaper_stop, true);
+    pthread_join(reaper, NULL);
+    reap();
+    written = reaped_bytes + live_file_take();
+
+    printf("%9u %6s %12.0f %12.0f %9.1f %9.1f %10llu %7llu %10llu %10lld\n",
+           nprod, mode == MODE_RING ? "ring" : "mutex",
+           (double)lines / ((double)(t1 - t0) / 1e9),
+           (double)lines / ((double)(t2 - t0) / 1e9),
+           (double)(lines * opt_line_len) / ((double)(t2 - t0) / 1e9) / (1024.0 * 1024.0),
+           lines ? (double)busy / (double)lines : 0.0,
+           (unsigned long long)writes, (unsigned long long)baks,
+           (unsigned long long)cs.full_waits,
+           (long long)(lines * opt_line_len - written) / (long long)opt_line_len);
+    fflush(stdout);
+}
+
+/*******************************************************************************
+ *                     MAIN
+ ******************************************************************************/
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-p 1,2,4,...] [-d secs] [-l line size] [-s rotation size]\n"
+            "       [-D dir] [-m ring|mutex|both] [-M]\n", prog);
+    return EXIT_FAILURE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *counts = BENCH_DEFAULT_PRODUCERS;
+    int modes = MODE_RING | MODE_MUTEX;
+    char list[256], *tok, *save;
+    int opt, n;
+
+    while ((opt = getopt(argc, argv, "p:d:l:s:D:m:M")) != -1) {
+        switch (opt) {
+        case 'p': counts = optarg; break;
+        case 'd': opt_seconds = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'l': opt_line_len = strtoul(optarg, NULL, 10); break;
+        case 's': opt_rotate = strtoull(optarg, NULL, 10); break;
+        case 'D': opt_dir = optarg; break;
+        case 'm':
+            if (!strcmp(optarg, "ring")) modes = MODE_RING;
+            else if (!strcmp(optarg, "mutex")) modes = MODE_MUTEX;
+            else if (!strcmp(optarg, "both")) modes = MODE_RING | MODE_MUTEX;
+            else return usage(argv[0]);
+            break;
+        case 'M': opt_mmap = true; break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (opt_seconds < 1 || opt_line_len < BENCH_LINE_MIN || opt_line_len > LOG_CLIENT_LINE_MAX ||
+        opt_rotate < opt_line_len) {
+        return usage(argv[0]);
+    }
+    if (mkdir(opt_dir, 0755) < 0 && errno != EEXIST) {
+        perror(opt_dir);
+        return EXIT_FAILURE;
+    }
+
+    /* "[pppp] [INFO] seq 000000000000 xxx...\n" */
+    n = snprintf(line_template, sizeof(line_template), "[0000] [INFO] seq ");
+    seq_offset = (size_t)n;
+    memset(line_template + n, '0', 12);
+    memset(line_template + n + 12, 'x', opt_line_len - (size_t)n - 13);
+    line_template[n + 12] = ' ';
+    line_template[opt_line_len - 1] = '\n';
+
+    printf("%d cores, %zu byte lines, %us per run%s\n\n",
+           (int)sysconf(_SC_NPROCESSORS_ONLN), opt_line_len, opt_seconds,
+           opt_mmap ? ", mmap writer" : "");
+    printf("%9s %6s %12s %12s %9s %9s %10s %7s %10s %10s\n", "producers", "mode",
+           "lines/s", "end-to-end", "MB/s", "ns/line", "writes", "baks", "full_waits",
+           "lost");
+
+    snprintf(list, sizeof(list), "%s", counts);
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        unsigned nprod = (unsigned)strtoul(tok, NULL, 10);
+
+        if (nprod < 1 || nprod > BENCH_MAX_PRODUCERS) return usage(argv[0]);
+        if (modes & MODE_RING) bench_run(MODE_RING, nprod);
+        if (modes & MODE_MUTEX) bench_run(MODE_MUTEX, nprod);
+    }
+    return EXIT_SUCCESS;
+}
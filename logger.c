@@ -6,10 +6,12 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
-#include <sys/stat.h>
+#include <signal.h>
 #include <pthread.h>
 #include <sched.h>
 
+#include "ipmgr_log_writer.h"
+
 #define LOG_FILE_1 "var/log/ipstrc.log"
 #define LOG_FILE_2 "var/log/pdtrc.log"
 #define LOG_FILE_3 "var/log/ipmgr.log"
@@ -17,19 +19,60 @@
 #define MAX_LOG_SIZE 10240  // 10KB in bytes
 #define NUM_THREADS 4
 #define LOG_DIR_PATH "var/log"
+#define DEFAULT_RATE 1000   // Lines per second per thread, 0 = as fast as possible
+
+// Writer settings and rate, from the command line
+static log_writer_params_t writer_params = { .rotate_size = MAX_LOG_SIZE };
+static unsigned lines_per_sec = DEFAULT_RATE;
+static int verbose = 1;
+static volatile sig_atomic_t stop_logging;
+
+#define MAX_MESSAGES 16
+#define MAX_MESSAGE_LEN 128
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+// A message format split around its %d, compiled once at startup
+typedef struct {
+    char text[MAX_MESSAGE_LEN];  // Format without the %d, %% unescaped
+    size_t head_len;             // Bytes before the value
+    size_t len;
+    int has_value;
+} message_t;
+
+// One service: the file it logs into and what its lines say
+typedef struct {
+    const char *name;
+    const char *log_file;
+    const char *const *formats;
+    size_t num_formats;
+    unsigned value_mod;          // Values of %d are 0 .. value_mod - 1
+    message_t messages[MAX_MESSAGES];
+} log_source_t;
 
 // Thread data structure
 typedef struct {
     int thread_id;
     int cpu_core;
-    const char *log_file;
-    const char *thread_name;
-    void (*log_generator)(char*, size_t);
+    log_source_t *source;
 } thread_data_t;
 
-// Log level types
-const char *log_levels[] = {"INFO", "WARN", "ERROR", "DEBUG"};
-const int num_log_levels = 4;
+// "[YYYY-mm-dd HH:MM:SS] " of the current second, rebuilt when it changes
+typedef struct {
+    time_t sec;                  // Second in prefix, -1 before the first line
+    time_t zone_until;           // gmtoff is good until then
+    long gmtoff;
+    char prefix[32];
+    size_t len;
+} ts_cache_t;
+
+// Log level tags, lengths known up front
+#define LEVEL_TAG(s) { s, sizeof(s) - 1 }
+static const struct {
+    const char *text;
+    size_t len;
+} level_tags[] = {
+    LEVEL_TAG("[INFO] "), LEVEL_TAG("[WARN] "), LEVEL_TAG("[ERROR] "), LEVEL_TAG("[DEBUG] ")
+};
 
 // Sample log messages for each service
 const char *ipstrc_messages[] = {
@@ -85,122 +128,142 @@ const char *ipmgr_messages[] = {
 };
 
 
-// Get current timestamp in ISO 8601 format
-void get_timestamp(char *buffer, size_t size) {
-    time_t now;
-    struct tm *tm_info;
-    
-    time(&now);
-    tm_info = localtime(&now);
-    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
-}
+// The services, one logger thread each
+static log_source_t log_sources[NUM_THREADS] = {
+    { .name = "ipstrc", .log_file = LOG_FILE_1, .formats = ipstrc_messages,
+      .num_formats = ARRAY_LEN(ipstrc_messages), .value_mod = 1000 },
+    { .name = "pdtrc", .log_file = LOG_FILE_2, .formats = pdtrc_messages,
+      .num_formats = ARRAY_LEN(pdtrc_messages), .value_mod = 100 },
+    { .name = "ipmgr", .log_file = LOG_FILE_3, .formats = ipmgr_messages,
+      .num_formats = ARRAY_LEN(ipmgr_messages), .value_mod = 100 },
+    { .name = "inttrc", .log_file = LOG_FILE_4, .formats = inttrc_messages,
+      .num_formats = ARRAY_LEN(inttrc_messages), .value_mod = 100 },
+};
 
-// Generate a random log message for ipstrc
-void generate_ipstrc_log(char *buffer, size_t size) {
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    int msg_idx = rand() % 10;
-    int level_idx = rand() % num_log_levels;
-    int random_val = rand() % 1000;
-    
-    snprintf(buffer, size, "[%s] [%s] ", timestamp, log_levels[level_idx]);
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), ipstrc_messages[msg_idx], random_val);
-    strncat(buffer, msg, size - strlen(buffer) - 1);
-    strncat(buffer, "\n", size - strlen(buffer) - 1);
-}
+// Split every format of a source around its %d (at most one per format)
+static void compile_messages(log_source_t *src) {
+    for (size_t i = 0; i < src->num_formats && i < MAX_MESSAGES; i++) {
+        message_t *m = &src->messages[i];
+        const char *f = src->formats[i];
 
-// Generate a random log message for pdtrc
-void generate_pdtrc_log(char *buffer, size_t size) {
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    int msg_idx = rand() % 10;
-    int level_idx = rand() % num_log_levels;
-    int random_val = rand() % 100;
-    
-    snprintf(buffer, size, "[%s] [%s] ", timestamp, log_levels[level_idx]);
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), pdtrc_messages[msg_idx], random_val);
-    strncat(buffer, msg, size - strlen(buffer) - 1);
-    strncat(buffer, "\n", size - strlen(buffer) - 1);
+        m->has_value = 0;
+        m->len = 0;
+        while (*f && m->len < sizeof(m->text)) {
+            if (f[0] == '%' && f[1] == 'd' && !m->has_value) {
+                m->has_value = 1;
+                m->head_len = m->len;
+                f += 2;
+                continue;
+            }
+            if (f[0] == '%' && f[1] == '%') f++;
+            m->text[m->len++] = *f++;
+        }
+        if (!m->has_value) m->head_len = m->len;
+    }
+    if (src->num_formats > MAX_MESSAGES) src->num_formats = MAX_MESSAGES;
 }
 
-// Generate a random log message for ipmgr
-void generate_ipmgr_log(char *buffer, size_t size) {
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    int msg_idx = rand() % 10;
-    int level_idx = rand() % num_log_levels;
-    int random_val = rand() % 100;
-    
-    snprintf(buffer, size, "[%s] [%s] ", timestamp, log_levels[level_idx]);
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), ipmgr_messages[msg_idx], random_val);
-    strncat(buffer, msg, size - strlen(buffer) - 1);
-    strncat(buffer, "\n", size - strlen(buffer) - 1);
+static char *put2(char *p, unsigned v) {
+    p[0] = (char)('0' + v / 10);
+    p[1] = (char)('0' + v % 10);
+    return p + 2;
 }
 
-// Generate a random log message for ipmgr
-void generate_inttrc_log(char *buffer, size_t size) {
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    int msg_idx = rand() % 10;
-    int level_idx = rand() % num_log_levels;
-    int random_val = rand() % 100;
-    
-    snprintf(buffer, size, "[%s] [%s] ", timestamp, log_levels[level_idx]);
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), inttrc_messages[msg_idx], random_val);
-    strncat(buffer, msg, size - strlen(buffer) - 1);
-    strncat(buffer, "\n", size - strlen(buffer) - 1);
-}
+static char *put_uint(char *p, unsigned v) {
+    char tmp[10];
+    int n = 0;
 
-// Get file size in bytes
-long get_file_size(const char *filename) {
-    struct stat st;
-    if (stat(filename, &st) == 0) {
-        return st.st_size;
-    }
-    return 0;  // File doesn't exist or error
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
 }
 
-// Write log to file, rename to .bak if size exceeds limit (thread-safe version)
-int write_log(FILE **fp, thread_data_t *data, const char *log_message, long *old_size) {
-    long current_size = get_file_size(data->log_file);
+// Days since 1970-01-01 to a Gregorian date (H. Hinnant's civil_from_days)
+static void civil_from_days(int64_t z, int *y, unsigned *m, unsigned *d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int)(yoe + era * 400) + (*m <= 2);
+}
 
-    if (current_size - *old_size >= MAX_LOG_SIZE) {
-        fclose(*fp);
+// Brings the cached timestamp prefix to the current second. clock_gettime()
+// is a vDSO call; the date is worked out here instead of by localtime(),
+// which takes the time zone lock. Only the UTC offset comes from
+// localtime_r(), once every 15 minutes: zone changes fall on quarter hours.
+static void ts_cache_update(ts_cache_t *ts) {
+    struct timespec now;
 
-        // make a new unique .bak each time
-        char bak_name[256];
-        time_t now = time(NULL);
-        
-        snprintf(bak_name, sizeof(bak_name), "%s/%s.%ld.bak", 
-            LOG_DIR_PATH, data->thread_name, now);
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec == ts->sec) return;
+    ts->sec = now.tv_sec;
 
-        rename(data->log_file, bak_name);
+    if (now.tv_sec >= ts->zone_until) {
+        struct tm tm;
+        if (localtime_r(&now.tv_sec, &tm)) ts->gmtoff = tm.tm_gmtoff;
+        ts->zone_until = (now.tv_sec / 900 + 1) * 900;
+    }
 
-        *fp = fopen(data->log_file, "a"); // start new log
-        if (*fp == NULL) {
-            fprintf(stderr, "Error reopening %s: %s\n", data->log_file, strerror(errno));
-            return -1;
-        }
-        *old_size = 0;
+    int64_t local = (int64_t)now.tv_sec + ts->gmtoff;
+    int64_t days = local / 86400;
+    int64_t sod = local % 86400;
+    if (sod < 0) {
+        sod += 86400;
+        days--;
     }
 
-    fprintf(*fp, "%s", log_message);
-    fflush(*fp);
-    return 0;
+    int year;
+    unsigned month, day;
+    civil_from_days(days, &year, &month, &day);
+
+    char *p = ts->prefix;
+    *p++ = '[';
+    p = put2(p, (unsigned)year / 100 % 100);
+    p = put2(p, (unsigned)year % 100);
+    *p++ = '-';
+    p = put2(p, month);
+    *p++ = '-';
+    p = put2(p, day);
+    *p++ = ' ';
+    p = put2(p, (unsigned)(sod / 3600));
+    *p++ = ':';
+    p = put2(p, (unsigned)(sod / 60 % 60));
+    *p++ = ':';
+    p = put2(p, (unsigned)(sod % 60));
+    *p++ = ']';
+    *p++ = ' ';
+    ts->len = (size_t)(p - ts->prefix);
 }
 
+// Formats a random line of the source into buffer (at least 256 bytes):
+// "[timestamp] [LEVEL] message\n", no NUL. Returns its length.
+static size_t format_log_line(const log_source_t *src, ts_cache_t *ts, unsigned *seed,
+                              char *buffer) {
+    const message_t *m = &src->messages[(unsigned)rand_r(seed) % src->num_formats];
+    unsigned level = (unsigned)rand_r(seed) % ARRAY_LEN(level_tags);
+    char *p = buffer;
+
+    ts_cache_update(ts);
+    memcpy(p, ts->prefix, ts->len);
+    p += ts->len;
+    memcpy(p, level_tags[level].text, level_tags[level].len);
+    p += level_tags[level].len;
+    memcpy(p, m->text, m->head_len);
+    p += m->head_len;
+    if (m->has_value) p = put_uint(p, (unsigned)rand_r(seed) % src->value_mod);
+    memcpy(p, m->text + m->head_len, m->len - m->head_len);
+    p += m->len - m->head_len;
+    *p++ = '\n';
+    return (size_t)(p - buffer);
+}
 
 // Pin thread to a specific CPU core
 int pin_thread_to_core(int core_id) {
@@ -220,12 +283,25 @@ int pin_thread_to_core(int core_id) {
     return 0;
 }
 
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_logging = 1;
+}
+
 // Logger thread function
 void *logger_thread(void *arg) {
     thread_data_t *data = (thread_data_t *)arg;
     char log_buffer[512];
-    int log_counter = 0;
-    long old_size = 0;
+    uint64_t log_counter = 0;
+    log_writer_t writer;
+    log_source_t *src = data->source;
+    ts_cache_t ts = { .sec = -1 };
     
     // Pin this thread to its assigned CPU core
     if (pin_thread_to_core(data->cpu_core) == 0) {
@@ -236,102 +312,121 @@ void *logger_thread(void *arg) {
     // Seed random number generator with thread-specific seed
     unsigned int seed = time(NULL) + data->thread_id;
     
-    // Open log file
-    FILE *fp = fopen(data->log_file, "a");
-    if (fp == NULL) {
+    // Open log file: rotation size is tracked by the writer, no stat() per line
+    if (log_writer_open(&writer, LOG_DIR_PATH, src->name, &writer_params) != 0) {
         fprintf(stderr, "[Thread %d] Error opening %s: %s\n", 
-                data->thread_id, data->log_file, strerror(errno));
+                data->thread_id, src->log_file, strerror(errno));
         return NULL;
     }
     
-    printf("[Thread %d] Started logging to %s\n", data->thread_id, data->log_file);
-    
-    // Main logging loop
-    while (1) {
-        // Generate log message using thread-specific generator
-        data->log_generator(log_buffer, sizeof(log_buffer));
+    printf("[Thread %d] Started logging to %s\n", data->thread_id, src->log_file);
+    
+    // Main logging loop, paced on the clock since the start
+    uint64_t start = now_ns();
+    while (!stop_logging) {
+        if (lines_per_sec) {
+            uint64_t elapsed = now_ns() - start;
+            uint64_t due = elapsed / 1000 * lines_per_sec / 1000000;
+            if (log_counter >= due) {
+                // Idle: nothing buffered may wait past the flush latency
+                log_writer_poll(&writer);
+                uint64_t next = (log_counter + 1) * 1000000000ULL / lines_per_sec;
+                usleep(next > elapsed ? (useconds_t)((next - elapsed) / 1000) : 0);
+                continue;
+            }
+        }
+
+        // Generate log message from the thread's service, thread-local random
+        size_t len = format_log_line(src, &ts, &seed, log_buffer);
         
-        // Write log (thread-safe version)
-        if (write_log(&fp, data, log_buffer, &old_size) == 0) {
+        if (log_writer_append(&writer, log_buffer, len) == 0) {
             // Optionally print to console (can be disabled for pure stress test)
-            if (log_counter % 100 == 0) {  // Print every 100th log to reduce console spam
-                printf("[Thread %d][%d] %s: %s", 
-                       data->thread_id, log_counter, data->thread_name, log_buffer);
+            if (verbose && log_counter % 100 == 0) {  // Print every 100th log to reduce console spam
+                printf("[Thread %d][%llu] %s: %.*s", 
+                       data->thread_id, (unsigned long long)log_counter, src->name,
+                       (int)len, log_buffer);
             }
+        } else {
+            fprintf(stderr, "[Thread %d] Error writing %s: %s\n",
+                    data->thread_id, src->log_file, strerror(errno));
         }
         
         log_counter++;
-        
-        // Very short sleep for high stress - ~1000 logs per second per thread
-        // Adjust this value to control stress level:
-        // 1000 = ~1000 logs/sec, 10000 = ~100 logs/sec, 100000 = ~10 logs/sec
-        usleep(1000);
-        
-        // Use thread-local random
-        rand_r(&seed);
     }
     
-    fclose(fp);
+    // Last lines out; the file stays for the next run to append to
+    log_writer_close(&writer, false);
+    printf("[Thread %d] %llu lines, %llu writes, %llu .bak files\n", data->thread_id,
+           (unsigned long long)writer.stats.lines, (unsigned long long)writer.stats.writes,
+           (unsigned long long)writer.stats.baks);
     return NULL;
 }
 
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r lines/s] [-s rotate bytes] [-b batch bytes] [-l flush us] [-m] [-q]\n"
+            "  -r  lines per second per thread, 0 = as fast as possible (%d)\n"
+            "  -s  bytes per file before it is renamed to .bak (%d)\n"
+            "  -b  bytes gathered per write() (%d)\n"
+            "  -l  longest a line is buffered, microseconds (%d)\n"
+            "  -m  preallocate each file and write it through mmap\n"
+            "  -q  do not print sample lines\n",
+            prog, DEFAULT_RATE, MAX_LOG_SIZE, LOG_WRITER_DEFAULT_BATCH,
+            LOG_WRITER_DEFAULT_LATENCY_US);
+    return EXIT_FAILURE;
+}
+
 int main(int argc, char *argv[]) {
-    (void)argc;  // Unused parameter
-    (void)argv;  // Unused parameter
-    
     pthread_t threads[NUM_THREADS];
     thread_data_t thread_data[NUM_THREADS];
-    
-    // Seed random number generator
-    srand(time(NULL));
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:s:b:l:mq")) != -1) {
+        switch (opt) {
+        case 'r': lines_per_sec = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 's': writer_params.rotate_size = strtoull(optarg, NULL, 10); break;
+        case 'b': writer_params.batch_len = strtoul(optarg, NULL, 10); break;
+        case 'l': writer_params.flush_latency_us = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'm': writer_params.use_mmap = true; break;
+        case 'q': verbose = 0; break;
+        default: return usage(argv[0]);
+        }
+    }
+
+    // Ctrl+C: threads write out what they buffered and stop
+    struct sigaction sa = { .sa_handler = handle_stop };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
     
     printf("========================================\n");
     printf("  Multi-threaded Log Generator\n");
     printf("========================================\n");
     printf("Number of threads: %d\n", NUM_THREADS);
     printf("Writing logs to:\n");
-    printf("  - %s\n", LOG_FILE_1);
-    printf("  - %s\n", LOG_FILE_2);
-    printf("  - %s\n", LOG_FILE_3);
-    printf("  - %s\n", LOG_FILE_4);
-    printf("Rate: ~1000 logs/sec per thread (4000 total)\n");
-    printf("Max log size: %d bytes (rename to .bak when exceeded)\n", MAX_LOG_SIZE);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        printf("  - %s\n", log_sources[i].log_file);
+    }
+    if (lines_per_sec) {
+        printf("Rate: %u logs/sec per thread (%u total)\n", lines_per_sec,
+               lines_per_sec * NUM_THREADS);
+    } else {
+        printf("Rate: unthrottled\n");
+    }
+    printf("Max log size: %llu bytes (rename to .bak when reached)\n",
+           (unsigned long long)writer_params.rotate_size);
     printf("CPU Affinity: Each thread pinned to separate core\n");
     printf("Press Ctrl+C to stop\n");
     printf("========================================\n\n");
     
-    // Configure thread data
-    thread_data[0] = (thread_data_t){
-        .thread_id = 0,
-        .cpu_core = 0,
-        .log_file = LOG_FILE_1,
-        .thread_name = "ipstrc",
-        .log_generator = generate_ipstrc_log
-    };
-    
-    thread_data[1] = (thread_data_t){
-        .thread_id = 1,
-        .cpu_core = 1,
-        .log_file = LOG_FILE_2,
-        .thread_name = "pdtrc",
-        .log_generator = generate_pdtrc_log
-    };
-    
-    thread_data[2] = (thread_data_t){
-        .thread_id = 2,
-        .cpu_core = 2,
-        .log_file = LOG_FILE_3,
-        .thread_name = "ipmgr",
-        .log_generator = generate_ipmgr_log
-    };
-    
-    thread_data[3] = (thread_data_t){
-        .thread_id = 3,
-        .cpu_core = 3,
-        .log_file = LOG_FILE_4,
-        .thread_name = "inttrc",
-        .log_generator = generate_inttrc_log
-    };
+    // Configure thread data: thread i logs for service i on core i
+    for (int i = 0; i < NUM_THREADS; i++) {
+        compile_messages(&log_sources[i]);
+        thread_data[i] = (thread_data_t){
+            .thread_id = i,
+            .cpu_core = i,
+            .source = &log_sources[i]
+        };
+    }
     
     // Create threads
     printf("Creating threads...\n");
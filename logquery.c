@@ -0,0 +1,336 @@
+/*******************************************************************************
+ * File: logquery.c
+ *
+ * Description:
+ *   Search tool of the seekable archives of ipmgr_log_rotator
+ *   (archive_format = seekable, see ipmgr_seekable.h): prints the log lines
+ *   of a time window and / or a set of levels, decompressing only the
+ *   frames whose index entry overlaps them instead of the whole archive.
+ *
+ *   A line matches when its "[YYYY-MM-DD HH:MM:SS] [LEVEL]" prefix is in
+ *   the window and one of the levels; lines without prefix (continuation
+ *   of a multi line message) go with the line before them.
+ *
+ * Usage:
+ *   logquery.exe [-s start] [-e end] [-l levels] [-D dict] [-H] [-v] archive...
+ *     -s, -e  "YYYY-MM-DD HH:MM:SS" or "YYYY-MM-DD" (whole day), inclusive
+ *     -l      comma separated INFO, WARN, ERROR, DEBUG, OTHER
+ *     -D      zstd dictionary the archive was written with
+ *             (<watch_dir><type>.zdict.<id>, id as printed by "zstd -lv")
+ *     -H      prefix each line with its file name in the archive
+ *     -v      report frames and bytes decompressed on stderr
+ *
+ * Build:
+ *   gcc -O2 -o logquery.exe logquery.c ipmgr_seekable.c ipmgr_codec.c -lz
+ *   zstd and lz4 archives: add -DIPMGR_WITH_ZSTD=1 -lzstd -DIPMGR_WITH_LZ4=1 -llz4
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* System Headers */
+#include <sys/stat.h>
+#include <fcntl.h>
+
+/* Local Headers */
+#include "ipmgr_codec.h"
+#include "ipmgr_seekable.h"
+
+#define QUERY_LEVELS_ALL    (SEEK_LEVEL_INFO | SEEK_LEVEL_WARN | SEEK_LEVEL_ERROR | \
+                             SEEK_LEVEL_DEBUG | SEEK_LEVEL_OTHER)
+
+/* Query and line filter state of the frames being decoded */
+typedef struct query_ {
+    int64_t start;
+    int64_t end;
+    uint32_t levels;
+    bool filtered;              /* Any of -s, -e, -l given */
+    bool show_name;
+    const char *member;         /* Name of the frame's file */
+
+    bool in_line;
+    bool decided;               /* Current line kept or dropped */
+    bool keep;
+    bool prev_keep;             /* Decision continuation lines follow */
+    size_t prefix_len;
+    char prefix[32];
+} query_t;
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+/* -s / -e argument, a date alone is the start or the end of that day */
+static int
+parse_time_arg(const char *arg, bool end_of_day, int64_t *ts)
+{
+    char buf[20];
+
+    if (strlen(arg) == 10) {
+        snprintf(buf, sizeof(buf), "%s %s", arg, end_of_day ? "23:59:59" : "00:00:00");
+        arg = buf;
+    }
+    if (strlen(arg) != 19 || !seek_parse_time(arg, ts)) {
+        fprintf(stderr, "Invalid time \"%s\", expected YYYY-MM-DD [HH:MM:SS]\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/* -l argument: comma separated level names */
+static int
+parse_levels_arg(const char *arg, uint32_t *levels)
+{
+    *levels = 0;
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        uint32_t bit = seek_level_from_name(arg, len);
+
+        if (bit == SEEK_LEVEL_OTHER && !(len == 5 && !memcmp(arg, "OTHER", 5))) {
+            fprintf(stderr, "Unknown level \"%.*s\"\n", (int)len, arg);
+            return -1;
+        }
+        *levels |= bit;
+        arg += len;
+        if (*arg == ',') arg++;
+    }
+    return 0;
+}
+
+/* Reads a whole (dictionary) file, NULL on failure (reported) */
+static void *
+load_file(const char *path, size_t *len)
+{
+    struct stat st;
+    FILE *fp = fopen(path, "rb");
+    void *data = NULL;
+
+    if (!fp || fstat(fileno(fp), &st) < 0 || !(data = malloc((size_t)st.st_size + 1)) ||
+        fread(data, 1, (size_t)st.st_size, fp) != (size_t)st.st_size) {
+        perror(path);
+        free(data);
+        data = NULL;
+    }
+    if (fp) fclose(fp);
+    *len = data ? (size_t)st.st_size : 0;
+    return data;
+}
+
+static bool
+frame_selected(const query_t *q, const seek_frame_t *f)
+{
+    /* Only continuation lines: decoded, they follow the frame before */
+    if (f->ts_min == SEEK_TS_NONE_MIN) return true;
+    return f->ts_max >= q->start && f->ts_min <= q->end && (f->levels & q->levels);
+}
+
+/* Decides on the line whose prefix is collected, and prints the prefix if kept */
+static void
+query_decide(query_t *q)
+{
+    int64_t ts;
+    uint32_t level;
+
+    if (!q->filtered) {
+        q->keep = true;
+    } else if (seek_parse_line(q->prefix, q->prefix_len, &ts, &level)) {
+        q->keep = ts >= q->start && ts <= q->end && (level & q->levels);
+    } else {
+        q->keep = q->prev_keep;
+    }
+    q->prev_keep = q->keep;
+    q->decided = true;
+
+    if (q->keep) {
+        if (q->show_name) printf("%s:", q->member);
+        fwrite(q->prefix, 1, q->prefix_len, stdout);
+    }
+}
+
+/**
+ * query_sink()
+ *
+ * Purpose:
+ *   Codec sink of the decoded frames: prints the matching lines. Only the
+ *   first bytes of a line are held back, until its prefix is complete.
+ */
+static int
+query_sink(void *ctx, const void *buf, size_t len)
+{
+    query_t *q = ctx;
+    const char *p = buf, *end = p + len;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *stop = nl ? nl + 1 : end;
+
+        if (!q->in_line) {
+            q->in_line = true;
+            q->decided = false;
+            q->prefix_len = 0;
+        }
+        if (!q->decided) {
+            size_t n = (size_t)((nl ? nl : end) - p);
+
+            if (n > sizeof(q->prefix) - q->prefix_len) {
+                n = sizeof(q->prefix) - q->prefix_len;
+            }
+            memcpy(q->prefix + q->prefix_len, p, n);
+            q->prefix_len += n;
+            p += n;
+            if (!nl && q->prefix_len < sizeof(q->prefix)) break;
+            query_decide(q);
+        }
+        if (q->keep) fwrite(p, 1, (size_t)(stop - p), stdout);
+        if (nl) q->in_line = false;
+        p = stop;
+    }
+    return ferror(stdout) ? -1 : 0;
+}
+
+/**
+ * query_archive()
+ *
+ * Purpose:
+ *   Decodes the selected frames of one archive through query_sink().
+ *
+ * @return 0 on success, -1 on failure (reported)
+ */
+static int
+query_archive(query_t *q, const char *path, const void *dict, size_t dict_len, bool verbose)
+{
+    seek_index_t idx;
+    off_t footer_off;
+    uint64_t comp_total = 0, comp_read = 0;
+    uint32_t decoded = 0, last = UINT32_MAX;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int rc = 0;
+
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    seek_index_init(&idx, CODEC_GZIP);
+    if (seek_index_read(fd, &idx, &footer_off) < 0) {
+        if (errno == EBADMSG) {
+            fprintf(stderr, "%s: not a seekable archive\n", path);
+        } else {
+            perror(path);
+        }
+        close(fd);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < idx.nframes; i++) {
+        const seek_frame_t *f = &idx.frames[i];
+
+        comp_total += f->comp_len;
+        if (!frame_selected(q, f)) continue;
+
+        /* Continuation lines only carry over from the frame just before */
+        if (last == UINT32_MAX || last + 1 != i || idx.frames[last].member != f->member) {
+            q->in_line = false;
+            q->prev_keep = false;
+        }
+        q->member = idx.members[f->member];
+
+        if (lseek(fd, (off_t)f->comp_off, SEEK_SET) < 0 ||
+            codec_decode_file(idx.codec, fd, f->comp_len, dict, dict_len, query_sink, q) < 0) {
+            fprintf(stderr, "%s: frame %u at %llu: %s%s\n", path, i,
+                    (unsigned long long)f->comp_off, strerror(errno),
+                    errno == EBADMSG && idx.codec == CODEC_ZSTD && !dict ?
+                    " (zstd dictionary needed? see -D)" : "");
+            rc = -1;
+            break;
+        }
+        /* Frame cut inside a line (no line end for too long) */
+        if (q->in_line && !q->decided) query_decide(q);
+
+        comp_read += f->comp_len;
+        decoded++;
+        last = i;
+    }
+
+    if (verbose) {
+        fprintf(stderr, "%s: %s, %u of %u frames decompressed, %llu of %llu bytes\n",
+                path, codec_name(idx.codec), decoded, idx.nframes,
+                (unsigned long long)comp_read, (unsigned long long)comp_total);
+    }
+    seek_index_free(&idx);
+    close(fd);
+    return rc;
+}
+
+/*******************************************************************************
+ *                     MAIN
+ ******************************************************************************/
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s start] [-e end] [-l INFO,WARN,ERROR,DEBUG,OTHER]"
+            " [-D zstd_dict] [-H] [-v] <archive>...\n", prog);
+    return EXIT_FAILURE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    query_t q = { .start = INT64_MIN, .end = INT64_MAX, .levels = QUERY_LEVELS_ALL };
+    void *dict = NULL;
+    size_t dict_len = 0;
+    bool verbose = false;
+    int opt, rc = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "s:e:l:D:Hv")) != -1) {
+        switch (opt) {
+        case 's':
+            if (parse_time_arg(optarg, false, &q.start) < 0) return EXIT_FAILURE;
+            q.filtered = true;
+            break;
+        case 'e':
+            if (parse_time_arg(optarg, true, &q.end) < 0) return EXIT_FAILURE;
+            q.filtered = true;
+            break;
+        case 'l':
+            if (parse_levels_arg(optarg, &q.levels) < 0) return EXIT_FAILURE;
+            q.filtered = true;
+            break;
+        case 'D':
+            free(dict);
+            dict = load_file(optarg, &dict_len);
+            if (!dict) return EXIT_FAILURE;
+            break;
+        case 'H':
+            q.show_name = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            free(dict);
+            return usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        free(dict);
+        return usage(argv[0]);
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (query_archive(&q, argv[i], dict, dict_len, verbose) < 0) rc = EXIT_FAILURE;
+    }
+    if (fflush(stdout) != 0) {
+        perror("stdout");
+        rc = EXIT_FAILURE;
+    }
+    free(dict);
+    return rc;
+}
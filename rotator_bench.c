@@ -0,0 +1,1337 @@
+/*******************************************************************************
+ * File: rotator_bench.c
+ *
+ * Description:
+ *   Reproducible benchmark of ipmgr_log_rotator under a logger.c style
+ *   load: writer threads append fixed size lines to their log type's file
+ *   and rename it to "<type>.<n>.bak" once it passes the rotation size,
+ *   as logger.c does, while the rotator runs in this process (the default)
+ *   or as a separate ipmgr_log_rotator.exe (-x).
+ *
+ *   Reported, on stderr for people and as one JSON object on stdout:
+ *     - lines and bytes written, .bak files created and rotated per second
+ *       over the write phase, and the .bak backlog left at its end
+ *     - .bak to rotated latency, p50 / p99 / p999 / max: from the rename
+ *       creating the .bak to the rotator renaming or removing it, seen by
+ *       an inotify watch of the bench's own (IN_MOVED_FROM, IN_DELETE)
+ *     - busy % of every core over the write phase (/proc/stat) and the CPU
+ *       time of the rotator over the whole run
+ *     - data loss: once the rotator has settled, every archive, rotated
+ *       log and leftover file of the run is read back and the sequence
+ *       number each line carries is checked off; missing, duplicate and
+ *       corrupt (torn, truncated) lines are counted
+ *     - the rotator's own counters (ipmgr_metrics.h), when its page is up
+ *
+ *   Lines: "[YYYY-MM-DD HH:MM:SS] [LEVEL] bench <thread> <seq> xxx...\n",
+ *   padded to the line size; contents depend on the options only.
+ *
+ *   The run uses <dir> with log types bench000, bench001, ...; leftover
+ *   bench* files there are removed first, and again at the end unless -k.
+ *   A config file for the rotator is written as <dir>rotator_bench.conf
+ *   (-c adds global keys to it: codec, archive_format, max_files ...).
+ *
+ *   Exit status: 0 when the rotator settled and no line was lost,
+ *   duplicated or corrupted, 1 otherwise.
+ *
+ * Usage:
+ *   rotator_bench.exe [-t threads] [-n types] [-r lines/s] [-l line size]
+ *                     [-s rotation size] [-d secs] [-D dir] [-c config]
+ *                     [-x rotator exe] [-S secs] [-p] [-k] [-v]
+ *     -t  writer threads (default 4), thread i writes type i % types
+ *     -n  log types (default 4)
+ *     -r  lines per second per thread, 0 = as fast as possible (1000)
+ *     -l  bytes per line, newline included (100)
+ *     -s  bytes written to a file before it is renamed to .bak (10240)
+ *     -d  seconds of writing (10)
+ *     -D  directory of the run (bench_logs/)
+ *     -c  file of global config keys added to the rotator's config
+ *     -x  run this rotator executable instead of the in-process rotator
+ *     -S  seconds the rotator gets to settle after the writers stop (30)
+ *     -p  pin writer i to core i, as logger.c does
+ *     -k  keep the files of the run
+ *     -v  rotator diagnostics to stderr (out-of-process rotator)
+ *
+ * Build:
+ *   gcc -O2 -DIPMGR_LOG_ROTATOR_NO_MAIN -o rotator_bench.exe rotator_bench.c ipmgr_log_rotator.c ipmgr_archive.c ipmgr_log_config.c ipmgr_uring.c ipmgr_codec.c ipmgr_seekable.c ipmgr_metrics.c ipmgr_diag.c ipmgr_retention.c -pthread -lz
+ *   (add -lrt for shm_open() on glibc older than 2.34)
+ *   zstd and lz4 codecs: add -DIPMGR_WITH_ZSTD=1 -lzstd -DIPMGR_WITH_LZ4=1 -llz4
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <inttypes.h>
+
+/* System Headers */
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+
+/* Threading Headers */
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Local Headers */
+#include "ipmgr_log_rotator.h"
+#include "ipmgr_codec.h"
+#include "ipmgr_metrics.h"
+
+/*******************************************************************************
+ *  CONFIGURATION DEFINES BEGIN
+ ******************************************************************************/
+
+#define BENCH_DEFAULT_THREADS   4
+#define BENCH_DEFAULT_TYPES     4
+#define BENCH_DEFAULT_RATE      1000            /* logger.c: ~1000 lines/s per thread */
+#define BENCH_DEFAULT_LINE_LEN  100
+#define BENCH_DEFAULT_ROTATE    10240           /* logger.c MAX_LOG_SIZE */
+#define BENCH_DEFAULT_SECONDS   10
+#define BENCH_DEFAULT_DIR       "bench_logs/"
+
+#define BENCH_MAX_THREADS       1024
+#define BENCH_MAX_TYPES         1000            /* bench000 .. bench999 */
+#define BENCH_LINE_MIN          64              /* Longest line header fits */
+#define BENCH_LINE_MAX          4096
+#define BENCH_BATCH_LEN         (64 * 1024)     /* Bytes per write(), at most */
+#define BENCH_BAK_RING          65536           /* .bak creation times kept per type */
+
+#define BENCH_SETTLE_SECS       30      /* Default -S: wait for the rotator this long */
+#define BENCH_QUIET_MS          1000    /* Directory unchanged this long: settled */
+#define BENCH_START_SECS        10      /* Out-of-process rotator start up */
+#define BENCH_READ_LEN          (1024 * 1024)
+#define BENCH_MAX_DICTS         64      /* zstd dictionaries tried per archive */
+
+#define BENCH_CONF_NAME         "rotator_bench.conf"
+
+/*******************************************************************************
+ *  CONFIGURATION DEFINES END
+ ******************************************************************************/
+
+/* .bak creation, looked up by the latency watcher */
+typedef struct bak_stamp_ {
+    _Atomic uint64_t seq_plus1;     /* 0: free */
+    _Atomic uint64_t created_ns;
+} bak_stamp_t;
+
+/* One log type, shared by the writers i with i % types == its index */
+typedef struct bench_type_ {
+    char name[16];                  /* bench000 */
+    char path[PATH_MAX];            /* <dir>bench000.log */
+    pthread_mutex_t lock;
+    int fd;
+    uint64_t bytes;                 /* Written to the current file */
+    uint64_t next_bak;              /* <n> of the next .bak */
+    bak_stamp_t *stamps;            /* BENCH_BAK_RING entries */
+} bench_type_t;
+
+typedef struct bench_writer_ {
+    pthread_t thread;
+    unsigned id;
+    bench_type_t *type;
+    uint64_t lines;                 /* Lines written, sequence numbers 0 .. lines-1 */
+    uint64_t cpu_ns;
+    char *buf;
+} bench_writer_t;
+
+/* Busy and total jiffies of one core */
+typedef struct cpu_times_ {
+    uint64_t busy;
+    uint64_t total;
+} cpu_times_t;
+
+/* Lines of one file, checked off once the whole file was read */
+typedef struct line_reader_ {
+    char carry[BENCH_LINE_MAX];     /* Line split across reads */
+    size_t carry_len;
+    bool carry_long;                /* Carry overflowed: a corrupt line */
+    uint64_t *found;                /* writer << 44 | seq */
+    size_t nfound, cap;
+    uint64_t corrupt;
+} line_reader_t;
+
+/* Tar stream parser in front of a line_reader_t */
+typedef struct tar_reader_ {
+    line_reader_t *lines;
+    unsigned char hdr[512];
+    size_t hdr_len;
+    uint64_t data_left;             /* Of the current member */
+    uint64_t pad_left;              /* To the next 512 byte block */
+    bool data_lines;                /* Member is a regular file */
+} tar_reader_t;
+
+/* Options */
+static unsigned opt_threads = BENCH_DEFAULT_THREADS;
+static unsigned opt_types = BENCH_DEFAULT_TYPES;
+static unsigned opt_rate = BENCH_DEFAULT_RATE;
+static size_t opt_line_len = BENCH_DEFAULT_LINE_LEN;
+static uint64_t opt_rotate = BENCH_DEFAULT_ROTATE;
+static unsigned opt_seconds = BENCH_DEFAULT_SECONDS;
+static unsigned opt_settle = BENCH_SETTLE_SECS;
+static const char *opt_extra_config;
+static const char *opt_rotator_exe;
+static bool opt_pin, opt_keep, opt_verbose;
+static char bench_dir[PATH_MAX] = BENCH_DEFAULT_DIR;
+
+static bench_type_t *types;
+static bench_writer_t *writers;
+static atomic_bool writers_stop;
+static uint64_t write_start_ns;
+
+/* Latency watcher */
+static pthread_t watcher_thread;
+static atomic_bool watcher_stop;
+static int watcher_fd = -1;
+static metrics_hist_t bak_latency;          /* Written by the watcher only */
+static _Atomic uint64_t baks_rotated;
+static _Atomic uint64_t baks_unmatched;     /* Out of the stamp ring */
+static _Atomic uint64_t watcher_overflows;
+static uint64_t watcher_cpu_ns;
+
+/* Verification */
+static uint64_t *seen_bits;                 /* Per writer, a bit per line */
+static size_t bits_words;                   /* Words per writer */
+static uint64_t lines_found, lines_duplicate, lines_corrupt;
+static unsigned files_read, files_unreadable;
+
+static pid_t rotator_pid;
+static metrics_slot_t rotator_metrics;
+static bool rotator_metrics_valid;
+
+static const char *const log_levels[] = { "INFO", "WARN", "ERROR", "DEBUG" };
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sleep_ns(uint64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+static bool
+has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+
+    return n >= m && memcmp(s + n - m, suffix, m) == 0;
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Single writer record into a local histogram of the ipmgr_metrics.h layout */
+static void
+latency_record(uint64_t v)
+{
+    metrics_hist_t *h = &bak_latency;
+
+    atomic_fetch_add_explicit(&h->buckets[metrics_hist_bucket(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    if (v > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max, v, memory_order_relaxed);
+    }
+}
+
+/**
+ * cpu_sample()
+ *
+ * Purpose:
+ *   Reads the busy and total jiffies of every core from /proc/stat.
+ *
+ * @return Cores read, 0 if /proc/stat is not there
+ */
+static int
+cpu_sample(cpu_times_t *cpus, int max)
+{
+    char line[512];
+    int n = 0;
+    FILE *fp = fopen("/proc/stat", "r");
+
+    if (!fp) return 0;
+    while (n < max && fgets(line, sizeof(line), fp)) {
+        unsigned long long v[8] = { 0 };
+        unsigned cpu;
+
+        if (strncmp(line, "cpu", 3) != 0 || line[3] < '0' || line[3] > '9') continue;
+        if (sscanf(line + 3, "%u %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5) {
+            continue;
+        }
+        /* user nice system idle iowait irq softirq steal */
+        cpus[n].total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+        cpus[n].busy = cpus[n].total - v[3] - v[4];
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/* utime + stime of a process, in seconds; -1 if unknown */
+static double
+process_cpu_seconds(pid_t pid)
+{
+    char path[64], buf[1024], *p;
+    unsigned long long utime, stime;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    /* Fields 14 and 15, counted after the parenthesized command name */
+    p = strrchr(buf, ')');
+    if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                     &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static double
+self_cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+           (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/*******************************************************************************
+ *                     WRITERS
+ ******************************************************************************/
+
+/* Renames the type's file to the next .bak; type lock held */
+static void
+type_rotate(bench_type_t *t)
+{
+    char bak[PATH_MAX + 32];
+    uint64_t seq = t->next_bak++;
+    bak_stamp_t *st = &t->stamps[seq % BENCH_BAK_RING];
+
+    close(t->fd);
+    t->fd = -1;
+    t->bytes = 0;
+
+    snprintf(bak, sizeof(bak), "%s%s.%" PRIu64 ".bak", bench_dir, t->name, seq);
+
+    /* Stamped before the rename, the rotator may take the .bak right away */
+    atomic_store_explicit(&st->seq_plus1, 0, memory_order_relaxed);
+    atomic_store_explicit(&st->created_ns, now_ns(), memory_order_relaxed);
+    atomic_store_explicit(&st->seq_plus1, seq + 1, memory_order_release);
+
+    if (rename(t->path, bak) < 0) {
+        fprintf(stderr, "rename %s: %s\n", t->path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Appends whole lines to the type's file, rotating it past the size */
+static void
+type_write(bench_type_t *t, const char *buf, size_t len)
+{
+    pthread_mutex_lock(&t->lock);
+    if (t->fd < 0) {
+        t->fd = open(t->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (t->fd < 0) {
+            fprintf(stderr, "open %s: %s\n", t->path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (write_full(t->fd, buf, len) < 0) {
+        fprintf(stderr, "write %s: %s\n", t->path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    t->bytes += len;
+    if (t->bytes >= opt_rotate) type_rotate(t);
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* One line of opt_line_len bytes */
+static void
+line_format(char *p, const char *timestamp, unsigned writer, uint64_t seq)
+{
+    int n = snprintf(p, opt_line_len, "[%s] [%s] bench %u %" PRIu64 " ",
+                     timestamp, log_levels[seq % 4], writer, seq);
+
+    memset(p + n, 'x', opt_line_len - (size_t)n - 1);
+    p[opt_line_len - 1] = '\n';
+}
+
+/**
+ * writer_thread_fn()
+ *
+ * Purpose:
+ *   Writes lines to the writer's log type until told to stop. A throttled
+ *   writer keeps to its rate on the clock since the start, writing the
+ *   lines due so far in one write(); an unthrottled one writes full
+ *   batches back to back.
+ */
+static void *
+writer_thread_fn(void *arg)
+{
+    bench_writer_t *w = arg;
+    size_t batch_len = BENCH_BATCH_LEN < opt_rotate ? BENCH_BATCH_LEN : (size_t)opt_rotate;
+    uint64_t batch_lines = batch_len / opt_line_len ? batch_len / opt_line_len : 1;
+    uint64_t seq = 0;
+    time_t ts_sec = 0;
+    char timestamp[32] = "";
+
+    if (opt_pin) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->id % (unsigned)sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    while (!atomic_load_explicit(&writers_stop, memory_order_relaxed)) {
+        uint64_t n = batch_lines;
+        size_t len = 0;
+        time_t now;
+
+        if (opt_rate) {
+            uint64_t elapsed = now_ns() - write_start_ns;
+            uint64_t due = elapsed / 1000 * opt_rate / 1000000;
+
+            if (due <= seq) {
+                uint64_t next = (seq + 1) * 1000000000ULL / opt_rate;
+
+                sleep_ns(next > elapsed ? next - elapsed : 1000);
+                continue;
+            }
+            if (due - seq < n) n = due - seq;
+        }
+
+        now = time(NULL);
+        if (now != ts_sec) {
+            struct tm tm;
+
+            localtime_r(&now, &tm);
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+            ts_sec = now;
+        }
+        for (uint64_t i = 0; i < n; i++) {
+            line_format(w->buf + len, timestamp, w->id, seq++);
+            len += opt_line_len;
+        }
+        type_write(w->type, w->buf, len);
+    }
+
+    w->lines = seq;
+    w->cpu_ns = thread_cpu_ns();
+    return NULL;
+}
+
+/*******************************************************************************
+ *                     LATENCY WATCHER
+ ******************************************************************************/
+
+/* A .bak of the run left the writers' names: rotated */
+static void
+watcher_bak_gone(const char *name, uint64_t at_ns)
+{
+    unsigned type;
+    uint64_t seq;
+    bak_stamp_t *st;
+
+    if (!has_suffix(name, ".bak") || sscanf(name, "bench%3u.%" SCNu64, &type, &seq) != 2 ||
+        type >= opt_types) {
+        return;
+    }
+    atomic_fetch_add(&baks_rotated, 1);
+
+    st = &types[type].stamps[seq % BENCH_BAK_RING];
+    if (atomic_load_explicit(&st->seq_plus1, memory_order_acquire) != seq + 1) {
+        atomic_fetch_add(&baks_unmatched, 1);
+        return;
+    }
+    uint64_t created = atomic_load_explicit(&st->created_ns, memory_order_relaxed);
+    latency_record(at_ns > created ? at_ns - created : 0);
+}
+
+/**
+ * watcher_thread_fn()
+ *
+ * Purpose:
+ *   Sees each .bak go (renamed by the rotator into its chain or a pending
+ *   segment, or appended and removed) and records the time since the
+ *   writer created it. Event times are those of the read() returning them.
+ */
+static void *
+watcher_thread_fn(void *arg)
+{
+    static char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = watcher_fd, .events = POLLIN };
+
+    (void)arg;
+    while (!atomic_load(&watcher_stop)) {
+        ssize_t len;
+        uint64_t at;
+
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        len = read(watcher_fd, buf, sizeof(buf));
+        if (len <= 0) continue;
+        at = now_ns();
+
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                atomic_fetch_add(&watcher_overflows, 1);
+            } else if (ev->len > 0) {
+                watcher_bak_gone(ev->name, at);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    watcher_cpu_ns = thread_cpu_ns();
+    return NULL;
+}
+
+/*******************************************************************************
+ *                     RUN DIRECTORY
+ ******************************************************************************/
+
+/* Files of the run: everything named bench* */
+static bool
+bench_file(const char *name)
+{
+    return strncmp(name, "bench", 5) == 0;
+}
+
+/* Removes the files of a previous run (or of this one) */
+static void
+dir_clean(void)
+{
+    DIR *d = opendir(bench_dir);
+    struct dirent *de;
+    char path[PATH_MAX + 256];
+
+    if (!d) return;
+    while ((de = readdir(d)) != NULL) {
+        if (!bench_file(de->d_name) && strcmp(de->d_name, BENCH_CONF_NAME) != 0) continue;
+        snprintf(path, sizeof(path), "%s%s", bench_dir, de->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+/**
+ * dir_state()
+ *
+ * Purpose:
+ *   Summary of the run's files: how many .bak and .part (archive being
+ *   written) files there are, and a hash of names, sizes and times that
+ *   changes whenever the rotator does anything.
+ */
+static uint64_t
+dir_state(unsigned *baks, unsigned *parts)
+{
+    DIR *d = opendir(bench_dir);
+    struct dirent *de;
+    char path[PATH_MAX + 256];
+    uint64_t hash = 1469598103934665603ULL;
+
+    *baks = *parts = 0;
+    if (!d) return 0;
+    while ((de = readdir(d)) != NULL) {
+        struct stat st;
+        uint64_t h = 1469598103934665603ULL;
+
+        if (!bench_file(de->d_name)) continue;
+        if (has_suffix(de->d_name, ".bak")) (*baks)++;
+        if (has_suffix(de->d_name, ".part")) (*parts)++;
+
+        snprintf(path, sizeof(path), "%s%s", bench_dir, de->d_name);
+        if (lstat(path, &st) < 0) continue;
+        for (const char *c = de->d_name; *c; c++) h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+        h ^= (uint64_t)st.st_size * 31 + (uint64_t)st.st_mtim.tv_nsec;
+        hash += h;      /* Order independent */
+    }
+    closedir(d);
+    return hash;
+}
+
+/**
+ * wait_settled()
+ *
+ * Purpose:
+ *   Waits until the rotator took every .bak and finished every archive,
+ *   and then left the directory alone for BENCH_QUIET_MS.
+ *
+ * @return true when settled, false after opt_settle seconds
+ */
+static bool
+wait_settled(void)
+{
+    uint64_t deadline = now_ns() + (uint64_t)opt_settle * 1000000000ULL;
+    uint64_t last = 0, quiet_since = 0;
+
+    while (now_ns() < deadline) {
+        unsigned baks, parts;
+        uint64_t state = dir_state(&baks, &parts);
+
+        if (baks || parts || state != last) {
+            last = state;
+            quiet_since = now_ns();
+        } else if (now_ns() - quiet_since >= BENCH_QUIET_MS * 1000000ULL) {
+            return true;
+        }
+        sleep_ns(50 * 1000000ULL);
+    }
+    return false;
+}
+
+/* Writes the rotator's configuration for the run */
+static int
+write_config(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) return -1;
+    fprintf(fp, "# rotator_bench.c run configuration\n");
+    fprintf(fp, "watch_dir = %s\n", bench_dir);
+    fprintf(fp, "delete_obsolete_archives = no\n");
+    fprintf(fp, "delete_obsolete_logs = yes\n");
+
+    if (opt_extra_config) {
+        char line[1024];
+        FILE *extra = fopen(opt_extra_config, "r");
+
+        if (!extra) {
+            fclose(fp);
+            return -1;
+        }
+        fprintf(fp, "\n# %s\n", opt_extra_config);
+        while (fgets(line, sizeof(line), extra)) fputs(line, fp);
+        fclose(extra);
+    }
+
+    fprintf(fp, "\n");
+    for (unsigned i = 0; i < opt_types; i++) fprintf(fp, "[%s]\n", types[i].name);
+    return fclose(fp);
+}
+
+/*******************************************************************************
+ *                     VERIFICATION
+ ******************************************************************************/
+
+static void
+line_reader_reset(line_reader_t *lr)
+{
+    lr->carry_len = 0;
+    lr->carry_long = false;
+    lr->nfound = 0;
+    lr->corrupt = 0;
+}
+
+/* Parses a decimal number ending in a space */
+static bool
+parse_number(const char **p, const char *end, uint64_t *v)
+{
+    const char *s = *p;
+
+    *v = 0;
+    while (s < end && *s >= '0' && *s <= '9') *v = *v * 10 + (uint64_t)(*s++ - '0');
+    if (s == *p || s >= end || *s != ' ') return false;
+    *p = s + 1;
+    return true;
+}
+
+/* One complete line, newline included */
+static void
+line_check(line_reader_t *lr, const char *line, size_t len)
+{
+    const char *end = line + len;
+    const char *p = memmem(line, len, "] bench ", 8);
+    uint64_t writer, seq;
+
+    if (!p || len != opt_line_len) {
+        lr->corrupt++;
+        return;
+    }
+    p += 8;
+    if (!parse_number(&p, end, &writer) || !parse_number(&p, end, &seq) ||
+        writer >= opt_threads || seq >= (1ULL << 44)) {
+        lr->corrupt++;
+        return;
+    }
+    if (lr->nfound == lr->cap) {
+        size_t cap = lr->cap ? lr->cap * 2 : 65536;
+        uint64_t *f = realloc(lr->found, cap * sizeof(*f));
+
+        if (!f) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        lr->found = f;
+        lr->cap = cap;
+    }
+    lr->found[lr->nfound++] = writer << 44 | seq;
+}
+
+/* Feeds file data; lines may be split anywhere */
+static void
+line_feed(line_reader_t *lr, const char *buf, size_t len)
+{
+    while (len > 0) {
+        const char *nl = memchr(buf, '\n', len);
+        size_t take = nl ? (size_t)(nl - buf) + 1 : len;
+
+        if (lr->carry_len == 0 && nl) {
+            line_check(lr, buf, take);
+        } else {
+            if (lr->carry_len + take > sizeof(lr->carry)) {
+                lr->carry_long = true;
+                lr->carry_len = 0;
+            }
+            if (!lr->carry_long) {
+                memcpy(lr->carry + lr->carry_len, buf, take);
+                lr->carry_len += take;
+            }
+            if (nl) {
+                if (lr->carry_long) lr->corrupt++;
+                else line_check(lr, lr->carry, lr->carry_len);
+                lr->carry_len = 0;
+                lr->carry_long = false;
+            }
+        }
+        buf += take;
+        len -= take;
+    }
+}
+
+/* End of a file: an unterminated last line is corrupt */
+static void
+line_end(line_reader_t *lr)
+{
+    if (lr->carry_len || lr->carry_long) lr->corrupt++;
+    lr->carry_len = 0;
+    lr->carry_long = false;
+}
+
+/* Checks the lines of a fully read file off */
+static void
+line_commit(line_reader_t *lr)
+{
+    for (size_t i = 0; i < lr->nfound; i++) {
+        uint64_t writer = lr->found[i] >> 44, seq = lr->found[i] & ((1ULL << 44) - 1);
+        size_t word = writer * bits_words + seq / 64;
+        uint64_t bit = 1ULL << (seq % 64);
+
+        if (seq >= writers[writer].lines) {
+            lines_corrupt++;
+        } else if (seen_bits[word] & bit) {
+            lines_duplicate++;
+        } else {
+            seen_bits[word] |= bit;
+            lines_found++;
+        }
+    }
+    lines_corrupt += lr->corrupt;
+}
+
+static int
+plain_sink(void *ctx, const void *buf, size_t len)
+{
+    line_feed(ctx, buf, len);
+    return 0;
+}
+
+/* Tar stream: lines of the regular file members, headers and padding skipped */
+static int
+tar_sink(void *ctx, const void *data, size_t len)
+{
+    tar_reader_t *tr = ctx;
+    const unsigned char *buf = data;
+
+    while (len > 0) {
+        size_t take;
+
+        if (tr->data_left > 0) {
+            take = len < tr->data_left ? len : (size_t)tr->data_left;
+            if (tr->data_lines) line_feed(tr->lines, (const char *)buf, take);
+            tr->data_left -= take;
+            if (tr->data_left == 0 && tr->data_lines) line_end(tr->lines);
+        } else if (tr->pad_left > 0) {
+            take = len < tr->pad_left ? len : (size_t)tr->pad_left;
+            tr->pad_left -= take;
+        } else {
+            uint64_t size = 0;
+            bool zero = true;
+
+            take = sizeof(tr->hdr) - tr->hdr_len;
+            if (take > len) take = len;
+            memcpy(tr->hdr + tr->hdr_len, buf, take);
+            tr->hdr_len += take;
+            if (tr->hdr_len == sizeof(tr->hdr)) {
+                tr->hdr_len = 0;
+                for (size_t i = 0; i < sizeof(tr->hdr) && zero; i++) zero = tr->hdr[i] == 0;
+
+                /* End of archive blocks: incremental archives hold several */
+                if (!zero) {
+                    for (int i = 124; i < 136 && tr->hdr[i] >= '0' && tr->hdr[i] <= '7'; i++) {
+                        size = size * 8 + (uint64_t)(tr->hdr[i] - '0');
+                    }
+                    tr->data_left = size;
+                    tr->pad_left = (512 - size % 512) % 512;
+                    tr->data_lines = tr->hdr[156] == '0' || tr->hdr[156] == '\0' ||
+                                     tr->hdr[156] == '7';
+                }
+            }
+        }
+        buf += take;
+        len -= take;
+    }
+    return 0;
+}
+
+/* Reads a rotated log, pending segment or leftover file */
+static int
+read_plain(const char *path, line_reader_t *lr)
+{
+    static char buf[BENCH_READ_LEN];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    ssize_t n;
+
+    if (fd < 0) return -1;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) line_feed(lr, buf, (size_t)n);
+    close(fd);
+    if (n < 0) return -1;
+    line_end(lr);
+    return 0;
+}
+
+/* Reads an archive through the codec layer, with a zstd dictionary or not */
+static int
+read_archive(const char *path, int codec, bool tar, const void *dict, size_t dict_len,
+             line_reader_t *lr)
+{
+    tar_reader_t tr = { .lines = lr };
+    int fd = open(path, O_RDONLY | O_CLOEXEC), rc;
+
+    if (fd < 0) return -1;
+    rc = tar ? codec_decode_file(codec, fd, CODEC_DECODE_TO_EOF, dict, dict_len, tar_sink, &tr)
+             : codec_decode_file(codec, fd, CODEC_DECODE_TO_EOF, dict, dict_len, plain_sink, lr);
+    close(fd);
+    if (rc == 0 && !tar) line_end(lr);
+    return rc;
+}
+
+/* zstd dictionaries of the run, <type>.zdict.<id> */
+typedef struct bench_dict_ {
+    void *buf;
+    size_t len;
+} bench_dict_t;
+
+static int
+load_dicts(bench_dict_t *dicts, int max)
+{
+    DIR *d = opendir(bench_dir);
+    struct dirent *de;
+    int n = 0;
+
+    if (!d) return 0;
+    while (n < max && (de = readdir(d)) != NULL) {
+        char path[PATH_MAX + 256];
+        struct stat st;
+        int fd;
+
+        if (!bench_file(de->d_name) || !strstr(de->d_name, ".zdict.") ||
+            has_suffix(de->d_name, ".part")) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s%s", bench_dir, de->d_name);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        if (fstat(fd, &st) == 0 && st.st_size > 0 && (dicts[n].buf = malloc((size_t)st.st_size))) {
+            if (read(fd, dicts[n].buf, (size_t)st.st_size) == st.st_size) {
+                dicts[n++].len = (size_t)st.st_size;
+            } else {
+                free(dicts[n].buf);
+            }
+        }
+        close(fd);
+    }
+    closedir(d);
+    return n;
+}
+
+/**
+ * verify_run()
+ *
+ * Purpose:
+ *   Reads back every file of the run and checks off the lines found:
+ *   archives (<type>.log_<time>...) through the codec layer, a tar
+ *   archive member by member; rotated logs, generations, pending segments
+ *   and leftover .bak or live files as they are. A file is counted only
+ *   once read in full; an archive that does not decode is unreadable, and
+ *   its lines missing.
+ */
+static void
+verify_run(void)
+{
+    static line_reader_t lr;
+    bench_dict_t dicts[BENCH_MAX_DICTS];
+    int ndicts = load_dicts(dicts, BENCH_MAX_DICTS);
+    DIR *d = opendir(bench_dir);
+    struct dirent *de;
+
+    if (!d) {
+        perror(bench_dir);
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        char path[PATH_MAX + 256];
+        const char *name = de->d_name;
+        struct stat st;
+        int rc = -1;
+
+        if (!bench_file(name) || strstr(name, ".zdict.") || has_suffix(name, ".part")) continue;
+        snprintf(path, sizeof(path), "%s%s", bench_dir, name);
+        if (lstat(path, &st) < 0 || !S_ISREG(st.st_mode)) continue;   /* .latest link */
+
+        line_reader_reset(&lr);
+        if (strstr(name, ".log_")) {
+            static const struct { const char *ext; int codec; } exts[] = {
+                { ".gz", CODEC_GZIP }, { ".zst", CODEC_ZSTD }, { ".lz4", CODEC_LZ4 },
+            };
+            int codec = -1;
+            bool tar = strstr(name, ".tar.") != NULL;
+
+            for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+                if (has_suffix(name, exts[i].ext)) codec = exts[i].codec;
+            }
+            if (codec < 0) continue;
+
+            rc = read_archive(path, codec, tar, NULL, 0, &lr);
+            for (int i = 0; rc < 0 && codec == CODEC_ZSTD && i < ndicts; i++) {
+                line_reader_reset(&lr);
+                rc = read_archive(path, codec, tar, dicts[i].buf, dicts[i].len, &lr);
+            }
+        } else {
+            rc = read_plain(path, &lr);
+        }
+
+        if (rc < 0) {
+            fprintf(stderr, "%s: unreadable (%s)\n", path, strerror(errno));
+            files_unreadable++;
+            continue;
+        }
+        line_commit(&lr);
+        files_read++;
+    }
+    closedir(d);
+    for (int i = 0; i < ndicts; i++) free(dicts[i].buf);
+    free(lr.found);
+}
+
+/*******************************************************************************
+ *                     ROTATOR
+ ******************************************************************************/
+
+/**
+ * rotator_spawn()
+ *
+ * Purpose:
+ *   Starts the rotator executable on the run's config and waits until its
+ *   metrics page shows a rotator thread up (its watch is in place by
+ *   then).
+ *
+ * @return 0 on success, -1 if it did not come up
+ */
+static int
+rotator_spawn(const char *conf)
+{
+    uint64_t deadline = now_ns() + BENCH_START_SECS * 1000000000ULL;
+
+    rotator_pid = fork();
+    if (rotator_pid < 0) return -1;
+    if (rotator_pid == 0) {
+        if (!opt_verbose) {
+            int null = open("/dev/null", O_WRONLY);
+
+            if (null >= 0) {
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+            }
+        }
+        execl(opt_rotator_exe, opt_rotator_exe, conf, (char *)NULL);
+        _exit(127);
+    }
+
+    while (now_ns() < deadline) {
+        const metrics_page_t *page;
+        bool ready = false;
+        int status;
+
+        if (waitpid(rotator_pid, &status, WNOHANG) == rotator_pid) {
+            fprintf(stderr, "%s exited at start up\n", opt_rotator_exe);
+            rotator_pid = 0;
+            return -1;
+        }
+        page = metrics_map(NULL);
+        if (page) {
+            if (page->pid == rotator_pid) {
+                for (uint32_t i = 1; i < page->nslots && !ready; i++) {
+                    ready = atomic_load(&page->slots[i].in_use) &&
+                            strncmp(page->slots[i].name, "rotator", 7) == 0;
+                }
+            }
+            metrics_unmap(page);
+        }
+        if (ready) return 0;
+        sleep_ns(20 * 1000000ULL);
+    }
+    fprintf(stderr, "%s did not start within %ds\n", opt_rotator_exe, BENCH_START_SECS);
+    kill(rotator_pid, SIGKILL);
+    waitpid(rotator_pid, NULL, 0);
+    rotator_pid = 0;
+    return -1;
+}
+
+/* Snapshot of the rotator's own counters, if its page is the one up */
+static void
+rotator_metrics_read(void)
+{
+    const metrics_page_t *page = metrics_map(NULL);
+
+    if (!page) return;
+    if (page->pid == rotator_pid) {
+        metrics_sum(page, -1, &rotator_metrics);
+        rotator_metrics_valid = true;
+    }
+    metrics_unmap(page);
+}
+
+/*******************************************************************************
+ *                     REPORT
+ ******************************************************************************/
+
+static void
+print_json(double write_secs, double settle_secs, bool settled, uint64_t lines,
+           uint64_t baks, uint64_t rotated_in_window, double rotator_cpu,
+           double run_secs, const cpu_times_t *c0, const cpu_times_t *c1, int ncpus)
+{
+    const metrics_hist_t *h = &bak_latency;
+    uint64_t count = atomic_load(&h->count);
+    uint64_t missing = lines - lines_found;
+
+    printf("{\"rotator\":\"%s\",\"threads\":%u,\"types\":%u,\"rate\":%u,"
+           "\"line_len\":%zu,\"rotate_size\":%" PRIu64 ",\"write_s\":%.3f,",
+           opt_rotator_exe ? "process" : "in-process", opt_threads, opt_types, opt_rate,
+           opt_line_len, opt_rotate, write_secs);
+    printf("\"lines_written\":%" PRIu64 ",\"bytes_written\":%" PRIu64 ","
+           "\"lines_per_s\":%.1f,\"mb_per_s\":%.3f,",
+           lines, lines * opt_line_len, (double)lines / write_secs,
+           (double)(lines * opt_line_len) / write_secs / (1024.0 * 1024.0));
+    printf("\"bak_created\":%" PRIu64 ",\"bak_rotated\":%" PRIu64 ","
+           "\"bak_created_per_s\":%.1f,\"bak_rotated_per_s\":%.1f,\"bak_backlog_at_end\":%" PRId64 ",",
+           baks, atomic_load(&baks_rotated), (double)baks / write_secs,
+           (double)rotated_in_window / write_secs,
+           (int64_t)baks - (int64_t)rotated_in_window);
+    printf("\"latency_ns\":{\"samples\":%" PRIu64 ",\"unmatched\":%" PRIu64 ","
+           "\"overflows\":%" PRIu64 ",\"mean\":%" PRIu64 ",\"p50\":%" PRIu64 ","
+           "\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "},",
+           count, atomic_load(&baks_unmatched), atomic_load(&watcher_overflows),
+           count ? atomic_load(&h->sum) / count : 0, metrics_hist_percentile(h, 50.0),
+           metrics_hist_percentile(h, 99.0), metrics_hist_percentile(h, 99.9),
+           atomic_load(&h->max));
+    printf("\"settled\":%s,\"settle_s\":%.3f,\"files_read\":%u,\"files_unreadable\":%u,"
+           "\"lines_found\":%" PRIu64 ",\"lines_missing\":%" PRIu64 ","
+           "\"lines_duplicate\":%" PRIu64 ",\"lines_corrupt\":%" PRIu64 ",",
+           settled ? "true" : "false", settle_secs, files_read, files_unreadable,
+           lines_found, missing, lines_duplicate, lines_corrupt);
+    printf("\"rotator_cpu_s\":%.3f,\"rotator_cpu_pct\":%.1f,\"cpu_busy_pct\":[",
+           rotator_cpu, rotator_cpu >= 0 ? 100.0 * rotator_cpu / run_secs : -1.0);
+    for (int i = 0; i < ncpus; i++) {
+        uint64_t total = c1[i].total - c0[i].total;
+
+        printf("%s%.1f", i ? "," : "",
+               total ? 100.0 * (double)(c1[i].busy - c0[i].busy) / (double)total : 0.0);
+    }
+    printf("],\"rotator_metrics\":");
+    if (rotator_metrics_valid) {
+        const metrics_hist_t *r = &rotator_metrics.hists[MH_BAK_TO_ROTATED];
+
+        printf("{");
+        for (int c = 0; c < MC_COUNT; c++) {
+            printf("\"%s\":%" PRIu64 ",", metrics_counter_name(c), rotator_metrics.counters[c]);
+        }
+        printf("\"bak_to_rotated_p50_ns\":%" PRIu64 ",\"bak_to_rotated_p99_ns\":%" PRIu64 ","
+               "\"bak_to_rotated_p999_ns\":%" PRIu64 "}",
+               metrics_hist_percentile(r, 50.0), metrics_hist_percentile(r, 99.0),
+               metrics_hist_percentile(r, 99.9));
+    } else {
+        printf("null");
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void
+print_summary(double write_secs, bool settled, uint64_t lines, uint64_t baks,
+              uint64_t rotated_in_window, double rotator_cpu)
+{
+    const metrics_hist_t *h = &bak_latency;
+
+    fprintf(stderr, "%" PRIu64 " lines in %.2fs (%.0f lines/s), %" PRIu64 " .bak files "
+            "(%.1f/s created, %.1f/s rotated)\n", lines, write_secs, (double)lines / write_secs,
+            baks, (double)baks / write_secs, (double)rotated_in_window / write_secs);
+    fprintf(stderr, ".bak to rotated: p50 %.3fms p99 %.3fms p999 %.3fms max %.3fms "
+            "(%" PRIu64 " samples)\n",
+            metrics_hist_percentile(h, 50.0) / 1e6, metrics_hist_percentile(h, 99.0) / 1e6,
+            metrics_hist_percentile(h, 99.9) / 1e6, atomic_load(&h->max) / 1e6,
+            atomic_load(&h->count));
+    fprintf(stderr, "rotator cpu %.2fs, %s; %u files read, %u unreadable\n", rotator_cpu,
+            settled ? "settled" : "NOT settled", files_read, files_unreadable);
+    fprintf(stderr, "lines: %" PRIu64 " found, %" PRIu64 " missing, %" PRIu64 " duplicate, "
+            "%" PRIu64 " corrupt\n", lines_found, lines - lines_found, lines_duplicate,
+            lines_corrupt);
+}
+
+/*******************************************************************************
+ *                     MAIN
+ ******************************************************************************/
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-n types] [-r lines/s] [-l line size]\n"
+            "       [-s rotation size] [-d secs] [-D dir] [-c config] [-x rotator exe]\n"
+            "       [-S secs] [-p] [-k] [-v]\n", prog);
+    return EXIT_FAILURE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static cpu_times_t cpu0[1024], cpu1[1024];
+    char conf[PATH_MAX + 32];
+    uint64_t lines = 0, baks = 0, rotated_in_window, t_end, t_run0;
+    double write_secs, settle_secs, rotator_cpu, cpu_start = 0, run_secs;
+    size_t dir_len;
+    bool settled, ok;
+    int opt, ncpus;
+
+    while ((opt = getopt(argc, argv, "t:n:r:l:s:d:D:c:x:S:pkv")) != -1) {
+        switch (opt) {
+        case 't': opt_threads = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'n': opt_types = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'r': opt_rate = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'l': opt_line_len = strtoul(optarg, NULL, 10); break;
+        case 's': opt_rotate = strtoull(optarg, NULL, 10); break;
+        case 'd': opt_seconds = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'D': snprintf(bench_dir, sizeof(bench_dir) - 1, "%s", optarg); break;
+        case 'c': opt_extra_config = optarg; break;
+        case 'x': opt_rotator_exe = optarg; break;
+        case 'S': opt_settle = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'p': opt_pin = true; break;
+        case 'k': opt_keep = true; break;
+        case 'v': opt_verbose = true; break;
+        default: return usage(argv[0]);
+        }
+    }
+    if (opt_threads < 1 || opt_threads > BENCH_MAX_THREADS || opt_types < 1 ||
+        opt_types > BENCH_MAX_TYPES || opt_types > opt_threads ||
+        opt_line_len < BENCH_LINE_MIN || opt_line_len > BENCH_LINE_MAX ||
+        opt_rotate < opt_line_len || opt_seconds < 1) {
+        return usage(argv[0]);
+    }
+
+    dir_len = strlen(bench_dir);
+    if (bench_dir[dir_len - 1] != '/') strcat(bench_dir, "/");
+    if (mkdir(bench_dir, 0755) < 0 && errno != EEXIST) {
+        perror(bench_dir);
+        return EXIT_FAILURE;
+    }
+    dir_clean();
+
+    types = calloc(opt_types, sizeof(*types));
+    writers = calloc(opt_threads, sizeof(*writers));
+    if (!types || !writers) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < opt_types; i++) {
+        bench_type_t *t = &types[i];
+
+        snprintf(t->name, sizeof(t->name), "bench%03u", i);
+        snprintf(t->path, sizeof(t->path), "%s%s.log", bench_dir, t->name);
+        pthread_mutex_init(&t->lock, NULL);
+        t->fd = -1;
+        t->stamps = calloc(BENCH_BAK_RING, sizeof(*t->stamps));
+        if (!t->stamps) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+    }
+
+    snprintf(conf, sizeof(conf), "%s%s", bench_dir, BENCH_CONF_NAME);
+    if (write_config(conf) != 0) {
+        fprintf(stderr, "%s: %s\n", opt_extra_config ? opt_extra_config : conf, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* Latency watch first: it must not miss the rotator taking a .bak */
+    watcher_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher_fd < 0 || inotify_add_watch(watcher_fd, bench_dir, IN_MOVED_FROM | IN_DELETE) < 0) {
+        perror("inotify");
+        return EXIT_FAILURE;
+    }
+    if (pthread_create(&watcher_thread, NULL, watcher_thread_fn, NULL) != 0) {
+        fprintf(stderr, "Failed to create the watcher thread\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Rotator, then the writers: they inherit its blocked SIGHUP in-process */
+    t_run0 = now_ns();
+    if (opt_rotator_exe) {
+        if (rotator_spawn(conf) < 0) return EXIT_FAILURE;
+        cpu_start = process_cpu_seconds(rotator_pid);
+    } else {
+        rotator_pid = getpid();
+        ipmgr_log_rotator_set_config_file(conf);
+        ipmgr_start_log_rotator_thread();
+        cpu_start = self_cpu_seconds();
+    }
+
+    ncpus = cpu_sample(cpu0, 1024);
+    write_start_ns = now_ns();
+    for (unsigned i = 0; i < opt_threads; i++) {
+        bench_writer_t *w = &writers[i];
+
+        w->id = i;
+        w->type = &types[i % opt_types];
+        w->buf = malloc(BENCH_BATCH_LEN + BENCH_LINE_MAX);
+        if (!w->buf || pthread_create(&w->thread, NULL, writer_thread_fn, w) != 0) {
+            fprintf(stderr, "Failed to start writer %u\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    sleep_ns((uint64_t)opt_seconds * 1000000000ULL);
+    atomic_store(&writers_stop, true);
+    for (unsigned i = 0; i < opt_threads; i++) {
+        pthread_join(writers[i].thread, NULL);
+        lines += writers[i].lines;
+    }
+    t_end = now_ns();
+    rotated_in_window = atomic_load(&baks_rotated);
+    cpu_sample(cpu1, ncpus);
+    write_secs = (double)(t_end - write_start_ns) / 1e9;
+
+    /* What is left in the live files goes to the rotator too */
+    for (unsigned i = 0; i < opt_types; i++) {
+        pthread_mutex_lock(&types[i].lock);
+        if (types[i].fd >= 0) type_rotate(&types[i]);
+        baks += types[i].next_bak;
+        pthread_mutex_unlock(&types[i].lock);
+    }
+
+    settled = wait_settled();
+    settle_secs = (double)(now_ns() - t_end) / 1e9;
+    run_secs = (double)(now_ns() - t_run0) / 1e9;
+    rotator_metrics_read();
+
+    atomic_store(&watcher_stop, true);
+    pthread_join(watcher_thread, NULL);
+    close(watcher_fd);
+
+    if (opt_rotator_exe) {
+        rotator_cpu = process_cpu_seconds(rotator_pid);
+        if (rotator_cpu >= 0 && cpu_start >= 0) rotator_cpu -= cpu_start;
+        kill(rotator_pid, SIGTERM);
+        waitpid(rotator_pid, NULL, 0);
+    } else {
+        /* The process less the bench's own threads */
+        uint64_t bench_ns = watcher_cpu_ns;
+
+        for (unsigned i = 0; i < opt_threads; i++) bench_ns += writers[i].cpu_ns;
+        rotator_cpu = self_cpu_seconds() - cpu_start - (double)bench_ns / 1e9;
+        if (rotator_cpu < 0) rotator_cpu = 0;
+        ipmgr_stop_log_rotator_thread();
+    }
+
+    /* Check every line of the run off */
+    bits_words = 1;
+    for (unsigned i = 0; i < opt_threads; i++) {
+        size_t words = (size_t)(writers[i].lines + 63) / 64;
+
+        if (words > bits_words) bits_words = words;
+    }
+    seen_bits = calloc((size_t)opt_threads * bits_words, sizeof(uint64_t));
+    if (!seen_bits) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    verify_run();
+
+    print_summary(write_secs, settled, lines, baks, rotated_in_window, rotator_cpu);
+    print_json(write_secs, settle_secs, settled, lines, baks, rotated_in_window, rotator_cpu,
+               run_secs, cpu0, cpu1, ncpus);
+
+    if (!opt_keep) dir_clean();
+    ok = settled && lines_found == lines && lines_duplicate == 0 && lines_corrupt == 0;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
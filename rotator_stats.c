@@ -0,0 +1,229 @@
+/*******************************************************************************
+ * File: rotator_stats.c
+ *
+ * Description:
+ *   Reader of the metrics page of a running ipmgr_log_rotator
+ *   (ipmgr_metrics.h): prints its counters and the percentiles of its
+ *   latency histograms. The page is only mapped, the rotator never sees
+ *   the reader.
+ *
+ *   Percentiles are bucket upper bounds, within 12.5% of the value.
+ *
+ * Usage:
+ *   rotator_stats.exe [-i secs] [-t]
+ *     -i  print every secs seconds: counter rates and the histograms of
+ *         the interval, instead of totals since the rotator started
+ *         (max stays the largest value since the start)
+ *     -t  per thread breakdown of the counters
+ *
+ * Build:
+ *   gcc -O2 -o rotator_stats.exe rotator_stats.c ipmgr_metrics.c
+ *   (add -lrt for shm_open() on glibc older than 2.34)
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+/* Standard Library Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/* Local Headers */
+#include "ipmgr_metrics.h"
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+#define NPERCENTILES  (sizeof(percentiles) / sizeof(percentiles[0]))
+
+/* Snapshots, too large for the stack */
+static metrics_slot_t total, prev, delta;
+
+/*******************************************************************************
+ *                     HELPER FUNCTIONS
+ ******************************************************************************/
+
+/* Nanoseconds or bytes, human readable */
+static const char *
+fmt_value(char *buf, size_t len, double v, bool bytes)
+{
+    if (bytes) {
+        if (v < 1024.0) snprintf(buf, len, "%.0fB", v);
+        else if (v < 1024.0 * 1024.0) snprintf(buf, len, "%.1fK", v / 1024.0);
+        else if (v < 1024.0 * 1024.0 * 1024.0) snprintf(buf, len, "%.1fM", v / (1024.0 * 1024.0));
+        else snprintf(buf, len, "%.2fG", v / (1024.0 * 1024.0 * 1024.0));
+    } else {
+        if (v < 1e3) snprintf(buf, len, "%.0fns", v);
+        else if (v < 1e6) snprintf(buf, len, "%.1fus", v / 1e3);
+        else if (v < 1e9) snprintf(buf, len, "%.1fms", v / 1e6);
+        else snprintf(buf, len, "%.2fs", v / 1e9);
+    }
+    return buf;
+}
+
+/* d = a - b, histograms and counters; max is a's */
+static void
+slot_diff(metrics_slot_t *d, const metrics_slot_t *a, const metrics_slot_t *b)
+{
+    for (int c = 0; c < MC_COUNT; c++) {
+        d->counters[c] = a->counters[c] - b->counters[c];
+    }
+    for (int h = 0; h < MH_COUNT; h++) {
+        d->hists[h].count = a->hists[h].count - b->hists[h].count;
+        d->hists[h].sum = a->hists[h].sum - b->hists[h].sum;
+        d->hists[h].max = a->hists[h].max;
+        for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+            d->hists[h].buckets[i] = a->hists[h].buckets[i] - b->hists[h].buckets[i];
+        }
+    }
+}
+
+/**
+ * print_slot()
+ *
+ * Purpose:
+ *   Prints the counters of a snapshot (and their rate over secs, if
+ *   secs > 0) and one line per histogram recorded into.
+ */
+static void
+print_slot(const metrics_slot_t *s, const metrics_slot_t *totals, double secs)
+{
+    char buf[32];
+
+    for (int c = 0; c < MC_COUNT; c++) {
+        uint64_t v = s->counters[c];
+
+        if (secs > 0) {
+            printf("  %-22s %14llu %12.1f/s\n", metrics_counter_name(c),
+                   (unsigned long long)totals->counters[c], (double)v / secs);
+        } else {
+            printf("  %-22s %14llu\n", metrics_counter_name(c), (unsigned long long)v);
+        }
+    }
+
+    printf("\n  %-20s %9s %9s", "histogram", "count", "mean");
+    for (size_t p = 0; p < NPERCENTILES; p++) {
+        snprintf(buf, sizeof(buf), "p%g", percentiles[p]);
+        printf(" %9s", buf);
+    }
+    printf(" %9s\n", "max");
+
+    for (int h = 0; h < MH_COUNT; h++) {
+        const metrics_hist_t *hist = &s->hists[h];
+        bool bytes = metrics_hist_is_bytes(h);
+        uint64_t count = hist->count;
+
+        printf("  %-20s %9llu", metrics_hist_name(h), (unsigned long long)count);
+        if (count == 0) {
+            printf("\n");
+            continue;
+        }
+        printf(" %9s", fmt_value(buf, sizeof(buf), (double)hist->sum / (double)count, bytes));
+        for (size_t p = 0; p < NPERCENTILES; p++) {
+            printf(" %9s", fmt_value(buf, sizeof(buf),
+                                     (double)metrics_hist_percentile(hist, percentiles[p]),
+                                     bytes));
+        }
+        printf(" %9s\n", fmt_value(buf, sizeof(buf), (double)hist->max, bytes));
+    }
+}
+
+/* One line per thread slot with its non zero counters */
+static void
+print_threads(const metrics_page_t *page)
+{
+    static metrics_slot_t one;
+
+    printf("\n  per thread:\n");
+    for (uint32_t i = 0; i < page->nslots; i++) {
+        if (!atomic_load(&page->slots[i].in_use)) continue;
+
+        metrics_sum(page, (int)i, &one);
+        printf("  [%2u] %-28s", i, page->slots[i].name);
+        for (int c = 0; c < MC_COUNT; c++) {
+            if (one.counters[c]) {
+                printf(" %s=%llu", metrics_counter_name(c), (unsigned long long)one.counters[c]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+/*******************************************************************************
+ *                     MAIN
+ ******************************************************************************/
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-i secs] [-t]\n", prog);
+    return EXIT_FAILURE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const metrics_page_t *page;
+    unsigned interval = 0;
+    bool threads = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:t")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = (unsigned)strtoul(optarg, NULL, 10);
+            if (interval == 0) return usage(argv[0]);
+            break;
+        case 't':
+            threads = true;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    page = metrics_map(NULL);
+    if (!page) {
+        if (errno == EPROTO) {
+            fprintf(stderr, "%s: written by another rotator version\n", METRICS_SHM_NAME);
+        } else {
+            fprintf(stderr, "%s: %s (rotator not running?)\n", METRICS_SHM_NAME, strerror(errno));
+        }
+        return EXIT_FAILURE;
+    }
+
+    printf("ipmgr_log_rotator pid %lld, up %llds, %u threads attached\n",
+           (long long)page->pid, (long long)(time(NULL) - page->started),
+           atomic_load(&page->attached));
+
+    metrics_sum(page, -1, &total);
+    if (interval == 0) {
+        printf("\n");
+        print_slot(&total, &total, 0);
+        if (threads) print_threads(page);
+        metrics_unmap(page);
+        return EXIT_SUCCESS;
+    }
+
+    /* Rates and histograms of each interval */
+    while (1) {
+        struct timespec t0, t1;
+        double secs;
+
+        prev = total;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        sleep(interval);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+        metrics_sum(page, -1, &total);
+        slot_diff(&delta, &total, &prev);
+
+        printf("\n--- last %.1fs ---\n", secs);
+        print_slot(&delta, &total, secs);
+        if (threads) print_threads(page);
+        fflush(stdout);
+    }
+}
@@ -12,14 +12,14 @@ echo ""
 if [ ! -f "./ipmgr_log_rotator.exe" ]; then
     echo "ERROR: ipmgr_log_rotator.exe not found"
     echo "Please compile ipmgr_log_rotator.c first:"
-    echo "  gcc -o ipmgr_log_rotator.exe ipmgr_log_rotator.c -pthread"
+    echo "  gcc -o ipmgr_log_rotator.exe ipmgr_log_rotator.c ipmgr_archive.c ipmgr_log_config.c ipmgr_uring.c ipmgr_codec.c ipmgr_seekable.c ipmgr_metrics.c ipmgr_diag.c ipmgr_retention.c -pthread -lz"
     exit 1
 fi
 
 if [ ! -f "./logger.exe" ]; then
     echo "ERROR: logger.exe not found"
     echo "Please compile logger.c first:"
-    echo "  gcc -o logger.exe logger.c -pthread"
+    echo "  gcc -o logger.exe logger.c ipmgr_log_writer.c -pthread"
     exit 1
 fi
 